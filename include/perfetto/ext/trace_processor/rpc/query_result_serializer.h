@@ -54,7 +54,17 @@ class IteratorImpl;
 class QueryResultSerializer {
  public:
   static constexpr uint32_t kDefaultBatchSplitThreshold = 128 * 1024;
-  explicit QueryResultSerializer(Iterator);
+
+  // How the rows of each batch are encoded (see QueryArgs.ResultEncoding in
+  // trace_processor.proto).
+  enum class Encoding {
+    // Row by row, in QueryResult.batch.
+    kCells,
+    // Column by column, in QueryResult.columnar_batch.
+    kColumnar,
+  };
+
+  explicit QueryResultSerializer(Iterator, Encoding = Encoding::kCells);
   ~QueryResultSerializer();
 
   // No copy or move.
@@ -78,10 +88,12 @@ class QueryResultSerializer {
  private:
   void SerializeMetadata(protos::pbzero::QueryResult*);
   void SerializeBatch(protos::pbzero::QueryResult*);
+  void SerializeColumnarBatch(protos::pbzero::QueryResult*);
   void MaybeSerializeError(protos::pbzero::QueryResult*);
 
   std::unique_ptr<IteratorImpl> iter_;
   const uint32_t num_cols_;
+  const Encoding encoding_;
   bool did_write_metadata_ = false;
   bool eof_reached_ = false;
   uint32_t col_ = UINT32_MAX;
@@ -285,6 +285,24 @@ struct PERFETTO_EXPORT_COMPONENT TracingServiceInitOpts {
   using CompressorFn = void (*)(std::vector<TracePacket>*);
   CompressorFn compressor_fn = nullptr;
 
+  // Same as |compressor_fn|, used for TraceConfig::COMPRESSION_TYPE_ZSTD.
+  CompressorFn zstd_compressor_fn = nullptr;
+
+  // If set, trace filtering and compression of the packets read from the
+  // buffers, and writing them into the file of write_into_file sessions, are
+  // posted to task runners returned by this function rather than running on
+  // the task runner of the service, so that they don't delay the handling of
+  // commits and IPCs during large reads. Only tracing sessions which filter or
+  // compress their packets use one: each is assigned to the task runner with
+  // the fewest such sessions, so that the packets of a session are processed
+  // in order and those of different sessions in parallel.
+  // The function is called lazily, when such a session starts and all the task
+  // runners created so far are used by other sessions, and at most
+  // |max_packet_processing_task_runners| times. The task runners it returns
+  // must outlive the service.
+  std::function<base::TaskRunner*()> create_packet_processing_task_runner;
+  size_t max_packet_processing_task_runners = 1;
+
   // Whether the relay endpoint is enabled on producer transport(s).
   bool enable_relay_endpoint = false;
 };
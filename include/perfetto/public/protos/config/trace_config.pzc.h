@@ -57,6 +57,8 @@ PERFETTO_PB_ENUM_IN_MSG(perfetto_protos_TraceConfig, CompressionType){
                                   COMPRESSION_TYPE_UNSPECIFIED) = 0,
     PERFETTO_PB_ENUM_IN_MSG_ENTRY(perfetto_protos_TraceConfig,
                                   COMPRESSION_TYPE_DEFLATE) = 1,
+    PERFETTO_PB_ENUM_IN_MSG_ENTRY(perfetto_protos_TraceConfig,
+                                  COMPRESSION_TYPE_ZSTD) = 2,
 };
 
 PERFETTO_PB_ENUM_IN_MSG(perfetto_protos_TraceConfig, StatsdLogging){
@@ -170,6 +170,59 @@ struct PERFETTO_EXPORT_COMPONENT Config {
   // The flag has no impact on non-proto traces.
   bool analyze_trace_proto_content = false;
 
+  // The number of threads trace processor can use to speed up the ingestion of
+  // proto traces. Currently this is used to decompress |compressed_packets|
+  // in parallel; parsing itself remains single-threaded. Values <= 1 keep
+  // ingestion fully on the calling thread.
+  uint32_t ingestion_thread_count = 1;
+
+  // When > 0, the approximate number of bytes of trace packets which trace
+  // processor keeps in memory while they are waiting to be sorted. Once the
+  // packets buffered for sorting exceed this budget, the contents of the
+  // packets added afterwards are written to a temporary file and read back
+  // when the packets are parsed. A packet counts for the whole chunk of the
+  // trace it was read from, as it keeps it alive. This bounds the peak memory
+  // use of traces which need a lot of buffering (e.g. with kForceFullSort) at
+  // the cost of extra I/O. Only applies to proto traces.
+  uint64_t ingestion_memory_budget_bytes = 0;
+
+  // The number of threads trace processor can use to speed up queries.
+  // Currently this is used to split filtering and sorting of tables with a
+  // large number of rows in chunks processed in parallel. Values <= 1 keep
+  // queries fully on the calling thread.
+  uint32_t query_thread_count = 1;
+
+  // When > 0, keys of the args table which are looked up by EXTRACT_ARG at
+  // least this many times (counting each row the function is called on) are
+  // promoted to a dedicated column indexed by arg set id. Lookups of promoted
+  // keys are then constant time instead of searching the args table, at the
+  // cost of memory for the values of the key (~16 bytes per arg set having
+  // the key). Useful for traces with a very large number of args (e.g. Chrome
+  // traces) queried repeatedly for the same keys.
+  uint32_t arg_column_promotion_threshold = 0;
+
+  // When non-empty, the directory where the tables created by SQL modules
+  // (e.g. the standard library) are cached across trace processor instances:
+  // including a module on a trace whose tables were cached by a previous
+  // instance loads them from disk instead of running the module's queries.
+  // The directory must exist. Entries are keyed on the trace, the version of
+  // trace processor and the options above which change how the trace is
+  // imported, so one directory can be shared by different builds and configs.
+  std::string module_cache_dir;
+
+  // When > 0, enables live ingestion for traces which are still being written
+  // while they are parsed. After every Parse() call, all the events with a
+  // timestamp older than the latest timestamp seen minus this window are
+  // sorted and committed to the tables, regardless of the sorting mode and of
+  // the flush and read buffer events in the trace. This timestamp (the
+  // ingestion watermark) is exposed as the |ingestion_watermark_ns| entry of
+  // the metadata table: queries run between Parse() calls see all the events
+  // before the watermark and none after it. Events arriving later with a
+  // timestamp before the watermark are still parsed but are counted in the
+  // |sorter_push_event_out_of_order| stat. The window should be chosen larger
+  // than the maximum reordering of events in the trace.
+  int64_t live_ingestion_window_ns = 0;
+
   // When set to true, trace processor will be augmented with a bunch of helpful
   // features for local development such as extra SQL fuctions.
   //
@@ -119,6 +119,18 @@ class PERFETTO_EXPORT_COMPONENT TraceProcessor : public TraceProcessorStorage {
   virtual std::string GetCurrentTraceName() = 0;
   virtual void SetCurrentTraceName(const std::string&) = 0;
 
+  // Writes a snapshot of the fully loaded trace (i.e. after NotifyEndOfFile()
+  // was called) to the file at |path|. Loading the snapshot with
+  // LoadSnapshot() is much faster than parsing the trace again. Snapshots can
+  // only be loaded by the same version of trace processor.
+  virtual base::Status WriteSnapshot(const std::string& path) = 0;
+
+  // Loads the snapshot of a trace written by WriteSnapshot() at |path|. Must
+  // be called instead of parsing a trace: after this call, the trace is fully
+  // loaded as if NotifyEndOfFile() had been called. If an error is returned,
+  // the instance should be discarded.
+  virtual base::Status LoadSnapshot(const std::string& path) = 0;
+
   // Enables "meta-tracing" of trace processor.
   // Metatracing involves tracing trace processor itself to root-cause
   // performace issues in trace processor. See |DisableAndReadMetatrace| for
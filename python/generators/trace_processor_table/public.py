@@ -43,6 +43,8 @@ class ColumnFlag(enum_Flag):
   HIDDEN = auto()
   DENSE = auto()
   SET_ID = auto()
+  RUN_LENGTH_ENCODED = auto()
+  DICTIONARY_ENCODED = auto()
 
 
 @dataclass(frozen=True)
@@ -45,6 +45,7 @@ class ColumnSerializer:
     self.is_ancestor = self.parsed_col.is_ancestor
     self.is_string = parsed_type.cpp_type == 'StringPool::Id'
     self.is_optional = parsed_type.is_optional
+    self.encoding = column_encoding(self.flags)
 
   def colindex(self) -> str:
     return f'    static constexpr uint32_t {self.name} = {self.col_index};'
@@ -113,6 +114,8 @@ class ColumnSerializer:
 
     storage = f'ColumnStorage<ColumnType::{self.name}::stored_type>'
     dense = str(ColumnFlag.DENSE in self.flags).lower()
+    if self.encoding:
+      return f'''{self.name}_({storage}::Create<{dense}>({self.encoding}))'''
     return f'''{self.name}_({storage}::Create<{dense}>())'''
 
   def column_init(self) -> Optional[str]:
@@ -233,11 +236,24 @@ class ColumnSerializer:
       return None
     if self.is_ancestor:
       return None
+    if self.encoding:
+      return f'''
+    PERFETTO_DCHECK({self.name}_.size() == parent_overlay.size());
+    '''
     return f'''
     PERFETTO_DCHECK({self.name}.size() == parent_overlay.size());
     {self.name}_ = std::move({self.name});
     '''
 
+  def extend_encoded_init(self) -> Optional[str]:
+    # Encoded storage has to be built before the storage layers pointing into
+    # it are created.
+    if self.is_ancestor or not self.encoding:
+      return None
+    return f'''{self.name}_(
+          ColumnStorage<ColumnType::{self.name}::stored_type>::CreateEncoded(
+            {self.name}, {self.encoding}))'''
+
   def storage_layer(self) -> Optional[str]:
     if self.is_ancestor:
       return None
@@ -271,6 +287,8 @@ class ColumnSerializer:
       return f''
     if self.is_implicit_id:
       return f'{self.name}_storage_layer_(new column::IdStorage())'
+    if self.encoding:
+      return self.encoded_storage_layer_init()
     if self.is_string:
       return f'''{self.name}_storage_layer_(
           new column::StringStorage(string_pool(), &{self.name}_.vector()))'''
@@ -282,12 +300,38 @@ class ColumnSerializer:
           new column::NumericStorage<ColumnType::{self.name}::non_optional_stored_type>(
             &{self.name}_.non_null_vector(),
             ColumnTypeHelper<ColumnType::{self.name}::stored_type>::ToColumnType(),
-            {str(ColumnFlag.SORTED in self.flags).lower()}))'''
+            {str(ColumnFlag.SORTED in self.flags).lower()},
+            &{self.name}_.zone_map()))'''
     return f'''{self.name}_storage_layer_(
         new column::NumericStorage<ColumnType::{self.name}::non_optional_stored_type>(
           &{self.name}_.vector(),
           ColumnTypeHelper<ColumnType::{self.name}::stored_type>::ToColumnType(),
-          {str(ColumnFlag.SORTED in self.flags).lower()}))'''
+          {str(ColumnFlag.SORTED in self.flags).lower()},
+          &{self.name}_.zone_map()))'''
+
+  def encoded_storage_layer_init(self) -> str:
+    if ColumnFlag.RUN_LENGTH_ENCODED in self.flags:
+      encoded = f'{self.name}_.run_length()'
+      layer = f'column::RunLengthStorage(&{encoded}.run_ends()'
+      values = f'{encoded}.values()'
+      is_sorted = str(ColumnFlag.SORTED in self.flags).lower()
+    else:
+      encoded = f'{self.name}_.dictionary()'
+      layer = f'column::DictionaryStorage(&{encoded}.codes()'
+      values = f'{encoded}.dictionary()'
+      is_sorted = 'false'
+    if self.is_string:
+      return f'''{self.name}_storage_layer_(
+        new {layer},
+          RefPtr<column::DataLayer>(
+            new column::StringStorage(string_pool(), &{values}))))'''
+    return f'''{self.name}_storage_layer_(
+        new {layer},
+          RefPtr<column::DataLayer>(
+            new column::NumericStorage<ColumnType::{self.name}::non_optional_stored_type>(
+              &{values},
+              ColumnTypeHelper<ColumnType::{self.name}::stored_type>::ToColumnType(),
+              {is_sorted}))))'''
 
   def null_layer_init(self) -> str:
     if self.is_ancestor:
@@ -564,6 +608,9 @@ class TableSerializer(object):
     null_layer_init = self.foreach_col(
         ColumnSerializer.null_layer_init, delimiter=',\n        ')
     null_layer_sep = '\n,' if null_layer_init else ''
+    encoded_init = self.foreach_col(
+        ColumnSerializer.extend_encoded_init, delimiter=',\n        ')
+    encoded_sep = '\n,' if encoded_init else ''
     params = self.foreach_col(
         ColumnSerializer.extend_parent_param, delimiter='\n, ')
     storage_layer_create = self.foreach_col(
@@ -580,7 +627,8 @@ class TableSerializer(object):
           GetColumns(this, &parent),
           parent,
           parent_overlay),
-          const_parent_(&parent){storage_layer_sep}
+          const_parent_(&parent){encoded_sep}
+        {encoded_init}{storage_layer_sep}
         {storage_layer_init}{null_layer_sep}
         {null_layer_init} {{
     {self.foreach_col(ColumnSerializer.static_assert_flags)}
@@ -755,10 +803,12 @@ def serialize_header(ifdef_guard: str, tables: List[ParsedTable],
 #include "src/trace_processor/db/column/arrangement_overlay.h"
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/dense_null_overlay.h"
+#include "src/trace_processor/db/column/dictionary_storage.h"
 #include "src/trace_processor/db/column/numeric_storage.h"
 #include "src/trace_processor/db/column/id_storage.h"
 #include "src/trace_processor/db/column/null_overlay.h"
 #include "src/trace_processor/db/column/range_overlay.h"
+#include "src/trace_processor/db/column/run_length_storage.h"
 #include "src/trace_processor/db/column/selector_overlay.h"
 #include "src/trace_processor/db/column/set_id_storage.h"
 #include "src/trace_processor/db/column/string_storage.h"
@@ -798,4 +848,19 @@ def to_cpp_flags(raw_flag: ColumnFlag) -> str:
     flags.append('ColumnLegacy::Flag::kDense')
   if ColumnFlag.SET_ID in raw_flag:
     flags.append('ColumnLegacy::Flag::kSetId')
+  if ColumnFlag.RUN_LENGTH_ENCODED in raw_flag:
+    flags.append('ColumnLegacy::Flag::kRunLengthEncoded')
+  if ColumnFlag.DICTIONARY_ENCODED in raw_flag:
+    flags.append('ColumnLegacy::Flag::kDictionaryEncoded')
   return ' | '.join(flags)
+
+
+def column_encoding(raw_flag: ColumnFlag) -> Optional[str]:
+  """Returns the C++ ColumnEncoding for the given flags or None if the column
+  is not encoded."""
+
+  if ColumnFlag.RUN_LENGTH_ENCODED in raw_flag:
+    return 'ColumnEncoding::kRunLength'
+  if ColumnFlag.DICTIONARY_ENCODED in raw_flag:
+    return 'ColumnEncoding::kDictionary'
+  return None
@@ -153,6 +153,10 @@ def data_layer_type(table: Table, col: ParsedColumn) -> str:
   parsed = parse_type(table, col.column.type)
   if col.is_implicit_id:
     return 'column::IdStorage'
+  if ColumnFlag.RUN_LENGTH_ENCODED in col.column.flags:
+    return 'column::RunLengthStorage'
+  if ColumnFlag.DICTIONARY_ENCODED in col.column.flags:
+    return 'column::DictionaryStorage'
   if parsed.cpp_type == 'StringPool::Id':
     return 'column::StringStorage'
   if ColumnFlag.SET_ID in col.column.flags:
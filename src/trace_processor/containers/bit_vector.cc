@@ -437,6 +437,28 @@ BitVector BitVector::FromSortedIndexVector(
   return {words, counts, size};
 }
 
+BitVector BitVector::FromConsecutiveParts(std::vector<BitVector> parts) {
+  if (parts.empty()) {
+    return {};
+  }
+  // The last part is already as large as the result: copy all the words
+  // before it from the other parts.
+  BitVector res = std::move(parts.back());
+  uint32_t start_word = 0;
+  for (uint32_t i = 0; i < parts.size() - 1; ++i) {
+    const BitVector& part = parts[i];
+    PERFETTO_CHECK(part.size() % kBitsInWord == 0);
+    uint32_t end_word = part.size() / kBitsInWord;
+    PERFETTO_CHECK(start_word <= end_word);
+    PERFETTO_CHECK(end_word <= WordCount(res.size()));
+    std::copy(part.words_.begin() + start_word, part.words_.begin() + end_word,
+              res.words_.begin() + start_word);
+    start_word = end_word;
+  }
+  UpdateCounts(res.words_, res.counts_);
+  return res;
+}
+
 BitVector BitVector::IntersectRange(uint32_t range_start,
                                     uint32_t range_end) const {
   // We should skip all bits until the index of first set bit bigger than
@@ -491,34 +513,65 @@ std::vector<uint32_t> BitVector::GetSetBitIndices() const {
 void BitVector::Serialize(
     protos::pbzero::SerializedColumn::BitVector* msg) const {
   msg->set_size(size_);
-  if (!counts_.empty()) {
+  // Only the blocks holding the first |size_| bits are written: some
+  // operations leave spare capacity at the end of |words_| and |counts_|.
+  uint32_t block_count = BlockCount(size_);
+  PERFETTO_DCHECK(counts_.size() >= block_count);
+  PERFETTO_DCHECK(words_.size() >= Block::kWords * block_count);
+  if (block_count > 0) {
     msg->set_counts(reinterpret_cast<const uint8_t*>(counts_.data()),
-                    sizeof(uint32_t) * counts_.size());
-  }
-  if (!words_.empty()) {
+                    sizeof(uint32_t) * block_count);
     msg->set_words(reinterpret_cast<const uint8_t*>(words_.data()),
-                   sizeof(uint64_t) * words_.size());
+                   sizeof(uint64_t) * Block::kWords * block_count);
   }
 }
 
 // Deserialize BitVector from proto.
-void BitVector::Deserialize(
+bool BitVector::Deserialize(
     const protos::pbzero::SerializedColumn::BitVector::Decoder& bv_msg) {
-  size_ = bv_msg.size();
-  if (bv_msg.has_counts()) {
-    counts_.resize(
-        static_cast<size_t>(bv_msg.counts().size / sizeof(uint32_t)));
-    memcpy(counts_.data(), bv_msg.counts().data, bv_msg.counts().size);
-  } else {
-    counts_.clear();
+  uint32_t size = bv_msg.size();
+  protozero::ConstBytes words = bv_msg.words();
+  protozero::ConstBytes counts = bv_msg.counts();
+  if (words.size != sizeof(uint64_t) * BlockCount(size) * Block::kWords ||
+      counts.size != sizeof(uint32_t) * BlockCount(size)) {
+    return false;
   }
 
-  if (bv_msg.has_words()) {
-    words_.resize(static_cast<size_t>(bv_msg.words().size / sizeof(uint64_t)));
-    memcpy(words_.data(), bv_msg.words().data, bv_msg.words().size);
-  } else {
-    words_.clear();
+  std::vector<uint64_t> new_words(words.size / sizeof(uint64_t));
+  if (words.size > 0) {
+    memcpy(new_words.data(), words.data, words.size);
+  }
+  std::vector<uint32_t> new_counts(counts.size / sizeof(uint32_t));
+  if (counts.size > 0) {
+    memcpy(new_counts.data(), counts.data, counts.size);
+  }
+
+  // Bits past the end of the BitVector must be unset and the counts must be
+  // the prefix sums of the set bits of the blocks: everything else relies on
+  // these invariants.
+  if (size % BitWord::kBits != 0) {
+    uint64_t last_word = new_words[size / BitWord::kBits];
+    if (last_word >> (size % BitWord::kBits) != 0) {
+      return false;
+    }
   }
+  for (uint32_t i = WordCount(size); i < new_words.size(); ++i) {
+    if (new_words[i] != 0) {
+      return false;
+    }
+  }
+  uint32_t set_bits = 0;
+  for (uint32_t i = 0; i < new_counts.size(); ++i) {
+    if (new_counts[i] != set_bits) {
+      return false;
+    }
+    set_bits += ConstBlock(&new_words[Block::kWords * i]).CountSetBits();
+  }
+
+  size_ = size;
+  words_ = std::move(new_words);
+  counts_ = std::move(new_counts);
+  return true;
 }
 
 }  // namespace perfetto::trace_processor
@@ -83,6 +83,12 @@ class BitVector {
       global_bit_offset_ += BitWord::kBits;
     }
 
+    // Appends |count| unset bits to the Builder.
+    void Skip(uint32_t count) {
+      PERFETTO_DCHECK(global_bit_offset_ + count <= size_);
+      global_bit_offset_ += count;
+    }
+
     // Creates a BitVector from this Builder.
     BitVector Build() && {
       if (size_ == 0)
@@ -353,6 +359,17 @@ class BitVector {
   PERFETTO_WARN_UNUSED_RESULT static BitVector FromSortedIndexVector(
       const std::vector<int64_t>&);
 
+  // Creates a BitVector by stitching together |parts|: the bits between the
+  // end of the previous part (or 0 for the first part) and the end of a part
+  // are taken from that part. The parts must be sorted by size and the size
+  // of every part but the last one must be a multiple of 64. The resulting
+  // BitVector has the size of the last part.
+  //
+  // This is used to combine the results of searching consecutive ranges of
+  // a column in parallel.
+  PERFETTO_WARN_UNUSED_RESULT static BitVector FromConsecutiveParts(
+      std::vector<BitVector> parts);
+
   // Creates a BitVector of size `min(range_end, size())` with bits between
   // |start| and |end| filled with corresponding bits from |this| BitVector.
   PERFETTO_WARN_UNUSED_RESULT BitVector
@@ -409,8 +426,9 @@ class BitVector {
   // Serialize internals of BitVector to proto.
   void Serialize(protos::pbzero::SerializedColumn_BitVector* msg) const;
 
-  // Deserialize BitVector from proto.
-  void Deserialize(
+  // Deserialize BitVector from proto. Returns false (leaving the BitVector
+  // unchanged) if |bv_msg| does not describe a valid BitVector.
+  PERFETTO_WARN_UNUSED_RESULT bool Deserialize(
       const protos::pbzero::SerializedColumn_BitVector_Decoder& bv_msg);
 
  private:
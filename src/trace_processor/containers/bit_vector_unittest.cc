@@ -753,6 +753,39 @@ TEST(BitVectorUnittest, UpdateSetBitsGetSetBitIndices) {
   ASSERT_THAT(bv.GetSetBitIndices(), IsEmpty());
 }
 
+TEST(BitVectorUnittest, FromConsecutiveParts) {
+  // Parts as returned by searches on [10, 128), [128, 256) and [256, 300).
+  BitVector first = BitVector::RangeForTesting(
+      10, 128, [](uint32_t i) { return i % 3 == 0; });
+  BitVector second(128, false);
+  second.Resize(256, true);
+  BitVector third = BitVector::RangeForTesting(
+      256, 300, [](uint32_t i) { return i % 2 == 0; });
+
+  std::vector<BitVector> parts;
+  parts.emplace_back(std::move(first));
+  parts.emplace_back(std::move(second));
+  parts.emplace_back(std::move(third));
+  BitVector bv = BitVector::FromConsecutiveParts(std::move(parts));
+
+  auto expected = [](uint32_t i) {
+    if (i < 10) {
+      return false;
+    }
+    if (i < 128) {
+      return i % 3 == 0;
+    }
+    return i < 256 || i % 2 == 0;
+  };
+  ASSERT_EQ(bv.size(), 300u);
+  uint32_t set_count = 0;
+  for (uint32_t i = 0; i < 300; ++i) {
+    ASSERT_EQ(bv.IsSet(i), expected(i)) << i;
+    set_count += expected(i);
+  }
+  ASSERT_EQ(bv.CountSetBits(), set_count);
+}
+
 TEST(BitVectorUnittest, SerializeSimple) {
   BitVector bv{1, 0, 1, 0, 1, 0, 1};
   protozero::HeapBuffered<protos::pbzero::SerializedColumn::BitVector> msg;
@@ -774,7 +807,7 @@ TEST(BitVectorUnittest, SerializeDeserializeSimple) {
                                                                buffer.size());
 
   BitVector des;
-  des.Deserialize(decoder);
+  ASSERT_TRUE(des.Deserialize(decoder));
 
   ASSERT_EQ(des.size(), 7u);
   ASSERT_EQ(des.CountSetBits(), 4u);
@@ -785,5 +818,58 @@ TEST(BitVectorUnittest, SerializeDeserializeSimple) {
   ASSERT_TRUE(des.IsSet(6));
 }
 
+TEST(BitVectorUnittest, SerializeDeserializeMultipleBlocks) {
+  BitVector bv;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    if (i % 3 == 0) {
+      bv.AppendTrue();
+    } else {
+      bv.AppendFalse();
+    }
+  }
+  protozero::HeapBuffered<protos::pbzero::SerializedColumn::BitVector> msg;
+  bv.Serialize(msg.get());
+  auto buffer = msg.SerializeAsArray();
+
+  protos::pbzero::SerializedColumn::BitVector::Decoder decoder(buffer.data(),
+                                                               buffer.size());
+  BitVector des;
+  ASSERT_TRUE(des.Deserialize(decoder));
+  ASSERT_EQ(des.size(), 2000u);
+  ASSERT_EQ(des.CountSetBits(), bv.CountSetBits());
+  ASSERT_EQ(des.CountSetBits(1500), bv.CountSetBits(1500));
+  ASSERT_EQ(des.IndexOfNthSet(600), bv.IndexOfNthSet(600));
+}
+
+TEST(BitVectorUnittest, DeserializeRejectsInvalid) {
+  BitVector bv{1, 0, 1, 0, 1, 0, 1};
+  protozero::HeapBuffered<protos::pbzero::SerializedColumn::BitVector> valid;
+  bv.Serialize(valid.get());
+  auto buffer = valid.SerializeAsArray();
+  protos::pbzero::SerializedColumn::BitVector::Decoder decoder(buffer.data(),
+                                                               buffer.size());
+
+  // More bits than there are words.
+  protozero::HeapBuffered<protos::pbzero::SerializedColumn::BitVector> msg;
+  msg->set_size(10000);
+  msg->set_words(decoder.words().data, decoder.words().size);
+  msg->set_counts(decoder.counts().data, decoder.counts().size);
+  auto too_large = msg.SerializeAsArray();
+
+  // Bits set past the end of the BitVector.
+  msg.Reset();
+  msg->set_size(3);
+  msg->set_words(decoder.words().data, decoder.words().size);
+  msg->set_counts(decoder.counts().data, decoder.counts().size);
+  auto trailing_bits = msg.SerializeAsArray();
+
+  for (const auto& invalid : {too_large, trailing_bits}) {
+    BitVector des{true};
+    ASSERT_FALSE(des.Deserialize(protos::pbzero::SerializedColumn::BitVector::
+                                     Decoder(invalid.data(), invalid.size())));
+    ASSERT_EQ(des.size(), 1u);
+  }
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor
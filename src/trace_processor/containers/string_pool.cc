@@ -16,8 +16,12 @@
 
 #include "src/trace_processor/containers/string_pool.h"
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <limits>
 #include <tuple>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/utils.h"
@@ -31,6 +35,10 @@ StringPool::StringPool() {
       "minimum size of large strings must be small enough to support any "
       "string that doesn't fit in a Block.");
 
+  shards_.reset(new Shard[kNumShards]);
+  insert_mutex_.reset(new std::mutex());
+
+  blocks_.reserve(kMaxBlocks);
   blocks_.emplace_back(kBlockSizeBytes);
 
   // Reserve a slot for the null string.
@@ -50,13 +58,14 @@ StringPool::Id StringPool::InsertString(base::StringView str, uint64_t hash) {
   std::tie(success, offset) = blocks_.back().TryInsert(str);
   if (PERFETTO_UNLIKELY(!success)) {
     // The block did not have enough space for the string. If the string is
-    // large, add it into the |large_strings_| vector, to avoid discarding a
+    // large, add it into |large_string_chunks_|, to avoid discarding a
     // large portion of the current block's memory. This also enables us to
     // support strings that wouldn't fit into a single block. Otherwise, add a
     // new block to store the string.
     if (str.size() + kMaxMetadataSize >= kMinLargeStringSizeBytes) {
       return InsertLargeString(str, hash);
     }
+    PERFETTO_CHECK(blocks_.size() < kMaxBlocks);
     blocks_.emplace_back(kBlockSizeBytes);
 
     // Try and reserve space again - this time we should definitely succeed.
@@ -68,22 +77,33 @@ StringPool::Id StringPool::InsertString(base::StringView str, uint64_t hash) {
   // hash to the id.
   Id string_id = Id::BlockString(blocks_.size() - 1, offset);
 
-  // Deliberately not adding |string_id| to |string_index_|. The caller
+  // Deliberately not adding |string_id| to the index. The caller
   // (InternString()) must take care of this.
-  PERFETTO_DCHECK(string_index_.Find(hash));
+  PERFETTO_DCHECK(ShardFor(hash).index.Find(hash));
 
   return string_id;
 }
 
 StringPool::Id StringPool::InsertLargeString(base::StringView str,
                                              uint64_t hash) {
-  large_strings_.emplace_back(new std::string(str.begin(), str.size()));
+  size_t index = large_strings_size_;
+  auto chunk_and_offset = LargeStringChunkAndOffset(index);
+  PERFETTO_CHECK(chunk_and_offset.first < kNumLargeStringChunks);
+  std::unique_ptr<std::string[]>& chunk =
+      large_string_chunks_[chunk_and_offset.first];
+  if (!chunk) {
+    chunk.reset(
+        new std::string[kFirstLargeStringChunkSize << chunk_and_offset.first]);
+  }
+  chunk[chunk_and_offset.second].assign(str.data(), str.size());
+  large_strings_size_++;
+
   // Compute id from the index and add a mapping from the hash to the id.
-  Id string_id = Id::LargeString(large_strings_.size() - 1);
+  Id string_id = Id::LargeString(index);
 
-  // Deliberately not adding |string_id| to |string_index_|. The caller
+  // Deliberately not adding |string_id| to the index. The caller
   // (InternString()) must take care of this.
-  PERFETTO_DCHECK(string_index_.Find(hash));
+  PERFETTO_DCHECK(ShardFor(hash).index.Find(hash));
 
   return string_id;
 }
@@ -120,6 +140,92 @@ std::pair<bool /*success*/, uint32_t /*offset*/> StringPool::Block::TryInsert(
   return std::make_pair(true, offset);
 }
 
+bool StringPool::Block::Assign(protozero::ConstBytes bytes) {
+  PERFETTO_DCHECK(pos_ == 0);
+  if (bytes.size == 0 || bytes.size + kMaxMetadataSize > size_)
+    return false;
+
+  // Walk the encoded strings to make sure the block is well formed: each
+  // entry must have a sane size and be null terminated within |bytes|.
+  const uint8_t* ptr = bytes.data;
+  const uint8_t* end = bytes.data + bytes.size;
+  while (ptr < end) {
+    uint64_t str_size = 0;
+    const uint8_t* str_ptr = protozero::proto_utils::ParseVarInt(
+        ptr, std::min(end, ptr + kMaxMetadataSize), &str_size);
+    if (str_ptr == ptr || str_size >= static_cast<uint64_t>(end - str_ptr))
+      return false;
+    if (str_ptr[str_size] != '\0')
+      return false;
+    ptr = str_ptr + str_size + 1;
+  }
+
+  mem_.EnsureCommitted(bytes.size);
+  memcpy(Get(0), bytes.data, bytes.size);
+  pos_ = static_cast<uint32_t>(bytes.size);
+  return true;
+}
+
+void StringPool::Serialize(
+    const std::function<void(protozero::ConstBytes, bool)>& fn) const {
+  for (const Block& block : blocks_) {
+    fn(protozero::ConstBytes{block.Get(0), block.pos()}, false);
+  }
+  for (size_t i = 0; i < large_strings_size_; ++i) {
+    NullTermStringView str = GetLargeString(Id::LargeString(i));
+    fn(protozero::ConstBytes{reinterpret_cast<const uint8_t*>(str.data()),
+                             str.size()},
+       true);
+  }
+}
+
+bool StringPool::Deserialize(
+    const std::vector<protozero::ConstBytes>& blocks,
+    const std::vector<protozero::ConstBytes>& large_strings) {
+  PERFETTO_CHECK(size() == 0 && large_strings_size_ == 0 &&
+                 blocks_.size() == 1);
+
+  // The first block must start with the null string.
+  if (blocks.empty() || blocks.size() > kMaxBlocks || blocks[0].size < 2 ||
+      blocks[0].data[0] != 0 || blocks[0].data[1] != 0) {
+    return false;
+  }
+  std::vector<Block> new_blocks;
+  new_blocks.reserve(kMaxBlocks);
+  for (protozero::ConstBytes bytes : blocks) {
+    new_blocks.emplace_back(kBlockSizeBytes);
+    if (!new_blocks.back().Assign(bytes))
+      return false;
+  }
+  if (large_strings.size() > kLargeStringFlagBitMask)
+    return false;
+
+  blocks_ = std::move(new_blocks);
+  for (protozero::ConstBytes bytes : large_strings) {
+    auto chunk_and_offset = LargeStringChunkAndOffset(large_strings_size_);
+    std::unique_ptr<std::string[]>& chunk =
+        large_string_chunks_[chunk_and_offset.first];
+    if (!chunk) {
+      chunk.reset(new std::string[kFirstLargeStringChunkSize
+                                  << chunk_and_offset.first]);
+    }
+    chunk[chunk_and_offset.second].assign(
+        reinterpret_cast<const char*>(bytes.data), bytes.size);
+    large_strings_size_++;
+  }
+
+  // Rebuild the index: the Ids of the strings are implied by their position
+  // so iterating the pool gives back exactly the original mapping.
+  for (auto it = CreateIterator(); it; ++it) {
+    Id id = it.StringId();
+    if (id.is_null())
+      continue;
+    auto hash = it.StringView().Hash();
+    ShardFor(hash).index.Insert(hash, id);
+  }
+  return true;
+}
+
 StringPool::Iterator::Iterator(const StringPool* pool) : pool_(pool) {}
 
 StringPool::Iterator& StringPool::Iterator::operator++() {
@@ -144,15 +250,15 @@ StringPool::Iterator& StringPool::Iterator::operator++() {
     return *this;
   }
 
-  // Advance to the next string from |large_strings_|.
-  PERFETTO_DCHECK(large_strings_index_ < pool_->large_strings_.size());
+  // Advance to the next large string.
+  PERFETTO_DCHECK(large_strings_index_ < pool_->large_strings_size_);
   large_strings_index_++;
   return *this;
 }
 
 StringPool::Iterator::operator bool() const {
   return block_index_ < pool_->blocks_.size() ||
-         large_strings_index_ < pool_->large_strings_.size();
+         large_strings_index_ < pool_->large_strings_size_;
 }
 
 NullTermStringView StringPool::Iterator::StringView() {
@@ -168,7 +274,7 @@ StringPool::Id StringPool::Iterator::StringId() {
       return Id::Null();
     return Id::BlockString(block_index_, block_offset_);
   }
-  PERFETTO_DCHECK(large_strings_index_ < pool_->large_strings_.size());
+  PERFETTO_DCHECK(large_strings_index_ < pool_->large_strings_size_);
   return Id::LargeString(large_strings_index_);
 }
 
@@ -17,11 +17,13 @@
 #ifndef SRC_TRACE_PROCESSOR_CONTAINERS_STRING_POOL_H_
 #define SRC_TRACE_PROCESSOR_CONTAINERS_STRING_POOL_H_
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <utility>
@@ -32,6 +34,7 @@
 #include "perfetto/ext/base/hash.h"
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/protozero/field.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "src/trace_processor/containers/null_term_string_view.h"
 
@@ -39,6 +42,10 @@ namespace perfetto::trace_processor {
 
 // Interns strings in a string pool and hands out compact StringIds which can
 // be used to retrieve the string in O(1).
+//
+// The index from strings to Ids is split into shards (by hash) each guarded by
+// its own lock, which allows multiple threads to intern strings at the same
+// time using |InternStringConcurrently|. Ids never change once handed out.
 class StringPool {
  public:
   struct Id {
@@ -130,7 +137,7 @@ class StringPool {
 
     // Perform a hashtable insertion with a null ID just to check if the string
     // is already inserted. If it's not, overwrite 0 with the actual Id.
-    auto it_and_inserted = string_index_.Insert(hash, Id());
+    auto it_and_inserted = ShardFor(hash).index.Insert(hash, Id());
     Id* id = it_and_inserted.first;
     if (!it_and_inserted.second) {
       PERFETTO_DCHECK(Get(*id) == str);
@@ -140,12 +147,38 @@ class StringPool {
     return *id;
   }
 
+  // Same as |InternString| but can be called from multiple threads at the same
+  // time. Only the shard of the index owning the string is locked for lookups
+  // so threads interning different strings rarely contend. While any thread is
+  // calling this function, the only other function which can be called is
+  // |Get| on Ids returned previously.
+  //
+  // Note that the Ids assigned to strings depend on the order in which threads
+  // insert them.
+  Id InternStringConcurrently(base::StringView str) {
+    if (str.data() == nullptr)
+      return Id::Null();
+
+    auto hash = str.Hash();
+    Shard& shard = ShardFor(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it_and_inserted = shard.index.Insert(hash, Id());
+    Id* id = it_and_inserted.first;
+    if (!it_and_inserted.second) {
+      PERFETTO_DCHECK(Get(*id) == str);
+      return *id;
+    }
+    std::lock_guard<std::mutex> insert_lock(*insert_mutex_);
+    *id = InsertString(str, hash);
+    return *id;
+  }
+
   std::optional<Id> GetId(base::StringView str) const {
     if (str.data() == nullptr)
       return Id::Null();
 
     auto hash = str.Hash();
-    Id* id = string_index_.Find(hash);
+    Id* id = ShardFor(hash).index.Find(hash);
     if (id) {
       PERFETTO_DCHECK(Get(*id) == str);
       return *id;
@@ -163,7 +196,12 @@ class StringPool {
 
   Iterator CreateIterator() const { return Iterator(this); }
 
-  size_t size() const { return string_index_.size(); }
+  size_t size() const {
+    size_t size = 0;
+    for (size_t i = 0; i < kNumShards; ++i)
+      size += shards_[i].index.size();
+    return size;
+  }
 
   // Maximum Id of a small (not large) string in the string pool.
   StringPool::Id MaxSmallStringId() const {
@@ -171,11 +209,36 @@ class StringPool {
   }
 
   // Returns whether there is at least one large string in a string pool
-  bool HasLargeString() const { return !large_strings_.empty(); }
+  bool HasLargeString() const { return large_strings_size_ > 0; }
+
+  // Passes the contents of the pool to |fn| as raw bytes: first the used part
+  // of each block, then each large string, in Id order. Restoring them with
+  // |Deserialize| gives back a pool where every Id maps to the same string.
+  void Serialize(
+      const std::function<void(protozero::ConstBytes, bool is_large_string)>&
+          fn) const;
+
+  // Restores the contents of a pool passed to the function given to
+  // |Serialize|. Must only be called on a newly constructed pool. Returns false
+  // (leaving the pool unchanged) if |blocks| are not valid blocks of a pool.
+  bool Deserialize(const std::vector<protozero::ConstBytes>& blocks,
+                   const std::vector<protozero::ConstBytes>& large_strings);
 
  private:
   using StringHash = uint64_t;
 
+  // Maps hashes of strings to the Id in the string pool.
+  using StringIndex = base::FlatHashMap<StringHash,
+                                        Id,
+                                        base::AlreadyHashed<StringHash>,
+                                        base::LinearProbe,
+                                        /*AppendOnly=*/true>;
+
+  struct Shard {
+    std::mutex mutex;
+    StringIndex index{/*initial_capacity=*/256u};
+  };
+
   struct Block {
     explicit Block(size_t size)
         : mem_(base::PagedMemory::Allocate(size,
@@ -198,6 +261,11 @@ class StringPool {
     std::pair<bool /*success*/, uint32_t /*offset*/> TryInsert(
         base::StringView str);
 
+    // Copies |bytes|, the used part of a block passed to the function given
+    // to |Serialize|, into this (empty) block. Returns false if |bytes| is not
+    // a valid sequence of encoded strings.
+    bool Assign(protozero::ConstBytes bytes);
+
     uint32_t OffsetOf(const uint8_t* ptr) const {
       PERFETTO_DCHECK(Get(0) < ptr &&
                       ptr <= Get(static_cast<uint32_t>(size_ - 1)));
@@ -216,7 +284,7 @@ class StringPool {
   friend class StringPoolTest;
 
   // StringPool IDs are 32-bit. If the MSB is 1, the remaining bits of the ID
-  // are an index into the |large_strings_| vector. Otherwise, the next 6 bits
+  // are an index into |large_string_chunks_|. Otherwise, the next 6 bits
   // are the index of the Block in the pool, and the remaining 25 bits the
   // offset of the encoded string inside the pool.
   //
@@ -234,18 +302,34 @@ class StringPool {
       0xffffffff & ~kLargeStringFlagBitMask & ~kBlockOffsetBitMask;
 
   static constexpr size_t kBlockSizeBytes = kBlockOffsetBitMask + 1;  // 32 MB
+  static constexpr size_t kMaxBlocks = 1u << kNumBlockIndexBits;
+
+  // The index is split in 2^kNumShardBits shards using the top bits of the
+  // hash of the strings (the FlatHashMap of each shard uses the low bits).
+  static constexpr size_t kNumShardBits = 4;
+  static constexpr size_t kNumShards = 1u << kNumShardBits;
 
   // If a string doesn't fit into the current block, we can either start a new
-  // block or insert the string into the |large_strings_| vector. To maximize
+  // block or insert the string into |large_string_chunks_|. To maximize
   // the used proportion of each block's memory, we only start a new block if
   // the string isn't very large.
   static constexpr size_t kMinLargeStringSizeBytes = kBlockSizeBytes / 8;
 
+  // Large strings are stored in chunks which never move once allocated, chunk
+  // i having room for kFirstLargeStringChunkSize << i strings. The number of
+  // chunks is enough to address every large string index an Id can hold.
+  static constexpr size_t kFirstLargeStringChunkSize = 16;
+  static constexpr size_t kNumLargeStringChunks = 28;
+
   // Number of bytes to reserve for size and null terminator.
   // This is the upper limit on metadata size: 5 bytes for max uint32,
   // plus 1 byte for null terminator. The actual size may be lower.
   static constexpr uint8_t kMaxMetadataSize = 6;
 
+  Shard& ShardFor(StringHash hash) const {
+    return shards_[hash >> (64 - kNumShardBits)];
+  }
+
   // Inserts the string with the given hash into the pool and return its Id.
   Id InsertString(base::StringView, uint64_t hash);
 
@@ -255,7 +339,7 @@ class StringPool {
   // The returned pointer points to the start of the string metadata (i.e. the
   // first byte of the size).
   const uint8_t* IdToPtr(Id id) const {
-    // If the MSB is set, the ID represents an index into |large_strings_|, so
+    // If the MSB is set, the ID represents a large string index, so
     // shouldn't be converted into a block pointer.
     PERFETTO_DCHECK(!id.is_large_string());
 
@@ -289,31 +373,51 @@ class StringPool {
     return {reinterpret_cast<const char*>(str_ptr), size};
   }
 
-  // Lookup a string in the |large_strings_| vector. |id| should have the MSB
-  // set.
+  // Returns the chunk of |large_string_chunks_| holding the large string with
+  // index |index| and the position of the string in that chunk.
+  static std::pair<size_t, size_t> LargeStringChunkAndOffset(size_t index) {
+    size_t chunk = 0;
+    size_t chunk_size = kFirstLargeStringChunkSize;
+    while (index >= chunk_size) {
+      index -= chunk_size;
+      chunk_size <<= 1;
+      ++chunk;
+    }
+    PERFETTO_DCHECK(chunk < kNumLargeStringChunks);
+    return {chunk, index};
+  }
+
+  // Lookup a string in |large_string_chunks_|. |id| should have the MSB set.
+  // Does not lock: the chunks and the strings in them never move, even while
+  // |InternStringConcurrently| appends strings on other threads.
   NullTermStringView GetLargeString(Id id) const {
     PERFETTO_DCHECK(id.is_large_string());
     size_t index = id.large_string_index();
-    PERFETTO_DCHECK(index < large_strings_.size());
-    const std::string* str = large_strings_[index].get();
-    return {str->c_str(), str->size()};
+    PERFETTO_DCHECK(index < large_strings_size_);
+    auto chunk_and_offset = LargeStringChunkAndOffset(index);
+    const std::string& str =
+        large_string_chunks_[chunk_and_offset.first][chunk_and_offset.second];
+    return {str.c_str(), str.size()};
   }
 
-  // The actual memory storing the strings.
+  // The actual memory storing the strings. The capacity is reserved up front
+  // for all the blocks which can be addressed by an Id so that the blocks never
+  // move while other threads are reading them.
   std::vector<Block> blocks_;
 
-  // Any string that is too large to fit into a Block is stored separately
-  // (inside a unique_ptr to ensure any references to it remain valid even if
-  // |large_strings_| is resized).
-  std::vector<std::unique_ptr<std::string>> large_strings_;
+  // Any string that is too large to fit into a Block is stored separately, in
+  // chunks allocated on demand (see LargeStringChunkAndOffset).
+  std::array<std::unique_ptr<std::string[]>, kNumLargeStringChunks>
+      large_string_chunks_;
+  size_t large_strings_size_ = 0;
 
-  // Maps hashes of strings to the Id in the string pool.
-  base::FlatHashMap<StringHash,
-                    Id,
-                    base::AlreadyHashed<StringHash>,
-                    base::LinearProbe,
-                    /*AppendOnly=*/true>
-      string_index_{/*initial_capacity=*/4096u};
+  // The shards of the index from hashes of strings to Ids (kNumShards).
+  std::unique_ptr<Shard[]> shards_;
+
+  // Guards the insertion of new strings in |blocks_| and
+  // |large_string_chunks_| by
+  // |InternStringConcurrently|.
+  std::unique_ptr<std::mutex> insert_mutex_;
 };
 
 }  // namespace perfetto::trace_processor
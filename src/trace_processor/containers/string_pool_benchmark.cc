@@ -0,0 +1,75 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/ext/base/string_view.h"
+#include "src/trace_processor/containers/string_pool.h"
+
+namespace {
+
+using perfetto::base::StringView;
+using perfetto::trace_processor::StringPool;
+
+constexpr uint32_t kStringCount = 4096;
+
+// Strings with a length similar to the names of slices and ftrace fields.
+const std::vector<std::string>& GetStrings() {
+  static std::vector<std::string>* strings = [] {
+    auto* res = new std::vector<std::string>();
+    std::minstd_rand0 rnd_engine(0);
+    for (uint32_t i = 0; i < kStringCount; ++i) {
+      std::string str(8 + rnd_engine() % 32, ' ');
+      for (char& c : str)
+        c = static_cast<char>('a' + rnd_engine() % 26);
+      res->push_back(std::move(str));
+    }
+    return res;
+  }();
+  return *strings;
+}
+
+}  // namespace
+
+static void BM_StringPoolInternString(benchmark::State& state) {
+  StringPool pool;
+  const std::vector<std::string>& strings = GetStrings();
+  for (auto _ : state) {
+    for (const std::string& str : strings)
+      benchmark::DoNotOptimize(pool.InternString(StringView(str)));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          kStringCount);
+}
+BENCHMARK(BM_StringPoolInternString);
+
+static void BM_StringPoolInternStringConcurrently(benchmark::State& state) {
+  // Shared by all the threads running the benchmark (and by all the runs of
+  // the benchmark: after the first iteration, all the lookups are hits which
+  // is the common case when parsing traces).
+  static StringPool* pool = new StringPool();
+  const std::vector<std::string>& strings = GetStrings();
+  for (auto _ : state) {
+    for (const std::string& str : strings)
+      benchmark::DoNotOptimize(pool->InternStringConcurrently(StringView(str)));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          kStringCount);
+}
+BENCHMARK(BM_StringPoolInternStringConcurrently)->ThreadRange(1, 8);
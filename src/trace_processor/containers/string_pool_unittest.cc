@@ -18,6 +18,10 @@
 
 #include <array>
 #include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "test/gtest_and_gmock.h"
 
@@ -31,6 +35,14 @@ class StringPoolTest : public testing::Test {
   static constexpr size_t kBlockSizeBytes = StringPool::kBlockSizeBytes;
   static constexpr size_t kMinLargeStringSizeBytes =
       StringPool::kMinLargeStringSizeBytes;
+  static constexpr size_t kFirstLargeStringChunkSize =
+      StringPool::kFirstLargeStringChunkSize;
+  static constexpr size_t kNumLargeStringChunks =
+      StringPool::kNumLargeStringChunks;
+
+  static std::pair<size_t, size_t> LargeStringChunkAndOffset(size_t index) {
+    return StringPool::LargeStringChunkAndOffset(index);
+  }
 
   StringPool pool_;
 };
@@ -128,9 +140,43 @@ TEST_F(StringPoolTest, StressTest) {
   ASSERT_EQ(string_map.size(), 0u);
 }
 
+TEST_F(StringPoolTest, ConcurrentIntern) {
+  constexpr uint32_t kThreadCount = 4;
+  constexpr uint32_t kStringCount = 10000;
+
+  // Every thread interns the same strings (in a different order) so that the
+  // same string is often inserted by multiple threads at the same time.
+  std::vector<std::vector<StringPool::Id>> ids(kThreadCount);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kThreadCount; ++t) {
+    threads.emplace_back([this, t, &ids] {
+      ids[t].resize(kStringCount);
+      for (uint32_t i = 0; i < kStringCount; ++i) {
+        uint32_t str_idx = (i + t * kStringCount / kThreadCount) % kStringCount;
+        std::string str = "string_" + std::to_string(str_idx);
+        ids[t][str_idx] = pool_.InternStringConcurrently(base::StringView(str));
+        ASSERT_EQ(pool_.Get(ids[t][str_idx]), base::StringView(str));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  ASSERT_EQ(pool_.size(), kStringCount);
+  for (uint32_t i = 0; i < kStringCount; ++i) {
+    std::string str = "string_" + std::to_string(i);
+    for (uint32_t t = 0; t < kThreadCount; ++t) {
+      ASSERT_EQ(ids[t][i], ids[0][i]);
+    }
+    ASSERT_EQ(pool_.InternString(base::StringView(str)), ids[0][i]);
+    ASSERT_EQ(pool_.GetId(base::StringView(str)), ids[0][i]);
+  }
+}
+
 TEST_F(StringPoolTest, BigString) {
   // Two of these should fit into one block, but the third one should go into
-  // the |large_strings_| list.
+  // |large_string_chunks_|.
   constexpr size_t kBigStringSize = 15 * 1024 * 1024;
   // Will fit into block 1 after two kBigStringSize strings.
   constexpr size_t kSmallStringSize = 16 * 1024;
@@ -138,7 +184,7 @@ TEST_F(StringPoolTest, BigString) {
   // 2*kSmallStringSize, but is smaller than kMinLargeStringSizeBytes, so will
   // start a new block.
   constexpr size_t kMediumStringSize = 2 * 1024 * 1024;
-  // Would not fit into a block at all, so ahs to go into |large_strings_|.
+  // Would not fit into a block at all, so has to go into the large strings.
   constexpr size_t kEnormousStringSize = 33 * 1024 * 1024;
 
   constexpr std::array<size_t, 8> kStringSizes = {
@@ -197,6 +243,82 @@ TEST_F(StringPoolTest, BigString) {
   }
 }
 
+TEST_F(StringPoolTest, LargeStringChunks) {
+  using ChunkAndOffset = std::pair<size_t, size_t>;
+  const size_t kFirst = kFirstLargeStringChunkSize;
+  ASSERT_EQ(LargeStringChunkAndOffset(0), ChunkAndOffset(0, 0));
+  ASSERT_EQ(LargeStringChunkAndOffset(kFirst - 1),
+            ChunkAndOffset(0, kFirst - 1));
+  ASSERT_EQ(LargeStringChunkAndOffset(kFirst), ChunkAndOffset(1, 0));
+  ASSERT_EQ(LargeStringChunkAndOffset(3 * kFirst - 1),
+            ChunkAndOffset(1, 2 * kFirst - 1));
+  ASSERT_EQ(LargeStringChunkAndOffset(3 * kFirst), ChunkAndOffset(2, 0));
+
+  // Every large string index an Id can hold has a chunk.
+  size_t max_index = (1u << 31) - 1;
+  ASSERT_LT(LargeStringChunkAndOffset(max_index).first, kNumLargeStringChunks);
+}
+
+TEST_F(StringPoolTest, SerializeDeserialize) {
+  std::vector<std::string> strings = {"", "foo", "bar", "foobar"};
+  for (uint32_t i = 0; i < 1000; ++i) {
+    strings.push_back("string_" + std::to_string(i));
+  }
+  strings.emplace_back(kBlockSizeBytes, 'x');
+  strings.emplace_back(kBlockSizeBytes, 'y');
+
+  std::vector<StringPool::Id> ids;
+  for (const auto& str : strings) {
+    ids.push_back(pool_.InternString(base::StringView(str)));
+  }
+  ASSERT_TRUE(pool_.HasLargeString());
+
+  std::vector<std::vector<uint8_t>> serialized_blocks;
+  std::vector<std::vector<uint8_t>> serialized_large_strings;
+  pool_.Serialize([&](protozero::ConstBytes bytes, bool is_large_string) {
+    (is_large_string ? serialized_large_strings : serialized_blocks)
+        .emplace_back(bytes.data, bytes.data + bytes.size);
+  });
+  ASSERT_EQ(serialized_large_strings.size(), 2u);
+
+  std::vector<protozero::ConstBytes> blocks;
+  for (const auto& block : serialized_blocks) {
+    blocks.push_back(protozero::ConstBytes{block.data(), block.size()});
+  }
+  std::vector<protozero::ConstBytes> large_strings;
+  for (const auto& str : serialized_large_strings) {
+    large_strings.push_back(protozero::ConstBytes{str.data(), str.size()});
+  }
+
+  StringPool restored;
+  ASSERT_TRUE(restored.Deserialize(blocks, large_strings));
+  ASSERT_EQ(restored.size(), pool_.size());
+  ASSERT_EQ(restored.MaxSmallStringId(), pool_.MaxSmallStringId());
+  for (size_t i = 0; i < strings.size(); ++i) {
+    ASSERT_EQ(restored.Get(ids[i]), base::StringView(strings[i]));
+    ASSERT_EQ(restored.GetId(base::StringView(strings[i])), ids[i]);
+  }
+
+  // Newly interned strings should not clobber the restored ones.
+  StringPool::Id new_id = restored.InternString("new_string");
+  ASSERT_EQ(restored.Get(new_id), "new_string");
+  ASSERT_EQ(restored.Get(ids[1]), "foo");
+  ASSERT_EQ(restored.InternString("foo"), ids[1]);
+}
+
+TEST_F(StringPoolTest, DeserializeRejectsMalformedBlock) {
+  // Null string followed by a string claiming to be longer than the block.
+  const uint8_t kBlock[] = {0, 0, 10, 'a', 'b', 0};
+  StringPool restored;
+  ASSERT_FALSE(restored.Deserialize(
+      {protozero::ConstBytes{kBlock, sizeof(kBlock)}}, {}));
+
+  // The pool is left untouched.
+  ASSERT_EQ(restored.size(), 0u);
+  StringPool::Id id = restored.InternString("foo");
+  ASSERT_EQ(restored.Get(id), "foo");
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
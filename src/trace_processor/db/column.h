@@ -121,6 +121,24 @@ class ColumnLegacy {
     // flag can only be set when the type is ColumnType::kUint32; other types
     // are not supported.
     kSetId = 1 << 4,
+
+    // Indicates that the data in the column should be stored as runs of equal
+    // consecutive values rather than one value per row. This is worthwhile
+    // for columns where the same value is repeated many times in a row: this
+    // uses much less memory and filters are evaluated once per run.
+    //
+    // If this flag is set, kNonNull should be set (unless this is a string
+    // column) and kSetId and kDictionaryEncoded should not be set.
+    kRunLengthEncoded = 1 << 5,
+
+    // Indicates that the data in the column should be stored as bit-packed
+    // indices into a dictionary of the distinct values of the column. This is
+    // worthwhile for columns with few distinct values: this uses much less
+    // memory and filters are evaluated once per distinct value.
+    //
+    // If this flag is set, kNonNull should be set (unless this is a string
+    // column) and kSetId and kRunLengthEncoded should not be set.
+    kDictionaryEncoded = 1 << 6,
   };
 
   // Iterator over a column which conforms to std iterator interface
@@ -383,6 +401,13 @@ class ColumnLegacy {
 
   const ColumnStorageBase& storage_base() const { return *storage_; }
 
+  // Returns the number of values of the column updated in place (see
+  // ColumnStorageBase::mutation_count). Id and dummy columns are never
+  // updated.
+  uint64_t mutation_count() const {
+    return storage_ ? storage_->mutation_count() : 0;
+  }
+
  protected:
   // Returns the backing sparse vector cast to contain data of type T.
   // Should only be called when |type_| == ToColumnType<T>().
@@ -468,10 +493,14 @@ class ColumnLegacy {
   static constexpr bool IsSorted(uint32_t flags) {
     return (flags & Flag::kSorted) != 0;
   }
+  static constexpr bool IsEncoded(uint32_t flags) {
+    return (flags & (Flag::kRunLengthEncoded | Flag::kDictionaryEncoded)) != 0;
+  }
 
   static constexpr bool IsFlagsAndTypeValid(uint32_t flags, ColumnType type) {
     return (!IsDense(flags) || IsFlagsForDenseValid(flags)) &&
-           (!IsSetId(flags) || IsFlagsAndTypeForSetIdValid(flags, type));
+           (!IsSetId(flags) || IsFlagsAndTypeForSetIdValid(flags, type)) &&
+           (!IsEncoded(flags) || IsFlagsAndTypeForEncodedValid(flags, type));
   }
 
   static constexpr bool IsFlagsForDenseValid(uint32_t flags) {
@@ -487,6 +516,19 @@ class ColumnLegacy {
     return IsSorted(flags) && !IsNullable(flags) && type == ColumnType::kUint32;
   }
 
+  static constexpr bool IsFlagsAndTypeForEncodedValid(uint32_t flags,
+                                                      ColumnType type) {
+    // Only one encoding can be used at a time.
+    // Encoded storage only exists for non-null, non-set-id columns (string
+    // columns are always stored as non-null StringPool::Ids).
+    // Id columns are never stored so cannot be encoded.
+    constexpr uint32_t kBothEncodings =
+        Flag::kRunLengthEncoded | Flag::kDictionaryEncoded;
+    return (flags & kBothEncodings) != kBothEncodings && !IsSetId(flags) &&
+           (!IsNullable(flags) || type == ColumnType::kString) &&
+           type != ColumnType::kId;
+  }
+
   static SqlValue::Type ToSqlValueType(ColumnType type) {
     switch (type) {
       case ColumnType::kInt32:
@@ -29,11 +29,13 @@
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/db/column/arrangement_overlay.h"
 #include "src/trace_processor/db/column/dense_null_overlay.h"
+#include "src/trace_processor/db/column/dictionary_storage.h"
 #include "src/trace_processor/db/column/dummy_storage.h"
 #include "src/trace_processor/db/column/id_storage.h"
 #include "src/trace_processor/db/column/null_overlay.h"
 #include "src/trace_processor/db/column/numeric_storage.h"
 #include "src/trace_processor/db/column/range_overlay.h"
+#include "src/trace_processor/db/column/run_length_storage.h"
 #include "src/trace_processor/db/column/selector_overlay.h"
 #include "src/trace_processor/db/column/set_id_storage.h"
 #include "src/trace_processor/db/column/string_storage.h"
@@ -56,6 +58,8 @@ DataLayerChain::~DataLayerChain() = default;
 
 std::unique_ptr<DataLayerChain> DataLayer::MakeChain() {
   switch (impl_) {
+    case Impl::kDictionary:
+      return static_cast<DictionaryStorage*>(this)->MakeChain();
     case Impl::kDummy:
       return static_cast<DummyStorage*>(this)->MakeChain();
     case Impl::kId:
@@ -68,6 +72,8 @@ std::unique_ptr<DataLayerChain> DataLayer::MakeChain() {
       return static_cast<NumericStorage<int32_t>*>(this)->MakeChain();
     case Impl::kNumericInt64:
       return static_cast<NumericStorage<int64_t>*>(this)->MakeChain();
+    case Impl::kRunLength:
+      return static_cast<RunLengthStorage*>(this)->MakeChain();
     case Impl::kSetId:
       return static_cast<SetIdStorage*>(this)->MakeChain();
     case Impl::kString:
@@ -102,12 +108,14 @@ std::unique_ptr<DataLayerChain> DataLayer::MakeChain(
     case Impl::kSelector:
       return static_cast<SelectorOverlay*>(this)->MakeChain(std::move(inner),
                                                             args);
+    case Impl::kDictionary:
     case Impl::kDummy:
     case Impl::kId:
     case Impl::kNumericDouble:
     case Impl::kNumericUint32:
     case Impl::kNumericInt32:
     case Impl::kNumericInt64:
+    case Impl::kRunLength:
     case Impl::kSetId:
     case Impl::kString:
       PERFETTO_FATAL(
@@ -190,6 +198,17 @@ std::unique_ptr<DataLayerChain> DenseNullOverlay::MakeChain(
   return std::make_unique<ChainImpl>(std::move(inner), non_null_);
 }
 
+DictionaryStorage::DictionaryStorage(const BitPackedVector* codes,
+                                     RefPtr<DataLayer> dictionary)
+    : DataLayer(Impl::kDictionary),
+      codes_(codes),
+      dictionary_(std::move(dictionary)) {}
+DictionaryStorage::~DictionaryStorage() = default;
+
+std::unique_ptr<DataLayerChain> DictionaryStorage::MakeChain() {
+  return std::make_unique<ChainImpl>(codes_, dictionary_->MakeChain());
+}
+
 std::unique_ptr<DataLayerChain> DummyStorage::MakeChain() {
   return std::make_unique<ChainImpl>();
 }
@@ -220,14 +239,18 @@ NumericStorageBase::~NumericStorageBase() = default;
 
 template <typename T>
 std::unique_ptr<DataLayerChain> NumericStorage<T>::MakeChain() {
-  return std::make_unique<ChainImpl>(vector_, storage_type_, is_sorted_);
+  return std::make_unique<ChainImpl>(vector_, zone_map_, storage_type_,
+                                     is_sorted_);
 }
 
 template <typename T>
 NumericStorage<T>::NumericStorage(const std::vector<T>* vec,
                                   ColumnType type,
-                                  bool is_sorted)
-    : NumericStorageBase(type, is_sorted, GetImpl()), vector_(vec) {}
+                                  bool is_sorted,
+                                  const ZoneMap<T>* zone_map)
+    : NumericStorageBase(type, is_sorted, GetImpl()),
+      vector_(vec),
+      zone_map_(zone_map) {}
 
 // Define explicit instantiation of the necessary templates here to reduce
 // binary size bloat.
@@ -246,6 +269,17 @@ std::unique_ptr<DataLayerChain> RangeOverlay::MakeChain(
   return std::make_unique<ChainImpl>(std::move(inner), range_);
 }
 
+RunLengthStorage::RunLengthStorage(const std::vector<uint32_t>* run_ends,
+                                   RefPtr<DataLayer> values)
+    : DataLayer(Impl::kRunLength),
+      run_ends_(run_ends),
+      values_(std::move(values)) {}
+RunLengthStorage::~RunLengthStorage() = default;
+
+std::unique_ptr<DataLayerChain> RunLengthStorage::MakeChain() {
+  return std::make_unique<ChainImpl>(run_ends_, values_->MakeChain());
+}
+
 SelectorOverlay::SelectorOverlay(const BitVector* selector)
     : DataLayer(Impl::kSelector), selector_(selector) {}
 SelectorOverlay::~SelectorOverlay() = default;
@@ -70,6 +70,7 @@ class DataLayer : public RefCounted {
   enum class Impl {
     kArrangement,
     kDenseNull,
+    kDictionary,
     kDummy,
     kId,
     kNull,
@@ -78,6 +79,7 @@ class DataLayer : public RefCounted {
     kNumericInt32,
     kNumericInt64,
     kRange,
+    kRunLength,
     kSelector,
     kSetId,
     kString,
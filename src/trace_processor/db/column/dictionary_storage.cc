@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column/dictionary_storage.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/dictionary_vector.h"
+#include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/tp_metatrace.h"
+
+#include "protos/perfetto/trace_processor/metatrace_categories.pbzero.h"
+#include "protos/perfetto/trace_processor/serialization.pbzero.h"
+
+namespace perfetto::trace_processor::column {
+
+DictionaryStorage::ChainImpl::ChainImpl(
+    const BitPackedVector* codes,
+    std::unique_ptr<DataLayerChain> dictionary)
+    : codes_(codes), dictionary_(std::move(dictionary)) {}
+
+SingleSearchResult DictionaryStorage::ChainImpl::SingleSearch(
+    FilterOp op,
+    SqlValue sql_val,
+    uint32_t index) const {
+  return dictionary_->SingleSearch(op, sql_val, codes_->Get(index));
+}
+
+SearchValidationResult DictionaryStorage::ChainImpl::ValidateSearchConstraints(
+    FilterOp op,
+    SqlValue value) const {
+  return dictionary_->ValidateSearchConstraints(op, value);
+}
+
+RangeOrBitVector DictionaryStorage::ChainImpl::SearchValidated(
+    FilterOp op,
+    SqlValue sql_val,
+    Range in) const {
+  PERFETTO_TP_TRACE(metatrace::Category::DB,
+                    "DictionaryStorage::ChainImpl::Search");
+  if (in.empty()) {
+    return RangeOrBitVector(Range());
+  }
+
+  uint32_t match_count = 0;
+  std::vector<uint8_t> code_matches = MatchingCodes(op, sql_val, &match_count);
+  if (match_count == 0) {
+    return RangeOrBitVector(Range());
+  }
+  if (match_count == dictionary_->size()) {
+    return RangeOrBitVector(in);
+  }
+
+  // Only the codes of the elements need to be looked at: as the dictionary is
+  // small, |code_matches| stays in cache for the whole scan.
+  BitVector::Builder builder(in.end, in.start);
+  uint32_t i = in.start;
+  for (uint32_t front = builder.BitsUntilWordBoundaryOrFull(); front > 0;
+       --front, ++i) {
+    builder.Append(code_matches[codes_->Get(i)]);
+  }
+  for (uint32_t words = builder.BitsInCompleteWordsUntilFull() /
+                        BitVector::kBitsInWord;
+       words > 0; --words) {
+    uint64_t word = 0;
+    for (uint32_t bit = 0; bit < BitVector::kBitsInWord; ++bit, ++i) {
+      word |= static_cast<uint64_t>(code_matches[codes_->Get(i)]) << bit;
+    }
+    builder.AppendWord(word);
+  }
+  for (; i < in.end; ++i) {
+    builder.Append(code_matches[codes_->Get(i)]);
+  }
+  return RangeOrBitVector(std::move(builder).Build());
+}
+
+void DictionaryStorage::ChainImpl::IndexSearchValidated(
+    FilterOp op,
+    SqlValue sql_val,
+    Indices& indices) const {
+  PERFETTO_TP_TRACE(metatrace::Category::DB,
+                    "DictionaryStorage::ChainImpl::IndexSearch");
+  // As in SearchValidated, evaluate the constraint once for each distinct
+  // value rather than once per index: many indices share the same code.
+  uint32_t match_count = 0;
+  std::vector<uint8_t> code_matches = MatchingCodes(op, sql_val, &match_count);
+  if (match_count == dictionary_->size()) {
+    return;
+  }
+  indices.tokens.erase(
+      std::remove_if(indices.tokens.begin(), indices.tokens.end(),
+                     [this, &code_matches](const Token& token) {
+                       return !code_matches[codes_->Get(token.index)];
+                     }),
+      indices.tokens.end());
+}
+
+void DictionaryStorage::ChainImpl::StableSort(SortToken* start,
+                                              SortToken* end,
+                                              SortDirection direction) const {
+  for (SortToken* it = start; it != end; ++it) {
+    it->index = codes_->Get(it->index);
+  }
+  dictionary_->StableSort(start, end, direction);
+}
+
+void DictionaryStorage::ChainImpl::Distinct(Indices& indices) const {
+  PERFETTO_TP_TRACE(metatrace::Category::DB,
+                    "DictionaryStorage::ChainImpl::Distinct");
+  TranslateToCodes(indices);
+  dictionary_->Distinct(indices);
+}
+
+std::optional<Token> DictionaryStorage::ChainImpl::MaxElement(
+    Indices& indices) const {
+  PERFETTO_TP_TRACE(metatrace::Category::DB,
+                    "DictionaryStorage::ChainImpl::MaxElement");
+  TranslateToCodes(indices);
+  return dictionary_->MaxElement(indices);
+}
+
+std::optional<Token> DictionaryStorage::ChainImpl::MinElement(
+    Indices& indices) const {
+  PERFETTO_TP_TRACE(metatrace::Category::DB,
+                    "DictionaryStorage::ChainImpl::MinElement");
+  TranslateToCodes(indices);
+  return dictionary_->MinElement(indices);
+}
+
+SqlValue DictionaryStorage::ChainImpl::Get_AvoidUsingBecauseSlow(
+    uint32_t index) const {
+  return dictionary_->Get_AvoidUsingBecauseSlow(codes_->Get(index));
+}
+
+void DictionaryStorage::ChainImpl::Serialize(StorageProto* storage) const {
+  auto* dictionary_storage = storage->set_dictionary_storage();
+  dictionary_storage->set_codes(
+      reinterpret_cast<const uint8_t*>(codes_->words().data()),
+      sizeof(uint64_t) * codes_->words().size());
+  dictionary_storage->set_bit_width(codes_->bit_width());
+  dictionary_storage->set_size(codes_->size());
+  dictionary_->Serialize(dictionary_storage->set_storage());
+}
+
+std::vector<uint8_t> DictionaryStorage::ChainImpl::MatchingCodes(
+    FilterOp op,
+    SqlValue sql_val,
+    uint32_t* match_count) const {
+  // Evaluate the constraint once for each distinct value.
+  uint32_t dictionary_size = dictionary_->size();
+  RangeOrBitVector matching =
+      dictionary_->SearchValidated(op, sql_val, Range(0, dictionary_size));
+  std::vector<uint8_t> code_matches(dictionary_size);
+  if (matching.IsRange()) {
+    Range r = std::move(matching).TakeIfRange();
+    for (uint32_t i = r.start; i < r.end; ++i) {
+      code_matches[i] = 1;
+    }
+    *match_count = r.size();
+  } else {
+    BitVector bv = std::move(matching).TakeIfBitVector();
+    for (uint32_t code : bv.GetSetBitIndices()) {
+      code_matches[code] = 1;
+    }
+    *match_count = bv.CountSetBits();
+  }
+  return code_matches;
+}
+
+void DictionaryStorage::ChainImpl::TranslateToCodes(Indices& indices) const {
+  for (auto& token : indices.tokens) {
+    token.index = codes_->Get(token.index);
+  }
+  // Codes are in insertion order of the values so no order is preserved.
+  indices.state = Indices::State::kNonmonotonic;
+}
+
+}  // namespace perfetto::trace_processor::column
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_DICTIONARY_STORAGE_H_
+#define SRC_TRACE_PROCESSOR_DB_COLUMN_DICTIONARY_STORAGE_H_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/ref_counted.h"
+#include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/dictionary_vector.h"
+#include "src/trace_processor/db/column/types.h"
+
+namespace perfetto::trace_processor::column {
+
+// Storage for dictionary encoded data (see DictionaryVector): |dictionary| is
+// a storage DataLayer containing the distinct values and |codes| contains, for
+// each element, the index of its value in |dictionary|.
+//
+// Searches evaluate the constraint once per dictionary entry and then only
+// compare the codes of the elements; all other operations are forwarded to
+// |dictionary| after replacing each element with its code.
+class DictionaryStorage final : public DataLayer {
+ public:
+  DictionaryStorage(const BitPackedVector* codes,
+                    RefPtr<DataLayer> dictionary);
+  ~DictionaryStorage() override;
+
+  std::unique_ptr<DataLayerChain> MakeChain();
+
+ private:
+  class ChainImpl : public DataLayerChain {
+   public:
+    ChainImpl(const BitPackedVector* codes,
+              std::unique_ptr<DataLayerChain> dictionary);
+
+    SingleSearchResult SingleSearch(FilterOp,
+                                    SqlValue,
+                                    uint32_t) const override;
+
+    SearchValidationResult ValidateSearchConstraints(FilterOp,
+                                                     SqlValue) const override;
+
+    RangeOrBitVector SearchValidated(FilterOp, SqlValue, Range) const override;
+
+    void IndexSearchValidated(FilterOp, SqlValue, Indices&) const override;
+
+    void StableSort(SortToken* start,
+                    SortToken* end,
+                    SortDirection) const override;
+
+    void Distinct(Indices&) const override;
+
+    std::optional<Token> MaxElement(Indices&) const override;
+
+    std::optional<Token> MinElement(Indices&) const override;
+
+    SqlValue Get_AvoidUsingBecauseSlow(uint32_t index) const override;
+
+    void Serialize(StorageProto*) const override;
+
+    uint32_t size() const override { return codes_->size(); }
+
+    std::string DebugString() const override { return "DictionaryStorage"; }
+
+   private:
+    // Returns, for each code of the dictionary, whether its value matches the
+    // constraint, and sets |match_count| to the number of matching codes.
+    std::vector<uint8_t> MatchingCodes(FilterOp op,
+                                       SqlValue sql_val,
+                                       uint32_t* match_count) const;
+
+    // Replaces the index of each token with the code of the element.
+    void TranslateToCodes(Indices& indices) const;
+
+    const BitPackedVector* codes_ = nullptr;
+    std::unique_ptr<DataLayerChain> dictionary_;
+  };
+
+  const BitPackedVector* codes_ = nullptr;
+  RefPtr<DataLayer> dictionary_;
+};
+
+}  // namespace perfetto::trace_processor::column
+
+#endif  // SRC_TRACE_PROCESSOR_DB_COLUMN_DICTIONARY_STORAGE_H_
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column/dictionary_storage.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/ref_counted.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/dictionary_vector.h"
+#include "src/trace_processor/db/column/numeric_storage.h"
+#include "src/trace_processor/db/column/string_storage.h"
+#include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/column/utils.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor::column {
+namespace {
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+using Indices = DataLayerChain::Indices;
+using SortToken = DataLayerChain::SortToken;
+using SortDirection = DataLayerChain::SortDirection;
+
+template <typename T>
+RefPtr<DataLayer> MakeNumeric(const std::vector<T>& values,
+                              ColumnType type,
+                              bool is_sorted) {
+  return RefPtr<DataLayer>(new NumericStorage<T>(&values, type, is_sorted));
+}
+
+TEST(BitPackedVector, GrowsBitWidth) {
+  BitPackedVector bpv;
+  std::vector<uint32_t> expected;
+  for (uint32_t i = 0; i < 200; ++i) {
+    uint32_t value = (i * 7919u) % (i < 100 ? 4u : 100000u);
+    bpv.Append(value);
+    expected.push_back(value);
+  }
+  ASSERT_EQ(bpv.bit_width(), 17u);
+  for (uint32_t i = 0; i < 200; ++i) {
+    ASSERT_EQ(bpv.Get(i), expected[i]);
+  }
+
+  bpv.Set(3, 99999);
+  bpv.Set(4, 0);
+  ASSERT_EQ(bpv.Get(2), expected[2]);
+  ASSERT_EQ(bpv.Get(3), 99999u);
+  ASSERT_EQ(bpv.Get(4), 0u);
+  ASSERT_EQ(bpv.Get(5), expected[5]);
+}
+
+TEST(DictionaryVector, AppendAndSet) {
+  auto dict = DictionaryVector<int64_t>::Build({10, 20, 10, 10, 30, 20});
+  ASSERT_EQ(dict.size(), 6u);
+  ASSERT_THAT(dict.dictionary(), ElementsAre(10, 20, 30));
+  ASSERT_EQ(dict.codes().bit_width(), 2u);
+  ASSERT_EQ(dict.Get(4), 30);
+
+  dict.Set(0, 40);
+  ASSERT_THAT(dict.dictionary(), ElementsAre(10, 20, 30, 40));
+  ASSERT_EQ(dict.Get(0), 40);
+  ASSERT_EQ(dict.Get(2), 10);
+}
+
+TEST(DictionaryStorage, SingleSearch) {
+  auto dict = DictionaryVector<uint32_t>::Build({5, 3, 5, 7});
+  auto values = MakeNumeric(dict.dictionary(), ColumnType::kUint32, false);
+  DictionaryStorage storage(&dict.codes(), values);
+  auto chain = storage.MakeChain();
+
+  ASSERT_EQ(chain->SingleSearch(FilterOp::kEq, SqlValue::Long(5), 2),
+            SingleSearchResult::kMatch);
+  ASSERT_EQ(chain->SingleSearch(FilterOp::kEq, SqlValue::Long(5), 1),
+            SingleSearchResult::kNoMatch);
+}
+
+TEST(DictionaryStorage, Search) {
+  std::vector<uint32_t> data;
+  for (uint32_t i = 0; i < 150; ++i) {
+    data.push_back(i % 3);
+  }
+  auto dict = DictionaryVector<uint32_t>::Build(data);
+  auto values = MakeNumeric(dict.dictionary(), ColumnType::kUint32, false);
+  DictionaryStorage storage(&dict.codes(), values);
+  auto chain = storage.MakeChain();
+
+  auto res = chain->Search(FilterOp::kEq, SqlValue::Long(1), Range(2, 150));
+  std::vector<uint32_t> expected;
+  for (uint32_t i = 2; i < 150; ++i) {
+    if (i % 3 == 1) {
+      expected.push_back(i);
+    }
+  }
+  ASSERT_EQ(utils::ToIndexVectorForTests(res), expected);
+
+  res = chain->Search(FilterOp::kGt, SqlValue::Long(2), Range(0, 150));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), IsEmpty());
+
+  res = chain->Search(FilterOp::kLe, SqlValue::Long(2), Range(10, 12));
+  ASSERT_TRUE(res.IsRange());
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(10, 11));
+}
+
+TEST(DictionaryStorage, SearchString) {
+  StringPool pool;
+  std::vector<StringPool::Id> values{
+      pool.InternString("R"), pool.InternString("S"), pool.InternString("R"),
+      pool.InternString("D"), pool.InternString("S")};
+  auto dict = DictionaryVector<StringPool::Id>::Build(values);
+  DictionaryStorage storage(&dict.codes(),
+                            RefPtr<DataLayer>(
+                                new StringStorage(&pool, &dict.dictionary())));
+  auto chain = storage.MakeChain();
+
+  auto res = chain->Search(FilterOp::kEq, SqlValue::String("S"), Range(0, 5));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(1, 4));
+
+  res =
+      chain->Search(FilterOp::kGlob, SqlValue::String("[DR]*"), Range(0, 5));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(0, 2, 3));
+}
+
+TEST(DictionaryStorage, IndexSearch) {
+  auto dict = DictionaryVector<uint32_t>::Build({5, 3, 5, 7});
+  auto values = MakeNumeric(dict.dictionary(), ColumnType::kUint32, false);
+  DictionaryStorage storage(&dict.codes(), values);
+  auto chain = storage.MakeChain();
+
+  Indices indices = Indices::CreateWithIndexPayloadForTesting(
+      {0, 1, 2, 3}, Indices::State::kMonotonic);
+  chain->IndexSearch(FilterOp::kGe, SqlValue::Long(5), indices);
+  ASSERT_THAT(utils::ExtractPayloadForTesting(indices), ElementsAre(0, 2, 3));
+}
+
+TEST(DictionaryStorage, StableSortAndDistinct) {
+  auto dict = DictionaryVector<int64_t>::Build({5, 3, 5, -7});
+  auto values = MakeNumeric(dict.dictionary(), ColumnType::kInt64, false);
+  DictionaryStorage storage(&dict.codes(), values);
+  auto chain = storage.MakeChain();
+
+  std::vector<SortToken> tokens{{0, 0}, {1, 1}, {2, 2}, {3, 3}};
+  chain->StableSort(tokens.data(), tokens.data() + tokens.size(),
+                    SortDirection::kDescending);
+  ASSERT_THAT(utils::ExtractPayloadForTesting(tokens),
+              ElementsAre(0, 2, 1, 3));
+
+  Indices indices = Indices::CreateWithIndexPayloadForTesting(
+      {0, 1, 2, 3}, Indices::State::kMonotonic);
+  chain->Distinct(indices);
+  ASSERT_THAT(utils::ExtractPayloadForTesting(indices), ElementsAre(0, 1, 3));
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor::column
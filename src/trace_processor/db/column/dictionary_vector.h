@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_DICTIONARY_VECTOR_H_
+#define SRC_TRACE_PROCESSOR_DB_COLUMN_DICTIONARY_VECTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/hash.h"
+#include "perfetto/public/compiler.h"
+
+namespace perfetto::trace_processor::column {
+
+// Vector of unsigned integers which are all stored using the same number of
+// bits. The number of bits grows as larger values are stored.
+class BitPackedVector {
+ public:
+  static constexpr uint32_t kBitsInWord = 64;
+
+  BitPackedVector() = default;
+
+  PERFETTO_ALWAYS_INLINE uint32_t Get(uint32_t idx) const {
+    PERFETTO_DCHECK(idx < size_);
+    uint64_t bit = static_cast<uint64_t>(idx) * bit_width_;
+    auto word = static_cast<size_t>(bit / kBitsInWord);
+    auto offset = static_cast<uint32_t>(bit % kBitsInWord);
+    uint64_t value = words_[word] >> offset;
+    if (offset + bit_width_ > kBitsInWord) {
+      value |= words_[word + 1] << (kBitsInWord - offset);
+    }
+    return static_cast<uint32_t>(value & Mask());
+  }
+
+  void Set(uint32_t idx, uint32_t value) {
+    PERFETTO_DCHECK(idx < size_);
+    EnsureBitWidth(value);
+    uint64_t bit = static_cast<uint64_t>(idx) * bit_width_;
+    auto word = static_cast<size_t>(bit / kBitsInWord);
+    auto offset = static_cast<uint32_t>(bit % kBitsInWord);
+    words_[word] &= ~(Mask() << offset);
+    words_[word] |= static_cast<uint64_t>(value) << offset;
+    if (offset + bit_width_ > kBitsInWord) {
+      uint32_t shift = kBitsInWord - offset;
+      words_[word + 1] &= ~(Mask() >> shift);
+      words_[word + 1] |= static_cast<uint64_t>(value) >> shift;
+    }
+  }
+
+  void Append(uint32_t value) {
+    EnsureBitWidth(value);
+    size_++;
+    words_.resize(WordsForSize(size_, bit_width_));
+    Set(size_ - 1, value);
+  }
+
+  void ShrinkToFit() { words_.shrink_to_fit(); }
+
+  uint32_t size() const { return size_; }
+
+  // Number of bits used to store each element.
+  uint32_t bit_width() const { return bit_width_; }
+
+  const std::vector<uint64_t>& words() const { return words_; }
+
+ private:
+  static size_t WordsForSize(uint32_t size, uint32_t bit_width) {
+    uint64_t bits = static_cast<uint64_t>(size) * bit_width;
+    return static_cast<size_t>((bits + kBitsInWord - 1) / kBitsInWord);
+  }
+
+  uint64_t Mask() const { return (uint64_t(1) << bit_width_) - 1; }
+
+  // Repacks all the elements with a larger width if |value| does not fit in
+  // the current one. As the width only grows to the next power of two of the
+  // largest value, this happens at most 32 times.
+  void EnsureBitWidth(uint32_t value) {
+    if (PERFETTO_LIKELY((static_cast<uint64_t>(value) >> bit_width_) == 0)) {
+      return;
+    }
+    uint32_t new_width = bit_width_;
+    while ((static_cast<uint64_t>(value) >> new_width) != 0) {
+      new_width++;
+    }
+    BitPackedVector res;
+    res.bit_width_ = new_width;
+    res.size_ = size_;
+    res.words_.resize(WordsForSize(size_, new_width));
+    for (uint32_t i = 0; i < size_; ++i) {
+      res.Set(i, Get(i));
+    }
+    *this = std::move(res);
+  }
+
+  std::vector<uint64_t> words_;
+  uint32_t size_ = 0;
+  uint32_t bit_width_ = 1;
+};
+
+// Stores a sequence of values as a dictionary of the distinct values and, for
+// each element, the bit-packed index (code) of its value in the dictionary.
+// For columns with few distinct values (e.g. utids, track ids or states of a
+// large table) each element only takes a handful of bits.
+//
+// The dictionary is in insertion order and is never shrunk: values which are
+// overwritten by |Set| stay in the dictionary.
+template <typename T>
+class DictionaryVector {
+ public:
+  DictionaryVector() = default;
+
+  // Builds a dictionary encoded copy of |values|.
+  static DictionaryVector<T> Build(const std::vector<T>& values) {
+    DictionaryVector<T> res;
+    for (const T& value : values) {
+      res.Append(value);
+    }
+    return res;
+  }
+
+  T Get(uint32_t idx) const { return dictionary_[codes_.Get(idx)]; }
+
+  void Append(T value) { codes_.Append(CodeFor(value)); }
+
+  void Set(uint32_t idx, T value) { codes_.Set(idx, CodeFor(value)); }
+
+  void ShrinkToFit() {
+    dictionary_.shrink_to_fit();
+    codes_.ShrinkToFit();
+  }
+
+  // The distinct values, indexed by code.
+  const std::vector<T>& dictionary() const { return dictionary_; }
+
+  // The code of each element.
+  const BitPackedVector& codes() const { return codes_; }
+
+  uint32_t size() const { return codes_.size(); }
+
+ private:
+  // Hashes integers with base::Hasher and mixes the std::hash of other types
+  // (e.g. StringPool::Id) as std::hash is often the identity function which
+  // is a poor fit for open addressing.
+  struct ValueHash {
+    size_t operator()(const T& value) const {
+      if constexpr (std::is_arithmetic_v<T>) {
+        return base::Hash<T>{}(value);
+      } else {
+        return base::Hash<size_t>{}(std::hash<T>{}(value));
+      }
+    }
+  };
+
+  uint32_t CodeFor(T value) {
+    auto [code, inserted] = code_for_value_.Insert(
+        value, static_cast<uint32_t>(dictionary_.size()));
+    if (inserted) {
+      dictionary_.emplace_back(value);
+    }
+    return *code;
+  }
+
+  std::vector<T> dictionary_;
+  base::FlatHashMap<T, uint32_t, ValueHash> code_for_value_;
+  BitPackedVector codes_;
+};
+
+}  // namespace perfetto::trace_processor::column
+
+#endif  // SRC_TRACE_PROCESSOR_DB_COLUMN_DICTIONARY_VECTOR_H_
@@ -28,6 +28,7 @@
 #include <variant>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/public/compiler.h"
 #include "perfetto/trace_processor/basic_types.h"
@@ -35,11 +36,16 @@
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/column/utils.h"
+#include "src/trace_processor/db/column/zone_map.h"
 #include "src/trace_processor/tp_metatrace.h"
 
 #include "protos/perfetto/trace_processor/metatrace_categories.pbzero.h"
 #include "protos/perfetto/trace_processor/serialization.pbzero.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+#include <immintrin.h>
+#endif
+
 namespace perfetto::trace_processor::column {
 namespace {
 
@@ -137,30 +143,277 @@ uint32_t UpperBoundIntrinsic(const void* vector_ptr,
       val);
 }
 
+// Splits a search of |count| elements starting at the current position of
+// |builder| into an unaligned head, a run of complete words and an unaligned
+// tail.
+struct SearchSplit {
+  explicit SearchSplit(const BitVector::Builder& builder, uint32_t count)
+      : front(std::min(builder.BitsUntilWordBoundaryOrFull(), count)),
+        words_bits((count - front) / BitVector::kBitsInWord *
+                   BitVector::kBitsInWord),
+        back(count - front - words_bits) {}
+
+  uint32_t front;
+  uint32_t words_bits;
+  uint32_t back;
+};
+
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+
+// AVX2 comparison kernels for each numeric type. Each |Compare| call compares
+// |kLanes| contiguous values with a broadcasted value and returns the results
+// packed in the low |kLanes| bits of the returned mask.
+template <typename T>
+struct Avx2Lanes;
+
+// Shared implementation for the integer types where AVX2 only gives us
+// equality and signed greater-than: the remaining operators are derived from
+// those two.
+template <typename Derived>
+struct Avx2IntLanes {
+  template <FilterOp op>
+  PERFETTO_ALWAYS_INLINE static uint32_t Compare(__m256i a, __m256i b) {
+    constexpr uint32_t kAll = (1u << Derived::kLanes) - 1;
+    switch (op) {
+      case FilterOp::kEq:
+        return Derived::Eq(a, b);
+      case FilterOp::kNe:
+        return ~Derived::Eq(a, b) & kAll;
+      case FilterOp::kLt:
+        return Derived::Gt(b, a);
+      case FilterOp::kLe:
+        return ~Derived::Gt(a, b) & kAll;
+      case FilterOp::kGt:
+        return Derived::Gt(a, b);
+      case FilterOp::kGe:
+        return ~Derived::Gt(b, a) & kAll;
+      case FilterOp::kGlob:
+      case FilterOp::kRegex:
+      case FilterOp::kIsNotNull:
+      case FilterOp::kIsNull:
+        break;
+    }
+    PERFETTO_FATAL("For GCC");
+  }
+};
+
+template <>
+struct Avx2Lanes<int64_t> : Avx2IntLanes<Avx2Lanes<int64_t>> {
+  using Vec = __m256i;
+  static constexpr uint32_t kLanes = 4;
+
+  static Vec Load(const int64_t* ptr) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+  }
+  static Vec Broadcast(int64_t val) { return _mm256_set1_epi64x(val); }
+  static uint32_t Eq(Vec a, Vec b) {
+    return static_cast<uint32_t>(
+        _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b))));
+  }
+  static uint32_t Gt(Vec a, Vec b) {
+    return static_cast<uint32_t>(
+        _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(a, b))));
+  }
+};
+
+template <>
+struct Avx2Lanes<int32_t> : Avx2IntLanes<Avx2Lanes<int32_t>> {
+  using Vec = __m256i;
+  static constexpr uint32_t kLanes = 8;
+
+  static Vec Load(const int32_t* ptr) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+  }
+  static Vec Broadcast(int32_t val) { return _mm256_set1_epi32(val); }
+  static uint32_t Eq(Vec a, Vec b) {
+    return static_cast<uint32_t>(
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))));
+  }
+  static uint32_t Gt(Vec a, Vec b) {
+    return static_cast<uint32_t>(
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, b))));
+  }
+};
+
+// AVX2 has no unsigned comparisons: flipping the sign bit of both sides maps
+// the unsigned order onto the signed one.
+template <>
+struct Avx2Lanes<uint32_t> : Avx2IntLanes<Avx2Lanes<uint32_t>> {
+  using Vec = __m256i;
+  static constexpr uint32_t kLanes = 8;
+
+  static Vec Load(const uint32_t* ptr) {
+    return _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)), SignBit());
+  }
+  static Vec Broadcast(uint32_t val) {
+    return _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(val)),
+                            SignBit());
+  }
+  static uint32_t Eq(Vec a, Vec b) {
+    return static_cast<uint32_t>(
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))));
+  }
+  static uint32_t Gt(Vec a, Vec b) {
+    return static_cast<uint32_t>(
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, b))));
+  }
+
+ private:
+  static Vec SignBit() {
+    return _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+  }
+};
+
+// Doubles have native predicates for every operator. The predicates are
+// chosen to match the std comparators when NaNs are involved (i.e. only !=
+// is true for NaN).
+template <>
+struct Avx2Lanes<double> {
+  using Vec = __m256d;
+  static constexpr uint32_t kLanes = 4;
+
+  static Vec Load(const double* ptr) { return _mm256_loadu_pd(ptr); }
+  static Vec Broadcast(double val) { return _mm256_set1_pd(val); }
+
+  template <FilterOp op>
+  PERFETTO_ALWAYS_INLINE static uint32_t Compare(Vec a, Vec b) {
+    switch (op) {
+      case FilterOp::kEq:
+        return Mask(_mm256_cmp_pd(a, b, _CMP_EQ_OQ));
+      case FilterOp::kNe:
+        return Mask(_mm256_cmp_pd(a, b, _CMP_NEQ_UQ));
+      case FilterOp::kLt:
+        return Mask(_mm256_cmp_pd(a, b, _CMP_LT_OQ));
+      case FilterOp::kLe:
+        return Mask(_mm256_cmp_pd(a, b, _CMP_LE_OQ));
+      case FilterOp::kGt:
+        return Mask(_mm256_cmp_pd(a, b, _CMP_GT_OQ));
+      case FilterOp::kGe:
+        return Mask(_mm256_cmp_pd(a, b, _CMP_GE_OQ));
+      case FilterOp::kGlob:
+      case FilterOp::kRegex:
+      case FilterOp::kIsNotNull:
+      case FilterOp::kIsNull:
+        break;
+    }
+    PERFETTO_FATAL("For GCC");
+  }
+
+ private:
+  static uint32_t Mask(Vec v) {
+    return static_cast<uint32_t>(_mm256_movemask_pd(v));
+  }
+};
+
+// Same as |utils::LinearSearchWithComparator| but computes each full word of
+// the result with AVX2 instead of relying on the compiler to auto-vectorize
+// the per-bit loop (which it fails to do for most of the types/operators).
+template <FilterOp op, typename T, typename Comparator>
+void LinearSearchAvx2(T val,
+                      const T* data_ptr,
+                      uint32_t count,
+                      Comparator comparator,
+                      BitVector::Builder& builder) {
+  using Lanes = Avx2Lanes<T>;
+  static_assert(BitVector::kBitsInWord % Lanes::kLanes == 0);
+
+  SearchSplit split(builder, count);
+  const T* cur_val = data_ptr;
+  for (uint32_t i = 0; i < split.front; ++i, ++cur_val) {
+    builder.Append(comparator(*cur_val, val));
+  }
+
+  const typename Lanes::Vec vec_val = Lanes::Broadcast(val);
+  for (uint32_t i = 0; i < split.words_bits; i += BitVector::kBitsInWord) {
+    uint64_t word = 0;
+    for (uint32_t k = 0; k < BitVector::kBitsInWord;
+         k += Lanes::kLanes, cur_val += Lanes::kLanes) {
+      uint64_t mask =
+          Lanes::template Compare<op>(Lanes::Load(cur_val), vec_val);
+      word |= mask << k;
+    }
+    builder.AppendWord(word);
+  }
+
+  for (uint32_t i = 0; i < split.back; ++i, ++cur_val) {
+    builder.Append(comparator(*cur_val, val));
+  }
+}
+
+#else
+
+// Same as |utils::LinearSearchWithComparator| but only searches the next
+// |count| elements instead of filling the whole builder.
+template <typename T, typename Comparator>
+void LinearSearchScalar(T val,
+                        const T* data_ptr,
+                        uint32_t count,
+                        Comparator comparator,
+                        BitVector::Builder& builder) {
+  SearchSplit split(builder, count);
+  const T* cur_val = data_ptr;
+  for (uint32_t i = 0; i < split.front; ++i, ++cur_val) {
+    builder.Append(comparator(*cur_val, val));
+  }
+
+  // This should be very easy for the compiler to auto-vectorize.
+  for (uint32_t i = 0; i < split.words_bits; i += BitVector::kBitsInWord) {
+    uint64_t word = 0;
+    for (uint32_t k = 0; k < BitVector::kBitsInWord; ++k, ++cur_val) {
+      bool comp_result = comparator(*cur_val, val);
+      word |= static_cast<uint64_t>(comp_result) << k;
+    }
+    builder.AppendWord(word);
+  }
+
+  for (uint32_t i = 0; i < split.back; ++i, ++cur_val) {
+    builder.Append(comparator(*cur_val, val));
+  }
+}
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+
+template <FilterOp op, typename T, typename Comparator>
+PERFETTO_ALWAYS_INLINE void LinearSearch(T val,
+                                         const T* start,
+                                         uint32_t count,
+                                         Comparator comparator,
+                                         BitVector::Builder& builder) {
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+  LinearSearchAvx2<op>(val, start, count, comparator, builder);
+#else
+  LinearSearchScalar(val, start, count, comparator, builder);
+#endif
+}
+
+// Searches the next |count| elements starting at |start|, appending the
+// results to |builder|.
 template <typename T>
 void TypedLinearSearch(T typed_val,
                        const T* start,
+                       uint32_t count,
                        FilterOp op,
                        BitVector::Builder& builder) {
   switch (op) {
     case FilterOp::kEq:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::equal_to<T>(), builder);
+      return LinearSearch<FilterOp::kEq>(typed_val, start, count,
+                                         std::equal_to<T>(), builder);
     case FilterOp::kNe:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::not_equal_to<T>(), builder);
+      return LinearSearch<FilterOp::kNe>(typed_val, start, count,
+                                         std::not_equal_to<T>(), builder);
     case FilterOp::kLe:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::less_equal<T>(), builder);
+      return LinearSearch<FilterOp::kLe>(typed_val, start, count,
+                                         std::less_equal<T>(), builder);
     case FilterOp::kLt:
-      return utils::LinearSearchWithComparator(typed_val, start, std::less<T>(),
-                                               builder);
+      return LinearSearch<FilterOp::kLt>(typed_val, start, count,
+                                         std::less<T>(), builder);
     case FilterOp::kGt:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::greater<T>(), builder);
+      return LinearSearch<FilterOp::kGt>(typed_val, start, count,
+                                         std::greater<T>(), builder);
     case FilterOp::kGe:
-      return utils::LinearSearchWithComparator(
-          typed_val, start, std::greater_equal<T>(), builder);
+      return LinearSearch<FilterOp::kGe>(typed_val, start, count,
+                                         std::greater_equal<T>(), builder);
     case FilterOp::kGlob:
     case FilterOp::kRegex:
     case FilterOp::kIsNotNull:
@@ -169,6 +422,46 @@ void TypedLinearSearch(T typed_val,
   }
 }
 
+// Searches |range| of |data|, skipping over all the blocks which |zone_map|
+// shows cannot contain a match.
+template <typename T>
+void TypedLinearSearchWithZoneMap(T typed_val,
+                                  const T* data,
+                                  const ZoneMap<T>* zone_map,
+                                  FilterOp op,
+                                  Range range,
+                                  BitVector::Builder& builder) {
+  if (!zone_map || !zone_map->valid()) {
+    TypedLinearSearch(typed_val, data + range.start, range.size(), op, builder);
+    return;
+  }
+
+  constexpr uint32_t kRowsPerBlock = ZoneMap<T>::kRowsPerBlock;
+  const uint32_t block_count = zone_map->block_count();
+  auto may_match = [&](uint32_t block) {
+    return block >= block_count || zone_map->MayMatch(block, op, typed_val);
+  };
+
+  uint32_t cur = range.start;
+  uint32_t block = cur / kRowsPerBlock;
+  while (cur < range.end) {
+    // Coalesce all the following blocks with the same outcome so that
+    // matching blocks are searched with as few calls as possible.
+    bool match = may_match(block);
+    uint32_t end;
+    do {
+      end = std::min((++block) * kRowsPerBlock, range.end);
+    } while (end < range.end && may_match(block) == match);
+
+    if (match) {
+      TypedLinearSearch(typed_val, data + cur, end - cur, op, builder);
+    } else {
+      builder.Skip(end - cur);
+    }
+    cur = end;
+  }
+}
+
 SearchValidationResult IntColumnWithDouble(FilterOp op, SqlValue* sql_val) {
   double double_val = sql_val->AsDouble();
 
@@ -245,9 +538,13 @@ SearchValidationResult DoubleColumnWithInt(FilterOp op, SqlValue* sql_val) {
 }  // namespace
 
 NumericStorageBase::ChainImpl::ChainImpl(const void* vector_ptr,
+                                         const void* zone_map_ptr,
                                          ColumnType type,
                                          bool is_sorted)
-    : vector_ptr_(vector_ptr), storage_type_(type), is_sorted_(is_sorted) {}
+    : vector_ptr_(vector_ptr),
+      zone_map_ptr_(zone_map_ptr),
+      storage_type_(type),
+      is_sorted_(is_sorted) {}
 
 SearchValidationResult NumericStorageBase::ChainImpl::ValidateSearchConstraints(
     FilterOp op,
@@ -455,29 +752,15 @@ BitVector NumericStorageBase::ChainImpl::LinearSearchInternal(
     NumericValue val,
     Range range) const {
   BitVector::Builder builder(range.end, range.start);
-  if (const auto* u32 = std::get_if<uint32_t>(&val)) {
-    const auto* start =
-        static_cast<const std::vector<uint32_t>*>(vector_ptr_)->data() +
-        range.start;
-    TypedLinearSearch(*u32, start, op, builder);
-  } else if (const auto* i64 = std::get_if<int64_t>(&val)) {
-    const auto* start =
-        static_cast<const std::vector<int64_t>*>(vector_ptr_)->data() +
-        range.start;
-    TypedLinearSearch(*i64, start, op, builder);
-  } else if (const auto* i32 = std::get_if<int32_t>(&val)) {
-    const auto* start =
-        static_cast<const std::vector<int32_t>*>(vector_ptr_)->data() +
-        range.start;
-    TypedLinearSearch(*i32, start, op, builder);
-  } else if (const auto* db = std::get_if<double>(&val)) {
-    const auto* start =
-        static_cast<const std::vector<double>*>(vector_ptr_)->data() +
-        range.start;
-    TypedLinearSearch(*db, start, op, builder);
-  } else {
-    PERFETTO_DFATAL("Invalid");
-  }
+  std::visit(
+      [this, op, range, &builder](auto typed_val) {
+        using T = decltype(typed_val);
+        const auto* data = static_cast<const std::vector<T>*>(vector_ptr_);
+        const auto* zone_map = static_cast<const ZoneMap<T>*>(zone_map_ptr_);
+        TypedLinearSearchWithZoneMap(typed_val, data->data(), zone_map, op,
+                                     range, builder);
+      },
+      val);
   return std::move(builder).Build();
 }
 
@@ -525,24 +808,24 @@ void NumericStorageBase::ChainImpl::Serialize(StorageProto* msg) const {
       break;
     }
     case ColumnType::kInt32: {
-      const auto* ptr = static_cast<const std::vector<int64_t>*>(vector_ptr_);
+      const auto* ptr = static_cast<const std::vector<int32_t>*>(vector_ptr_);
       numeric_storage_msg->set_values(
           reinterpret_cast<const uint8_t*>(ptr->data()),
           sizeof(int32_t) * ptr->size());
       break;
     }
     case ColumnType::kUint32: {
-      const auto* ptr = static_cast<const std::vector<int64_t>*>(vector_ptr_);
+      const auto* ptr = static_cast<const std::vector<uint32_t>*>(vector_ptr_);
       numeric_storage_msg->set_values(
           reinterpret_cast<const uint8_t*>(ptr->data()),
           sizeof(uint32_t) * ptr->size());
       break;
     }
     case ColumnType::kDouble: {
-      const auto* ptr = static_cast<const std::vector<int64_t>*>(vector_ptr_);
+      const auto* ptr = static_cast<const std::vector<double>*>(vector_ptr_);
       numeric_storage_msg->set_values(
           reinterpret_cast<const uint8_t*>(ptr->data()),
-          sizeof(double_t) * ptr->size());
+          sizeof(double) * ptr->size());
       break;
     }
     case ColumnType::kDummy:
@@ -35,6 +35,7 @@
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/column/utils.h"
+#include "src/trace_processor/db/column/zone_map.h"
 
 namespace perfetto::trace_processor::column {
 
@@ -55,7 +56,10 @@ class NumericStorageBase : public DataLayer {
     std::string DebugString() const override { return "NumericStorage"; }
 
    protected:
-    ChainImpl(const void* vector_ptr, ColumnType type, bool is_sorted);
+    ChainImpl(const void* vector_ptr,
+              const void* zone_map_ptr,
+              ColumnType type,
+              bool is_sorted);
 
    private:
     // All viable numeric values for ColumnTypes.
@@ -68,6 +72,9 @@ class NumericStorageBase : public DataLayer {
                                 Range search_range) const;
 
     const void* vector_ptr_ = nullptr;
+    // Optional ZoneMap<T> over |vector_ptr_| used to skip blocks in linear
+    // searches.
+    const void* zone_map_ptr_ = nullptr;
     const ColumnType storage_type_ = ColumnType::kDummy;
     const bool is_sorted_ = false;
   };
@@ -83,9 +90,12 @@ class NumericStorageBase : public DataLayer {
 template <typename T>
 class NumericStorage final : public NumericStorageBase {
  public:
+  // |zone_map|, if not null, must be kept up to date with the contents of
+  // |vec| by the owner of both (see ColumnStorage).
   PERFETTO_NO_INLINE NumericStorage(const std::vector<T>* vec,
                                     ColumnType type,
-                                    bool is_sorted);
+                                    bool is_sorted,
+                                    const ZoneMap<T>* zone_map = nullptr);
 
   // The implementation of this function is given by
   // make_chain.cc/make_chain_minimal.cc depending on whether this is a minimal
@@ -95,8 +105,11 @@ class NumericStorage final : public NumericStorageBase {
  private:
   class ChainImpl : public NumericStorageBase::ChainImpl {
    public:
-    ChainImpl(const std::vector<T>* vector, ColumnType type, bool is_sorted)
-        : NumericStorageBase::ChainImpl(vector, type, is_sorted),
+    ChainImpl(const std::vector<T>* vector,
+              const ZoneMap<T>* zone_map,
+              ColumnType type,
+              bool is_sorted)
+        : NumericStorageBase::ChainImpl(vector, zone_map, type, is_sorted),
           vector_(vector) {}
 
     SingleSearchResult SingleSearch(FilterOp op,
@@ -193,6 +206,7 @@ class NumericStorage final : public NumericStorageBase {
   }
 
   const std::vector<T>* vector_;
+  const ZoneMap<T>* zone_map_;
 };
 
 // Define external templates to reduce binary size bloat.
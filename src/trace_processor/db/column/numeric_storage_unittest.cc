@@ -17,6 +17,7 @@
 
 #include <cmath>
 #include <cstdint>
+#include <functional>
 #include <limits>
 #include <numeric>
 #include <tuple>
@@ -27,6 +28,7 @@
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/column/utils.h"
+#include "src/trace_processor/db/column/zone_map.h"
 #include "src/trace_processor/db/compare.h"
 #include "test/gtest_and_gmock.h"
 
@@ -246,6 +248,91 @@ TEST(NumericStorage, SearchCompareWithNegative) {
   ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(1, 3, 4));
 }
 
+// Large enough to go through the word-at-a-time path of linear search, with
+// values on both sides of the sign bit to catch signed comparisons.
+TEST(NumericStorage, SearchUint32MultipleWords) {
+  std::vector<uint32_t> data_vec(300);
+  for (uint32_t i = 0; i < data_vec.size(); ++i) {
+    data_vec[i] = i % 3 == 0 ? std::numeric_limits<uint32_t>::max() - i : i;
+  }
+  NumericStorage<uint32_t> storage(&data_vec, ColumnType::kUint32, false);
+  auto chain = storage.MakeChain();
+  Range test_range(3, 290);
+  SqlValue val = SqlValue::Long(150);
+
+  auto check = [&](FilterOp op, auto fn) {
+    std::vector<uint32_t> expected;
+    for (uint32_t i = test_range.start; i < test_range.end; ++i) {
+      if (fn(data_vec[i], 150u))
+        expected.push_back(i);
+    }
+    auto res = chain->Search(op, val, test_range);
+    ASSERT_EQ(utils::ToIndexVectorForTests(res), expected);
+  };
+  check(FilterOp::kEq, std::equal_to<uint32_t>());
+  check(FilterOp::kNe, std::not_equal_to<uint32_t>());
+  check(FilterOp::kLt, std::less<uint32_t>());
+  check(FilterOp::kLe, std::less_equal<uint32_t>());
+  check(FilterOp::kGt, std::greater<uint32_t>());
+  check(FilterOp::kGe, std::greater_equal<uint32_t>());
+}
+
+TEST(NumericStorage, SearchDoubleMultipleWordsWithNan) {
+  std::vector<double> data_vec(200);
+  for (uint32_t i = 0; i < data_vec.size(); ++i) {
+    data_vec[i] = i % 7 == 0 ? std::nan("") : static_cast<double>(i % 10);
+  }
+  NumericStorage<double> storage(&data_vec, ColumnType::kDouble, false);
+  auto chain = storage.MakeChain();
+  Range test_range(0, 200);
+
+  auto res = chain->Search(FilterOp::kLe, SqlValue::Double(4), test_range);
+  std::vector<uint32_t> expected;
+  for (uint32_t i = 0; i < data_vec.size(); ++i) {
+    if (data_vec[i] <= 4)
+      expected.push_back(i);
+  }
+  ASSERT_EQ(utils::ToIndexVectorForTests(res), expected);
+
+  res = chain->Search(FilterOp::kNe, SqlValue::Double(4), test_range);
+  expected.clear();
+  for (uint32_t i = 0; i < data_vec.size(); ++i) {
+    if (data_vec[i] != 4)
+      expected.push_back(i);
+  }
+  ASSERT_EQ(utils::ToIndexVectorForTests(res), expected);
+}
+
+TEST(NumericStorage, SearchWithZoneMap) {
+  // Three blocks: the middle one is the only one which can contain values
+  // greater than 1000.
+  constexpr uint32_t kRowsPerBlock = ZoneMap<int64_t>::kRowsPerBlock;
+  std::vector<int64_t> data_vec(3 * kRowsPerBlock);
+  for (uint32_t i = 0; i < data_vec.size(); ++i) {
+    data_vec[i] = i / kRowsPerBlock == 1 ? 1000 + i % 7 : i % 500;
+  }
+  auto zone_map = ZoneMap<int64_t>::Build(data_vec);
+  NumericStorage<int64_t> storage(&data_vec, ColumnType::kInt64, false,
+                                  &zone_map);
+  NumericStorage<int64_t> no_zone_map_storage(&data_vec, ColumnType::kInt64,
+                                              false);
+  auto chain = storage.MakeChain();
+  auto no_zone_map_chain = no_zone_map_storage.MakeChain();
+
+  for (FilterOp op : {FilterOp::kEq, FilterOp::kNe, FilterOp::kLt,
+                      FilterOp::kLe, FilterOp::kGt, FilterOp::kGe}) {
+    for (Range range : {Range(0, 3 * kRowsPerBlock),
+                        Range(13, 2 * kRowsPerBlock + 7),
+                        Range(kRowsPerBlock + 1, kRowsPerBlock + 100)}) {
+      SqlValue val = SqlValue::Long(1003);
+      auto res = chain->Search(op, val, range);
+      auto expected = no_zone_map_chain->Search(op, val, range);
+      ASSERT_EQ(utils::ToIndexVectorForTests(res),
+                utils::ToIndexVectorForTests(expected));
+    }
+  }
+}
+
 TEST(NumericStorage, IndexSearch) {
   std::vector<int32_t> data_vec{-5, 5, -4, 4, -3, 3, 0};
   NumericStorage<int32_t> storage(&data_vec, ColumnType::kInt32, false);
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column/run_length_storage.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/tp_metatrace.h"
+
+#include "protos/perfetto/trace_processor/metatrace_categories.pbzero.h"
+#include "protos/perfetto/trace_processor/serialization.pbzero.h"
+
+namespace perfetto::trace_processor::column {
+
+RunLengthStorage::ChainImpl::ChainImpl(const std::vector<uint32_t>* run_ends,
+                                       std::unique_ptr<DataLayerChain> values)
+    : run_ends_(run_ends), values_(std::move(values)) {}
+
+SingleSearchResult RunLengthStorage::ChainImpl::SingleSearch(
+    FilterOp op,
+    SqlValue sql_val,
+    uint32_t index) const {
+  return values_->SingleSearch(op, sql_val, RunForIndex(index));
+}
+
+SearchValidationResult RunLengthStorage::ChainImpl::ValidateSearchConstraints(
+    FilterOp op,
+    SqlValue value) const {
+  return values_->ValidateSearchConstraints(op, value);
+}
+
+RangeOrBitVector RunLengthStorage::ChainImpl::SearchValidated(
+    FilterOp op,
+    SqlValue sql_val,
+    Range in) const {
+  PERFETTO_TP_TRACE(metatrace::Category::DB,
+                    "RunLengthStorage::ChainImpl::Search");
+  if (in.empty()) {
+    return RangeOrBitVector(Range());
+  }
+
+  // Evaluate the constraint once per run overlapping |in|.
+  uint32_t first_run = RunForIndex(in.start);
+  uint32_t last_run = RunForIndex(in.end - 1);
+  RangeOrBitVector runs =
+      values_->SearchValidated(op, sql_val, Range(first_run, last_run + 1));
+
+  // Consecutive runs cover consecutive elements: a range of runs is a range
+  // of elements.
+  if (runs.IsRange()) {
+    Range run_range = std::move(runs).TakeIfRange();
+    if (run_range.empty()) {
+      return RangeOrBitVector(Range());
+    }
+    return RangeOrBitVector(
+        Range(std::max(in.start, RunStart(run_range.start)),
+              std::min(in.end, (*run_ends_)[run_range.end - 1])));
+  }
+
+  BitVector matching = std::move(runs).TakeIfBitVector();
+  BitVector res(in.start, false);
+  for (uint32_t run : matching.GetSetBitIndices()) {
+    res.Resize(std::max(in.start, RunStart(run)), false);
+    res.Resize(std::min(in.end, (*run_ends_)[run]), true);
+  }
+  res.Resize(in.end, false);
+  return RangeOrBitVector(std::move(res));
+}
+
+void RunLengthStorage::ChainImpl::IndexSearchValidated(FilterOp op,
+                                                       SqlValue sql_val,
+                                                       Indices& indices) const {
+  PERFETTO_TP_TRACE(metatrace::Category::DB,
+                    "RunLengthStorage::ChainImpl::IndexSearch");
+  TranslateToRuns(indices);
+  values_->IndexSearchValidated(op, sql_val, indices);
+}
+
+void RunLengthStorage::ChainImpl::StableSort(SortToken* start,
+                                             SortToken* end,
+                                             SortDirection direction) const {
+  for (SortToken* it = start; it != end; ++it) {
+    it->index = RunForIndex(it->index);
+  }
+  values_->StableSort(start, end, direction);
+}
+
+void RunLengthStorage::ChainImpl::Distinct(Indices& indices) const {
+  PERFETTO_TP_TRACE(metatrace::Category::DB,
+                    "RunLengthStorage::ChainImpl::Distinct");
+  TranslateToRuns(indices);
+  values_->Distinct(indices);
+}
+
+std::optional<Token> RunLengthStorage::ChainImpl::MaxElement(
+    Indices& indices) const {
+  PERFETTO_TP_TRACE(metatrace::Category::DB,
+                    "RunLengthStorage::ChainImpl::MaxElement");
+  TranslateToRuns(indices);
+  return values_->MaxElement(indices);
+}
+
+std::optional<Token> RunLengthStorage::ChainImpl::MinElement(
+    Indices& indices) const {
+  PERFETTO_TP_TRACE(metatrace::Category::DB,
+                    "RunLengthStorage::ChainImpl::MinElement");
+  TranslateToRuns(indices);
+  return values_->MinElement(indices);
+}
+
+SqlValue RunLengthStorage::ChainImpl::Get_AvoidUsingBecauseSlow(
+    uint32_t index) const {
+  return values_->Get_AvoidUsingBecauseSlow(RunForIndex(index));
+}
+
+void RunLengthStorage::ChainImpl::Serialize(StorageProto* storage) const {
+  auto* run_length_storage = storage->set_run_length_storage();
+  run_length_storage->set_run_ends(
+      reinterpret_cast<const uint8_t*>(run_ends_->data()),
+      sizeof(uint32_t) * run_ends_->size());
+  values_->Serialize(run_length_storage->set_storage());
+}
+
+uint32_t RunLengthStorage::ChainImpl::RunForIndex(uint32_t index) const {
+  PERFETTO_DCHECK(index < size());
+  return static_cast<uint32_t>(std::distance(
+      run_ends_->begin(),
+      std::upper_bound(run_ends_->begin(), run_ends_->end(), index)));
+}
+
+void RunLengthStorage::ChainImpl::TranslateToRuns(Indices& indices) const {
+  if (indices.state == Indices::State::kNonmonotonic) {
+    for (auto& token : indices.tokens) {
+      token.index = RunForIndex(token.index);
+    }
+    return;
+  }
+  // For sorted indices, the run of each index can only be after the run of
+  // the previous one: restrict the search to the remaining runs. The mapping
+  // from elements to runs is monotonic so the state is unchanged.
+  auto it = run_ends_->begin();
+  for (auto& token : indices.tokens) {
+    PERFETTO_DCHECK(token.index < size());
+    it = std::upper_bound(it, run_ends_->end(), token.index);
+    token.index = static_cast<uint32_t>(std::distance(run_ends_->begin(), it));
+  }
+}
+
+}  // namespace perfetto::trace_processor::column
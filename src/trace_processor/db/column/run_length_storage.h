@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_RUN_LENGTH_STORAGE_H_
+#define SRC_TRACE_PROCESSOR_DB_COLUMN_RUN_LENGTH_STORAGE_H_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/ref_counted.h"
+#include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/types.h"
+
+namespace perfetto::trace_processor::column {
+
+// Storage for run length encoded data (see RunLengthVector): |values| is a
+// storage DataLayer containing the value of each run and |run_ends| contains
+// the index one past the last element of each run.
+//
+// All the operations are done on the runs rather than on the individual
+// elements: for example, a search evaluates the constraint once per run and
+// returns all the elements of the matching runs.
+class RunLengthStorage final : public DataLayer {
+ public:
+  RunLengthStorage(const std::vector<uint32_t>* run_ends,
+                   RefPtr<DataLayer> values);
+  ~RunLengthStorage() override;
+
+  std::unique_ptr<DataLayerChain> MakeChain();
+
+ private:
+  class ChainImpl : public DataLayerChain {
+   public:
+    ChainImpl(const std::vector<uint32_t>* run_ends,
+              std::unique_ptr<DataLayerChain> values);
+
+    SingleSearchResult SingleSearch(FilterOp,
+                                    SqlValue,
+                                    uint32_t) const override;
+
+    SearchValidationResult ValidateSearchConstraints(FilterOp,
+                                                     SqlValue) const override;
+
+    RangeOrBitVector SearchValidated(FilterOp, SqlValue, Range) const override;
+
+    void IndexSearchValidated(FilterOp, SqlValue, Indices&) const override;
+
+    void StableSort(SortToken* start,
+                    SortToken* end,
+                    SortDirection) const override;
+
+    void Distinct(Indices&) const override;
+
+    std::optional<Token> MaxElement(Indices&) const override;
+
+    std::optional<Token> MinElement(Indices&) const override;
+
+    SqlValue Get_AvoidUsingBecauseSlow(uint32_t index) const override;
+
+    void Serialize(StorageProto*) const override;
+
+    uint32_t size() const override {
+      return run_ends_->empty() ? 0 : run_ends_->back();
+    }
+
+    std::string DebugString() const override { return "RunLengthStorage"; }
+
+   private:
+    uint32_t RunForIndex(uint32_t index) const;
+
+    uint32_t RunStart(uint32_t run) const {
+      return run == 0 ? 0 : (*run_ends_)[run - 1];
+    }
+
+    // Replaces the index of each token with the index of its run.
+    void TranslateToRuns(Indices& indices) const;
+
+    const std::vector<uint32_t>* run_ends_ = nullptr;
+    std::unique_ptr<DataLayerChain> values_;
+  };
+
+  const std::vector<uint32_t>* run_ends_ = nullptr;
+  RefPtr<DataLayer> values_;
+};
+
+}  // namespace perfetto::trace_processor::column
+
+#endif  // SRC_TRACE_PROCESSOR_DB_COLUMN_RUN_LENGTH_STORAGE_H_
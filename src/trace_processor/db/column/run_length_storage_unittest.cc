@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column/run_length_storage.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/ref_counted.h"
+#include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/numeric_storage.h"
+#include "src/trace_processor/db/column/run_length_vector.h"
+#include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/column/utils.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor::column {
+namespace {
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+using Indices = DataLayerChain::Indices;
+using SortToken = DataLayerChain::SortToken;
+using SortDirection = DataLayerChain::SortDirection;
+
+template <typename T>
+RefPtr<DataLayer> MakeNumeric(const std::vector<T>& values,
+                              ColumnType type,
+                              bool is_sorted) {
+  return RefPtr<DataLayer>(new NumericStorage<T>(&values, type, is_sorted));
+}
+
+TEST(RunLengthVector, AppendAndGet) {
+  auto rle = RunLengthVector<uint32_t>::Build({5, 5, 5, 1, 1, 5, 7});
+  ASSERT_EQ(rle.size(), 7u);
+  ASSERT_THAT(rle.values(), ElementsAre(5u, 1u, 5u, 7u));
+  ASSERT_THAT(rle.run_ends(), ElementsAre(3u, 5u, 6u, 7u));
+  for (uint32_t i = 0; i < 3; ++i) {
+    ASSERT_EQ(rle.Get(i), 5u);
+  }
+  ASSERT_EQ(rle.Get(4), 1u);
+  ASSERT_EQ(rle.Get(6), 7u);
+}
+
+TEST(RunLengthVector, SetSplitsAndMergesRuns) {
+  auto rle = RunLengthVector<uint32_t>::Build({5, 5, 5, 1, 1});
+
+  // Splitting the middle of a run.
+  rle.Set(1, 2);
+  ASSERT_THAT(rle.values(), ElementsAre(5u, 2u, 5u, 1u));
+  ASSERT_THAT(rle.run_ends(), ElementsAre(1u, 2u, 3u, 5u));
+
+  // Restoring the value merges the runs back.
+  rle.Set(1, 5);
+  ASSERT_THAT(rle.values(), ElementsAre(5u, 1u));
+  ASSERT_THAT(rle.run_ends(), ElementsAre(3u, 5u));
+
+  // Extending a run by changing the first element of its neighbour.
+  rle.Set(3, 5);
+  ASSERT_THAT(rle.values(), ElementsAre(5u, 1u));
+  ASSERT_THAT(rle.run_ends(), ElementsAre(4u, 5u));
+
+  rle.Set(4, 5);
+  ASSERT_THAT(rle.values(), ElementsAre(5u));
+  ASSERT_THAT(rle.run_ends(), ElementsAre(5u));
+}
+
+TEST(RunLengthVector, SetMatchesPlainVector) {
+  std::vector<uint32_t> plain;
+  for (uint32_t i = 0; i < 64; ++i) {
+    plain.push_back(i / 8);
+  }
+  auto rle = RunLengthVector<uint32_t>::Build(plain);
+
+  // Deterministic pseudo random updates covering splits, merges and moves of
+  // run boundaries.
+  uint32_t seed = 1;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    uint32_t idx = (seed >> 8) % 64;
+    uint32_t value = (seed >> 20) % 4;
+    plain[idx] = value;
+    rle.Set(idx, value);
+
+    ASSERT_EQ(rle.size(), 64u);
+    for (uint32_t j = 0; j < 64; ++j) {
+      ASSERT_EQ(rle.Get(j), plain[j]);
+    }
+    for (uint32_t r = 0; r + 1 < rle.run_count(); ++r) {
+      ASSERT_NE(rle.values()[r], rle.values()[r + 1]);
+    }
+  }
+}
+
+TEST(RunLengthStorage, SingleSearch) {
+  auto rle = RunLengthVector<uint32_t>::Build({1, 1, 2, 2, 2, 3});
+  auto values = MakeNumeric(rle.values(), ColumnType::kUint32, true);
+  RunLengthStorage storage(&rle.run_ends(), values);
+  auto chain = storage.MakeChain();
+
+  ASSERT_EQ(chain->SingleSearch(FilterOp::kEq, SqlValue::Long(2), 4),
+            SingleSearchResult::kMatch);
+  ASSERT_EQ(chain->SingleSearch(FilterOp::kEq, SqlValue::Long(2), 1),
+            SingleSearchResult::kNoMatch);
+}
+
+TEST(RunLengthStorage, SearchRangeOfRuns) {
+  auto rle = RunLengthVector<uint32_t>::Build({1, 1, 2, 2, 2, 3, 3, 4});
+  auto values = MakeNumeric(rle.values(), ColumnType::kUint32, true);
+  RunLengthStorage storage(&rle.run_ends(), values);
+  auto chain = storage.MakeChain();
+
+  auto res = chain->Search(FilterOp::kEq, SqlValue::Long(2), Range(0, 8));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(2, 3, 4));
+
+  res = chain->Search(FilterOp::kGe, SqlValue::Long(2), Range(3, 6));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(3, 4, 5));
+
+  res = chain->Search(FilterOp::kGt, SqlValue::Long(4), Range(0, 8));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), IsEmpty());
+}
+
+TEST(RunLengthStorage, SearchBitVectorOfRuns) {
+  auto rle = RunLengthVector<uint32_t>::Build({1, 1, 2, 2, 1, 3, 1, 1});
+  auto values = MakeNumeric(rle.values(), ColumnType::kUint32, false);
+  RunLengthStorage storage(&rle.run_ends(), values);
+  auto chain = storage.MakeChain();
+
+  auto res = chain->Search(FilterOp::kEq, SqlValue::Long(1), Range(1, 7));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(1, 4, 6));
+
+  res = chain->Search(FilterOp::kNe, SqlValue::Long(1), Range(0, 8));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(2, 3, 5));
+}
+
+TEST(RunLengthStorage, IndexSearch) {
+  auto rle = RunLengthVector<uint32_t>::Build({1, 1, 2, 2, 1, 3, 1, 1});
+  auto values = MakeNumeric(rle.values(), ColumnType::kUint32, false);
+  RunLengthStorage storage(&rle.run_ends(), values);
+  auto chain = storage.MakeChain();
+
+  Indices indices = Indices::CreateWithIndexPayloadForTesting(
+      {7, 5, 3, 0}, Indices::State::kNonmonotonic);
+  chain->IndexSearch(FilterOp::kEq, SqlValue::Long(1), indices);
+  ASSERT_THAT(utils::ExtractPayloadForTesting(indices), ElementsAre(0, 3));
+
+  indices = Indices::CreateWithIndexPayloadForTesting(
+      {0, 2, 3, 5, 7}, Indices::State::kMonotonic);
+  chain->IndexSearch(FilterOp::kGe, SqlValue::Long(2), indices);
+  ASSERT_THAT(utils::ExtractPayloadForTesting(indices), ElementsAre(1, 2, 3));
+}
+
+TEST(RunLengthStorage, StableSort) {
+  auto rle = RunLengthVector<int64_t>::Build({3, 3, -1, 2, 2});
+  auto values = MakeNumeric(rle.values(), ColumnType::kInt64, false);
+  RunLengthStorage storage(&rle.run_ends(), values);
+  auto chain = storage.MakeChain();
+
+  std::vector<SortToken> tokens{{0, 0}, {1, 1}, {2, 2}, {3, 3}, {4, 4}};
+  chain->StableSort(tokens.data(), tokens.data() + tokens.size(),
+                    SortDirection::kAscending);
+  ASSERT_THAT(utils::ExtractPayloadForTesting(tokens),
+              ElementsAre(2, 3, 4, 0, 1));
+}
+
+TEST(RunLengthStorage, Distinct) {
+  auto rle = RunLengthVector<int64_t>::Build({3, 3, -1, 2, 2, 3});
+  auto values = MakeNumeric(rle.values(), ColumnType::kInt64, false);
+  RunLengthStorage storage(&rle.run_ends(), values);
+  auto chain = storage.MakeChain();
+
+  Indices indices = Indices::CreateWithIndexPayloadForTesting(
+      {0, 1, 2, 3, 4, 5}, Indices::State::kMonotonic);
+  chain->Distinct(indices);
+  ASSERT_THAT(utils::ExtractPayloadForTesting(indices), ElementsAre(0, 2, 3));
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor::column
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_RUN_LENGTH_VECTOR_H_
+#define SRC_TRACE_PROCESSOR_DB_COLUMN_RUN_LENGTH_VECTOR_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/public/compiler.h"
+
+namespace perfetto::trace_processor::column {
+
+// Stores a sequence of values as runs of equal consecutive values: for each
+// run, the value and the index one past the last element of the run are
+// stored. This is much more compact than a plain vector for columns where the
+// same value is repeated many times in a row (e.g. the cpu of consecutive
+// events in a per-cpu table).
+//
+// Appends are O(1) and random access is O(log(runs)). Updates are O(log(runs))
+// when they only move the boundary between two runs; otherwise they split or
+// merge runs which moves all the following runs. This is cheap for the recently
+// appended rows, which are the ones usually updated (e.g. the end state of the
+// last slice on a cpu), but columns updated at random should not use RLE.
+template <typename T>
+class RunLengthVector {
+ public:
+  RunLengthVector() = default;
+
+  // Builds a run length encoded copy of |values|.
+  static RunLengthVector<T> Build(const std::vector<T>& values) {
+    RunLengthVector<T> res;
+    for (const T& value : values) {
+      res.Append(value);
+    }
+    return res;
+  }
+
+  T Get(uint32_t idx) const { return values_[RunForIndex(idx)]; }
+
+  PERFETTO_ALWAYS_INLINE void Append(T value) {
+    if (PERFETTO_LIKELY(!values_.empty() && values_.back() == value)) {
+      run_ends_.back()++;
+      return;
+    }
+    values_.emplace_back(value);
+    run_ends_.emplace_back(size() + 1);
+  }
+
+  void Set(uint32_t idx, T value) {
+    uint32_t run = RunForIndex(idx);
+    if (values_[run] == value) {
+      return;
+    }
+    uint32_t start = RunStart(run);
+    uint32_t end = run_ends_[run];
+    if (end - start == 1) {
+      values_[run] = value;
+      MergeWithNext(run);
+      if (run > 0) {
+        MergeWithNext(run - 1);
+      }
+      return;
+    }
+    // Moving the boundary with a neighbouring run holding |value| does not
+    // change the number of runs.
+    if (idx == start && run > 0 && values_[run - 1] == value) {
+      run_ends_[run - 1]++;
+      return;
+    }
+    if (idx + 1 == end && run + 1 < values_.size() &&
+        values_[run + 1] == value) {
+      run_ends_[run]--;
+      return;
+    }
+
+    // Split |run| in place: only the runs after it are moved.
+    auto pos = static_cast<std::ptrdiff_t>(run);
+    if (idx == start) {
+      values_.insert(values_.begin() + pos, value);
+      run_ends_.insert(run_ends_.begin() + pos, idx + 1);
+    } else if (idx + 1 == end) {
+      run_ends_[run] = idx;
+      values_.insert(values_.begin() + pos + 1, value);
+      run_ends_.insert(run_ends_.begin() + pos + 1, end);
+    } else {
+      T old = values_[run];
+      run_ends_[run] = idx;
+      values_.insert(values_.begin() + pos + 1, {value, old});
+      run_ends_.insert(run_ends_.begin() + pos + 1, {idx + 1, end});
+    }
+  }
+
+  void ShrinkToFit() {
+    values_.shrink_to_fit();
+    run_ends_.shrink_to_fit();
+  }
+
+  // Returns the index of the run containing the element at |idx|.
+  uint32_t RunForIndex(uint32_t idx) const {
+    PERFETTO_DCHECK(idx < size());
+    return static_cast<uint32_t>(std::distance(
+        run_ends_.begin(),
+        std::upper_bound(run_ends_.begin(), run_ends_.end(), idx)));
+  }
+
+  // Returns the index of the first element of |run|.
+  uint32_t RunStart(uint32_t run) const {
+    return run == 0 ? 0 : run_ends_[run - 1];
+  }
+
+  // The value of each run.
+  const std::vector<T>& values() const { return values_; }
+
+  // The index one past the last element of each run.
+  const std::vector<uint32_t>& run_ends() const { return run_ends_; }
+
+  uint32_t run_count() const { return static_cast<uint32_t>(values_.size()); }
+
+  uint32_t size() const { return run_ends_.empty() ? 0 : run_ends_.back(); }
+
+ private:
+  void MergeWithNext(uint32_t run) {
+    if (run + 1 >= values_.size() || values_[run] != values_[run + 1]) {
+      return;
+    }
+    run_ends_[run] = run_ends_[run + 1];
+    auto next = static_cast<std::ptrdiff_t>(run + 1);
+    values_.erase(values_.begin() + next);
+    run_ends_.erase(run_ends_.begin() + next);
+  }
+
+  std::vector<T> values_;
+  std::vector<uint32_t> run_ends_;
+};
+
+}  // namespace perfetto::trace_processor::column
+
+#endif  // SRC_TRACE_PROCESSOR_DB_COLUMN_RUN_LENGTH_VECTOR_H_
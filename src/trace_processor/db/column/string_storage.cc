@@ -335,7 +335,11 @@ RangeOrBitVector StringStorage::ChainImpl::SearchValidated(
 void StringStorage::ChainImpl::IndexSearchValidated(FilterOp op,
                                                     SqlValue sql_val,
                                                     Indices& indices) const {
-  PERFETTO_DCHECK(indices.tokens.size() <= size());
+  // Encoded storages (e.g. RunLengthStorage) translate indices into indices in
+  // this storage, so several tokens can point to the same element.
+  PERFETTO_DCHECK(std::all_of(
+      indices.tokens.begin(), indices.tokens.end(),
+      [this](const Token& token) { return token.index < size(); }));
   PERFETTO_TP_TRACE(
       metatrace::Category::DB, "StringStorage::ChainImpl::IndexSearch",
       [&indices, op](metatrace::Record* r) {
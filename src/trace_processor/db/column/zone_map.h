@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_ZONE_MAP_H_
+#define SRC_TRACE_PROCESSOR_DB_COLUMN_ZONE_MAP_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/public/compiler.h"
+#include "src/trace_processor/db/column/types.h"
+
+namespace perfetto::trace_processor::column {
+
+// Keeps the minimum and maximum value of each block of |kRowsPerBlock|
+// consecutive values of a numeric column. This allows searches to skip whole
+// blocks which cannot contain any matching value (e.g. a narrow ts range on an
+// unsorted column).
+//
+// The statistics are maintained incrementally by the owner of the values
+// (see ColumnStorage): appends extend the last block and updates widen the
+// bounds of the affected block. Bounds are therefore always conservative but
+// might not be tight after updates.
+template <typename T>
+class ZoneMap {
+ public:
+  static_assert(std::is_arithmetic_v<T>, "ZoneMap requires a numeric type");
+
+  // Must be a multiple of the number of bits in a BitVector word so that
+  // skipped blocks are word aligned.
+  static constexpr uint32_t kRowsPerBlock = 4096;
+
+  ZoneMap() = default;
+
+  // Builds a zone map for the values in |values|.
+  static ZoneMap<T> Build(const std::vector<T>& values) {
+    ZoneMap<T> zm;
+    zm.blocks_.reserve(values.size() / kRowsPerBlock + 1);
+    for (T value : values) {
+      zm.Append(value);
+    }
+    return zm;
+  }
+
+  // Updates the statistics for a value appended to the column.
+  PERFETTO_ALWAYS_INLINE void Append(T value) {
+    if (PERFETTO_UNLIKELY(!valid_))
+      return;
+    if (PERFETTO_UNLIKELY(size_ % kRowsPerBlock == 0)) {
+      blocks_.emplace_back(Block{value, value});
+      if constexpr (std::is_floating_point_v<T>) {
+        if (std::isnan(value))
+          blocks_.back() = UnboundedBlock();
+      }
+    } else {
+      Widen(blocks_.back(), value);
+    }
+    size_++;
+  }
+
+  // Updates the statistics after the value at |row| was changed to |value|.
+  void Update(uint32_t row, T value) {
+    if (!valid_)
+      return;
+    PERFETTO_DCHECK(row < size_);
+    Widen(blocks_[row / kRowsPerBlock], value);
+  }
+
+  // Drops all the statistics and stops maintaining them. Used when the
+  // values are modified in a way which cannot be tracked cheaply (e.g.
+  // insertions in the middle of the column).
+  void Invalidate() {
+    valid_ = false;
+    size_ = 0;
+    blocks_.clear();
+    blocks_.shrink_to_fit();
+  }
+
+  // Returns whether any value in |block| could satisfy "value |op| |val|".
+  // False positives are possible, false negatives are not.
+  bool MayMatch(uint32_t block, FilterOp op, T val) const {
+    PERFETTO_DCHECK(block < block_count());
+    const Block& b = blocks_[block];
+    switch (op) {
+      case FilterOp::kEq:
+        return b.min <= val && val <= b.max;
+      case FilterOp::kNe:
+        return !(b.min == val && b.max == val);
+      case FilterOp::kLt:
+        return b.min < val;
+      case FilterOp::kLe:
+        return b.min <= val;
+      case FilterOp::kGt:
+        return b.max > val;
+      case FilterOp::kGe:
+        return b.max >= val;
+      case FilterOp::kGlob:
+      case FilterOp::kRegex:
+      case FilterOp::kIsNull:
+      case FilterOp::kIsNotNull:
+        return true;
+    }
+    PERFETTO_FATAL("For GCC");
+  }
+
+  // Whether the statistics are being maintained.
+  bool valid() const { return valid_; }
+
+  // Number of blocks with statistics. Rows past the last block do not have
+  // any statistics.
+  uint32_t block_count() const {
+    return static_cast<uint32_t>(blocks_.size());
+  }
+
+ private:
+  struct Block {
+    T min;
+    T max;
+  };
+
+  static Block UnboundedBlock() {
+    if constexpr (std::is_floating_point_v<T>) {
+      return Block{-std::numeric_limits<T>::infinity(),
+                   std::numeric_limits<T>::infinity()};
+    } else {
+      return Block{std::numeric_limits<T>::lowest(),
+                   std::numeric_limits<T>::max()};
+    }
+  }
+
+  static void Widen(Block& block, T value) {
+    if constexpr (std::is_floating_point_v<T>) {
+      // NaNs don't compare with anything: give up on the block as we have no
+      // way to represent "contains NaN" with min/max.
+      if (PERFETTO_UNLIKELY(std::isnan(value))) {
+        block = UnboundedBlock();
+        return;
+      }
+    }
+    block.min = std::min(block.min, value);
+    block.max = std::max(block.max, value);
+  }
+
+  std::vector<Block> blocks_;
+  uint32_t size_ = 0;
+  bool valid_ = true;
+};
+
+}  // namespace perfetto::trace_processor::column
+
+#endif  // SRC_TRACE_PROCESSOR_DB_COLUMN_ZONE_MAP_H_
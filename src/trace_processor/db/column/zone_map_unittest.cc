@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column/zone_map.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "src/trace_processor/db/column/types.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor::column {
+namespace {
+
+constexpr uint32_t kRowsPerBlock = ZoneMap<int64_t>::kRowsPerBlock;
+
+TEST(ZoneMap, AppendCreatesBlocks) {
+  ZoneMap<int64_t> zm;
+  ASSERT_EQ(zm.block_count(), 0u);
+  for (uint32_t i = 0; i < kRowsPerBlock + 1; ++i) {
+    zm.Append(i);
+  }
+  ASSERT_EQ(zm.block_count(), 2u);
+}
+
+TEST(ZoneMap, MayMatch) {
+  std::vector<int64_t> values;
+  for (uint32_t i = 0; i < kRowsPerBlock; ++i) {
+    values.push_back(100 + i % 100);
+  }
+  for (uint32_t i = 0; i < kRowsPerBlock; ++i) {
+    values.push_back(-50);
+  }
+  auto zm = ZoneMap<int64_t>::Build(values);
+  ASSERT_EQ(zm.block_count(), 2u);
+
+  // Block 0 contains [100, 199].
+  ASSERT_TRUE(zm.MayMatch(0, FilterOp::kEq, 150));
+  ASSERT_FALSE(zm.MayMatch(0, FilterOp::kEq, 99));
+  ASSERT_FALSE(zm.MayMatch(0, FilterOp::kEq, 200));
+  ASSERT_TRUE(zm.MayMatch(0, FilterOp::kNe, 100));
+  ASSERT_FALSE(zm.MayMatch(0, FilterOp::kLt, 100));
+  ASSERT_TRUE(zm.MayMatch(0, FilterOp::kLe, 100));
+  ASSERT_FALSE(zm.MayMatch(0, FilterOp::kGt, 199));
+  ASSERT_TRUE(zm.MayMatch(0, FilterOp::kGe, 199));
+
+  // Block 1 only contains -50.
+  ASSERT_FALSE(zm.MayMatch(1, FilterOp::kNe, -50));
+  ASSERT_TRUE(zm.MayMatch(1, FilterOp::kEq, -50));
+  ASSERT_TRUE(zm.MayMatch(1, FilterOp::kIsNotNull, 0));
+}
+
+TEST(ZoneMap, UpdateWidensBlock) {
+  ZoneMap<int64_t> zm;
+  for (uint32_t i = 0; i < 10; ++i) {
+    zm.Append(5);
+  }
+  ASSERT_FALSE(zm.MayMatch(0, FilterOp::kGt, 5));
+  zm.Update(3, 1000);
+  ASSERT_TRUE(zm.MayMatch(0, FilterOp::kGt, 5));
+  ASSERT_TRUE(zm.MayMatch(0, FilterOp::kEq, 1000));
+}
+
+TEST(ZoneMap, DoubleNan) {
+  ZoneMap<double> zm;
+  zm.Append(1.0);
+  zm.Append(std::nan(""));
+  zm.Append(2.0);
+  // The block contains a NaN: nothing can be excluded.
+  ASSERT_TRUE(zm.MayMatch(0, FilterOp::kEq, 100.0));
+  ASSERT_TRUE(zm.MayMatch(0, FilterOp::kNe, 1.0));
+
+  ZoneMap<double> zm_nan_first;
+  zm_nan_first.Append(std::nan(""));
+  zm_nan_first.Append(1.0);
+  ASSERT_TRUE(zm_nan_first.MayMatch(0, FilterOp::kLt, 0.0));
+}
+
+TEST(ZoneMap, Invalidate) {
+  ZoneMap<uint32_t> zm;
+  zm.Append(1);
+  ASSERT_TRUE(zm.valid());
+  zm.Invalidate();
+  ASSERT_FALSE(zm.valid());
+  ASSERT_EQ(zm.block_count(), 0u);
+  zm.Append(2);
+  ASSERT_EQ(zm.block_count(), 0u);
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor::column
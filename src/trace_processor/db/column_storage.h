@@ -19,15 +19,50 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <optional>
+#include <type_traits>
 #include <vector>
 
 #include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/public/compiler.h"
 #include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/db/column/dictionary_vector.h"
+#include "src/trace_processor/db/column/run_length_vector.h"
+#include "src/trace_processor/db/column/zone_map.h"
 
 namespace perfetto::trace_processor {
+namespace internal {
+
+// Per-block min/max statistics are only kept for numeric columns: for all
+// other types (e.g. StringPool::Id) this is an empty type.
+struct NoZoneMap {
+  template <typename U>
+  void Append(const U&) {}
+  template <typename U>
+  void Update(uint32_t, const U&) {}
+  void Invalidate() {}
+};
+
+template <typename T>
+using ZoneMapFor = std::
+    conditional_t<std::is_arithmetic_v<T>, column::ZoneMap<T>, NoZoneMap>;
+
+}  // namespace internal
+
+// How the values of a non-null column are stored in memory.
+enum class ColumnEncoding {
+  // One value per row in a std::vector.
+  kPlain,
+
+  // Runs of equal consecutive values (see column::RunLengthVector).
+  kRunLength,
+
+  // Bit-packed indices into a dictionary of the distinct values (see
+  // column::DictionaryVector).
+  kDictionary,
+};
 
 // Base class for allowing type erasure when defining plug-in implementations
 // of backing storage for columns.
@@ -42,10 +77,20 @@ class ColumnStorageBase {
   ColumnStorageBase(ColumnStorageBase&&) = default;
   ColumnStorageBase& operator=(ColumnStorageBase&&) noexcept = default;
 
+  // Pointer to the raw values of the storage: must only be called on
+  // storage which stores one value per row (i.e. is not encoded).
   virtual const void* data() const = 0;
   virtual const BitVector* bv() const = 0;
   virtual uint32_t size() const = 0;
   virtual uint32_t non_null_size() const = 0;
+
+  // Number of values changed in place (by |Set|) since the storage was
+  // created: indexes built on the column compare it to detect that they are
+  // stale.
+  uint64_t mutation_count() const { return mutation_count_; }
+
+ protected:
+  uint64_t mutation_count_ = 0;
 };
 
 // Class used for implementing storage for non-null columns.
@@ -60,21 +105,121 @@ class ColumnStorage final : public ColumnStorageBase {
   ColumnStorage(ColumnStorage&&) = default;
   ColumnStorage& operator=(ColumnStorage&&) noexcept = default;
 
-  T Get(uint32_t idx) const { return vector_[idx]; }
-  void Append(T val) { vector_.emplace_back(val); }
-  void Set(uint32_t idx, T val) { vector_[idx] = val; }
-  PERFETTO_NO_INLINE void ShrinkToFit() { vector_.shrink_to_fit(); }
-  const std::vector<T>& vector() const { return vector_; }
+  T Get(uint32_t idx) const {
+    switch (encoding_) {
+      case ColumnEncoding::kPlain:
+        return vector_[idx];
+      case ColumnEncoding::kRunLength:
+        return run_length_->Get(idx);
+      case ColumnEncoding::kDictionary:
+        return dictionary_->Get(idx);
+    }
+    PERFETTO_FATAL("For GCC");
+  }
+  void Append(T val) {
+    if (PERFETTO_LIKELY(encoding_ == ColumnEncoding::kPlain)) {
+      vector_.emplace_back(val);
+      zone_map_.Append(val);
+    } else if (encoding_ == ColumnEncoding::kRunLength) {
+      run_length_->Append(val);
+    } else {
+      dictionary_->Append(val);
+    }
+  }
+  void Set(uint32_t idx, T val) {
+    ++mutation_count_;
+    if (PERFETTO_LIKELY(encoding_ == ColumnEncoding::kPlain)) {
+      vector_[idx] = val;
+      zone_map_.Update(idx, val);
+    } else if (encoding_ == ColumnEncoding::kRunLength) {
+      run_length_->Set(idx, val);
+    } else {
+      dictionary_->Set(idx, val);
+    }
+  }
+  // Removes all the values. The storage is cleared in place: the storage
+  // layers of the column keep pointing at it.
+  void Clear() {
+    ++mutation_count_;
+    vector_.clear();
+    zone_map_ = {};
+    if (run_length_) {
+      *run_length_ = {};
+    }
+    if (dictionary_) {
+      *dictionary_ = {};
+    }
+  }
+  PERFETTO_NO_INLINE void ShrinkToFit() {
+    vector_.shrink_to_fit();
+    if (run_length_) {
+      run_length_->ShrinkToFit();
+    }
+    if (dictionary_) {
+      dictionary_->ShrinkToFit();
+    }
+  }
+  ColumnEncoding encoding() const { return encoding_; }
+
+  // Only valid for ColumnEncoding::kPlain storage.
+  const std::vector<T>& vector() const {
+    PERFETTO_CHECK(encoding_ == ColumnEncoding::kPlain);
+    return vector_;
+  }
+  const internal::ZoneMapFor<T>& zone_map() const { return zone_map_; }
 
-  const void* data() const final { return vector_.data(); }
+  // Only valid for ColumnEncoding::kRunLength storage.
+  const column::RunLengthVector<T>& run_length() const {
+    PERFETTO_CHECK(encoding_ == ColumnEncoding::kRunLength);
+    return *run_length_;
+  }
+
+  // Only valid for ColumnEncoding::kDictionary storage.
+  const column::DictionaryVector<T>& dictionary() const {
+    PERFETTO_CHECK(encoding_ == ColumnEncoding::kDictionary);
+    return *dictionary_;
+  }
+
+  const void* data() const final {
+    PERFETTO_CHECK(encoding_ == ColumnEncoding::kPlain);
+    return vector_.data();
+  }
   const BitVector* bv() const final { return nullptr; }
-  uint32_t size() const final { return static_cast<uint32_t>(vector_.size()); }
+  uint32_t size() const final {
+    switch (encoding_) {
+      case ColumnEncoding::kPlain:
+        return static_cast<uint32_t>(vector_.size());
+      case ColumnEncoding::kRunLength:
+        return run_length_->size();
+      case ColumnEncoding::kDictionary:
+        return dictionary_->size();
+    }
+    PERFETTO_FATAL("For GCC");
+  }
   uint32_t non_null_size() const final { return size(); }
 
   template <bool IsDense>
-  static ColumnStorage<T> Create() {
+  static ColumnStorage<T> Create(
+      ColumnEncoding encoding = ColumnEncoding::kPlain) {
     static_assert(!IsDense, "Invalid for non-null storage to be dense.");
-    return ColumnStorage<T>();
+    ColumnStorage<T> x;
+    x.encoding_ = encoding;
+    if (encoding == ColumnEncoding::kRunLength) {
+      x.run_length_ = std::make_unique<column::RunLengthVector<T>>();
+    } else if (encoding == ColumnEncoding::kDictionary) {
+      x.dictionary_ = std::make_unique<column::DictionaryVector<T>>();
+    }
+    return x;
+  }
+
+  // Creates storage with |encoding| containing the values of |storage|.
+  static ColumnStorage<T> CreateEncoded(const ColumnStorage<T>& storage,
+                                        ColumnEncoding encoding) {
+    ColumnStorage<T> x = Create<false>(encoding);
+    for (uint32_t i = 0; i < storage.size(); ++i) {
+      x.Append(storage.Get(i));
+    }
+    return x;
   }
 
   // Create non-null storage from nullable storage without nulls.
@@ -83,11 +228,23 @@ class ColumnStorage final : public ColumnStorageBase {
     PERFETTO_CHECK(null_storage.size() == null_storage.non_null_size());
     ColumnStorage<T> x;
     x.vector_ = std::move(null_storage).non_null_vector();
+    if constexpr (std::is_arithmetic_v<T>) {
+      x.zone_map_ = column::ZoneMap<T>::Build(x.vector_);
+    }
     return x;
   }
 
  private:
+  ColumnEncoding encoding_ = ColumnEncoding::kPlain;
   std::vector<T> vector_;
+  internal::ZoneMapFor<T> zone_map_;
+
+  // Only allocated for columns which opted into the encoding so plain columns
+  // (the vast majority) don't pay for the encoded representations. Being on
+  // the heap also keeps the pointers storage layers hold to them stable when
+  // the storage is moved.
+  std::unique_ptr<column::RunLengthVector<T>> run_length_;
+  std::unique_ptr<column::DictionaryVector<T>> dictionary_;
 };
 
 // Class used for implementing storage for nullable columns.
@@ -112,6 +269,7 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
   }
   void Append(T val) {
     data_.emplace_back(val);
+    zone_map_.Append(val);
     valid_.AppendTrue();
   }
   void Append(std::optional<T> val) {
@@ -122,9 +280,11 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
     }
   }
   void Set(uint32_t idx, T val) {
+    ++mutation_count_;
     if (mode_ == Mode::kDense) {
       valid_.Set(idx);
       data_[idx] = val;
+      zone_map_.Update(idx, val);
     } else {
       // Generally, we will be setting a null row to non-null so optimize for
       // that path.
@@ -132,11 +292,23 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
       bool was_set = valid_.Set(idx);
       if (PERFETTO_UNLIKELY(was_set)) {
         data_[row] = val;
+        zone_map_.Update(row, val);
       } else {
         data_.insert(data_.begin() + static_cast<ptrdiff_t>(row), val);
+        // Inserting shifts all the following values to a different block:
+        // the statistics cannot be cheaply kept in sync with that.
+        zone_map_.Invalidate();
       }
     }
   }
+  // Removes all the values. The storage is cleared in place: the storage
+  // layers of the column keep pointing at it.
+  void Clear() {
+    ++mutation_count_;
+    data_.clear();
+    valid_ = BitVector();
+    zone_map_ = {};
+  }
   bool IsDense() const { return mode_ == Mode::kDense; }
   PERFETTO_NO_INLINE void ShrinkToFit() {
     data_.shrink_to_fit();
@@ -146,6 +318,7 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
   // vector. For sparse it's equal to count set bits of the bit vector.
   const std::vector<T>& non_null_vector() const& { return data_; }
   const BitVector& non_null_bit_vector() const { return valid_; }
+  const internal::ZoneMapFor<T>& zone_map() const { return zone_map_; }
 
   const void* data() const final { return non_null_vector().data(); }
   const BitVector* bv() const final { return &non_null_bit_vector(); }
@@ -181,6 +354,7 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
   void AppendNull() {
     if (mode_ == Mode::kDense) {
       data_.emplace_back();
+      zone_map_.Append(data_.back());
     }
     valid_.AppendFalse();
   }
@@ -188,6 +362,7 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
   Mode mode_ = Mode::kSparse;
   std::vector<T> data_;
   BitVector valid_;
+  internal::ZoneMapFor<T> zone_map_;
 };
 
 }  // namespace perfetto::trace_processor
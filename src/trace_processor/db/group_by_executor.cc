@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/group_by_executor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/status_or.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column.h"
+#include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/tp_metatrace.h"
+#include "src/trace_processor/util/status_macros.h"
+
+#include "protos/perfetto/trace_processor/metatrace_categories.pbzero.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+using Output = GroupByExecutor::Output;
+
+constexpr uint32_t kNoCode = std::numeric_limits<uint32_t>::max();
+
+bool IsIntegerColumn(const ColumnLegacy& col) {
+  switch (col.col_type()) {
+    case ColumnType::kInt32:
+    case ColumnType::kUint32:
+    case ColumnType::kInt64:
+    case ColumnType::kId:
+      return true;
+    case ColumnType::kDouble:
+    case ColumnType::kString:
+    case ColumnType::kDummy:
+      return false;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+// Calls |fn(row, value)| for each row of |col|, where |value| is an
+// std::optional of type T.
+template <typename T, typename Fn>
+void ForEachTypedValue(const ColumnLegacy& col, uint32_t row_count, Fn fn) {
+  const ColumnStorageOverlay& overlay = col.overlay();
+  if (col.IsNullable()) {
+    const auto& storage = col.storage<std::optional<T>>();
+    for (uint32_t row = 0; row < row_count; ++row) {
+      fn(row, storage.Get(overlay.Get(row)));
+    }
+  } else {
+    const auto& storage = col.storage<T>();
+    for (uint32_t row = 0; row < row_count; ++row) {
+      fn(row, std::make_optional(storage.Get(overlay.Get(row))));
+    }
+  }
+}
+
+// Calls |fn(row, value)| for each row of |col| where |value| is an
+// std::optional<int64_t> for integer columns, std::optional<double> for
+// double columns and std::optional<StringPool::Id> for string columns.
+template <typename Fn>
+void ForEachValue(const ColumnLegacy& col, uint32_t row_count, Fn fn) {
+  auto widen = [&fn](uint32_t row, auto value) {
+    fn(row, value ? std::make_optional<int64_t>(*value) : std::nullopt);
+  };
+  switch (col.col_type()) {
+    case ColumnType::kInt32:
+      ForEachTypedValue<int32_t>(col, row_count, widen);
+      return;
+    case ColumnType::kUint32:
+      ForEachTypedValue<uint32_t>(col, row_count, widen);
+      return;
+    case ColumnType::kInt64:
+      ForEachTypedValue<int64_t>(col, row_count, fn);
+      return;
+    case ColumnType::kDouble:
+      ForEachTypedValue<double>(col, row_count, fn);
+      return;
+    case ColumnType::kId: {
+      const ColumnStorageOverlay& overlay = col.overlay();
+      for (uint32_t row = 0; row < row_count; ++row) {
+        fn(row, std::make_optional<int64_t>(overlay.Get(row)));
+      }
+      return;
+    }
+    case ColumnType::kString: {
+      const ColumnStorageOverlay& overlay = col.overlay();
+      const auto& storage = col.storage<StringPool::Id>();
+      for (uint32_t row = 0; row < row_count; ++row) {
+        StringPool::Id id = storage.Get(overlay.Get(row));
+        fn(row, id.is_null() ? std::nullopt : std::make_optional(id));
+      }
+      return;
+    }
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("Dummy columns cannot be aggregated");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+int64_t HashKey(int64_t value) {
+  return value;
+}
+int64_t HashKey(double value) {
+  // -0.0 and 0.0 are equal so must be in the same group.
+  double normalized = value == 0.0 ? 0.0 : value;
+  int64_t key;
+  memcpy(&key, &normalized, sizeof(key));
+  return key;
+}
+int64_t HashKey(StringPool::Id value) {
+  // Equal strings are interned to the same id.
+  return value.raw_id();
+}
+
+// Assigns a code to each distinct value of |col| (NULL being a value of its
+// own) and returns the code of each row.
+std::vector<uint32_t> CodesForColumn(const ColumnLegacy& col,
+                                     uint32_t row_count) {
+  std::vector<uint32_t> codes(row_count);
+  uint32_t next_code = 0;
+  if (col.IsId()) {
+    // Every row has a distinct value.
+    std::iota(codes.begin(), codes.end(), 0);
+  } else if (col.IsSorted() && !col.IsNullable() &&
+             col.col_type() != ColumnType::kString) {
+    // Equal values are next to each other: only look for runs.
+    std::optional<int64_t> prev;
+    ForEachValue(col, row_count, [&](uint32_t row, auto value) {
+      int64_t key = HashKey(*value);
+      if (!prev || *prev != key) {
+        prev = key;
+        next_code++;
+      }
+      codes[row] = next_code - 1;
+    });
+  } else {
+    base::FlatHashMap<int64_t, uint32_t> code_for_key;
+    uint32_t null_code = kNoCode;
+    ForEachValue(col, row_count, [&](uint32_t row, auto value) {
+      if (!value) {
+        if (null_code == kNoCode) {
+          null_code = next_code++;
+        }
+        codes[row] = null_code;
+        return;
+      }
+      auto [code, inserted] = code_for_key.Insert(HashKey(*value), next_code);
+      next_code += inserted;
+      codes[row] = *code;
+    });
+  }
+  return codes;
+}
+
+// Compares two values of a group by column in the same way as SQLite:
+// NULLs come first, then numbers and then strings (compared bytewise).
+int CompareKeys(const SqlValue& a, const SqlValue& b) {
+  if (a.type != b.type) {
+    if (a.is_null() || b.is_null()) {
+      return a.is_null() ? -1 : 1;
+    }
+    if (a.type == SqlValue::kString || b.type == SqlValue::kString) {
+      return a.type == SqlValue::kString ? 1 : -1;
+    }
+    double a_num = a.type == SqlValue::kLong
+                       ? static_cast<double>(a.long_value)
+                       : a.double_value;
+    double b_num = b.type == SqlValue::kLong
+                       ? static_cast<double>(b.long_value)
+                       : b.double_value;
+    return a_num < b_num ? -1 : (a_num > b_num ? 1 : 0);
+  }
+  switch (a.type) {
+    case SqlValue::kNull:
+      return 0;
+    case SqlValue::kLong:
+      return a.long_value < b.long_value
+                 ? -1
+                 : (a.long_value > b.long_value ? 1 : 0);
+    case SqlValue::kDouble:
+      return a.double_value < b.double_value
+                 ? -1
+                 : (a.double_value > b.double_value ? 1 : 0);
+    case SqlValue::kString:
+      return strcmp(a.string_value, b.string_value);
+    case SqlValue::kBytes:
+      break;
+  }
+  PERFETTO_FATAL("Unexpected value type");
+}
+
+// Sum of integers with the same semantics as SQLite: once the sum overflows,
+// it continues as a floating point (Kahan-Babuska-Neumaier) sum.
+struct IntegerSum {
+  void Add(int64_t value) {
+    if (!overflow) {
+      int64_t res;
+      if (!__builtin_add_overflow(sum, value, &res)) {
+        sum = res;
+        return;
+      }
+      overflow = true;
+      AddApprox(sum);
+    }
+    AddApprox(value);
+  }
+
+  double AsDouble() const {
+    return overflow ? approx + approx_err : static_cast<double>(sum);
+  }
+
+  int64_t sum = 0;
+  bool overflow = false;
+
+ private:
+  void AddApprox(int64_t value) {
+    // Large integers cannot be represented exactly as doubles: split them.
+    constexpr int64_t kMaxExact = int64_t(1) << 52;
+    if (value <= -kMaxExact || value >= kMaxExact) {
+      int64_t small = value % 16384;
+      AddApprox(static_cast<double>(value - small));
+      AddApprox(static_cast<double>(small));
+    } else {
+      AddApprox(static_cast<double>(value));
+    }
+  }
+  void AddApprox(double value) {
+    double t = approx + value;
+    if (std::fabs(approx) > std::fabs(value)) {
+      approx_err += (approx - t) + value;
+    } else {
+      approx_err += (value - t) + approx;
+    }
+    approx = t;
+  }
+
+  double approx = 0;
+  double approx_err = 0;
+};
+
+// Computes the value of |output| for each of the |group_count| groups.
+base::StatusOr<std::vector<SqlValue>> ComputeOutput(
+    const Table& table,
+    const Output& output,
+    const std::vector<uint32_t>& group_for_row,
+    const std::vector<uint32_t>& first_row_of_group,
+    uint32_t group_count) {
+  uint32_t row_count = table.row_count();
+  std::vector<SqlValue> res(group_count);
+  if (output.type == Output::Type::kCount && !output.col_idx) {
+    std::vector<int64_t> counts(group_count);
+    for (uint32_t row = 0; row < row_count; ++row) {
+      counts[group_for_row[row]]++;
+    }
+    for (uint32_t g = 0; g < group_count; ++g) {
+      res[g] = SqlValue::Long(counts[g]);
+    }
+    return res;
+  }
+
+  PERFETTO_CHECK(output.col_idx);
+  const ColumnLegacy& col = table.columns()[*output.col_idx];
+  switch (output.type) {
+    case Output::Type::kGroupByColumn:
+      for (uint32_t g = 0; g < group_count; ++g) {
+        res[g] = col.Get(first_row_of_group[g]);
+      }
+      return res;
+    case Output::Type::kCount: {
+      std::vector<int64_t> counts(group_count);
+      ForEachValue(col, row_count, [&](uint32_t row, auto value) {
+        counts[group_for_row[row]] += value.has_value();
+      });
+      for (uint32_t g = 0; g < group_count; ++g) {
+        res[g] = SqlValue::Long(counts[g]);
+      }
+      return res;
+    }
+    case Output::Type::kSum:
+    case Output::Type::kAvg: {
+      PERFETTO_CHECK(IsIntegerColumn(col));
+      std::vector<IntegerSum> sums(group_count);
+      std::vector<int64_t> counts(group_count);
+      ForEachValue(col, row_count, [&](uint32_t row, auto value) {
+        if constexpr (std::is_same_v<decltype(value),
+                                     std::optional<int64_t>>) {
+          if (value) {
+            sums[group_for_row[row]].Add(*value);
+            counts[group_for_row[row]]++;
+          }
+        }
+      });
+      for (uint32_t g = 0; g < group_count; ++g) {
+        if (counts[g] == 0) {
+          continue;
+        }
+        if (output.type == Output::Type::kAvg) {
+          res[g] = SqlValue::Double(sums[g].AsDouble() /
+                                    static_cast<double>(counts[g]));
+        } else if (sums[g].overflow) {
+          return base::ErrStatus("integer overflow");
+        } else {
+          res[g] = SqlValue::Long(sums[g].sum);
+        }
+      }
+      return res;
+    }
+    case Output::Type::kMin:
+    case Output::Type::kMax: {
+      bool is_min = output.type == Output::Type::kMin;
+      const StringPool& pool = *table.string_pool();
+      ForEachValue(col, row_count, [&](uint32_t row, auto value) {
+        if (!value) {
+          return;
+        }
+        SqlValue& cur = res[group_for_row[row]];
+        if constexpr (std::is_same_v<decltype(value),
+                                     std::optional<StringPool::Id>>) {
+          const char* str = pool.Get(*value).c_str();
+          if (cur.is_null() || (strcmp(str, cur.string_value) < 0) == is_min) {
+            cur = SqlValue::String(str);
+          }
+        } else if constexpr (std::is_same_v<decltype(value),
+                                            std::optional<double>>) {
+          if (cur.is_null() || (*value < cur.double_value) == is_min) {
+            cur = SqlValue::Double(*value);
+          }
+        } else {
+          if (cur.is_null() || (*value < cur.long_value) == is_min) {
+            cur = SqlValue::Long(*value);
+          }
+        }
+      });
+      return res;
+    }
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+base::Status AddValue(RuntimeTable::Builder& builder,
+                      uint32_t col,
+                      const SqlValue& value) {
+  switch (value.type) {
+    case SqlValue::kNull:
+      return builder.AddNull(col);
+    case SqlValue::kLong:
+      return builder.AddInteger(col, value.long_value);
+    case SqlValue::kDouble:
+      return builder.AddFloat(col, value.double_value);
+    case SqlValue::kString:
+      return builder.AddText(col, value.string_value);
+    case SqlValue::kBytes:
+      break;
+  }
+  PERFETTO_FATAL("Unexpected value type");
+}
+
+}  // namespace
+
+bool GroupByExecutor::IsSupported(const ColumnLegacy& col, Output::Type type) {
+  if (col.IsDummy()) {
+    return false;
+  }
+  switch (type) {
+    case Output::Type::kGroupByColumn:
+    case Output::Type::kCount:
+    case Output::Type::kMin:
+    case Output::Type::kMax:
+      return true;
+    case Output::Type::kSum:
+    case Output::Type::kAvg:
+      return IsIntegerColumn(col);
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+base::StatusOr<std::unique_ptr<RuntimeTable>> GroupByExecutor::GroupBy(
+    const Table& table,
+    const std::vector<uint32_t>& group_by,
+    const std::vector<Output>& outputs,
+    std::vector<std::string> col_names,
+    StringPool* pool) {
+  PERFETTO_TP_TRACE(metatrace::Category::DB, "GroupByExecutor::GroupBy");
+  PERFETTO_CHECK(!group_by.empty());
+  PERFETTO_CHECK(outputs.size() == col_names.size());
+  for (const Output& output : outputs) {
+    PERFETTO_CHECK(!output.col_idx ||
+                   IsSupported(table.columns()[*output.col_idx], output.type));
+  }
+
+  // Combine the codes of the values of each group by column into the group
+  // of each row.
+  uint32_t row_count = table.row_count();
+  std::vector<uint32_t> group_for_row =
+      CodesForColumn(table.columns()[group_by[0]], row_count);
+  for (uint32_t i = 1; i < group_by.size(); ++i) {
+    std::vector<uint32_t> codes =
+        CodesForColumn(table.columns()[group_by[i]], row_count);
+    base::FlatHashMap<uint64_t, uint32_t> group_for_pair;
+    for (uint32_t row = 0; row < row_count; ++row) {
+      uint64_t pair = (static_cast<uint64_t>(group_for_row[row]) << 32) |
+                      codes[row];
+      auto [group, inserted] = group_for_pair.Insert(
+          pair, static_cast<uint32_t>(group_for_pair.size()));
+      group_for_row[row] = *group;
+    }
+  }
+
+  std::vector<uint32_t> first_row_of_group;
+  for (uint32_t row = 0; row < row_count; ++row) {
+    if (group_for_row[row] == first_row_of_group.size()) {
+      first_row_of_group.push_back(row);
+    }
+  }
+  auto group_count = static_cast<uint32_t>(first_row_of_group.size());
+
+  // Groups are returned sorted by the group by columns.
+  std::vector<SqlValue> keys;
+  keys.reserve(static_cast<size_t>(group_count) * group_by.size());
+  for (uint32_t g = 0; g < group_count; ++g) {
+    for (uint32_t col : group_by) {
+      keys.push_back(table.columns()[col].Get(first_row_of_group[g]));
+    }
+  }
+  std::vector<uint32_t> sorted_groups(group_count);
+  std::iota(sorted_groups.begin(), sorted_groups.end(), 0);
+  size_t key_size = group_by.size();
+  std::stable_sort(sorted_groups.begin(), sorted_groups.end(),
+                   [&keys, key_size](uint32_t a, uint32_t b) {
+                     for (size_t i = 0; i < key_size; ++i) {
+                       int cmp = CompareKeys(keys[a * key_size + i],
+                                             keys[b * key_size + i]);
+                       if (cmp != 0) {
+                         return cmp < 0;
+                       }
+                     }
+                     return false;
+                   });
+
+  RuntimeTable::Builder builder(pool, std::move(col_names));
+  for (uint32_t i = 0; i < outputs.size(); ++i) {
+    ASSIGN_OR_RETURN(std::vector<SqlValue> values,
+                     ComputeOutput(table, outputs[i], group_for_row,
+                                   first_row_of_group, group_count));
+    for (uint32_t g : sorted_groups) {
+      RETURN_IF_ERROR(AddValue(builder, i, values[g]));
+    }
+  }
+  return std::move(builder).Build(group_count);
+}
+
+}  // namespace perfetto::trace_processor
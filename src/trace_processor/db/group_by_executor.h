@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_GROUP_BY_EXECUTOR_H_
+#define SRC_TRACE_PROCESSOR_DB_GROUP_BY_EXECUTOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/status_or.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "src/trace_processor/db/table.h"
+
+namespace perfetto::trace_processor {
+
+// Computes aggregations grouped by a set of columns of a Table, i.e. queries
+// of the form:
+//   SELECT <group by columns>, <aggregates> FROM table GROUP BY <columns>
+// directly on the storage of the columns instead of going through SQLite's
+// generic aggregation (which looks at one sqlite3_value at a time).
+//
+// Rows are grouped by hashing the values of the group by columns; sorted
+// group by columns are grouped by looking for runs of equal values instead.
+// The results match the ones SQLite would return for the same query
+// (including the order of the groups, which are sorted by the group by
+// columns).
+class GroupByExecutor {
+ public:
+  struct Output {
+    enum class Type {
+      // The value of one of the group by columns.
+      kGroupByColumn,
+      kCount,
+      kSum,
+      kMin,
+      kMax,
+      kAvg,
+    };
+    Type type;
+
+    // The column read by this output or std::nullopt for COUNT(*).
+    std::optional<uint32_t> col_idx;
+  };
+
+  // Returns whether |output| can be computed on |col|.
+  //
+  // SUM and AVG are only supported on integer columns: the result of summing
+  // doubles depends on the order of the additions (and on the version of
+  // SQLite) so they are left to SQLite.
+  static bool IsSupported(const ColumnLegacy& col, Output::Type type);
+
+  // Groups the rows of |table| by the columns |group_by| (which cannot be
+  // empty) and computes |outputs| for each group. Each output of type
+  // kGroupByColumn must read one of the columns in |group_by|.
+  //
+  // Returns a table with one column for each output, named by |col_names|,
+  // and one row for each group.
+  static base::StatusOr<std::unique_ptr<RuntimeTable>> GroupBy(
+      const Table& table,
+      const std::vector<uint32_t>& group_by,
+      const std::vector<Output>& outputs,
+      std::vector<std::string> col_names,
+      StringPool* pool);
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_DB_GROUP_BY_EXECUTOR_H_
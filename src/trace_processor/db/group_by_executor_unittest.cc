@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/group_by_executor.h"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/base/test/status_matchers.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+using base::gtest_matchers::IsOk;
+using testing::Not;
+using Output = GroupByExecutor::Output;
+using Type = GroupByExecutor::Output::Type;
+
+class GroupByExecutorTest : public ::testing::Test {
+ protected:
+  // Rows: (key, name, dur, value) with
+  //   key = NULL, 2, 1, 2, 1, NULL, 2
+  //   name = "b", "a", NULL, "c", "a", "b", "a"
+  //   dur = 10, 20, 30, NULL, 50, 60, 70
+  //   value = 1.5, -2.5, 3.5, 4.5, NULL, 6.5, 0.5
+  void SetUp() override {
+    RuntimeTable::Builder builder(&pool_, {"key", "name", "dur", "value"});
+    std::vector<std::optional<int64_t>> keys = {std::nullopt, 2, 1, 2, 1,
+                                                std::nullopt, 2};
+    std::vector<const char*> names = {"b", "a", nullptr, "c", "a", "b", "a"};
+    std::vector<std::optional<int64_t>> durs = {10, 20, 30, std::nullopt,
+                                                50, 60, 70};
+    std::vector<std::optional<double>> values = {1.5, -2.5, 3.5, 4.5,
+                                                 std::nullopt, 6.5, 0.5};
+    for (uint32_t i = 0; i < keys.size(); ++i) {
+      ASSERT_OK(keys[i] ? builder.AddInteger(0, *keys[i]) : builder.AddNull(0));
+      ASSERT_OK(names[i] ? builder.AddText(1, names[i]) : builder.AddNull(1));
+      ASSERT_OK(durs[i] ? builder.AddInteger(2, *durs[i]) : builder.AddNull(2));
+      ASSERT_OK(values[i] ? builder.AddFloat(3, *values[i])
+                          : builder.AddNull(3));
+    }
+    ASSERT_OK_AND_ASSIGN(table_, std::move(builder).Build(
+                                     static_cast<uint32_t>(keys.size())));
+  }
+
+  std::vector<std::vector<SqlValue>> Rows(const RuntimeTable& table) {
+    std::vector<std::vector<SqlValue>> rows;
+    for (auto it = table.IterateRows(); it; ++it) {
+      std::vector<SqlValue> row;
+      for (uint32_t i = 0; i < table.schema().columns.size() - 1; ++i) {
+        row.push_back(it.Get(i));
+      }
+      rows.push_back(std::move(row));
+    }
+    return rows;
+  }
+
+  StringPool pool_;
+  std::unique_ptr<RuntimeTable> table_;
+};
+
+TEST_F(GroupByExecutorTest, SingleColumn) {
+  std::vector<Output> outputs = {
+      {Type::kGroupByColumn, 0}, {Type::kCount, std::nullopt},
+      {Type::kCount, 1},         {Type::kSum, 2},
+      {Type::kAvg, 2},           {Type::kMin, 3},
+      {Type::kMax, 1},
+  };
+  ASSERT_OK_AND_ASSIGN(
+      auto res,
+      GroupByExecutor::GroupBy(*table_, {0}, outputs,
+                               {"key", "cnt", "cnt_name", "sum_dur",
+                                "avg_dur", "min_value", "max_name"},
+                               &pool_));
+  auto rows = Rows(*res);
+  ASSERT_EQ(rows.size(), 3u);
+
+  // Groups are sorted by key, NULL first.
+  ASSERT_TRUE(rows[0][0].is_null());
+  ASSERT_EQ(rows[0][1].AsLong(), 2);
+  ASSERT_EQ(rows[0][2].AsLong(), 2);
+  ASSERT_EQ(rows[0][3].AsLong(), 70);
+  ASSERT_EQ(rows[0][4].AsDouble(), 35.0);
+  ASSERT_EQ(rows[0][5].AsDouble(), 1.5);
+  ASSERT_STREQ(rows[0][6].AsString(), "b");
+
+  ASSERT_EQ(rows[1][0].AsLong(), 1);
+  ASSERT_EQ(rows[1][1].AsLong(), 2);
+  ASSERT_EQ(rows[1][2].AsLong(), 1);
+  ASSERT_EQ(rows[1][3].AsLong(), 80);
+  ASSERT_EQ(rows[1][4].AsDouble(), 40.0);
+  ASSERT_EQ(rows[1][5].AsDouble(), 3.5);
+  ASSERT_STREQ(rows[1][6].AsString(), "a");
+
+  ASSERT_EQ(rows[2][0].AsLong(), 2);
+  ASSERT_EQ(rows[2][1].AsLong(), 3);
+  ASSERT_EQ(rows[2][2].AsLong(), 3);
+  ASSERT_EQ(rows[2][3].AsLong(), 90);
+  ASSERT_EQ(rows[2][4].AsDouble(), 45.0);
+  ASSERT_EQ(rows[2][5].AsDouble(), -2.5);
+  ASSERT_STREQ(rows[2][6].AsString(), "c");
+}
+
+TEST_F(GroupByExecutorTest, MultipleColumns) {
+  std::vector<Output> outputs = {
+      {Type::kGroupByColumn, 1},
+      {Type::kGroupByColumn, 0},
+      {Type::kSum, 2},
+  };
+  ASSERT_OK_AND_ASSIGN(
+      auto res, GroupByExecutor::GroupBy(*table_, {1, 0}, outputs,
+                                         {"name", "key", "sum_dur"}, &pool_));
+  auto rows = Rows(*res);
+  ASSERT_EQ(rows.size(), 5u);
+
+  // (NULL, 1), ("a", 1), ("a", 2), ("b", NULL), ("c", 2).
+  ASSERT_TRUE(rows[0][0].is_null());
+  ASSERT_EQ(rows[0][1].AsLong(), 1);
+  ASSERT_EQ(rows[0][2].AsLong(), 30);
+  ASSERT_STREQ(rows[1][0].AsString(), "a");
+  ASSERT_EQ(rows[1][1].AsLong(), 1);
+  ASSERT_EQ(rows[1][2].AsLong(), 50);
+  ASSERT_STREQ(rows[2][0].AsString(), "a");
+  ASSERT_EQ(rows[2][1].AsLong(), 2);
+  ASSERT_EQ(rows[2][2].AsLong(), 90);
+  ASSERT_STREQ(rows[3][0].AsString(), "b");
+  ASSERT_TRUE(rows[3][1].is_null());
+  ASSERT_EQ(rows[3][2].AsLong(), 70);
+  ASSERT_STREQ(rows[4][0].AsString(), "c");
+  ASSERT_EQ(rows[4][1].AsLong(), 2);
+  ASSERT_TRUE(rows[4][2].is_null());
+}
+
+TEST_F(GroupByExecutorTest, Unsupported) {
+  const auto& cols = table_->columns();
+  ASSERT_TRUE(GroupByExecutor::IsSupported(cols[2], Type::kSum));
+  ASSERT_TRUE(GroupByExecutor::IsSupported(cols[3], Type::kMin));
+  ASSERT_FALSE(GroupByExecutor::IsSupported(cols[3], Type::kSum));
+  ASSERT_FALSE(GroupByExecutor::IsSupported(cols[1], Type::kAvg));
+}
+
+TEST_F(GroupByExecutorTest, SumOverflow) {
+  StringPool pool;
+  RuntimeTable::Builder builder(&pool, {"key", "value"});
+  for (uint32_t i = 0; i < 2; ++i) {
+    ASSERT_OK(builder.AddInteger(0, 0));
+    ASSERT_OK(builder.AddInteger(1, std::numeric_limits<int64_t>::max()));
+  }
+  ASSERT_OK_AND_ASSIGN(auto table, std::move(builder).Build(2));
+
+  ASSERT_THAT(GroupByExecutor::GroupBy(*table, {0}, {{Type::kSum, 1}},
+                                       {"sum"}, &pool)
+                  .status(),
+              Not(IsOk()));
+  auto avg = GroupByExecutor::GroupBy(*table, {0}, {{Type::kAvg, 1}},
+                                      {"avg"}, &pool);
+  ASSERT_OK(avg.status());
+  ASSERT_EQ(Rows(**avg)[0][0].AsDouble(),
+            static_cast<double>(std::numeric_limits<int64_t>::max()));
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
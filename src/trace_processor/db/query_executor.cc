@@ -16,29 +16,145 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <numeric>
+#include <optional>
 #include <utility>
 #include <vector>
 
 #include <sys/types.h>
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/bit_vector.h"
 #include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/compare.h"
 #include "src/trace_processor/db/query_executor.h"
 #include "src/trace_processor/db/table.h"
+#include "src/trace_processor/tp_metatrace.h"
 
 namespace perfetto::trace_processor {
 
 namespace {
 
 using Range = RowMap::Range;
+using SortToken = column::DataLayerChain::SortToken;
+
+// The metatrace ring buffer is not thread safe and the DB layer emits events
+// from inside Search and StableSort: don't go parallel while those are being
+// recorded.
+bool CanRunInParallel(base::ThreadPool* pool) {
+  return pool &&
+         (metatrace::Category::DB & metatrace::g_enabled_categories) == 0;
+}
+
+// The values of an order by column for each of the rows being merged by
+// |QueryExecutor::ParallelSort|. They are read from the column once so that
+// comparisons during the merge neither go through the layers of the column
+// nor box the values.
+struct MergeColumn {
+  MergeColumn(const ColumnLegacy& col, bool desc_in, uint32_t rows)
+      : type(col.type()), desc(desc_in) {
+    if (col.IsNullable()) {
+      is_null.resize(rows);
+    }
+    switch (type) {
+      case SqlValue::kLong:
+        longs.resize(rows);
+        break;
+      case SqlValue::kDouble:
+        doubles.resize(rows);
+        break;
+      case SqlValue::kString:
+        strings.resize(rows);
+        break;
+      case SqlValue::kNull:
+      case SqlValue::kBytes:
+        break;
+    }
+  }
+
+  void Set(uint32_t i, const SqlValue& value) {
+    if (value.is_null()) {
+      PERFETTO_DCHECK(!is_null.empty());
+      is_null[i] = true;
+      return;
+    }
+    switch (type) {
+      case SqlValue::kLong:
+        longs[i] = value.long_value;
+        break;
+      case SqlValue::kDouble:
+        doubles[i] = value.double_value;
+        break;
+      case SqlValue::kString:
+        strings[i] = base::StringView(value.string_value);
+        break;
+      case SqlValue::kNull:
+      case SqlValue::kBytes:
+        break;
+    }
+  }
+
+  // Same as compare::SqlValue on the values of the rows |a| and |b|.
+  int Compare(uint32_t a, uint32_t b) const {
+    if (!is_null.empty() && (is_null[a] || is_null[b])) {
+      return static_cast<int>(!is_null[a]) - static_cast<int>(!is_null[b]);
+    }
+    switch (type) {
+      case SqlValue::kLong:
+        return compare::Numeric(longs[a], longs[b]);
+      case SqlValue::kDouble:
+        return compare::Numeric(doubles[a], doubles[b]);
+      case SqlValue::kString:
+        return compare::String(strings[a], strings[b]);
+      case SqlValue::kNull:
+      case SqlValue::kBytes:
+        return 0;
+    }
+    PERFETTO_FATAL("For GCC");
+  }
+
+  SqlValue::Type type;
+  bool desc;
+  std::vector<uint8_t> is_null;
+  std::vector<int64_t> longs;
+  std::vector<double> doubles;
+  std::vector<base::StringView> strings;
+};
+
+// Returns how many elements of |left| are in the first |count| elements of
+// the stable merge of |left| and |right| (i.e. which takes elements from
+// |left| first on ties, like std::merge).
+template <typename Less>
+uint32_t MergePathSplit(uint32_t count,
+                        const uint32_t* left,
+                        uint32_t left_size,
+                        const uint32_t* right,
+                        uint32_t right_size,
+                        const Less& less) {
+  uint32_t lo = count > right_size ? count - right_size : 0;
+  uint32_t hi = std::min(count, left_size);
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (less(right[count - mid - 1], left[mid])) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
 
 }  // namespace
 
 void QueryExecutor::FilterColumn(const Constraint& c,
                                  const column::DataLayerChain& chain,
-                                 RowMap* rm) {
+                                 RowMap* rm,
+                                 base::ThreadPool* pool) {
   // Shortcut of empty row map.
   uint32_t rm_size = rm->size();
   if (rm_size == 0)
@@ -79,17 +195,21 @@ void QueryExecutor::FilterColumn(const Constraint& c,
     IndexSearch(c, chain, rm);
     return;
   }
-  LinearSearch(c, chain, rm);
+  LinearSearch(c, chain, rm, pool);
 }
 
 void QueryExecutor::LinearSearch(const Constraint& c,
                                  const column::DataLayerChain& chain,
-                                 RowMap* rm) {
+                                 RowMap* rm,
+                                 base::ThreadPool* pool) {
   // TODO(b/283763282): Align these to word boundaries.
   Range bounds(rm->Get(0), rm->Get(rm->size() - 1) + 1);
 
   // Search the storage.
-  RangeOrBitVector res = chain.Search(c.op, c.value, bounds);
+  RangeOrBitVector res =
+      CanRunInParallel(pool) && bounds.size() >= 2 * kRowsPerMorsel
+          ? ParallelSearch(c, chain, bounds, pool)
+          : chain.Search(c.op, c.value, bounds);
   if (rm->IsRange()) {
     if (res.IsRange()) {
       Range range = std::move(res).TakeIfRange();
@@ -110,6 +230,85 @@ void QueryExecutor::LinearSearch(const Constraint& c,
   rm->Intersect(RowMap(std::move(res).TakeIfBitVector()));
 }
 
+RangeOrBitVector QueryExecutor::ParallelSearch(
+    const Constraint& c,
+    const column::DataLayerChain& chain,
+    Range bounds,
+    base::ThreadPool* pool) {
+  // Morsels are aligned to multiples of |kRowsPerMorsel| so that all the
+  // BitVectors returned by the searches can be stitched together by copying
+  // whole words.
+  std::vector<Range> morsels;
+  for (uint32_t start = bounds.start; start < bounds.end;) {
+    uint32_t end = std::min(bounds.end, (start / kRowsPerMorsel + 1) *
+                                            kRowsPerMorsel);
+    morsels.emplace_back(start, end);
+    start = end;
+  }
+
+  // Search is const on all the layers so the same chain can be searched
+  // concurrently on disjoint ranges.
+  std::vector<std::optional<RangeOrBitVector>> results(morsels.size());
+  base::WaitableEvent done;
+  for (uint32_t i = 0; i < morsels.size(); ++i) {
+    pool->PostTask([&c, &chain, &morsels, &results, &done, i] {
+      results[i] = chain.Search(c.op, c.value, morsels[i]);
+      done.Notify();
+    });
+  }
+  done.Wait(morsels.size());
+
+  // If every morsel returned a range and the non-empty ones are contiguous,
+  // the result is still a range. This is the common case for sorted columns.
+  bool all_ranges = std::all_of(results.begin(), results.end(),
+                                [](const auto& r) { return r->IsRange(); });
+  if (all_ranges) {
+    std::vector<Range> ranges;
+    ranges.reserve(results.size());
+    for (auto& res : results) {
+      ranges.emplace_back(std::move(*res).TakeIfRange());
+    }
+    std::optional<Range> merged;
+    bool contiguous = true;
+    for (const Range& r : ranges) {
+      if (r.empty())
+        continue;
+      if (!merged) {
+        merged = r;
+      } else if (merged->end == r.start) {
+        merged->end = r.end;
+      } else {
+        contiguous = false;
+        break;
+      }
+    }
+    if (contiguous) {
+      return RangeOrBitVector(merged.value_or(Range()));
+    }
+    for (uint32_t i = 0; i < ranges.size(); ++i) {
+      results[i] = RangeOrBitVector(ranges[i]);
+    }
+  }
+
+  std::vector<BitVector> parts;
+  parts.reserve(results.size());
+  for (uint32_t i = 0; i < results.size(); ++i) {
+    if (results[i]->IsBitVector()) {
+      parts.emplace_back(std::move(*results[i]).TakeIfBitVector());
+      continue;
+    }
+    Range r = std::move(*results[i]).TakeIfRange();
+    if (r.empty()) {
+      r = Range();
+    }
+    BitVector bv(r.start, false);
+    bv.Resize(r.end, true);
+    bv.Resize(morsels[i].end, false);
+    parts.emplace_back(std::move(bv));
+  }
+  return RangeOrBitVector(BitVector::FromConsecutiveParts(std::move(parts)));
+}
+
 void QueryExecutor::IndexSearch(const Constraint& c,
                                 const column::DataLayerChain& chain,
                                 RowMap* rm) {
@@ -131,16 +330,23 @@ void QueryExecutor::IndexSearch(const Constraint& c,
 
 RowMap QueryExecutor::FilterLegacy(const Table* table,
                                    const std::vector<Constraint>& c_vec) {
-  RowMap rm(0, table->row_count());
+  return FilterLegacy(table, c_vec, RowMap(0, table->row_count()), nullptr);
+}
+
+RowMap QueryExecutor::FilterLegacy(const Table* table,
+                                   const std::vector<Constraint>& c_vec,
+                                   RowMap rm,
+                                   base::ThreadPool* pool) {
   for (const auto& c : c_vec) {
-    FilterColumn(c, table->ChainForColumn(c.col_idx), &rm);
+    FilterColumn(c, table->ChainForColumn(c.col_idx), &rm, pool);
   }
   return rm;
 }
 
 void QueryExecutor::SortLegacy(const Table* table,
                                const std::vector<Order>& ob,
-                               std::vector<uint32_t>& out) {
+                               std::vector<uint32_t>& out,
+                               base::ThreadPool* pool) {
   // Setup the sort token payload to match the input vector of indices. The
   // value of the payload will be untouched by the algorithm even while the
   // order changes to match the ordering defined by the input constraint set.
@@ -149,6 +355,23 @@ void QueryExecutor::SortLegacy(const Table* table,
     rows[i].payload = out[i];
   }
 
+  if (CanRunInParallel(pool) && rows.size() >= 2 * kRowsPerMorsel) {
+    ParallelSort(table, ob, rows, pool);
+  } else {
+    SortTokens(table, ob, rows.data(), rows.data() + rows.size());
+  }
+
+  // Recapture the payload from each of the sort tokens whose order now
+  // indicates the order
+  for (uint32_t i = 0; i < out.size(); ++i) {
+    out[i] = rows[i].payload;
+  }
+}
+
+void QueryExecutor::SortTokens(const Table* table,
+                               const std::vector<Order>& ob,
+                               SortToken* begin,
+                               SortToken* end) {
   // As our data is columnar, it's always more efficient to sort one column
   // at a time rather than try and sort lexiographically all at once.
   // To preserve correctness, we need to stably sort the index vector once
@@ -180,28 +403,133 @@ void QueryExecutor::SortLegacy(const Table* table,
   // which currently eliminates constraints on sorted columns.
   for (auto it = ob.rbegin(); it != ob.rend(); ++it) {
     // Reset the index to the payload at the start of each iote
-    for (uint32_t i = 0; i < out.size(); ++i) {
-      rows[i].index = rows[i].payload;
+    for (SortToken* row = begin; row != end; ++row) {
+      row->index = row->payload;
     }
     table->ChainForColumn(it->col_idx)
-        .StableSort(rows.data(), rows.data() + rows.size(),
+        .StableSort(begin, end,
                     it->desc
                         ? column::DataLayerChain::SortDirection::kDescending
                         : column::DataLayerChain::SortDirection::kAscending);
   }
+}
 
-  // Recapture the payload from each of the sort tokens whose order now
-  // indicates the order
-  for (uint32_t i = 0; i < out.size(); ++i) {
-    out[i] = rows[i].payload;
+void QueryExecutor::ParallelSort(const Table* table,
+                                 const std::vector<Order>& ob,
+                                 std::vector<SortToken>& rows,
+                                 base::ThreadPool* pool) {
+  // Sort each morsel independently: the column-at-a-time algorithm in
+  // |SortTokens| is used for each of them.
+  auto count = static_cast<uint32_t>(rows.size());
+  std::vector<Range> runs;
+  for (uint32_t start = 0; start < count; start += kRowsPerMorsel) {
+    runs.emplace_back(start, std::min(count, start + kRowsPerMorsel));
+  }
+  {
+    base::WaitableEvent done;
+    for (const Range& run : runs) {
+      pool->PostTask([table, &ob, &rows, &done, run] {
+        SortTokens(table, ob, rows.data() + run.start, rows.data() + run.end);
+        done.Notify();
+      });
+    }
+    done.Wait(runs.size());
+  }
+
+  // Read the values of the order by columns of the sorted morsels, in
+  // parallel as this goes through the layers of the columns.
+  std::vector<MergeColumn> columns;
+  for (const Order& o : ob) {
+    columns.emplace_back(table->columns()[o.col_idx], o.desc, count);
+  }
+  {
+    base::WaitableEvent done;
+    for (const Range& run : runs) {
+      pool->PostTask([table, &ob, &rows, &columns, &done, run] {
+        for (uint32_t i = 0; i < ob.size(); ++i) {
+          const column::DataLayerChain& chain =
+              table->ChainForColumn(ob[i].col_idx);
+          for (uint32_t pos = run.start; pos < run.end; ++pos) {
+            columns[i].Set(pos,
+                           chain.Get_AvoidUsingBecauseSlow(rows[pos].payload));
+          }
+        }
+        done.Notify();
+      });
+    }
+    done.Wait(runs.size());
+  }
+
+  // Merge the positions of the sorted rows pairwise until a single run is
+  // left. Each merge is itself split in morsels of its output which are
+  // merged in parallel: where each morsel starts in the two input runs is
+  // found with a binary search.
+  auto less = [&columns](uint32_t a, uint32_t b) {
+    for (const MergeColumn& col : columns) {
+      int cmp = col.Compare(a, b);
+      if (cmp != 0)
+        return col.desc ? cmp > 0 : cmp < 0;
+    }
+    return false;
+  };
+  std::vector<uint32_t> positions(count);
+  std::iota(positions.begin(), positions.end(), 0u);
+  std::vector<uint32_t> buffer(count);
+  uint32_t* src = positions.data();
+  uint32_t* dst = buffer.data();
+  while (runs.size() > 1) {
+    std::vector<Range> merged_runs;
+    base::WaitableEvent done;
+    uint32_t tasks = 0;
+    for (uint32_t i = 0; i < runs.size(); i += 2) {
+      if (i + 1 == runs.size()) {
+        // Odd run out: just carry it over to the next round.
+        const Range& run = runs[i];
+        std::copy(src + run.start, src + run.end, dst + run.start);
+        merged_runs.push_back(run);
+        continue;
+      }
+      const uint32_t* left = src + runs[i].start;
+      const uint32_t* right = src + runs[i + 1].start;
+      uint32_t left_size = runs[i].size();
+      uint32_t right_size = runs[i + 1].size();
+      uint32_t* out = dst + runs[i].start;
+      for (uint32_t start = 0; start < left_size + right_size;
+           start += kRowsPerMorsel) {
+        uint32_t end = std::min(left_size + right_size, start + kRowsPerMorsel);
+        pool->PostTask([=, &less, &done] {
+          uint32_t left_start =
+              MergePathSplit(start, left, left_size, right, right_size, less);
+          uint32_t left_end =
+              MergePathSplit(end, left, left_size, right, right_size, less);
+          // std::merge takes elements from the first range on ties, which
+          // keeps the sort stable.
+          std::merge(left + left_start, left + left_end,
+                     right + (start - left_start), right + (end - left_end),
+                     out + start, less);
+          done.Notify();
+        });
+        tasks++;
+      }
+      merged_runs.emplace_back(runs[i].start, runs[i + 1].end);
+    }
+    done.Wait(tasks);
+    runs = std::move(merged_runs);
+    std::swap(src, dst);
+  }
+
+  std::vector<SortToken> sorted(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    sorted[i] = rows[src[i]];
   }
+  rows = std::move(sorted);
 }
 
 void QueryExecutor::BoundedColumnFilterForTesting(
     const Constraint& c,
     const column::DataLayerChain& col,
     RowMap* rm) {
-  LinearSearch(c, col, rm);
+  LinearSearch(c, col, rm, nullptr);
 }
 
 void QueryExecutor::IndexedColumnFilterForTesting(
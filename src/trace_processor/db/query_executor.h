@@ -25,6 +25,10 @@
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/types.h"
 
+namespace perfetto::base {
+class ThreadPool;
+}  // namespace perfetto::base
+
 namespace perfetto::trace_processor {
 
 // Responsible for executing filtering/sorting operations on a single Table.
@@ -33,6 +37,11 @@ class QueryExecutor {
  public:
   static constexpr uint32_t kMaxOverlayCount = 8;
 
+  // Number of rows handled by a single task when filtering or sorting is
+  // split across a thread pool. Must be a multiple of the number of bits in a
+  // BitVector word so that the per-morsel results can be stitched together.
+  static constexpr uint32_t kRowsPerMorsel = 128 * 1024;
+
   // |row_count| is the size of the last overlay.
   QueryExecutor(const std::vector<column::DataLayerChain*>& columns,
                 uint32_t row_count)
@@ -42,7 +51,7 @@ class QueryExecutor {
   RowMap Filter(const std::vector<Constraint>& cs) {
     RowMap rm(0, row_count_);
     for (const auto& c : cs) {
-      FilterColumn(c, *columns_[c.col_idx], &rm);
+      FilterColumn(c, *columns_[c.col_idx], &rm, nullptr);
     }
     return rm;
   }
@@ -50,10 +59,24 @@ class QueryExecutor {
   // Enables QueryExecutor::Filter on Table columns.
   static RowMap FilterLegacy(const Table*, const std::vector<Constraint>&);
 
+  // Same as |FilterLegacy| above but only considers the rows in |rm| instead
+  // of all the rows of the table.
+  //
+  // If |pool| is not null, linear scans over large ranges of rows are split in
+  // morsels of |kRowsPerMorsel| rows which are searched in parallel.
+  static RowMap FilterLegacy(const Table*,
+                             const std::vector<Constraint>&,
+                             RowMap rm,
+                             base::ThreadPool* pool);
+
   // Enables QueryExecutor::Sort on Table columns.
+  //
+  // If |pool| is not null, large inputs are split in morsels of
+  // |kRowsPerMorsel| rows which are sorted in parallel and then merged.
   static void SortLegacy(const Table*,
                          const std::vector<Order>&,
-                         std::vector<uint32_t>&);
+                         std::vector<uint32_t>&,
+                         base::ThreadPool* pool);
 
   // Used only in unittests. Exposes private function.
   static void BoundedColumnFilterForTesting(const Constraint&,
@@ -69,13 +92,36 @@ class QueryExecutor {
   // Updates RowMap with result of filtering single column using the Constraint.
   static void FilterColumn(const Constraint&,
                            const column::DataLayerChain&,
-                           RowMap*);
+                           RowMap*,
+                           base::ThreadPool*);
 
   // Filters the column using Range algorithm - tries to find the smallest Range
   // to filter the storage with.
   static void LinearSearch(const Constraint&,
                            const column::DataLayerChain&,
-                           RowMap*);
+                           RowMap*,
+                           base::ThreadPool*);
+
+  // Searches |bounds| of |chain| by splitting it in morsels which are
+  // searched in parallel on |pool|.
+  static RangeOrBitVector ParallelSearch(const Constraint&,
+                                         const column::DataLayerChain&,
+                                         Range bounds,
+                                         base::ThreadPool* pool);
+
+  // Sorts |rows| with |ob| by sorting morsels in parallel on |pool| and
+  // merging the sorted morsels, also in parallel, on typed copies of the
+  // values of the order by columns.
+  static void ParallelSort(const Table*,
+                           const std::vector<Order>&,
+                           std::vector<column::DataLayerChain::SortToken>&,
+                           base::ThreadPool* pool);
+
+  // Stably sorts |rows| on all the columns in |ob|.
+  static void SortTokens(const Table*,
+                         const std::vector<Order>&,
+                         column::DataLayerChain::SortToken* begin,
+                         column::DataLayerChain::SortToken* end);
 
   // Filters the column using Index algorithm - finds the indices to filter the
   // storage with.
@@ -19,19 +19,25 @@
 #include <cstddef>
 #include <cstdint>
 #include <initializer_list>
+#include <memory>
 #include <optional>
+#include <random>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/base/test/utils.h"
 #include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column/numeric_storage.h"
 #include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/runtime_table.h"
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/tables/metadata_tables_py.h"
 #include "src/trace_processor/tables/profiler_tables_py.h"
@@ -231,6 +237,56 @@ struct HeapGraphObjectTableForBenchmark {
   HeapGraphObjectTable table_{&pool_};
 };
 
+// A table with random values, large enough to be split in many morsels when
+// it is filtered or sorted on a thread pool.
+class RandomTableForBenchmark {
+ public:
+  explicit RandomTableForBenchmark(benchmark::State& state) {
+    static constexpr uint32_t kRows = 8 * 1024 * 1024;
+    std::minstd_rand0 rnd_engine(0);
+    RuntimeTable::Builder builder(&pool_, {"value", "group", "name"});
+    for (uint32_t i = 0; i < kRows; ++i) {
+      if (!builder.AddInteger(0, rnd_engine() % (1024 * 1024)).ok() ||
+          !builder.AddInteger(1, rnd_engine() % 128).ok() ||
+          !builder
+               .AddText(2, ("name" + std::to_string(rnd_engine() % 1024)).c_str())
+               .ok()) {
+        state.SkipWithError("Failed to build the table");
+        return;
+      }
+    }
+    auto table = std::move(builder).Build(kRows);
+    if (!table.ok()) {
+      state.SkipWithError(table.status().c_message());
+      return;
+    }
+    table_ = std::move(*table);
+  }
+  StringPool pool_;
+  std::unique_ptr<RuntimeTable> table_;
+};
+
+// Runs |q| on a random table using a thread pool with state.range(0)
+// threads, or only the calling thread if it is 0.
+void BenchmarkRandomTableQuery(benchmark::State& state, const Query& q) {
+  RandomTableForBenchmark table(state);
+  if (!table.table_) {
+    return;
+  }
+  std::optional<base::ThreadPool> thread_pool;
+  if (state.range(0) > 0) {
+    thread_pool.emplace(static_cast<uint32_t>(state.range(0)));
+  }
+  base::ThreadPool* pool = thread_pool ? &*thread_pool : nullptr;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(table.table_->QueryToRowMap(q, pool));
+  }
+  state.counters["s/row"] =
+      benchmark::Counter(static_cast<double>(table.table_->row_count()),
+                         benchmark::Counter::kIsIterationInvariantRate |
+                             benchmark::Counter::kInvert);
+}
+
 void BenchmarkSliceTableFilter(benchmark::State& state,
                                SliceTableForBenchmark& table,
                                std::initializer_list<Constraint> c) {
@@ -249,6 +305,30 @@ void BenchmarkSliceTableFilter(benchmark::State& state,
           benchmark::Counter::kInvert);
 }
 
+// Benchmarks a full scan of a large, unsorted numeric column: this is the
+// shape of most filters on counter and sched tables.
+template <typename T>
+void BenchmarkNumericStorageSearch(benchmark::State& state,
+                                   ColumnType type,
+                                   FilterOp op,
+                                   SqlValue val) {
+  static constexpr uint32_t kSize = 16 * 1024 * 1024;
+  std::minstd_rand0 rnd_engine(0);
+  std::vector<T> data(kSize);
+  for (T& d : data) {
+    d = static_cast<T>(rnd_engine() % 1024);
+  }
+  column::NumericStorage<T> storage(&data, type, false);
+  auto chain = storage.MakeChain();
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(chain->Search(op, val, Range(0, kSize)));
+  }
+  state.counters["s/row"] = benchmark::Counter(
+      static_cast<double>(kSize), benchmark::Counter::kIsIterationInvariantRate |
+                                      benchmark::Counter::kInvert);
+}
+
 void BenchmarkSliceTableSort(benchmark::State& state,
                              SliceTableForBenchmark& table,
                              std::initializer_list<Order> ob) {
@@ -678,5 +758,66 @@ void BM_QEMax(benchmark::State& state) {
 }
 BENCHMARK(BM_QEMax);
 
+void BM_QENumericStorageSearchInt64Eq(benchmark::State& state) {
+  BenchmarkNumericStorageSearch<int64_t>(state, ColumnType::kInt64,
+                                         FilterOp::kEq, SqlValue::Long(512));
+}
+BENCHMARK(BM_QENumericStorageSearchInt64Eq);
+
+void BM_QENumericStorageSearchInt64Gt(benchmark::State& state) {
+  BenchmarkNumericStorageSearch<int64_t>(state, ColumnType::kInt64,
+                                         FilterOp::kGt, SqlValue::Long(512));
+}
+BENCHMARK(BM_QENumericStorageSearchInt64Gt);
+
+void BM_QENumericStorageSearchUint32Le(benchmark::State& state) {
+  BenchmarkNumericStorageSearch<uint32_t>(state, ColumnType::kUint32,
+                                          FilterOp::kLe, SqlValue::Long(512));
+}
+BENCHMARK(BM_QENumericStorageSearchUint32Le);
+
+void BM_QENumericStorageSearchInt32Ne(benchmark::State& state) {
+  BenchmarkNumericStorageSearch<int32_t>(state, ColumnType::kInt32,
+                                         FilterOp::kNe, SqlValue::Long(512));
+}
+BENCHMARK(BM_QENumericStorageSearchInt32Ne);
+
+void BM_QENumericStorageSearchDoubleLt(benchmark::State& state) {
+  BenchmarkNumericStorageSearch<double>(state, ColumnType::kDouble,
+                                        FilterOp::kLt, SqlValue::Double(512.5));
+}
+BENCHMARK(BM_QENumericStorageSearchDoubleLt);
+
+void BM_QEParallelFilter(benchmark::State& state) {
+  Query q;
+  q.constraints = {{0, FilterOp::kLt, SqlValue::Long(512 * 1024)}};
+  BenchmarkRandomTableQuery(state, q);
+}
+BENCHMARK(BM_QEParallelFilter)->Arg(0)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+void BM_QEParallelSortNumeric(benchmark::State& state) {
+  Query q;
+  q.orders = {{1, false}, {0, true}};
+  BenchmarkRandomTableQuery(state, q);
+}
+BENCHMARK(BM_QEParallelSortNumeric)
+    ->Arg(0)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime();
+
+void BM_QEParallelSortString(benchmark::State& state) {
+  Query q;
+  q.orders = {{2, false}};
+  BenchmarkRandomTableQuery(state, q);
+}
+BENCHMARK(BM_QEParallelSortString)
+    ->Arg(0)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime();
+
 }  // namespace
 }  // namespace perfetto::trace_processor
@@ -24,7 +24,9 @@
 #include <vector>
 
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/trace_processor/basic_types.h"
+#include "src/base/test/status_matchers.h"
 #include "src/trace_processor/containers/bit_vector.h"
 #include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/containers/string_pool.h"
@@ -38,6 +40,8 @@
 #include "src/trace_processor/db/column/set_id_storage.h"
 #include "src/trace_processor/db/column/string_storage.h"
 #include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "src/trace_processor/db/table.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto::trace_processor {
@@ -680,5 +684,46 @@ TEST(QueryExecutor, StringBinarySearchRegexWithNum) {
 }
 #endif
 
+TEST(QueryExecutor, ParallelFilterAndSortMatchSerial) {
+  // Enough rows for the table to be split in several morsels, the last of
+  // which is not full.
+  constexpr uint32_t kRows = 3 * QueryExecutor::kRowsPerMorsel + 1234;
+
+  StringPool pool;
+  RuntimeTable::Builder builder(&pool, {"sorted", "mod", "nullable", "str"});
+  for (uint32_t i = 0; i < kRows; ++i) {
+    ASSERT_OK(builder.AddInteger(0, i));
+    ASSERT_OK(builder.AddInteger(1, (i * 7919) % 1000));
+    if (i % 7 == 0) {
+      ASSERT_OK(builder.AddNull(2));
+    } else {
+      ASSERT_OK(builder.AddFloat(2, static_cast<double>(i % 13) / 2));
+    }
+    ASSERT_OK(builder.AddText(3, ("s" + std::to_string(i % 97)).c_str()));
+  }
+  ASSERT_OK_AND_ASSIGN(auto table, std::move(builder).Build(kRows));
+
+  std::vector<Query> queries(8);
+  queries[0].constraints = {{1, FilterOp::kLt, SqlValue::Long(500)}};
+  queries[1].constraints = {{0, FilterOp::kGe, SqlValue::Long(1000)},
+                            {0, FilterOp::kLt, SqlValue::Long(kRows - 10)}};
+  queries[2].constraints = {{2, FilterOp::kIsNull, SqlValue()},
+                            {1, FilterOp::kGt, SqlValue::Long(10)}};
+  queries[3].constraints = {{0, FilterOp::kGt, SqlValue::Long(kRows)}};
+  queries[4].orders = {{1, false}};
+  queries[5].constraints = {{1, FilterOp::kNe, SqlValue::Long(3)}};
+  queries[5].orders = {{2, true}, {1, false}};
+  queries[6].orders = {{3, false}};
+  queries[7].orders = {{3, true}, {2, false}};
+
+  base::ThreadPool thread_pool(4);
+  for (const Query& q : queries) {
+    RowMap serial = table->QueryToRowMap(q);
+    RowMap parallel = table->QueryToRowMap(q, &thread_pool);
+    ASSERT_EQ(std::move(parallel).TakeAsIndexVector(),
+              std::move(serial).TakeAsIndexVector());
+  }
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor
@@ -129,7 +129,7 @@ void CreateNonNullableIntsColumn(
 
   legacy_columns.emplace_back(col_name, ints_storage, flags, col_idx, 0);
   storage_layers[col_idx].reset(new column::NumericStorage<int64_t>(
-      &values, ColumnType::kInt64, is_sorted));
+      &values, ColumnType::kInt64, is_sorted, &ints_storage->zone_map()));
 }
 
 }  // namespace
@@ -287,7 +287,8 @@ base::StatusOr<std::unique_ptr<RuntimeTable>> RuntimeTable::Builder::Build(
         legacy_columns.emplace_back(col_names_[i].c_str(), ints,
                                     ColumnLegacy::Flag::kNoFlag, i, 0);
         storage_layers[i].reset(new column::NumericStorage<int64_t>(
-            &ints->non_null_vector(), ColumnType::kInt64, false));
+            &ints->non_null_vector(), ColumnType::kInt64, false,
+            &ints->zone_map()));
         null_layers[i].reset(
             new column::NullOverlay(&ints->non_null_bit_vector()));
       }
@@ -309,14 +310,16 @@ base::StatusOr<std::unique_ptr<RuntimeTable>> RuntimeTable::Builder::Build(
         legacy_columns.emplace_back(col_names_[i].c_str(), non_null_doubles,
                                     flags, i, 0);
         storage_layers[i].reset(new column::NumericStorage<double>(
-            &non_null_doubles->vector(), ColumnType::kDouble, is_sorted));
+            &non_null_doubles->vector(), ColumnType::kDouble, is_sorted,
+            &non_null_doubles->zone_map()));
 
       } else {
         // The column is nullable.
         legacy_columns.emplace_back(col_names_[i].c_str(), doubles,
                                     ColumnLegacy::Flag::kNoFlag, i, 0);
         storage_layers[i].reset(new column::NumericStorage<double>(
-            &doubles->non_null_vector(), ColumnType::kDouble, false));
+            &doubles->non_null_vector(), ColumnType::kDouble, false,
+            &doubles->zone_map()));
         null_layers[i].reset(
             new column::NullOverlay(&doubles->non_null_bit_vector()));
       }
@@ -16,12 +16,16 @@
 
 #include "src/trace_processor/db/runtime_table.h"
 
+#include <cstdint>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "src/base/test/status_matchers.h"
+#include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column/types.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto::trace_processor {
@@ -62,5 +66,161 @@ TEST_F(RuntimeTableTest, IntThenDouble) {
   ASSERT_EQ(col.Get(1).AsDouble(), 1.3);
 }
 
+TEST(RuntimeTableIndexTest, FilterUsingIndex) {
+  StringPool pool;
+  RuntimeTable::Builder builder(&pool, {"a", "b", "c"});
+  // Rows: (a, b, c) = (i % 3, i % 5, i).
+  constexpr uint32_t kRows = 100;
+  for (uint32_t i = 0; i < kRows; ++i) {
+    ASSERT_OK(builder.AddInteger(0, i % 3));
+    ASSERT_OK(builder.AddInteger(1, i % 5));
+    ASSERT_OK(builder.AddInteger(2, i));
+  }
+  ASSERT_OK_AND_ASSIGN(auto table, std::move(builder).Build(kRows));
+
+  std::vector<std::vector<Constraint>> queries = {
+      {{0, FilterOp::kEq, SqlValue::Long(1)}},
+      {{0, FilterOp::kEq, SqlValue::Long(1)},
+       {1, FilterOp::kEq, SqlValue::Long(2)}},
+      {{1, FilterOp::kGt, SqlValue::Long(1)},
+       {0, FilterOp::kEq, SqlValue::Long(2)},
+       {1, FilterOp::kLe, SqlValue::Long(3)}},
+      {{0, FilterOp::kEq, SqlValue::Long(0)},
+       {2, FilterOp::kLt, SqlValue::Long(50)}},
+      {{1, FilterOp::kEq, SqlValue::Long(4)}},
+  };
+  std::vector<std::vector<uint32_t>> expected;
+  for (const auto& cs : queries) {
+    Query q;
+    q.constraints = cs;
+    RowMap rm = table->QueryToRowMap(q);
+    expected.push_back(std::move(rm).TakeAsIndexVector());
+  }
+
+  ASSERT_OK(table->CreateIndex("idx", {0, 1}, false));
+  ASSERT_THAT(table->CreateIndex("idx", {0}, false), Not(IsOk()));
+  for (uint32_t i = 0; i < queries.size(); ++i) {
+    Query q;
+    q.constraints = queries[i];
+    RowMap rm = table->QueryToRowMap(q);
+    ASSERT_EQ(std::move(rm).TakeAsIndexVector(), expected[i]);
+  }
+
+  ASSERT_OK(table->DropIndex("idx"));
+  ASSERT_THAT(table->DropIndex("idx"), Not(IsOk()));
+}
+
+TEST(RuntimeTableIndexTest, FilterUsingHashIndex) {
+  StringPool pool;
+  RuntimeTable::Builder builder(&pool, {"a", "b", "c"});
+  // Rows: (a, b, c) = (i % 7 or NULL, "s" + i % 4, i / 2).
+  constexpr uint32_t kRows = 100;
+  for (uint32_t i = 0; i < kRows; ++i) {
+    if (i % 10 == 0) {
+      ASSERT_OK(builder.AddNull(0));
+    } else {
+      ASSERT_OK(builder.AddInteger(0, i % 7));
+    }
+    ASSERT_OK(builder.AddText(1, ("s" + std::to_string(i % 4)).c_str()));
+    ASSERT_OK(builder.AddFloat(2, i / 2.0));
+  }
+  ASSERT_OK_AND_ASSIGN(auto table, std::move(builder).Build(kRows));
+
+  std::vector<std::vector<Constraint>> queries = {
+      {{0, FilterOp::kEq, SqlValue::Long(3)}},
+      {{0, FilterOp::kEq, SqlValue::Double(3.0)}},
+      {{0, FilterOp::kEq, SqlValue::Double(3.5)}},
+      {{0, FilterOp::kEq, SqlValue::Long(42)}},
+      {{1, FilterOp::kEq, SqlValue::String("s2")}},
+      {{1, FilterOp::kEq, SqlValue::String("missing")}},
+      {{1, FilterOp::kEq, SqlValue::String("s1")},
+       {0, FilterOp::kEq, SqlValue::Long(5)}},
+      {{2, FilterOp::kGt, SqlValue::Double(10)},
+       {0, FilterOp::kEq, SqlValue::Long(1)},
+       {2, FilterOp::kLe, SqlValue::Double(40)}},
+  };
+  std::vector<std::vector<uint32_t>> expected;
+  for (const auto& cs : queries) {
+    Query q;
+    q.constraints = cs;
+    RowMap rm = table->QueryToRowMap(q);
+    expected.push_back(std::move(rm).TakeAsIndexVector());
+  }
+
+  ASSERT_TRUE(table->CreateHashIndex(0));
+  ASSERT_TRUE(table->CreateHashIndex(1));
+  ASSERT_FALSE(table->CreateHashIndex(2));
+  for (uint32_t i = 0; i < queries.size(); ++i) {
+    Query q;
+    q.constraints = queries[i];
+    RowMap rm = table->QueryToRowMap(q);
+    ASSERT_EQ(std::move(rm).TakeAsIndexVector(), expected[i]);
+  }
+}
+
+TEST(RuntimeTableIndexTest, HashIndexesEvicted) {
+  StringPool pool;
+  constexpr uint32_t kCols = Table::kMaxHashIndexes + 2;
+  std::vector<std::string> names;
+  for (uint32_t col = 0; col < kCols; ++col) {
+    names.push_back("c" + std::to_string(col));
+  }
+  RuntimeTable::Builder builder(&pool, names);
+  constexpr uint32_t kRows = 50;
+  for (uint32_t i = 0; i < kRows; ++i) {
+    for (uint32_t col = 0; col < kCols; ++col) {
+      ASSERT_OK(builder.AddInteger(col, i % (col + 2)));
+    }
+  }
+  ASSERT_OK_AND_ASSIGN(auto table, std::move(builder).Build(kRows));
+
+  // Creating more hash indexes than the table keeps evicts the older ones:
+  // queries on all the columns must still be answered correctly.
+  for (uint32_t col = 0; col < kCols; ++col) {
+    Query q;
+    q.constraints = {{col, FilterOp::kEq, SqlValue::Long(1)}};
+    RowMap expected = table->QueryToRowMap(q);
+    ASSERT_TRUE(table->CreateHashIndex(col));
+    ASSERT_EQ(table->QueryToRowMap(q).TakeAsIndexVector(),
+              std::move(expected).TakeAsIndexVector());
+  }
+  for (uint32_t col = 0; col < kCols; ++col) {
+    Query q;
+    q.constraints = {{col, FilterOp::kEq, SqlValue::Long(1)}};
+    ASSERT_EQ(table->QueryToRowMap(q).size(), (kRows + col) / (col + 2));
+  }
+}
+
+TEST(RuntimeTableIndexTest, HashIndexesDroppedWhenReleased) {
+  StringPool pool;
+  RuntimeTable::Builder builder(&pool, {"a"});
+  constexpr uint32_t kRows = 50;
+  for (uint32_t i = 0; i < kRows; ++i) {
+    ASSERT_OK(builder.AddInteger(0, i % 5));
+  }
+  ASSERT_OK_AND_ASSIGN(auto table, std::move(builder).Build(kRows));
+
+  // The index is shared by its users and dropped when the last one releases
+  // it.
+  std::optional<uint64_t> first = table->CreateHashIndex(0);
+  std::optional<uint64_t> second = table->CreateHashIndex(0);
+  ASSERT_TRUE(first);
+  ASSERT_EQ(first, second);
+  ASSERT_EQ(table->hash_index_count(), 1u);
+  table->ReleaseHashIndex(*first);
+  ASSERT_EQ(table->hash_index_count(), 1u);
+  table->ReleaseHashIndex(*second);
+  ASSERT_EQ(table->hash_index_count(), 0u);
+
+  // Releasing an index which was already dropped does nothing.
+  std::optional<uint64_t> third = table->CreateHashIndex(0);
+  ASSERT_TRUE(third);
+  ASSERT_NE(third, first);
+  table->ReleaseHashIndex(*first);
+  ASSERT_EQ(table->hash_index_count(), 1u);
+  table->ReleaseHashIndex(*third);
+  ASSERT_EQ(table->hash_index_count(), 0u);
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor
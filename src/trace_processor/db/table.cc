@@ -18,30 +18,334 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+#include "perfetto/protozero/field.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/public/compiler.h"
 #include "perfetto/trace_processor/ref_counted.h"
+#include "src/trace_processor/containers/bit_vector.h"
 #include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/db/column.h"
 #include "src/trace_processor/db/column/arrangement_overlay.h"
 #include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/dense_null_overlay.h"
+#include "src/trace_processor/db/column/null_overlay.h"
+#include "src/trace_processor/db/column/numeric_storage.h"
 #include "src/trace_processor/db/column/range_overlay.h"
 #include "src/trace_processor/db/column/selector_overlay.h"
+#include "src/trace_processor/db/column/set_id_storage.h"
+#include "src/trace_processor/db/column/string_storage.h"
 #include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/column_storage.h"
 #include "src/trace_processor/db/column_storage_overlay.h"
 #include "src/trace_processor/db/query_executor.h"
 
+#include "protos/perfetto/trace_processor/serialization.pbzero.h"
+
 namespace perfetto::trace_processor {
 
 namespace {
 using Indices = column::DataLayerChain::Indices;
+
+constexpr uint32_t kNoGroup = std::numeric_limits<uint32_t>::max();
+
+bool IsHashIndexSupported(const ColumnLegacy& col) {
+  switch (col.col_type()) {
+    case ColumnType::kInt32:
+    case ColumnType::kUint32:
+    case ColumnType::kInt64:
+    case ColumnType::kString:
+      return true;
+    case ColumnType::kId:
+    case ColumnType::kDouble:
+    case ColumnType::kDummy:
+      return false;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+// Returns the key of the value of |col| at |row| in a hash index or
+// std::nullopt if the value is null.
+std::optional<int64_t> HashKeyForRow(const ColumnLegacy& col, uint32_t row) {
+  if (col.col_type() == ColumnType::kString) {
+    StringPool::Id id =
+        col.storage<StringPool::Id>().Get(col.overlay().Get(row));
+    return id.is_null() ? std::nullopt
+                        : std::make_optional<int64_t>(id.raw_id());
+  }
+  SqlValue value = col.Get(row);
+  return value.is_null() ? std::nullopt
+                         : std::make_optional(value.long_value);
+}
+
+// Computes the key of |value| in a hash index on |col|: |key| is set to
+// std::nullopt if no row can be equal to |value|. Returns false if |value|
+// cannot be looked up in the index.
+bool HashKeyForValue(const ColumnLegacy& col,
+                     const StringPool& pool,
+                     const SqlValue& value,
+                     std::optional<int64_t>* key) {
+  if (col.col_type() == ColumnType::kString) {
+    if (value.type != SqlValue::kString) {
+      return false;
+    }
+    std::optional<StringPool::Id> id = pool.GetId(value.string_value);
+    *key = id ? std::make_optional<int64_t>(id->raw_id()) : std::nullopt;
+    return true;
+  }
+  switch (value.type) {
+    case SqlValue::kLong:
+      *key = value.long_value;
+      return true;
+    case SqlValue::kDouble: {
+      // Only integral doubles can be equal to an integer.
+      double d = value.double_value;
+      bool is_integral = d >= -9223372036854775808.0 &&
+                         d < 9223372036854775808.0 &&
+                         static_cast<double>(static_cast<int64_t>(d)) == d;
+      *key = is_integral ? std::make_optional(static_cast<int64_t>(d))
+                         : std::nullopt;
+      return true;
+    }
+    case SqlValue::kNull:
+    case SqlValue::kString:
+    case SqlValue::kBytes:
+      return false;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+using StorageProto = protos::pbzero::SerializedColumn::Storage;
+
+// Serializes |values| (and |non_null| for nullable columns) as the storage of
+// rows of |col| using the data layers which store such columns.
+template <typename T>
+void SerializeValues(const ColumnLegacy& col,
+                     StringPool* pool,
+                     const std::vector<T>& values,
+                     const BitVector* non_null,
+                     StorageProto* msg) {
+  std::unique_ptr<column::DataLayerChain> chain;
+  if constexpr (std::is_same_v<T, StringPool::Id>) {
+    chain = column::StringStorage(pool, &values, col.IsSorted()).MakeChain();
+  } else {
+    if constexpr (std::is_same_v<T, uint32_t>) {
+      if (col.IsSetId()) {
+        chain = column::SetIdStorage(&values).MakeChain();
+      }
+    }
+    if (!chain) {
+      chain = column::NumericStorage<T>(&values, col.col_type(), col.IsSorted())
+                  .MakeChain();
+    }
+  }
+  if (non_null) {
+    chain = col.IsDense()
+                ? column::DenseNullOverlay(non_null).MakeChain(std::move(chain))
+                : column::NullOverlay(non_null).MakeChain(std::move(chain));
+  }
+  chain->Serialize(msg);
+}
+
+template <typename T>
+void SerializeRows(const ColumnLegacy& col,
+                   StringPool* pool,
+                   const ColumnStorage<T>& storage,
+                   uint32_t start,
+                   uint32_t end,
+                   StorageProto* msg) {
+  std::vector<T> values;
+  if (storage.encoding() == ColumnEncoding::kPlain) {
+    values.assign(storage.vector().begin() + start,
+                  storage.vector().begin() + end);
+  } else {
+    values.reserve(end - start);
+    for (uint32_t i = start; i < end; ++i) {
+      values.push_back(storage.Get(i));
+    }
+  }
+  SerializeValues(col, pool, values, nullptr, msg);
+}
+
+template <typename T>
+void SerializeRows(const ColumnLegacy& col,
+                   StringPool* pool,
+                   const ColumnStorage<std::optional<T>>& storage,
+                   uint32_t start,
+                   uint32_t end,
+                   StorageProto* msg) {
+  const BitVector& valid = storage.non_null_bit_vector();
+  BitVector non_null;
+  for (uint32_t i = start; i < end; ++i) {
+    if (valid.IsSet(i)) {
+      non_null.AppendTrue();
+    } else {
+      non_null.AppendFalse();
+    }
+  }
+  // Dense storage has a value for every row, sparse storage only for the
+  // non-null ones.
+  uint32_t values_start = storage.IsDense() ? start : valid.CountSetBits(start);
+  uint32_t values_end = storage.IsDense() ? end : valid.CountSetBits(end);
+  std::vector<T> values(storage.non_null_vector().begin() + values_start,
+                        storage.non_null_vector().begin() + values_end);
+  SerializeValues(col, pool, values, &non_null, msg);
+}
+
+// Serializes the rows [start, end) of the storage of |col|.
+void SerializeColumnRows(const ColumnLegacy& col,
+                         StringPool* pool,
+                         uint32_t start,
+                         uint32_t end,
+                         StorageProto* msg) {
+  switch (col.col_type()) {
+    case ColumnType::kInt32:
+      if (col.IsNullable()) {
+        SerializeRows(col, pool, col.storage<std::optional<int32_t>>(), start,
+                      end, msg);
+      } else {
+        SerializeRows(col, pool, col.storage<int32_t>(), start, end, msg);
+      }
+      return;
+    case ColumnType::kUint32:
+      if (col.IsNullable()) {
+        SerializeRows(col, pool, col.storage<std::optional<uint32_t>>(), start,
+                      end, msg);
+      } else {
+        SerializeRows(col, pool, col.storage<uint32_t>(), start, end, msg);
+      }
+      return;
+    case ColumnType::kInt64:
+      if (col.IsNullable()) {
+        SerializeRows(col, pool, col.storage<std::optional<int64_t>>(), start,
+                      end, msg);
+      } else {
+        SerializeRows(col, pool, col.storage<int64_t>(), start, end, msg);
+      }
+      return;
+    case ColumnType::kDouble:
+      if (col.IsNullable()) {
+        SerializeRows(col, pool, col.storage<std::optional<double>>(), start,
+                      end, msg);
+      } else {
+        SerializeRows(col, pool, col.storage<double>(), start, end, msg);
+      }
+      return;
+    case ColumnType::kString:
+      SerializeRows(col, pool, col.storage<StringPool::Id>(), start, end, msg);
+      return;
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("Id and dummy columns have no storage");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+// Returns the values stored in the innermost data layer of |msg|, serialized
+// by |SerializeValues| for a column like |col|. Returns std::nullopt if |msg|
+// is not such a data layer.
+template <typename T>
+std::optional<protozero::ConstBytes> ValuesOf(const ColumnLegacy& col,
+                                              const StorageProto::Decoder& msg) {
+  if constexpr (std::is_same_v<T, StringPool::Id>) {
+    if (!msg.has_string_storage()) {
+      return std::nullopt;
+    }
+    return StorageProto::StringStorage::Decoder(msg.string_storage()).values();
+  } else {
+    if (col.IsSetId()) {
+      if (!msg.has_set_id_storage()) {
+        return std::nullopt;
+      }
+      return StorageProto::SetIdStorage::Decoder(msg.set_id_storage()).values();
+    }
+    if (!msg.has_numeric_storage()) {
+      return std::nullopt;
+    }
+    StorageProto::NumericStorage::Decoder numeric(msg.numeric_storage());
+    if (numeric.column_type() != static_cast<uint32_t>(col.col_type())) {
+      return std::nullopt;
+    }
+    return numeric.values();
+  }
+}
+
+// Returns the |i|th value of |values|. The serialized values are not
+// guaranteed to be aligned so they are copied out.
+template <typename T>
+T ValueAt(protozero::ConstBytes values, uint32_t i) {
+  T value;
+  memcpy(&value, values.data + sizeof(T) * i, sizeof(T));
+  return value;
 }
 
+// Appends the rows serialized in |msg| by |SerializeRows| to |storage|.
+// Returns the number of rows appended or std::nullopt if |msg| does not
+// contain rows of |col|.
+template <typename T>
+std::optional<uint32_t> AppendRows(const ColumnLegacy& col,
+                                   const StorageProto::Decoder& msg,
+                                   ColumnStorage<T>* storage) {
+  std::optional<protozero::ConstBytes> values = ValuesOf<T>(col, msg);
+  if (!values || values->size % sizeof(T) != 0) {
+    return std::nullopt;
+  }
+  auto count = static_cast<uint32_t>(values->size / sizeof(T));
+  for (uint32_t i = 0; i < count; ++i) {
+    storage->Append(ValueAt<T>(*values, i));
+  }
+  return count;
+}
+
+template <typename T>
+std::optional<uint32_t> AppendRows(const ColumnLegacy& col,
+                                   const StorageProto::Decoder& msg,
+                                   ColumnStorage<std::optional<T>>* storage) {
+  if (col.IsDense() ? !msg.has_dense_null_overlay() : !msg.has_null_overlay()) {
+    return std::nullopt;
+  }
+  // NullOverlay and DenseNullOverlay have the same schema.
+  StorageProto::NullOverlay::Decoder overlay(
+      col.IsDense() ? msg.dense_null_overlay() : msg.null_overlay());
+  BitVector non_null;
+  if (!non_null.Deserialize(protos::pbzero::SerializedColumn::BitVector::Decoder(
+          overlay.bit_vector()))) {
+    return std::nullopt;
+  }
+  std::optional<protozero::ConstBytes> values =
+      ValuesOf<T>(col, StorageProto::Decoder(overlay.storage()));
+  uint32_t value_count = col.IsDense() ? non_null.size() : non_null.CountSetBits();
+  if (!values || values->size != sizeof(T) * value_count) {
+    return std::nullopt;
+  }
+  for (uint32_t i = 0, value = 0; i < non_null.size(); ++i) {
+    if (non_null.IsSet(i)) {
+      storage->Append(std::make_optional(ValueAt<T>(*values, value++)));
+    } else {
+      storage->Append(std::optional<T>());
+      if (col.IsDense()) {
+        // Dense storage also has a (meaningless) value for null rows.
+        value++;
+      }
+    }
+  }
+  return non_null.size();
+}
+
+}  // namespace
+
 Table::Table(StringPool* pool,
              uint32_t row_count,
              std::vector<ColumnLegacy> columns,
@@ -66,6 +370,9 @@ Table& Table::operator=(Table&& other) noexcept {
   null_layers_ = std::move(other.null_layers_);
   overlay_layers_ = std::move(other.overlay_layers_);
   chains_ = std::move(other.chains_);
+  indexes_ = std::move(other.indexes_);
+  hash_indexes_ = std::move(other.hash_indexes_);
+  hash_index_uses_ = other.hash_index_uses_;
 
   for (ColumnLegacy& col : columns_) {
     col.table_ = this;
@@ -91,7 +398,177 @@ Table Table::CopyExceptOverlays() const {
   return {string_pool_, row_count_, std::move(cols), {}};
 }
 
-RowMap Table::QueryToRowMap(const Query& q) const {
+void Table::Serialize(
+    const std::string& table_name,
+    uint32_t rows_per_chunk,
+    const std::function<void(std::vector<uint8_t>)>& write_packet) const {
+  PERFETTO_CHECK(rows_per_chunk > 0);
+  {
+    protozero::HeapBuffered<protos::pbzero::SerializedTraceProcessorPacket>
+        packet;
+    auto* table = packet->set_table();
+    table->set_table_name(table_name);
+    table->set_row_count(row_count_);
+
+    // The overlays are the ones of tables built with their regular
+    // constructor: one selecting the rows of each ancestor table and the
+    // identity for the rows of this table.
+    const RowMap& own_rows = overlays_.back().row_map();
+    PERFETTO_CHECK(own_rows.IsRange() && own_rows.GetIfIRange()->start == 0 &&
+                   own_rows.size() == row_count_);
+    for (uint32_t i = 0; i < overlays_.size() - 1; ++i) {
+      PERFETTO_CHECK(overlays_[i].row_map().IsBitVector());
+      overlays_[i].row_map().GetIfBitVector()->Serialize(
+          table->add_parent_overlays());
+    }
+    write_packet(packet.SerializeAsArray());
+  }
+
+  auto own_overlay = static_cast<uint32_t>(overlays_.size() - 1);
+  for (const ColumnLegacy& col : columns_) {
+    if (col.overlay_index() != own_overlay || col.IsId() || col.IsDummy()) {
+      continue;
+    }
+    for (uint32_t start = 0; start < row_count_; start += rows_per_chunk) {
+      uint32_t end = start + std::min(rows_per_chunk, row_count_ - start);
+      protozero::HeapBuffered<protos::pbzero::SerializedTraceProcessorPacket>
+          packet;
+      auto* column = packet->set_column();
+      column->set_table_name(table_name);
+      column->set_column_name(col.name());
+      column->set_first_row(start);
+      SerializeColumnRows(col, string_pool_, start, end,
+                          column->set_storage());
+      write_packet(packet.SerializeAsArray());
+    }
+  }
+}
+
+template <typename Fn>
+void Table::VisitMutableStorage(ColumnLegacy* col, Fn fn) {
+  switch (col->col_type()) {
+    case ColumnType::kInt32:
+      if (col->IsNullable()) {
+        fn(col->mutable_storage<std::optional<int32_t>>());
+      } else {
+        fn(col->mutable_storage<int32_t>());
+      }
+      return;
+    case ColumnType::kUint32:
+      if (col->IsNullable()) {
+        fn(col->mutable_storage<std::optional<uint32_t>>());
+      } else {
+        fn(col->mutable_storage<uint32_t>());
+      }
+      return;
+    case ColumnType::kInt64:
+      if (col->IsNullable()) {
+        fn(col->mutable_storage<std::optional<int64_t>>());
+      } else {
+        fn(col->mutable_storage<int64_t>());
+      }
+      return;
+    case ColumnType::kDouble:
+      if (col->IsNullable()) {
+        fn(col->mutable_storage<std::optional<double>>());
+      } else {
+        fn(col->mutable_storage<double>());
+      }
+      return;
+    case ColumnType::kString:
+      fn(col->mutable_storage<StringPool::Id>());
+      return;
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("Id and dummy columns have no storage");
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+base::Status Table::Deserialize(
+    protozero::ConstBytes table_bytes,
+    const std::vector<protozero::ConstBytes>& columns) {
+  protos::pbzero::SerializedTable::Decoder table(table_bytes);
+  uint32_t row_count = table.row_count();
+
+  std::vector<BitVector> parent_overlays;
+  for (auto it = table.parent_overlays(); it; ++it) {
+    BitVector parent_rows;
+    if (!parent_rows.Deserialize(
+            protos::pbzero::SerializedColumn::BitVector::Decoder(*it)) ||
+        parent_rows.CountSetBits() != row_count) {
+      return base::ErrStatus("Invalid parent rows");
+    }
+    parent_overlays.push_back(std::move(parent_rows));
+  }
+  if (parent_overlays.size() != overlays_.size() - 1) {
+    return base::ErrStatus("Mismatched number of parent tables");
+  }
+  // The parent tables must have been restored first: the rows selected from
+  // them need to exist.
+  for (const ColumnLegacy& col : columns_) {
+    uint32_t overlay = col.overlay_index();
+    if (overlay < parent_overlays.size() && !col.IsId() && !col.IsDummy() &&
+        parent_overlays[overlay].size() > col.storage_base().size()) {
+      return base::ErrStatus("Parent rows missing for column %s", col.name());
+    }
+  }
+
+  auto own_overlay = static_cast<uint32_t>(overlays_.size() - 1);
+  auto is_stored = [own_overlay](const ColumnLegacy& col) {
+    return col.overlay_index() == own_overlay && !col.IsId() && !col.IsDummy();
+  };
+  for (ColumnLegacy& col : columns_) {
+    if (is_stored(col)) {
+      VisitMutableStorage(&col, [](auto* storage) { storage->Clear(); });
+    }
+  }
+
+  for (protozero::ConstBytes column_bytes : columns) {
+    protos::pbzero::SerializedColumn::Decoder column(column_bytes);
+    std::string name = column.column_name().ToStdString();
+    auto it = std::find_if(
+        columns_.begin(), columns_.end(), [&](const ColumnLegacy& col) {
+          return is_stored(col) && name == col.name();
+        });
+    if (it == columns_.end()) {
+      return base::ErrStatus("Unknown column %s", name.c_str());
+    }
+    // Chunks must be in order.
+    if (column.first_row() != it->storage_base().size()) {
+      return base::ErrStatus("Missing rows in column %s", it->name());
+    }
+    StorageProto::Decoder storage(column.storage());
+    std::optional<uint32_t> rows;
+    VisitMutableStorage(&*it, [&](auto* typed_storage) {
+      rows = AppendRows(*it, storage, typed_storage);
+    });
+    if (!rows) {
+      return base::ErrStatus("Invalid storage for column %s", it->name());
+    }
+  }
+  for (const ColumnLegacy& col : columns_) {
+    if (is_stored(col) && col.storage_base().size() != row_count) {
+      return base::ErrStatus("Invalid number of rows in column %s", col.name());
+    }
+  }
+
+  row_count_ = row_count;
+  for (uint32_t i = 0; i < parent_overlays.size(); ++i) {
+    overlays_[i] = ColumnStorageOverlay(std::move(parent_overlays[i]));
+    overlay_layers_[i].reset(
+        new column::SelectorOverlay(overlays_[i].row_map().GetIfBitVector()));
+  }
+  overlays_.back() = ColumnStorageOverlay(row_count_);
+
+  // Chains and indexes refer to the previous contents of the table.
+  chains_.clear();
+  indexes_.clear();
+  hash_indexes_.clear();
+  return base::OkStatus();
+}
+
+RowMap Table::QueryToRowMap(const Query& q, base::ThreadPool* pool) const {
   // We need to delay creation of the chains to this point because of Chrome
   // does not want the binary size overhead of including the chain
   // implementations. As they also don't query tables (instead just iterating)
@@ -105,7 +582,16 @@ RowMap Table::QueryToRowMap(const Query& q) const {
   }
 
   // Apply the query constraints.
-  RowMap rm = QueryExecutor::FilterLegacy(this, q.constraints);
+  std::optional<RowMap> index_rm;
+  if (PERFETTO_UNLIKELY(!hash_indexes_.empty())) {
+    index_rm = FilterUsingHashIndex(q.constraints, pool);
+  }
+  if (PERFETTO_UNLIKELY(!index_rm && !indexes_.empty())) {
+    index_rm = FilterUsingIndex(q.constraints, pool);
+  }
+  RowMap rm = index_rm ? std::move(*index_rm)
+                       : QueryExecutor::FilterLegacy(
+                             this, q.constraints, RowMap(0, row_count()), pool);
 
   if (q.order_type != Query::OrderType::kSort) {
     ApplyDistinct(q, &rm);
@@ -134,7 +620,7 @@ RowMap Table::QueryToRowMap(const Query& q) const {
   }
 
   if (q.order_type != Query::OrderType::kDistinct && !q.orders.empty()) {
-    ApplySort(q, &rm);
+    ApplySort(q, &rm, pool);
   }
 
   if (!q.limit.has_value() && q.offset == 0) {
@@ -151,7 +637,7 @@ RowMap Table::QueryToRowMap(const Query& q) const {
   return rm.SelectRows(RowMap(start, end));
 }
 
-Table Table::Sort(const std::vector<Order>& ob) const {
+Table Table::Sort(const std::vector<Order>& ob, base::ThreadPool* pool) const {
   if (ob.empty()) {
     return Copy();
   }
@@ -161,7 +647,7 @@ Table Table::Sort(const std::vector<Order>& ob) const {
   Table table = CopyExceptOverlays();
   Query q;
   q.orders = ob;
-  RowMap rm = QueryToRowMap(q);
+  RowMap rm = QueryToRowMap(q, pool);
   for (const ColumnStorageOverlay& overlay : overlays_) {
     table.overlays_.emplace_back(overlay.SelectRows(rm));
     PERFETTO_DCHECK(table.overlays_.back().size() == table.row_count());
@@ -229,6 +715,274 @@ void Table::CreateChains() const {
   }
 }
 
+base::Status Table::CreateIndex(const std::string& name,
+                               std::vector<uint32_t> col_idxs,
+                               bool replace) const {
+  auto it = std::find_if(indexes_.begin(), indexes_.end(),
+                         [&name](const ColumnIndex& idx) {
+                           return idx.name == name;
+                         });
+  if (it != indexes_.end() && !replace) {
+    return base::ErrStatus("Index '%s' already exists", name.c_str());
+  }
+  if (col_idxs.empty()) {
+    return base::ErrStatus("Index '%s' has no columns", name.c_str());
+  }
+  for (uint32_t col_idx : col_idxs) {
+    PERFETTO_CHECK(col_idx < columns_.size());
+  }
+  if (PERFETTO_UNLIKELY(chains_.size() != columns_.size())) {
+    CreateChains();
+  }
+
+  std::vector<Order> ob;
+  ob.reserve(col_idxs.size());
+  for (uint32_t col_idx : col_idxs) {
+    ob.push_back(Order{col_idx, false});
+  }
+  std::vector<uint32_t> index(row_count_);
+  for (uint32_t i = 0; i < row_count_; ++i) {
+    index[i] = i;
+  }
+  QueryExecutor::SortLegacy(this, ob, index, nullptr);
+
+  ColumnIndex col_index{name, std::move(col_idxs), std::move(index)};
+  for (uint32_t col_idx : col_index.columns) {
+    col_index.mutation_count += columns_[col_idx].mutation_count();
+  }
+  if (it != indexes_.end()) {
+    *it = std::move(col_index);
+  } else {
+    indexes_.emplace_back(std::move(col_index));
+  }
+  return base::OkStatus();
+}
+
+base::Status Table::DropIndex(const std::string& name) const {
+  auto it = std::find_if(indexes_.begin(), indexes_.end(),
+                         [&name](const ColumnIndex& idx) {
+                           return idx.name == name;
+                         });
+  if (it == indexes_.end()) {
+    return base::ErrStatus("Index '%s' does not exist", name.c_str());
+  }
+  indexes_.erase(it);
+  return base::OkStatus();
+}
+
+std::optional<uint64_t> Table::CreateHashIndex(uint32_t col_idx) const {
+  PERFETTO_CHECK(col_idx < columns_.size());
+  const ColumnLegacy& col = columns_[col_idx];
+  if (!IsHashIndexSupported(col)) {
+    return std::nullopt;
+  }
+  auto it = std::find_if(hash_indexes_.begin(), hash_indexes_.end(),
+                         [col_idx](const HashIndex& idx) {
+                           return idx.col_idx == col_idx;
+                         });
+  if (it != hash_indexes_.end() && IsHashIndexFresh(*it)) {
+    it->users++;
+    return it->id;
+  }
+
+  // Assign each distinct value to a group and count the rows of each group.
+  // Users of a stale index being replaced keep releasing the old id, which
+  // does not affect the new index.
+  HashIndex index;
+  index.col_idx = col_idx;
+  index.row_count = row_count_;
+  index.mutation_count = col.mutation_count();
+  index.last_use = ++hash_index_uses_;
+  index.id = index.last_use;
+  index.users = 1;
+  std::vector<uint32_t> group_for_row(row_count_, kNoGroup);
+  std::vector<uint32_t> group_sizes;
+  for (uint32_t row = 0; row < row_count_; ++row) {
+    std::optional<int64_t> key = HashKeyForRow(col, row);
+    if (!key) {
+      continue;
+    }
+    auto [group, inserted] = index.group_for_value.Insert(
+        *key, static_cast<uint32_t>(group_sizes.size()));
+    if (inserted) {
+      group_sizes.push_back(0);
+    }
+    group_sizes[*group]++;
+    group_for_row[row] = *group;
+  }
+
+  // Lay out the rows of all the groups contiguously.
+  index.offsets.resize(group_sizes.size() + 1);
+  for (uint32_t i = 0; i < group_sizes.size(); ++i) {
+    index.offsets[i + 1] = index.offsets[i] + group_sizes[i];
+  }
+  index.rows.resize(index.offsets.back());
+  std::vector<uint32_t> next(index.offsets.begin(), index.offsets.end() - 1);
+  for (uint32_t row = 0; row < row_count_; ++row) {
+    if (group_for_row[row] != kNoGroup) {
+      index.rows[next[group_for_row[row]]++] = row;
+    }
+  }
+
+  if (it == hash_indexes_.end() && hash_indexes_.size() >= kMaxHashIndexes) {
+    it = std::min_element(hash_indexes_.begin(), hash_indexes_.end(),
+                          [](const HashIndex& a, const HashIndex& b) {
+                            return a.last_use < b.last_use;
+                          });
+  }
+  uint64_t id = index.id;
+  if (it != hash_indexes_.end()) {
+    *it = std::move(index);
+  } else {
+    hash_indexes_.emplace_back(std::move(index));
+  }
+  return id;
+}
+
+void Table::ReleaseHashIndex(uint64_t id) const {
+  auto it = std::find_if(
+      hash_indexes_.begin(), hash_indexes_.end(),
+      [id](const HashIndex& idx) { return idx.id == id; });
+  if (it != hash_indexes_.end() && --it->users == 0) {
+    hash_indexes_.erase(it);
+  }
+}
+
+bool Table::IsIndexFresh(const ColumnIndex& idx) const {
+  if (idx.index.size() != row_count_) {
+    return false;
+  }
+  uint64_t mutation_count = 0;
+  for (uint32_t col_idx : idx.columns) {
+    mutation_count += columns_[col_idx].mutation_count();
+  }
+  return mutation_count == idx.mutation_count;
+}
+
+bool Table::IsHashIndexFresh(const HashIndex& idx) const {
+  return idx.row_count == row_count_ &&
+         idx.mutation_count == columns_[idx.col_idx].mutation_count();
+}
+
+std::optional<RowMap> Table::FilterUsingIndex(
+    const std::vector<Constraint>& cs,
+    base::ThreadPool* pool) const {
+  auto is_range_op = [](FilterOp op) {
+    return op == FilterOp::kLt || op == FilterOp::kLe || op == FilterOp::kGt ||
+           op == FilterOp::kGe;
+  };
+
+  // For each index, greedily find the constraints which it can answer: an
+  // equality constraint on each column of the longest possible prefix of the
+  // index followed by any range constraints on the next column. Pick the
+  // index which answers the most constraints.
+  const ColumnIndex* best = nullptr;
+  std::vector<uint32_t> best_cs;
+  std::vector<uint32_t> cur_cs;
+  for (const ColumnIndex& idx : indexes_) {
+    // Indexes are not updated when the table changes: ignore stale ones.
+    if (!IsIndexFresh(idx)) {
+      continue;
+    }
+    cur_cs.clear();
+    for (uint32_t col_idx : idx.columns) {
+      bool has_eq = false;
+      for (uint32_t i = 0; i < cs.size(); ++i) {
+        const Constraint& c = cs[i];
+        if (c.col_idx == col_idx && !c.value.is_null() &&
+            (c.op == FilterOp::kEq || is_range_op(c.op))) {
+          cur_cs.push_back(i);
+          has_eq = has_eq || c.op == FilterOp::kEq;
+        }
+      }
+      // Only equality constraints keep the rows sorted by the next column so
+      // stop as soon as a column does not have one.
+      if (!has_eq) {
+        break;
+      }
+    }
+    if (cur_cs.size() > best_cs.size()) {
+      best = &idx;
+      std::swap(best_cs, cur_cs);
+    }
+  }
+  if (!best) {
+    return std::nullopt;
+  }
+
+  // Narrow down the range of the index matching each constraint in turn. As
+  // all the constraints before a given one are equality constraints on
+  // previous columns of the index (or constraints on the same column), the
+  // range is always sorted by the column being searched so each step is a
+  // binary search.
+  Range range(0, static_cast<uint32_t>(best->index.size()));
+  for (uint32_t i : best_cs) {
+    const Constraint& c = cs[i];
+    column::DataLayerChain::OrderedIndices indices{
+        best->index.data() + range.start, range.size(),
+        Indices::State::kNonmonotonic};
+    Range res = ChainForColumn(c.col_idx).OrderedIndexSearch(c.op, c.value,
+                                                             indices);
+    range = Range(range.start + res.start, range.start + res.end);
+  }
+
+  std::vector<uint32_t> rows(
+      best->index.begin() + static_cast<std::ptrdiff_t>(range.start),
+      best->index.begin() + static_cast<std::ptrdiff_t>(range.end));
+  std::sort(rows.begin(), rows.end());
+
+  std::vector<Constraint> remaining;
+  for (uint32_t i = 0; i < cs.size(); ++i) {
+    if (std::find(best_cs.begin(), best_cs.end(), i) == best_cs.end()) {
+      remaining.push_back(cs[i]);
+    }
+  }
+  return QueryExecutor::FilterLegacy(this, remaining, RowMap(std::move(rows)),
+                                     pool);
+}
+
+std::optional<RowMap> Table::FilterUsingHashIndex(
+    const std::vector<Constraint>& cs,
+    base::ThreadPool* pool) const {
+  for (uint32_t i = 0; i < cs.size(); ++i) {
+    const Constraint& c = cs[i];
+    if (c.op != FilterOp::kEq) {
+      continue;
+    }
+    auto it = std::find_if(hash_indexes_.begin(), hash_indexes_.end(),
+                           [&c](const HashIndex& idx) {
+                             return idx.col_idx == c.col_idx;
+                           });
+    if (it == hash_indexes_.end()) {
+      continue;
+    }
+    // Hash indexes are not updated when the table changes: free stale ones
+    // (they will be rebuilt if the column keeps being joined on).
+    if (!IsHashIndexFresh(*it)) {
+      hash_indexes_.erase(it);
+      continue;
+    }
+    std::optional<int64_t> key;
+    if (!HashKeyForValue(columns_[c.col_idx], *string_pool_, c.value, &key)) {
+      continue;
+    }
+    it->last_use = ++hash_index_uses_;
+    const uint32_t* group = key ? it->group_for_value.Find(*key) : nullptr;
+    if (!group) {
+      return RowMap();
+    }
+    std::vector<uint32_t> rows(
+        it->rows.begin() + it->offsets[*group],
+        it->rows.begin() + it->offsets[*group + 1]);
+
+    std::vector<Constraint> remaining(cs.begin(), cs.end());
+    remaining.erase(remaining.begin() + i);
+    return QueryExecutor::FilterLegacy(this, remaining, RowMap(std::move(rows)),
+                                       pool);
+  }
+  return std::nullopt;
+}
+
 void Table::ApplyDistinct(const Query& q, RowMap* rm) const {
   auto& ob = q.orders;
   PERFETTO_DCHECK(!ob.empty());
@@ -259,7 +1013,9 @@ void Table::ApplyDistinct(const Query& q, RowMap* rm) const {
   *rm = RowMap(std::move(table_indices));
 }
 
-void Table::ApplySort(const Query& q, RowMap* rm) const {
+void Table::ApplySort(const Query& q,
+                      RowMap* rm,
+                      base::ThreadPool* pool) const {
   const auto& ob = q.orders;
   // Return the RowMap directly if there is a single constraint to sort the
   // table by a column which is already sorted.
@@ -277,7 +1033,7 @@ void Table::ApplySort(const Query& q, RowMap* rm) const {
     PERFETTO_DCHECK(ob.front().desc);
     std::reverse(idx.begin(), idx.end());
   } else {
-    QueryExecutor::SortLegacy(this, ob, idx);
+    QueryExecutor::SortLegacy(this, ob, idx, pool);
   }
 
   *rm = RowMap(std::move(idx));
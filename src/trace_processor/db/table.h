@@ -17,13 +17,19 @@
 #ifndef SRC_TRACE_PROCESSOR_DB_TABLE_H_
 #define SRC_TRACE_PROCESSOR_DB_TABLE_H_
 
+#include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/protozero/field.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/ref_counted.h"
 #include "src/trace_processor/containers/row_map.h"
@@ -33,6 +39,10 @@
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/column_storage_overlay.h"
 
+namespace perfetto::base {
+class ThreadPool;
+}  // namespace perfetto::base
+
 namespace perfetto::trace_processor {
 
 // Represents a table of data with named, strongly typed columns.
@@ -92,6 +102,25 @@ class Table {
     // Returns the storage index for the last overlay.
     uint32_t StorageIndexForLastOverlay() const { return its_.back().index(); }
 
+    // Returns the position of the current row in the iteration.
+    uint32_t row() const { return its_[0].row(); }
+
+    // Appends the values of column |col_idx| for the current row and the
+    // following ones, up to |count| rows in total, to |out|.
+    void GetNextRows(uint32_t col_idx,
+                     uint32_t count,
+                     std::vector<SqlValue>& out) const {
+      const auto& col = table_->columns_[col_idx];
+      const auto& overlay = overlays_.empty()
+                                ? table_->overlays()[col.overlay_index()]
+                                : overlays_[col.overlay_index()];
+      uint32_t row = its_[col.overlay_index()].row();
+      uint32_t end = row + std::min(count, overlay.size() - row);
+      for (; row < end; ++row) {
+        out.push_back(col.GetAtIdx(overlay.Get(row)));
+      }
+    }
+
    private:
     const Table* table_ = nullptr;
     std::vector<ColumnStorageOverlay> overlays_;
@@ -130,7 +159,10 @@ class Table {
 
   // Filters and sorts the tables with the arguments specified, returning the
   // result as a RowMap.
-  RowMap QueryToRowMap(const Query&) const;
+  //
+  // If |pool| is not null, scans and sorts of large numbers of rows are split
+  // across its threads.
+  RowMap QueryToRowMap(const Query&, base::ThreadPool* pool = nullptr) const;
 
   // Applies the RowMap |rm| onto this table and returns an iterator over the
   // resulting rows.
@@ -138,8 +170,10 @@ class Table {
     return Iterator(this, std::move(rm));
   }
 
-  // Sorts the table using the specified order by constraints.
-  Table Sort(const std::vector<Order>&) const;
+  // Sorts the table using the specified order by constraints. See
+  // |QueryToRowMap| for the meaning of |pool|.
+  Table Sort(const std::vector<Order>&,
+             base::ThreadPool* pool = nullptr) const;
 
   // Returns an iterator over the rows in this table.
   Iterator IterateRows() const { return Iterator(this); }
@@ -147,6 +181,73 @@ class Table {
   // Creates a copy of this table.
   Table Copy() const;
 
+  // Serializes the rows of the table, to be restored with |Deserialize|, as a
+  // SerializedTable packet followed by SerializedColumn packets storing the
+  // columns owned by this table (i.e. not inherited from a parent table) in
+  // chunks of at most |rows_per_chunk| rows. Each SerializedTraceProcessorPacket
+  // is passed to |write_packet| once complete.
+  //
+  // String columns reference the Ids of the string pool of the table, which
+  // needs to be serialized alongside.
+  void Serialize(
+      const std::string& table_name,
+      uint32_t rows_per_chunk,
+      const std::function<void(std::vector<uint8_t>)>& write_packet) const;
+
+  // Replaces the rows of the table with the ones serialized by |Serialize|:
+  // |table| is the SerializedTable and |columns| the SerializedColumns which
+  // followed it. String columns are restored as-is so the string pool of the
+  // table must have been restored first. Returns an error if the packets do
+  // not match the schema of this table: the contents of the table are then
+  // unspecified.
+  base::Status Deserialize(protozero::ConstBytes table,
+                           const std::vector<protozero::ConstBytes>& columns);
+
+  // Creates an index named |name| on the columns |col_idxs|: the rows of the
+  // table are sorted lexicographically by the values of these columns. When
+  // a query has equality constraints on a prefix of |col_idxs| (optionally
+  // followed by range constraints on the next column), QueryToRowMap will
+  // binary search the index instead of scanning the columns.
+  //
+  // Indexes only change how the table is queried, not its contents, so (like
+  // chains) they can be created on const tables. Indexes are not maintained
+  // when the table changes: they are ignored if rows were added to the table
+  // or values of the indexed columns were updated since the index was
+  // created.
+  base::Status CreateIndex(const std::string& name,
+                           std::vector<uint32_t> col_idxs,
+                           bool replace) const;
+
+  // Removes the index named |name| created by |CreateIndex|.
+  base::Status DropIndex(const std::string& name) const;
+
+  // Creates (if it does not exist already) a hash index on the column
+  // |col_idx|, mapping each value to the rows containing it: QueryToRowMap
+  // will then answer equality constraints on the column with a hash lookup
+  // instead of scanning the column. This turns the nested loop joins run by
+  // SQLite, which filter a table once for each row of the other table, into
+  // hash joins.
+  //
+  // Returns an id to pass to |ReleaseHashIndex| once the caller does not
+  // need the index anymore: the index is freed when all its users released
+  // it. Only integer and string columns are supported: returns std::nullopt
+  // for other columns. Like indexes, hash indexes are not maintained when
+  // the table changes: stale hash indexes are freed when they are next looked
+  // up. At most |kMaxHashIndexes| hash indexes are kept on a table: creating
+  // another one evicts the least recently used.
+  std::optional<uint64_t> CreateHashIndex(uint32_t col_idx) const;
+
+  // Releases the use of the hash index |id| returned by |CreateHashIndex|.
+  // Does nothing if the index was already evicted or rebuilt.
+  void ReleaseHashIndex(uint64_t id) const;
+
+  // The number of hash indexes on the table. For testing.
+  uint32_t hash_index_count() const {
+    return static_cast<uint32_t>(hash_indexes_.size());
+  }
+
+  static constexpr uint32_t kMaxHashIndexes = 4;
+
   uint32_t row_count() const { return row_count_; }
   StringPool* string_pool() const { return string_pool_; }
   const std::vector<ColumnLegacy>& columns() const { return columns_; }
@@ -196,10 +297,59 @@ class Table {
 
   void CreateChains() const;
 
+  // Calls |fn| with a pointer to the ColumnStorage of |col|, which must not
+  // be an id or dummy column.
+  template <typename Fn>
+  static void VisitMutableStorage(ColumnLegacy* col, Fn fn);
+
   Table CopyExceptOverlays() const;
 
+  struct ColumnIndex {
+    std::string name;
+    std::vector<uint32_t> columns;
+    // Rows of the table sorted by |columns|.
+    std::vector<uint32_t> index;
+    // Sum of the mutation counts of |columns| when the index was created.
+    uint64_t mutation_count = 0;
+  };
+
+  struct HashIndex {
+    uint32_t col_idx = 0;
+    // Identifies the index for |ReleaseHashIndex| and the number of users
+    // which did not release it yet.
+    uint64_t id = 0;
+    uint32_t users = 0;
+    // Number of rows in the table and mutation count of the column when the
+    // index was created.
+    uint32_t row_count = 0;
+    uint64_t mutation_count = 0;
+    // Value of |hash_index_uses_| when the index was last used.
+    uint64_t last_use = 0;
+    // Maps each non-null value (an integer or the raw id of a string) to a
+    // group of rows.
+    base::FlatHashMap<int64_t, uint32_t> group_for_value;
+    // The rows of group i are rows[offsets[i]..offsets[i + 1]), in increasing
+    // order.
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> rows;
+  };
+
+  // Filters the table using the index which can answer the most constraints
+  // in |cs| and applies any remaining constraints on the result. Returns
+  // std::nullopt if no index can be used.
+  std::optional<RowMap> FilterUsingIndex(const std::vector<Constraint>& cs,
+                                         base::ThreadPool* pool) const;
+
+  // Same as |FilterUsingIndex| for the first equality constraint of |cs| on a
+  // column with a hash index.
+  std::optional<RowMap> FilterUsingHashIndex(const std::vector<Constraint>& cs,
+                                             base::ThreadPool* pool) const;
+
+  bool IsIndexFresh(const ColumnIndex&) const;
+  bool IsHashIndexFresh(const HashIndex&) const;
+
   void ApplyDistinct(const Query&, RowMap*) const;
-  void ApplySort(const Query&, RowMap*) const;
+  void ApplySort(const Query&, RowMap*, base::ThreadPool* pool) const;
 
   StringPool* string_pool_ = nullptr;
   uint32_t row_count_ = 0;
@@ -210,6 +360,9 @@ class Table {
   std::vector<RefPtr<column::DataLayer>> null_layers_;
   std::vector<RefPtr<column::DataLayer>> overlay_layers_;
   mutable std::vector<std::unique_ptr<column::DataLayerChain>> chains_;
+  mutable std::vector<ColumnIndex> indexes_;
+  mutable std::vector<HashIndex> hash_indexes_;
+  mutable uint64_t hash_index_uses_ = 0;
 };
 
 }  // namespace perfetto::trace_processor
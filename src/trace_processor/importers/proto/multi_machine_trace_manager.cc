@@ -75,7 +75,8 @@ ProtoTraceReader* MultiMachineTraceManager::GetOrCreateReader(
     return remote_ctx->reader.get();
 
   auto context = CreateContext(raw_machine_id);
-  // Share the sorter, but enable for the parser.
+  // Share the sorter and the thread pool, but enable for the parser.
+  context->thread_pool = default_context_->thread_pool;
   context->sorter = default_context_->sorter;
   context->sorter->AddMachineContext(context.get());
   context->process_tracker->SetPidZeroIsUpidZeroIdleProcess();
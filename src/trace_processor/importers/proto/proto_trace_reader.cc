@@ -58,7 +58,11 @@ ProtoTraceReader::ProtoTraceReader(TraceProcessorContext* ctx)
     : context_(ctx),
       skipped_packet_key_id_(ctx->storage->InternString("skipped_packet")),
       invalid_incremental_state_key_id_(
-          ctx->storage->InternString("invalid_incremental_state")) {}
+          ctx->storage->InternString("invalid_incremental_state")) {
+  // The context (and hence the pool) outlives this reader.
+  if (ctx->thread_pool)
+    tokenizer_.SetDecompressionPool(ctx->thread_pool.get());
+}
 ProtoTraceReader::~ProtoTraceReader() = default;
 
 util::Status ProtoTraceReader::Parse(TraceBlobView blob) {
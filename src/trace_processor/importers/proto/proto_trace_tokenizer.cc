@@ -15,38 +15,73 @@
  */
 
 #include "src/trace_processor/importers/proto/proto_trace_tokenizer.h"
-#include "perfetto/trace_processor/trace_blob.h"
 
+#include <cstdint>
+#include <vector>
+
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/ext/base/waitable_event.h"
+#include "perfetto/trace_processor/trace_blob.h"
 
 namespace perfetto {
 namespace trace_processor {
 
 ProtoTraceTokenizer::ProtoTraceTokenizer() = default;
 
-util::Status ProtoTraceTokenizer::Decompress(TraceBlobView input,
-                                             TraceBlobView* output) {
-  PERFETTO_DCHECK(util::IsGzipSupported());
+void ProtoTraceTokenizer::DecompressInParallel(
+    std::vector<PendingPacket>* pending) {
+  PERFETTO_DCHECK(pool_);
+
+  uint64_t posted = 0;
+  base::WaitableEvent done;
+  for (PendingPacket& p : *pending) {
+    if (!p.compressed)
+      continue;
+    PendingPacket* packet = &p;
+    pool_->PostTask([packet, &done] {
+      // Each task uses its own decompressor: zlib streams are not thread-safe.
+      util::GzipDecompressor decompressor;
+      packet->status =
+          Decompress(&decompressor, packet->packet.data(),
+                     packet->packet.size(), &packet->decompressed);
+      done.Notify();
+    });
+    posted++;
+  }
+  done.Wait(posted);
+}
+
+// static
+util::Status ProtoTraceTokenizer::Decompress(
+    util::GzipDecompressor* decompressor,
+    const uint8_t* data,
+    size_t size,
+    std::vector<uint8_t>* output) {
+  output->clear();
+  output->reserve(size);
+
+  if (util::IsZstdFrame(data, size)) {
+    PERFETTO_DCHECK(util::IsZstdSupported());
+    if (!util::ZstdDecompress(data, size, output))
+      return util::ErrStatus("Failed to decompress zstd compressed packets");
+    return util::OkStatus();
+  }
 
-  std::vector<uint8_t> data;
-  data.reserve(input.length());
+  PERFETTO_DCHECK(util::IsGzipSupported());
 
   // Ensure that the decompressor is able to cope with a new stream of data.
-  decompressor_.Reset();
+  decompressor->Reset();
   using ResultCode = util::GzipDecompressor::ResultCode;
-  ResultCode ret = decompressor_.FeedAndExtract(
-      input.data(), input.length(),
-      [&data](const uint8_t* buffer, size_t buffer_len) {
-        data.insert(data.end(), buffer, buffer + buffer_len);
+  ResultCode ret = decompressor->FeedAndExtract(
+      data, size, [output](const uint8_t* buffer, size_t buffer_len) {
+        output->insert(output->end(), buffer, buffer + buffer_len);
       });
 
   if (ret == ResultCode::kError || ret == ResultCode::kNeedsMoreInput) {
     return util::ErrStatus("Failed to decompress (error code: %d)",
                            static_cast<int>(ret));
   }
-
-  TraceBlob out_blob = TraceBlob::CopyFrom(data.data(), data.size());
-  *output = TraceBlobView(std::move(out_blob));
   return util::OkStatus();
 }
 
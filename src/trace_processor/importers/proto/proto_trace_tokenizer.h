@@ -17,10 +17,14 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_PROTO_TRACE_TOKENIZER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_PROTO_TRACE_TOKENIZER_H_
 
+#include <cstddef>
 #include <cstdint>
+#include <utility>
 #include <vector>
 
 #include "perfetto/base/status.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/public/compiler.h"
 #include "perfetto/trace_processor/status.h"
@@ -28,6 +32,7 @@
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/util/gzip_utils.h"
 #include "src/trace_processor/util/status_macros.h"
+#include "src/trace_processor/util/zstd_utils.h"
 
 #include "protos/perfetto/trace/trace.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
@@ -41,8 +46,51 @@ class ProtoTraceTokenizer {
  public:
   ProtoTraceTokenizer();
 
+  // Sets a thread pool used to inflate |compressed_packets| concurrently.
+  // When set, the compressed packets found in a Tokenize() call are
+  // decompressed in parallel and all the packets are then passed to the
+  // callback in the same order as they appear in the trace. |pool| must
+  // outlive this object.
+  void SetDecompressionPool(base::ThreadPool* pool) { pool_ = pool; }
+
   template <typename Callback = util::Status(TraceBlobView)>
   util::Status Tokenize(TraceBlobView blob, Callback callback) {
+    util::Status status = TokenizeInternal(std::move(blob), callback);
+    if (!status.ok()) {
+      pending_.clear();
+      pending_compressed_bytes_ = 0;
+      return status;
+    }
+    return FlushPending(callback);
+  }
+
+ private:
+  static constexpr uint8_t kTracePacketTag =
+      protozero::proto_utils::MakeTagLengthDelimited(
+          protos::pbzero::Trace::kPacketFieldNumber);
+
+  // Upper bound on the compressed bytes buffered before the pending packets
+  // are decompressed and flushed. Bounds the memory used for the decompressed
+  // output of a single batch.
+  static constexpr size_t kMaxPendingCompressedBytes = 32ul * 1024 * 1024;
+
+  // A packet buffered while waiting for the compressed packets preceding it
+  // (or itself) to be decompressed on |pool_|.
+  struct PendingPacket {
+    // Either a whole TracePacket or, if |compressed| is true, the payload of
+    // its |compressed_packets| field.
+    TraceBlobView packet;
+    bool compressed = false;
+
+    // Only valid when |compressed| is true, after the decompression task
+    // completed. These are plain buffers rather than TraceBlobViews as the
+    // refcount of the latter is not thread-safe.
+    std::vector<uint8_t> decompressed;
+    util::Status status;
+  };
+
+  template <typename Callback = util::Status(TraceBlobView)>
+  util::Status TokenizeInternal(TraceBlobView blob, Callback callback) {
     const uint8_t* data = blob.data();
     size_t size = blob.size();
     if (!partial_buf_.empty()) {
@@ -108,11 +156,6 @@ class ProtoTraceTokenizer {
     return ParseInternal(blob.slice(data, size), callback);
   }
 
- private:
-  static constexpr uint8_t kTracePacketTag =
-      protozero::proto_utils::MakeTagLengthDelimited(
-          protos::pbzero::Trace::kPacketFieldNumber);
-
   template <typename Callback = util::Status(TraceBlobView)>
   util::Status ParseInternal(TraceBlobView whole_buf, Callback callback) {
     static constexpr auto kLengthDelimited =
@@ -142,41 +185,113 @@ class ProtoTraceTokenizer {
     protos::pbzero::TracePacket::Decoder decoder(packet.data(),
                                                  packet.length());
     if (decoder.has_compressed_packets()) {
-      if (!util::IsGzipSupported()) {
+      protozero::ConstBytes field = decoder.compressed_packets();
+      if (util::IsZstdFrame(field.data, field.size)) {
+        if (!util::IsZstdSupported()) {
+          return util::Status(
+              "Cannot decode compressed packets. Zstd not enabled");
+        }
+      } else if (!util::IsGzipSupported()) {
         return util::Status(
             "Cannot decode compressed packets. Zlib not enabled");
       }
 
-      protozero::ConstBytes field = decoder.compressed_packets();
       TraceBlobView compressed_packets = packet.slice(field.data, field.size);
-      TraceBlobView packets;
-
-      RETURN_IF_ERROR(Decompress(std::move(compressed_packets), &packets));
-
-      const uint8_t* start = packets.data();
-      const uint8_t* end = packets.data() + packets.length();
-      const uint8_t* ptr = start;
-      while ((end - ptr) > 2) {
-        const uint8_t* packet_outer = ptr;
-        if (PERFETTO_UNLIKELY(*ptr != kTracePacketTag))
-          return util::ErrStatus("Expected TracePacket tag");
-        uint64_t packet_size = 0;
-        ptr = protozero::proto_utils::ParseVarInt(++ptr, end, &packet_size);
-        const uint8_t* packet_start = ptr;
-        ptr += packet_size;
-        if (PERFETTO_UNLIKELY((ptr - packet_outer) < 2 || ptr > end))
-          return util::ErrStatus("Invalid packet size");
-
-        TraceBlobView sliced =
-            packets.slice(packet_start, static_cast<size_t>(packet_size));
-        RETURN_IF_ERROR(ParsePacket(std::move(sliced), callback));
+
+      if (pool_) {
+        pending_compressed_bytes_ += compressed_packets.size();
+        PendingPacket pending;
+        pending.packet = std::move(compressed_packets);
+        pending.compressed = true;
+        pending_.emplace_back(std::move(pending));
+        if (pending_compressed_bytes_ >= kMaxPendingCompressedBytes)
+          return FlushPending(callback);
+        return util::OkStatus();
       }
+
+      std::vector<uint8_t> data;
+      RETURN_IF_ERROR(Decompress(&decompressor_, compressed_packets.data(),
+                                 compressed_packets.size(), &data));
+      return ParseDecompressedPackets(ToBlobView(data), callback);
+    }
+
+    // Once a compressed packet has been deferred, all the following packets
+    // have to be deferred as well to preserve the trace order.
+    if (!pending_.empty()) {
+      PendingPacket pending;
+      pending.packet = std::move(packet);
+      pending_.emplace_back(std::move(pending));
       return util::OkStatus();
     }
     return callback(std::move(packet));
   }
 
-  util::Status Decompress(TraceBlobView input, TraceBlobView* output);
+  template <typename Callback = util::Status(TraceBlobView)>
+  util::Status ParseDecompressedPackets(TraceBlobView packets,
+                                        Callback callback) {
+    const uint8_t* start = packets.data();
+    const uint8_t* end = packets.data() + packets.length();
+    const uint8_t* ptr = start;
+    while ((end - ptr) > 2) {
+      const uint8_t* packet_outer = ptr;
+      if (PERFETTO_UNLIKELY(*ptr != kTracePacketTag))
+        return util::ErrStatus("Expected TracePacket tag");
+      uint64_t packet_size = 0;
+      ptr = protozero::proto_utils::ParseVarInt(++ptr, end, &packet_size);
+      const uint8_t* packet_start = ptr;
+      ptr += packet_size;
+      if (PERFETTO_UNLIKELY((ptr - packet_outer) < 2 || ptr > end))
+        return util::ErrStatus("Invalid packet size");
+
+      TraceBlobView sliced =
+          packets.slice(packet_start, static_cast<size_t>(packet_size));
+      RETURN_IF_ERROR(ParsePacket(std::move(sliced), callback));
+    }
+    return util::OkStatus();
+  }
+
+  // Decompresses all the pending compressed packets on |pool_| and then
+  // passes the pending packets to |callback| in trace order.
+  template <typename Callback = util::Status(TraceBlobView)>
+  util::Status FlushPending(Callback callback) {
+    if (pending_.empty())
+      return util::OkStatus();
+
+    std::vector<PendingPacket> pending = std::move(pending_);
+    pending_.clear();
+    pending_compressed_bytes_ = 0;
+    DecompressInParallel(&pending);
+
+    for (PendingPacket& p : pending) {
+      if (!p.compressed) {
+        RETURN_IF_ERROR(callback(std::move(p.packet)));
+        continue;
+      }
+      RETURN_IF_ERROR(p.status);
+      RETURN_IF_ERROR(
+          ParseDecompressedPackets(ToBlobView(p.decompressed), callback));
+      // Nested compressed packets (never emitted by the service in practice)
+      // are deferred again: flush them before moving to the next packet.
+      RETURN_IF_ERROR(FlushPending(callback));
+    }
+    return util::OkStatus();
+  }
+
+  // Fills |decompressed| and |status| of each compressed packet in |pending|.
+  // Blocks until all the packets have been processed.
+  void DecompressInParallel(std::vector<PendingPacket>* pending);
+
+  // Decompresses |size| bytes at |data| (a zstd frame or a zlib stream) into
+  // |output|. Only touches |decompressor| and |output|, so it can be called
+  // from any thread.
+  static util::Status Decompress(util::GzipDecompressor* decompressor,
+                                 const uint8_t* data,
+                                 size_t size,
+                                 std::vector<uint8_t>* output);
+
+  static TraceBlobView ToBlobView(const std::vector<uint8_t>& data) {
+    return TraceBlobView(TraceBlob::CopyFrom(data.data(), data.size()));
+  }
 
   // Used to glue together trace packets that span across two (or more)
   // Parse() boundaries.
@@ -184,6 +299,14 @@ class ProtoTraceTokenizer {
 
   // Allows support for compressed trace packets.
   util::GzipDecompressor decompressor_;
+
+  // Not owned. When non-null, compressed packets are decompressed on this
+  // pool. See SetDecompressionPool().
+  base::ThreadPool* pool_ = nullptr;
+
+  // Packets waiting for FlushPending(). Only used when |pool_| is set.
+  std::vector<PendingPacket> pending_;
+  size_t pending_compressed_bytes_ = 0;
 };
 
 }  // namespace trace_processor
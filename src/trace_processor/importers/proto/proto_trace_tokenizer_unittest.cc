@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/proto/proto_trace_tokenizer.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAreArray;
+
+std::vector<uint8_t> ZlibCompress(const std::vector<uint8_t>& input) {
+  uLongf size = compressBound(static_cast<uLong>(input.size()));
+  std::vector<uint8_t> output(size);
+  PERFETTO_CHECK(compress(output.data(), &size, input.data(),
+                          static_cast<uLong>(input.size())) == Z_OK);
+  output.resize(size);
+  return output;
+}
+
+// Builds a trace out of plain packets and of batches of packets compressed
+// in a single |compressed_packets| packet. Each packet is identified by its
+// timestamp, which is the index of the packet in the trace.
+class TraceBuilder {
+ public:
+  void AddPackets(uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i)
+      AddPacket(trace_.get());
+  }
+
+  void AddCompressedPackets(uint32_t count) {
+    protozero::HeapBuffered<protos::pbzero::Trace> inner;
+    for (uint32_t i = 0; i < count; ++i)
+      AddPacket(inner.get());
+    AddCompressedPayload(ZlibCompress(inner.SerializeAsArray()));
+  }
+
+  void AddCompressedPayload(const std::vector<uint8_t>& payload) {
+    trace_->add_packet()->set_compressed_packets(payload.data(),
+                                                 payload.size());
+  }
+
+  std::vector<uint8_t> Build() { return trace_.SerializeAsArray(); }
+
+  uint64_t packet_count() const { return next_ts_; }
+
+ private:
+  void AddPacket(protos::pbzero::Trace* trace) {
+    auto* packet = trace->add_packet();
+    packet->set_timestamp(next_ts_++);
+    packet->set_trusted_packet_sequence_id(1);
+  }
+
+  protozero::HeapBuffered<protos::pbzero::Trace> trace_;
+  uint64_t next_ts_ = 0;
+};
+
+class ProtoTraceTokenizerTest : public ::testing::TestWithParam<bool> {
+ protected:
+  ProtoTraceTokenizerTest() {
+    if (GetParam()) {
+      pool_ = std::make_unique<base::ThreadPool>(2);
+      tokenizer_.SetDecompressionPool(pool_.get());
+    }
+  }
+
+  // Tokenizes |trace| in chunks of |chunk_size| bytes and records the
+  // timestamps of the packets in |timestamps_|.
+  util::Status Tokenize(const std::vector<uint8_t>& trace, size_t chunk_size) {
+    for (size_t off = 0; off < trace.size(); off += chunk_size) {
+      size_t size = std::min(chunk_size, trace.size() - off);
+      util::Status status = tokenizer_.Tokenize(
+          TraceBlobView(TraceBlob::CopyFrom(trace.data() + off, size)),
+          [this](TraceBlobView packet) {
+            protos::pbzero::TracePacket::Decoder decoder(packet.data(),
+                                                         packet.size());
+            timestamps_.push_back(decoder.timestamp());
+            return util::OkStatus();
+          });
+      if (!status.ok())
+        return status;
+    }
+    return util::OkStatus();
+  }
+
+  std::unique_ptr<base::ThreadPool> pool_;
+  ProtoTraceTokenizer tokenizer_;
+  std::vector<uint64_t> timestamps_;
+};
+
+INSTANTIATE_TEST_SUITE_P(WithAndWithoutPool,
+                         ProtoTraceTokenizerTest,
+                         ::testing::Bool());
+
+TEST_P(ProtoTraceTokenizerTest, MixedPacketsKeepTraceOrder) {
+  TraceBuilder builder;
+  builder.AddPackets(2);
+  builder.AddCompressedPackets(10);
+  builder.AddCompressedPackets(1);
+  builder.AddPackets(3);
+  builder.AddCompressedPackets(20);
+  builder.AddPackets(1);
+  builder.AddCompressedPackets(5);
+  std::vector<uint8_t> trace = builder.Build();
+
+  std::vector<uint64_t> expected(builder.packet_count());
+  for (uint64_t i = 0; i < expected.size(); ++i)
+    expected[i] = i;
+
+  // Each Tokenize() call decompresses and flushes the packets it buffered:
+  // small chunks spread the packets (and packets split across chunks) over
+  // many batches.
+  for (size_t chunk_size : {trace.size(), size_t(64), size_t(7), size_t(1)}) {
+    timestamps_.clear();
+    ASSERT_TRUE(Tokenize(trace, chunk_size).ok());
+    ASSERT_THAT(timestamps_, ElementsAreArray(expected))
+        << "chunk_size: " << chunk_size;
+  }
+}
+
+TEST_P(ProtoTraceTokenizerTest, CorruptCompressedPacket) {
+  TraceBuilder builder;
+  builder.AddPackets(1);
+  builder.AddCompressedPackets(2);
+  // A zlib header followed by a block with an invalid type.
+  builder.AddCompressedPayload({0x78, 0x9c, 0xff, 0xff, 0xff, 0xff});
+  builder.AddPackets(1);
+
+  util::Status status = Tokenize(builder.Build(), 1024);
+  ASSERT_FALSE(status.ok());
+  // The packets before the corrupt one are still tokenized, the ones after it
+  // are not.
+  ASSERT_THAT(timestamps_, ElementsAreArray({0u, 1u, 2u}));
+}
+
+TEST_P(ProtoTraceTokenizerTest, TruncatedCompressedPacket) {
+  protozero::HeapBuffered<protos::pbzero::Trace> inner;
+  for (uint32_t i = 0; i < 10; ++i)
+    inner->add_packet()->set_timestamp(i);
+  std::vector<uint8_t> compressed = ZlibCompress(inner.SerializeAsArray());
+  compressed.resize(compressed.size() / 2);
+
+  TraceBuilder builder;
+  builder.AddCompressedPayload(compressed);
+  ASSERT_FALSE(Tokenize(builder.Build(), 1024).ok());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -29,17 +29,28 @@ namespace trace_processor {
 IteratorImpl::IteratorImpl(
     TraceProcessorImpl* trace_processor,
     base::StatusOr<PerfettoSqlEngine::ExecutionResult> result,
-    uint32_t sql_stats_row)
+    uint32_t sql_stats_row,
+    PerfettoSqlEngine::FunctionMemoizationStats memoization_stats)
     : trace_processor_(trace_processor),
+      engine_(trace_processor->engine_.get()),
       result_(std::move(result)),
-      sql_stats_row_(sql_stats_row) {}
+      sql_stats_row_(sql_stats_row),
+      memoization_stats_(memoization_stats) {}
 
 IteratorImpl::~IteratorImpl() {
   if (trace_processor_) {
+    if (result_.ok() && !result_->stmt.IsDone()) {
+      // The statement is abandoned before its end.
+      engine_->DropStatementMemoization();
+    }
     base::TimeNanos t_end = base::GetWallTimeNs();
     auto* sql_stats =
         trace_processor_.get()->context_.storage->mutable_sql_stats();
     sql_stats->RecordQueryEnd(sql_stats_row_, t_end.count());
+    sql_stats->RecordQueryMemoization(
+        sql_stats_row_, static_cast<int64_t>(memoization_stats_.hits),
+        static_cast<int64_t>(memoization_stats_.misses),
+        static_cast<int64_t>(memoization_stats_.evictions));
   }
 }
 
@@ -38,9 +38,13 @@ class TraceProcessorImpl;
 
 class IteratorImpl {
  public:
+  // |memoization_stats| counts the memoization of the function calls made
+  // while executing the statements of the query before the iterator is
+  // created.
   IteratorImpl(TraceProcessorImpl* impl,
                base::StatusOr<PerfettoSqlEngine::ExecutionResult>,
-               uint32_t sql_stats_row);
+               uint32_t sql_stats_row,
+               PerfettoSqlEngine::FunctionMemoizationStats memoization_stats);
   ~IteratorImpl();
 
   IteratorImpl(IteratorImpl&) noexcept = delete;
@@ -72,11 +76,20 @@ class IteratorImpl {
       return false;
     }
 
-    bool has_more = result_->stmt.Step();
+    bool has_more;
+    {
+      PerfettoSqlEngine::ScopedQueryMemoizationStats scoped_stats(
+          engine_, &memoization_stats_);
+      has_more = result_->stmt.Step();
+    }
     if (!result_->stmt.status().ok()) {
       PERFETTO_DCHECK(!has_more);
       result_ = result_->stmt.status();
     }
+    if (!has_more) {
+      // The values memoized by functions for the statement can't be reused.
+      engine_->DropStatementMemoization();
+    }
     return has_more;
   }
 
@@ -154,8 +167,10 @@ class IteratorImpl {
   void RecordFirstNextInSqlStats();
 
   ScopedTraceProcessor trace_processor_;
+  PerfettoSqlEngine* engine_ = nullptr;
   base::StatusOr<PerfettoSqlEngine::ExecutionResult> result_;
   uint32_t sql_stats_row_ = 0;
+  PerfettoSqlEngine::FunctionMemoizationStats memoization_stats_;
   bool called_next_ = false;
 };
 
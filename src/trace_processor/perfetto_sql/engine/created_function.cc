@@ -17,8 +17,13 @@
 #include "src/trace_processor/perfetto_sql/engine/created_function.h"
 
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <optional>
 #include <queue>
 #include <stack>
+#include <string>
 
 #include "perfetto/base/status.h"
 #include "src/trace_processor/perfetto_sql/engine/function_util.h"
@@ -26,6 +31,7 @@
 #include "src/trace_processor/sqlite/scoped_db.h"
 #include "src/trace_processor/sqlite/sql_source.h"
 #include "src/trace_processor/sqlite/sqlite_engine.h"
+#include "src/trace_processor/sqlite/sqlite_tokenizer.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
 #include "src/trace_processor/tp_metatrace.h"
 #include "src/trace_processor/util/status_macros.h"
@@ -155,14 +161,69 @@ struct StoredSqlValue {
   Data data = nullptr;
 };
 
+// Returns whether the statement |sql| calls a function whose result can change
+// between calls with the same arguments.
+bool CallsNonDeterministicFunction(const SqliteEngine& engine,
+                                   const SqlSource& sql) {
+  SqliteTokenizer tokenizer(sql);
+  SqliteTokenizer::Token prev = tokenizer.NextNonWhitespace();
+  while (!prev.str.empty()) {
+    SqliteTokenizer::Token next = tokenizer.NextNonWhitespace();
+    if (prev.token_type == SqliteTokenType::TK_ID &&
+        next.token_type == SqliteTokenType::TK_LP &&
+        engine.IsFunctionNonDeterministic(prev.str)) {
+      return true;
+    }
+    prev = next;
+  }
+  return false;
+}
+
+// Memoizes the results of a function.
+//
+// The results of deterministic functions are memoized for the duration of a
+// statement: functions are registered with SQLite as deterministic so calls
+// with the same arguments must return the same value, unless they call a
+// non-deterministic function (e.g. random()). As the tables read by the
+// function can change between statements, the results are dropped as soon as
+// the statement is done. To bound the memory used, the least recently used
+// results are evicted once they take more than |kMaxAutoMemoizedBytes|, and
+// functions whose arguments don't repeat stop being memoized (and having their
+// arguments encoded) after |kMaxMissesWithoutHit| calls.
+//
+// Memoization enabled with EXPERIMENTAL_MEMOIZE instead keeps all the results
+// across statements: unrolling recursive calls relies on them (see
+// RecursiveCallUnroller).
 class Memoizer {
  public:
-  // Supported arguments. For now, only functions with a single int argument are
-  // supported.
-  using MemoizedArgs = int64_t;
+  // The arguments of a call, encoded as a string so that calls with any number
+  // of arguments of any type can be memoized.
+  using MemoizedArgs = std::string;
+
+  static constexpr size_t kMaxAutoMemoizedBytes = 8 * 1024 * 1024;
+  static constexpr uint32_t kMaxMissesWithoutHit = 1024;
+
+  explicit Memoizer(PerfettoSqlEngine* engine)
+      : memoization_(engine->function_memoization()) {}
+  ~Memoizer() { memoization_->statement_droppers.Erase(this); }
+
+  Memoizer(const Memoizer&) = delete;
+  Memoizer& operator=(const Memoizer&) = delete;
+
+  // Disables the automatic memoization of the function, because it is not
+  // deterministic.
+  void DisableAutoMemoization() { auto_memoization_disabled_ = true; }
+
+  // Returns whether the results of the current call should be looked up and
+  // memoized: the arguments of the call don't need to be encoded otherwise.
+  bool IsMemoizing() {
+    MaybeDropStaleValues();
+    return persistent_ ||
+           (!auto_memoization_disabled_ && !gave_up_for_statement_);
+  }
 
-  // Enables memoization.
-  // Only functions with a single int argument returning ints are supported.
+  // Enables memoization across statements.
+  // Only functions with a single int argument are supported.
   base::Status EnableMemoization(const FunctionPrototype& prototype) {
     if (prototype.arguments.size() != 1 ||
         TypeToSqlValueType(prototype.arguments[0].type()) !=
@@ -171,37 +232,108 @@ class Memoizer {
           "EXPERIMENTAL_MEMOIZE: Function %s should take one int argument",
           prototype.function_name.c_str());
     }
-    enabled_ = true;
+    persistent_ = true;
     return base::OkStatus();
   }
 
   // Returns the memoized value for the current invocation if it exists.
-  std::optional<SqlValue> GetMemoizedValue(MemoizedArgs args) {
-    if (!enabled_) {
-      return std::nullopt;
-    }
-    StoredSqlValue* value = memoized_values_.Find(args);
-    if (!value) {
+  std::optional<SqlValue> GetMemoizedValue(const MemoizedArgs& args) {
+    MaybeDropStaleValues();
+    auto* it = entries_.Find(args);
+    if (!it) {
+      CountMiss();
+      if (!persistent_ && hits_in_statement_ == 0 &&
+          ++misses_in_statement_ >= kMaxMissesWithoutHit) {
+        // The arguments don't repeat: memoizing only costs time and memory.
+        DropValues();
+        gave_up_for_statement_ = true;
+      }
       return std::nullopt;
     }
-    return value->AsSqlValue();
+    Count(&PerfettoSqlEngine::FunctionMemoizationStats::hits);
+    hits_in_statement_++;
+    lru_.splice(lru_.begin(), lru_, *it);
+    return (*it)->value.AsSqlValue();
+  }
+
+  // Counts a call whose result had to be computed.
+  void CountMiss() {
+    Count(&PerfettoSqlEngine::FunctionMemoizationStats::misses);
   }
 
-  bool HasMemoizedValue(MemoizedArgs args) {
-    return GetMemoizedValue(args).has_value();
+  bool HasMemoizedValue(const MemoizedArgs& args) {
+    MaybeDropStaleValues();
+    return entries_.Find(args) != nullptr;
   }
 
   // Saves the return value of the current invocation for memoization.
-  void Memoize(MemoizedArgs args, SqlValue value) {
-    if (!enabled_) {
+  void Memoize(const MemoizedArgs& args, SqlValue value) {
+    if (memoization_->first_passes_in_progress > 0 || !IsMemoizing()) {
       return;
     }
-    memoized_values_.Insert(args, StoredSqlValue(value));
+    if (auto* it = entries_.Find(args); it) {
+      Remove(*it);
+    }
+    if (!persistent_ && lru_.empty()) {
+      // Drop the values as soon as the statement is done.
+      memoization_->statement_droppers.Insert(this, [this] { DropValues(); });
+    }
+    lru_.push_front(Entry{args, StoredSqlValue(value)});
+    entries_.Insert(args, lru_.begin());
+    memoized_bytes_ += lru_.front().size();
+    while (!persistent_ && memoized_bytes_ > kMaxAutoMemoizedBytes) {
+      Remove(std::prev(lru_.end()));
+      Count(&PerfettoSqlEngine::FunctionMemoizationStats::evictions);
+    }
+  }
+
+  // Encodes the arguments of a call.
+  static MemoizedArgs AsMemoizedArgs(size_t argc, sqlite3_value** argv) {
+    MemoizedArgs args;
+    for (size_t i = 0; i < argc; ++i) {
+      int type = sqlite3_value_type(argv[i]);
+      args.push_back(static_cast<char>(type));
+      switch (type) {
+        case SQLITE_INTEGER:
+          AppendPod(args, static_cast<int64_t>(sqlite3_value_int64(argv[i])));
+          break;
+        case SQLITE_FLOAT:
+          AppendPod(args, sqlite3_value_double(argv[i]));
+          break;
+        case SQLITE_TEXT: {
+          const auto* text =
+              reinterpret_cast<const char*>(sqlite3_value_text(argv[i]));
+          auto size = static_cast<uint32_t>(sqlite3_value_bytes(argv[i]));
+          AppendPod(args, size);
+          args.append(text, size);
+          break;
+        }
+        case SQLITE_BLOB: {
+          const auto* blob =
+              static_cast<const char*>(sqlite3_value_blob(argv[i]));
+          auto size = static_cast<uint32_t>(sqlite3_value_bytes(argv[i]));
+          AppendPod(args, size);
+          args.append(blob, size);
+          break;
+        }
+        case SQLITE_NULL:
+          break;
+      }
+    }
+    return args;
+  }
+
+  // Encodes the arguments of a call with a single int argument.
+  static MemoizedArgs AsMemoizedArgs(int64_t arg) {
+    MemoizedArgs args;
+    args.push_back(static_cast<char>(SQLITE_INTEGER));
+    AppendPod(args, arg);
+    return args;
   }
 
   // Checks that the function has a single int argument and returns it.
-  static std::optional<MemoizedArgs> AsMemoizedArgs(size_t argc,
-                                                    sqlite3_value** argv) {
+  static std::optional<int64_t> AsSingleIntArg(size_t argc,
+                                               sqlite3_value** argv) {
     if (argc != 1) {
       return std::nullopt;
     }
@@ -212,11 +344,84 @@ class Memoizer {
     return arg.AsLong();
   }
 
-  bool enabled() const { return enabled_; }
+  bool persistent() const { return persistent_; }
 
  private:
-  bool enabled_ = false;
-  base::FlatHashMap<MemoizedArgs, StoredSqlValue> memoized_values_;
+  struct Entry {
+    // Approximate memory used by an entry, including the hash map slot.
+    size_t size() const {
+      size_t res = sizeof(Entry) + sizeof(MemoizedArgs) + 4 * sizeof(void*) +
+                   2 * args.size();
+      if (const auto* str = std::get_if<StoredSqlValue::OwnedString>(
+              &value.data)) {
+        res += (*str)->size();
+      } else if (const auto* bytes = std::get_if<StoredSqlValue::OwnedBytes>(
+                     &value.data)) {
+        res += (*bytes)->size();
+      }
+      return res;
+    }
+
+    MemoizedArgs args;
+    StoredSqlValue value;
+  };
+  using EntryIt = std::list<Entry>::iterator;
+
+  template <typename T>
+  static void AppendPod(MemoizedArgs& args, T value) {
+    args.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void Remove(EntryIt it) {
+    memoized_bytes_ -= it->size();
+    entries_.Erase(it->args);
+    lru_.erase(it);
+  }
+
+  // Increments |counter| in the stats of the engine and of the current query.
+  void Count(uint64_t PerfettoSqlEngine::FunctionMemoizationStats::*counter) {
+    memoization_->stats.*counter += 1;
+    if (memoization_->query_stats)
+      memoization_->query_stats->*counter += 1;
+  }
+
+  // Drops the values memoized automatically by a previous statement. The
+  // values are normally dropped by the engine when the statement is done:
+  // this catches the statements of queries stepped alternately.
+  void MaybeDropStaleValues() {
+    if (persistent_ ||
+        statement_generation_ == memoization_->statement_generation) {
+      return;
+    }
+    DropValues();
+    gave_up_for_statement_ = false;
+    hits_in_statement_ = 0;
+    misses_in_statement_ = 0;
+    statement_generation_ = memoization_->statement_generation;
+  }
+
+  void DropValues() {
+    if (persistent_) {
+      return;
+    }
+    entries_.Clear();
+    lru_.clear();
+    memoized_bytes_ = 0;
+    memoization_->statement_droppers.Erase(this);
+  }
+
+  PerfettoSqlEngine::FunctionMemoization* memoization_;
+  bool persistent_ = false;
+  bool auto_memoization_disabled_ = false;
+  bool gave_up_for_statement_ = false;
+  uint64_t statement_generation_ = 0;
+  uint32_t hits_in_statement_ = 0;
+  uint32_t misses_in_statement_ = 0;
+  size_t memoized_bytes_ = 0;
+
+  // The memoized values, from the most to the least recently used.
+  std::list<Entry> lru_;
+  base::FlatHashMap<MemoizedArgs, EntryIt> entries_;
 };
 
 // A helper to unroll recursive calls: to minimise the amount of stack space
@@ -283,7 +488,8 @@ class RecursiveCallUnroller {
       : engine_(engine),
         stmt_(stmt),
         prototype_(prototype),
-        memoizer_(memoizer) {}
+        memoizer_(memoizer),
+        memoization_(engine->function_memoization()) {}
 
   // Whether we should just return null due to us being in the "first pass".
   enum class FunctionCallState {
@@ -291,8 +497,7 @@ class RecursiveCallUnroller {
     kEvaluate,
   };
 
-  base::StatusOr<FunctionCallState> OnFunctionCall(
-      Memoizer::MemoizedArgs args) {
+  base::StatusOr<FunctionCallState> OnFunctionCall(int64_t args) {
     // If we are in the second pass, we just continue the function execution,
     // including checking if a memoized value is available and returning it.
     //
@@ -305,7 +510,7 @@ class RecursiveCallUnroller {
     if (state_ == State::kComputingSecondPass) {
       return FunctionCallState::kEvaluate;
     }
-    if (!memoizer_.HasMemoizedValue(args)) {
+    if (!memoizer_.HasMemoizedValue(Memoizer::AsMemoizedArgs(args))) {
       ArgState* state = visited_.Find(args);
       if (state) {
         // Detect recursive loops, e.g. f(1) calling f(2) calling f(1).
@@ -320,7 +525,7 @@ class RecursiveCallUnroller {
     return FunctionCallState::kIgnoreDueToFirstPass;
   }
 
-  base::Status Run(Memoizer::MemoizedArgs initial_args) {
+  base::Status Run(int64_t initial_args) {
     PERFETTO_TP_TRACE(metatrace::Category::FUNCTION_CALL,
                       "UNROLL_RECURSIVE_FUNCTION_CALL",
                       [&](metatrace::Record* r) {
@@ -335,7 +540,7 @@ class RecursiveCallUnroller {
       // If we have scheduled first pass calls, we evaluate them first.
       if (!first_pass_.empty()) {
         state_ = State::kComputingFirstPass;
-        Memoizer::MemoizedArgs args = first_pass_.front();
+        int64_t args = first_pass_.front();
 
         PERFETTO_TP_TRACE(metatrace::Category::FUNCTION_CALL,
                           "SQL_FUNCTION_CALL", [&](metatrace::Record* r) {
@@ -346,12 +551,14 @@ class RecursiveCallUnroller {
 
         first_pass_.pop();
         second_pass_.push(args);
+        memoization_->first_passes_in_progress++;
         Evaluate(args).status();
+        memoization_->first_passes_in_progress--;
         continue;
       }
 
       state_ = State::kComputingSecondPass;
-      Memoizer::MemoizedArgs args = second_pass_.top();
+      int64_t args = second_pass_.top();
 
       PERFETTO_TP_TRACE(metatrace::Category::FUNCTION_CALL, "SQL_FUNCTION_CALL",
                         [&](metatrace::Record* r) {
@@ -369,7 +576,8 @@ class RecursiveCallUnroller {
         continue;
       }
       visited_.Insert(args, ArgState::kEvaluated);
-      memoizer_.Memoize(args, SqlValue::Long(*maybe_int_result));
+      memoizer_.Memoize(Memoizer::AsMemoizedArgs(args),
+                        SqlValue::Long(*maybe_int_result));
     }
     return base::OkStatus();
   }
@@ -379,7 +587,7 @@ class RecursiveCallUnroller {
   // - base::ErrStatus if the evaluation of the function failed.
   // - std::nullopt if the function returned a non-integer value.
   // - the result of the function otherwise.
-  base::StatusOr<std::optional<int64_t>> Evaluate(Memoizer::MemoizedArgs args) {
+  base::StatusOr<std::optional<int64_t>> Evaluate(int64_t args) {
     RETURN_IF_ERROR(MaybeBindIntArgument(stmt_, prototype_.function_name,
                                          prototype_.arguments[0], args));
     base::StatusOr<SqlValue> result = EvaluateScalarStatement(
@@ -397,6 +605,7 @@ class RecursiveCallUnroller {
   sqlite3_stmt* stmt_;
   const FunctionPrototype& prototype_;
   Memoizer& memoizer_;
+  PerfettoSqlEngine::FunctionMemoization* memoization_;
 
   // Current state of the evaluation.
   enum class State {
@@ -413,9 +622,9 @@ class RecursiveCallUnroller {
   };
 
   // See the class-level comment for the explanation of the two passes.
-  std::queue<Memoizer::MemoizedArgs> first_pass_;
-  base::FlatHashMap<Memoizer::MemoizedArgs, ArgState> visited_;
-  std::stack<Memoizer::MemoizedArgs> second_pass_;
+  std::queue<int64_t> first_pass_;
+  base::FlatHashMap<int64_t, ArgState> visited_;
+  std::stack<int64_t> second_pass_;
 };
 
 }  // namespace
@@ -425,7 +634,8 @@ class RecursiveCallUnroller {
 // of the function (e.g. when the function is called recursively).
 class State : public CreatedFunction::Context {
  public:
-  explicit State(PerfettoSqlEngine* engine) : engine_(engine) {}
+  explicit State(PerfettoSqlEngine* engine)
+      : engine_(engine), memoizer_(engine) {}
   ~State() override;
 
   // Prepare a statement and push it into the stack of allocated statements
@@ -484,7 +694,7 @@ class State : public CreatedFunction::Context {
   }
 
   base::StatusOr<RecursiveCallUnroller::FunctionCallState> OnFunctionCall(
-      Memoizer::MemoizedArgs args) {
+      int64_t args) {
     if (!recursive_call_unroller_) {
       return RecursiveCallUnroller::FunctionCallState::kEvaluate;
     }
@@ -492,14 +702,14 @@ class State : public CreatedFunction::Context {
   }
 
   // Called before checking the function for memoization.
-  base::Status UnrollRecursiveCallIfNeeded(Memoizer::MemoizedArgs args) {
-    if (!memoizer_.enabled() || !is_in_recursive_call() ||
+  base::Status UnrollRecursiveCallIfNeeded(int64_t args) {
+    if (!memoizer_.persistent() || !is_in_recursive_call() ||
         recursive_call_unroller_) {
       return base::OkStatus();
     }
     // If we are in a recursive call, we need to check if we have already
     // computed the result for the current arguments.
-    if (memoizer_.HasMemoizedValue(args)) {
+    if (memoizer_.HasMemoizedValue(Memoizer::AsMemoizedArgs(args))) {
       return base::OkStatus();
     }
 
@@ -621,15 +831,15 @@ base::Status CreatedFunction::Run(CreatedFunction::Context* ctx,
     }
   }
 
-  std::optional<Memoizer::MemoizedArgs> memoized_args =
-      Memoizer::AsMemoizedArgs(argc, argv);
-
-  if (memoized_args) {
+  // Recursive calls can only be unrolled for functions with a single int
+  // argument.
+  std::optional<int64_t> int_arg = Memoizer::AsSingleIntArg(argc, argv);
+  if (int_arg) {
     // If we are in the middle of an recursive calls unrolling, we might want to
     // ignore the function invocation. See the comment in RecursiveCallUnroller
     // for more details.
     base::StatusOr<RecursiveCallUnroller::FunctionCallState> unroll_state =
-        state->OnFunctionCall(*memoized_args);
+        state->OnFunctionCall(*int_arg);
     RETURN_IF_ERROR(unroll_state.status());
     if (*unroll_state ==
         RecursiveCallUnroller::FunctionCallState::kIgnoreDueToFirstPass) {
@@ -637,14 +847,21 @@ base::Status CreatedFunction::Run(CreatedFunction::Context* ctx,
       return base::OkStatus();
     }
 
-    RETURN_IF_ERROR(state->UnrollRecursiveCallIfNeeded(*memoized_args));
+    RETURN_IF_ERROR(state->UnrollRecursiveCallIfNeeded(*int_arg));
+  }
 
+  Memoizer& memoizer = state->memoizer();
+  std::optional<Memoizer::MemoizedArgs> memoized_args;
+  if (memoizer.IsMemoizing()) {
+    memoized_args = Memoizer::AsMemoizedArgs(argc, argv);
     std::optional<SqlValue> memoized_value =
-        state->memoizer().GetMemoizedValue(*memoized_args);
+        memoizer.GetMemoizedValue(*memoized_args);
     if (memoized_value) {
       out = *memoized_value;
       return base::OkStatus();
     }
+  } else {
+    memoizer.CountMiss();
   }
 
   PERFETTO_TP_TRACE(
@@ -670,7 +887,7 @@ base::Status CreatedFunction::Run(CreatedFunction::Context* ctx,
   state->ScheduleEmptyStatementValidation(state->CurrentStatement());
 
   if (memoized_args) {
-    state->memoizer().Memoize(*memoized_args, out);
+    memoizer.Memoize(*memoized_args, out);
   }
 
   return base::OkStatus();
@@ -691,6 +908,13 @@ base::Status CreatedFunction::Prepare(CreatedFunction::Context* ctx,
                                       sql_argument::Type return_type,
                                       SqlSource source) {
   State* state = static_cast<State*>(ctx);
+  SqliteEngine* sqlite_engine = state->engine()->sqlite_engine();
+  if (CallsNonDeterministicFunction(*sqlite_engine, source)) {
+    // The function itself is not deterministic: this matters to the
+    // functions calling it.
+    sqlite_engine->MarkFunctionNonDeterministic(prototype.function_name);
+    state->memoizer().DisableAutoMemoization();
+  }
   state->Reset(std::move(prototype), return_type, std::move(source));
 
   // Ideally, we would unregister the function here if the statement prep
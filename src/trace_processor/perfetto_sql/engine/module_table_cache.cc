@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/perfetto_sql/engine/module_table_cache.h"
+
+#include <fcntl.h>
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/proc_utils.h"
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/hash.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/uuid.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/runtime_table.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+// Bump when changing the format of the files below.
+constexpr char kMagic[] = "PTMC";
+constexpr uint32_t kFormatVersion = 1;
+
+// The type of each cell in the file.
+enum class CellType : uint8_t {
+  kNull = 0,
+  kLong = 1,
+  kDouble = 2,
+  kString = 3,
+};
+
+// File format (all integers are little endian):
+//   "PTMC" | version:u32 | key:str | columns:u32 | rows:u32
+//   column names: str * columns
+//   cells, column by column: (type:u8 [payload]) * rows * columns
+// where str is len:u32 followed by the bytes and the payload is an int64 for
+// kLong, a double for kDouble and a str for kString.
+class Writer {
+ public:
+  template <typename T>
+  void Write(T value) {
+    buf_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+  void WriteString(const char* data, size_t size) {
+    Write(static_cast<uint32_t>(size));
+    buf_.append(data, size);
+  }
+  const std::string& buf() const { return buf_; }
+
+ private:
+  std::string buf_;
+};
+
+class Reader {
+ public:
+  explicit Reader(const std::string& buf) : buf_(buf) {}
+
+  template <typename T>
+  bool Read(T* value) {
+    if (buf_.size() - pos_ < sizeof(T))
+      return false;
+    memcpy(value, buf_.data() + pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+  bool ReadString(std::string* value) {
+    uint32_t size;
+    if (!Read(&size) || buf_.size() - pos_ < size)
+      return false;
+    value->assign(buf_.data() + pos_, size);
+    pos_ += size;
+    return true;
+  }
+  bool at_end() const { return pos_ == buf_.size(); }
+
+ private:
+  const std::string& buf_;
+  size_t pos_ = 0;
+};
+
+}  // namespace
+
+ModuleTableCache::ModuleTableCache(std::string dir, std::string trace_key)
+    : dir_(std::move(dir)), trace_key_(std::move(trace_key)) {}
+
+std::string ModuleTableCache::KeyForTable(const std::string& include_key,
+                                          const std::string& module_sql,
+                                          const std::string& table_name,
+                                          uint64_t modules_hash) const {
+  base::StackString<64> hashes("%" PRIx64 ":%" PRIx64,
+                               base::Hasher::Combine(module_sql), modules_hash);
+  return trace_key_ + "\n" + include_key + "\n" + table_name + "\n" +
+         hashes.ToStdString();
+}
+
+std::string ModuleTableCache::PathForKey(const std::string& key) const {
+  base::StackString<32> name("%016" PRIx64 ".table",
+                             base::Hasher::Combine(key));
+  return dir_ + "/" + name.ToStdString();
+}
+
+std::unique_ptr<RuntimeTable> ModuleTableCache::Load(const std::string& key,
+                                                     StringPool* pool) const {
+  std::string path = PathForKey(key);
+  std::string buf;
+  if (!base::FileExists(path) || !base::ReadFile(path, &buf))
+    return nullptr;
+
+  Reader reader(buf);
+  char magic[4];
+  uint32_t version;
+  std::string stored_key;
+  uint32_t column_count;
+  uint32_t row_count;
+  if (!reader.Read(&magic) || memcmp(magic, kMagic, sizeof(magic)) != 0 ||
+      !reader.Read(&version) || version != kFormatVersion ||
+      !reader.ReadString(&stored_key) || !reader.Read(&column_count) ||
+      !reader.Read(&row_count)) {
+    PERFETTO_ELOG("Module table cache: ignoring invalid file %s", path.c_str());
+    return nullptr;
+  }
+  // Different keys can (very rarely) map to the same file.
+  if (stored_key != key)
+    return nullptr;
+
+  std::vector<std::string> column_names(column_count);
+  for (std::string& name : column_names) {
+    if (!reader.ReadString(&name)) {
+      PERFETTO_ELOG("Module table cache: truncated file %s", path.c_str());
+      return nullptr;
+    }
+  }
+
+  RuntimeTable::Builder builder(pool, column_names);
+  std::string str;
+  bool valid = true;
+  for (uint32_t col = 0; col < column_count && valid; ++col) {
+    for (uint32_t row = 0; row < row_count && valid; ++row) {
+      uint8_t type;
+      valid = reader.Read(&type);
+      if (!valid)
+        break;
+      base::Status status;
+      switch (static_cast<CellType>(type)) {
+        case CellType::kNull:
+          status = builder.AddNull(col);
+          break;
+        case CellType::kLong: {
+          int64_t value;
+          valid = reader.Read(&value);
+          if (valid)
+            status = builder.AddInteger(col, value);
+          break;
+        }
+        case CellType::kDouble: {
+          double value;
+          valid = reader.Read(&value);
+          if (valid)
+            status = builder.AddFloat(col, value);
+          break;
+        }
+        case CellType::kString:
+          valid = reader.ReadString(&str);
+          if (valid)
+            status = builder.AddText(col, str.c_str());
+          break;
+        default:
+          valid = false;
+          break;
+      }
+      valid = valid && status.ok();
+    }
+  }
+  if (!valid || !reader.at_end()) {
+    PERFETTO_ELOG("Module table cache: ignoring invalid file %s", path.c_str());
+    return nullptr;
+  }
+  auto table = std::move(builder).Build(row_count);
+  if (!table.ok()) {
+    PERFETTO_ELOG("Module table cache: ignoring invalid file %s: %s",
+                  path.c_str(), table.status().c_message());
+    return nullptr;
+  }
+  return std::move(*table);
+}
+
+base::Status ModuleTableCache::Store(
+    const std::string& key,
+    const std::vector<std::string>& column_names,
+    const RuntimeTable& table) const {
+  Writer writer;
+  for (size_t i = 0; i < 4; ++i)
+    writer.Write(kMagic[i]);
+  writer.Write(kFormatVersion);
+  writer.WriteString(key.data(), key.size());
+  const auto column_count = static_cast<uint32_t>(column_names.size());
+  writer.Write(column_count);
+  writer.Write(table.row_count());
+  for (const std::string& name : column_names)
+    writer.WriteString(name.data(), name.size());
+
+  // The table also has a hidden _auto_id column after the ones in
+  // |column_names|: it is recreated when the table is loaded.
+  for (uint32_t col = 0; col < column_count; ++col) {
+    for (auto it = table.IterateRows(); it; ++it) {
+      SqlValue value = it.Get(col);
+      switch (value.type) {
+        case SqlValue::kNull:
+          writer.Write(CellType::kNull);
+          break;
+        case SqlValue::kLong:
+          writer.Write(CellType::kLong);
+          writer.Write(value.long_value);
+          break;
+        case SqlValue::kDouble:
+          writer.Write(CellType::kDouble);
+          writer.Write(value.double_value);
+          break;
+        case SqlValue::kString:
+          writer.Write(CellType::kString);
+          writer.WriteString(value.string_value, strlen(value.string_value));
+          break;
+        case SqlValue::kBytes:
+          return base::ErrStatus("Bytes columns cannot be cached");
+      }
+    }
+  }
+
+  // Write to a temporary file first so that concurrent trace processor
+  // instances never see a partially written table. The name of the temporary
+  // file is unique so that instances storing the same table at the same time
+  // don't write into each other's file.
+  std::string path = PathForKey(key);
+  base::StackString<64> suffix(
+      ".%" PRIu64 ".%016" PRIx64 ".tmp",
+      static_cast<uint64_t>(base::GetProcessId()),
+      static_cast<uint64_t>(base::Uuidv4().lsb()));
+  std::string tmp_path = path + suffix.ToStdString();
+  {
+    base::ScopedFile fd(base::OpenFile(
+        tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_EXCL, 0644));
+    if (!fd) {
+      return base::ErrStatus("Failed to create %s", tmp_path.c_str());
+    }
+    const std::string& buf = writer.buf();
+    if (base::WriteAll(*fd, buf.data(), buf.size()) !=
+        static_cast<ssize_t>(buf.size())) {
+      fd.reset();
+      remove(tmp_path.c_str());
+      return base::ErrStatus("Failed to write %s", tmp_path.c_str());
+    }
+  }
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    remove(tmp_path.c_str());
+    return base::ErrStatus("Failed to rename %s", tmp_path.c_str());
+  }
+  return base::OkStatus();
+}
+
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_PERFETTO_SQL_ENGINE_MODULE_TABLE_CACHE_H_
+#define SRC_TRACE_PROCESSOR_PERFETTO_SQL_ENGINE_MODULE_TABLE_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/runtime_table.h"
+
+namespace perfetto::trace_processor {
+
+// On-disk cache of the tables created by the CREATE PERFETTO TABLE statements
+// of SQL modules.
+//
+// The contents of these tables only depend on the trace and on the SQL of the
+// modules: when the same module is included again on the same trace (e.g. by
+// a new trace processor instance loading the trace again), the table can be
+// loaded from disk instead of re-running its (potentially very expensive)
+// query.
+//
+// Entries are content addressed: the key of a table contains the id of the
+// trace, the SQL of the module file creating it and a hash of the SQL of all
+// the modules (which the module might depend on). Changing any of these simply
+// results in a cache miss. Entries are never evicted: that is left to the
+// owner of the directory.
+class ModuleTableCache {
+ public:
+  // |dir| is the directory where the tables are stored and must exist.
+  // |trace_key| identifies the trace (and anything else the contents of the
+  // tables depend on, e.g. the version of trace processor).
+  ModuleTableCache(std::string dir, std::string trace_key);
+
+  // Returns the key of the table |table_name| created by the module file
+  // with include key |include_key| and SQL |module_sql|. |modules_hash| is a
+  // hash of the SQL of all the registered modules.
+  std::string KeyForTable(const std::string& include_key,
+                          const std::string& module_sql,
+                          const std::string& table_name,
+                          uint64_t modules_hash) const;
+
+  // Returns the table stored with |key| or nullptr if there is none (or it
+  // cannot be read).
+  std::unique_ptr<RuntimeTable> Load(const std::string& key,
+                                     StringPool* pool) const;
+
+  // Stores |table|, whose columns are named |column_names|, with |key|.
+  base::Status Store(const std::string& key,
+                     const std::vector<std::string>& column_names,
+                     const RuntimeTable& table) const;
+
+ private:
+  std::string PathForKey(const std::string& key) const;
+
+  std::string dir_;
+  std::string trace_key_;
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_PERFETTO_SQL_ENGINE_MODULE_TABLE_CACHE_H_
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/perfetto_sql/engine/module_table_cache.h"
+
+#include <fcntl.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "src/base/test/tmp_dir_tree.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+class ModuleTableCacheTest : public ::testing::Test {
+ protected:
+  ~ModuleTableCacheTest() override {
+    // The files are created by the cache: make sure they are removed.
+    std::vector<std::string> files;
+    base::ListFilesRecursive(tmp_.path(), files);
+    for (const std::string& file : files) {
+      tmp_.TrackFile(file);
+    }
+  }
+
+  std::unique_ptr<RuntimeTable> CreateTable() {
+    RuntimeTable::Builder builder(&pool_, {"id", "dur", "name"});
+    EXPECT_TRUE(builder.AddInteger(0, 1).ok());
+    EXPECT_TRUE(builder.AddFloat(1, 1.5).ok());
+    EXPECT_TRUE(builder.AddText(2, "foo").ok());
+    EXPECT_TRUE(builder.AddInteger(0, 2).ok());
+    EXPECT_TRUE(builder.AddNull(1).ok());
+    EXPECT_TRUE(builder.AddNull(2).ok());
+    auto table = std::move(builder).Build(2);
+    EXPECT_TRUE(table.ok());
+    return std::move(*table);
+  }
+
+  base::TmpDirTree tmp_;
+  StringPool pool_;
+  ModuleTableCache cache_{tmp_.path(), "trace"};
+};
+
+TEST_F(ModuleTableCacheTest, Miss) {
+  std::string key = cache_.KeyForTable("foo.bar", "sql", "table", 0);
+  ASSERT_EQ(cache_.Load(key, &pool_), nullptr);
+}
+
+TEST_F(ModuleTableCacheTest, StoreAndLoad) {
+  std::string key = cache_.KeyForTable("foo.bar", "sql", "table", 0);
+  auto table = CreateTable();
+  ASSERT_TRUE(cache_.Store(key, {"id", "dur", "name"}, *table).ok());
+
+  auto loaded = cache_.Load(key, &pool_);
+  ASSERT_NE(loaded, nullptr);
+  ASSERT_EQ(loaded->row_count(), 2u);
+
+  auto it = loaded->IterateRows();
+  ASSERT_EQ(it.Get(0).AsLong(), 1);
+  ASSERT_EQ(it.Get(1).AsDouble(), 1.5);
+  ASSERT_STREQ(it.Get(2).AsString(), "foo");
+  ++it;
+  ASSERT_EQ(it.Get(0).AsLong(), 2);
+  ASSERT_TRUE(it.Get(1).is_null());
+  ASSERT_TRUE(it.Get(2).is_null());
+}
+
+TEST_F(ModuleTableCacheTest, DifferentKeys) {
+  std::string key = cache_.KeyForTable("foo.bar", "sql", "table", 0);
+  auto table = CreateTable();
+  ASSERT_TRUE(cache_.Store(key, {"id", "dur", "name"}, *table).ok());
+
+  // Changing the module, its SQL or the other modules must miss.
+  ASSERT_EQ(cache_.Load(cache_.KeyForTable("foo.baz", "sql", "table", 0),
+                        &pool_),
+            nullptr);
+  ASSERT_EQ(cache_.Load(cache_.KeyForTable("foo.bar", "sql2", "table", 0),
+                        &pool_),
+            nullptr);
+  ASSERT_EQ(cache_.Load(cache_.KeyForTable("foo.bar", "sql", "table", 1),
+                        &pool_),
+            nullptr);
+
+  // So must changing the trace.
+  ModuleTableCache other_trace(tmp_.path(), "other_trace");
+  ASSERT_EQ(other_trace.Load(
+                other_trace.KeyForTable("foo.bar", "sql", "table", 0), &pool_),
+            nullptr);
+}
+
+TEST_F(ModuleTableCacheTest, StoreTwice) {
+  // Storing a table which is already cached (e.g. by another instance)
+  // replaces it and leaves no temporary file behind.
+  std::string key = cache_.KeyForTable("foo.bar", "sql", "table", 0);
+  auto table = CreateTable();
+  ASSERT_TRUE(cache_.Store(key, {"id", "dur", "name"}, *table).ok());
+  ASSERT_TRUE(cache_.Store(key, {"id", "dur", "name"}, *table).ok());
+
+  std::vector<std::string> files;
+  ASSERT_TRUE(base::ListFilesRecursive(tmp_.path(), files).ok());
+  ASSERT_EQ(files.size(), 1u);
+  ASSERT_NE(cache_.Load(key, &pool_), nullptr);
+}
+
+TEST_F(ModuleTableCacheTest, CorruptFile) {
+  std::string key = cache_.KeyForTable("foo.bar", "sql", "table", 0);
+  auto table = CreateTable();
+  ASSERT_TRUE(cache_.Store(key, {"id", "dur", "name"}, *table).ok());
+
+  std::vector<std::string> files;
+  ASSERT_TRUE(base::ListFilesRecursive(tmp_.path(), files).ok());
+  ASSERT_EQ(files.size(), 1u);
+  std::string path = tmp_.AbsolutePath(files[0]);
+  std::string contents;
+  ASSERT_TRUE(base::ReadFile(path, &contents));
+
+  // Truncate the file.
+  base::ScopedFile fd(base::OpenFile(path, O_WRONLY | O_TRUNC));
+  ASSERT_TRUE(fd);
+  ASSERT_TRUE(base::WriteAll(*fd, contents.data(), contents.size() - 1) > 0);
+  fd.reset();
+  ASSERT_EQ(cache_.Load(key, &pool_), nullptr);
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/perfetto_sql/engine/native_group_by.h"
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/status_or.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "src/trace_processor/db/group_by_executor.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/perfetto_sql/engine/table_pointer_module.h"
+#include "src/trace_processor/sqlite/bindings/sqlite_result.h"
+#include "src/trace_processor/sqlite/scoped_db.h"
+#include "src/trace_processor/sqlite/sql_source.h"
+#include "src/trace_processor/sqlite/sqlite_tokenizer.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+using Output = GroupByExecutor::Output;
+
+std::optional<uint32_t> ColumnIndex(const Table& table, std::string_view name) {
+  const auto& cols = table.columns();
+  for (uint32_t i = 0; i < cols.size(); ++i) {
+    if (base::CaseInsensitiveEqual(cols[i].name(), std::string(name))) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<Output::Type> AggregateType(std::string_view name) {
+  std::string lower = base::ToLower(std::string(name));
+  if (lower == "count")
+    return Output::Type::kCount;
+  if (lower == "sum")
+    return Output::Type::kSum;
+  if (lower == "min")
+    return Output::Type::kMin;
+  if (lower == "max")
+    return Output::Type::kMax;
+  if (lower == "avg")
+    return Output::Type::kAvg;
+  return std::nullopt;
+}
+
+const char* SpecPrefix(Output::Type type) {
+  switch (type) {
+    case Output::Type::kGroupByColumn:
+      return "key";
+    case Output::Type::kCount:
+      return "count";
+    case Output::Type::kSum:
+      return "sum";
+    case Output::Type::kMin:
+      return "min";
+    case Output::Type::kMax:
+      return "max";
+    case Output::Type::kAvg:
+      return "avg";
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+base::StatusOr<Output> ParseOutputSpec(const Table& table,
+                                       const std::string& spec) {
+  size_t colon = spec.find(':');
+  if (colon == std::string::npos) {
+    return base::ErrStatus("Invalid output '%s'", spec.c_str());
+  }
+  std::string prefix = spec.substr(0, colon);
+  std::string col = spec.substr(colon + 1);
+
+  Output output;
+  if (prefix == "key") {
+    output.type = Output::Type::kGroupByColumn;
+  } else if (auto type = AggregateType(prefix); type) {
+    output.type = *type;
+  } else {
+    return base::ErrStatus("Invalid output '%s'", spec.c_str());
+  }
+  if (col.empty()) {
+    if (output.type != Output::Type::kCount) {
+      return base::ErrStatus("Missing column in output '%s'", spec.c_str());
+    }
+    return output;
+  }
+  output.col_idx = ColumnIndex(table, col);
+  if (!output.col_idx) {
+    return base::ErrStatus("Unknown column '%s'", col.c_str());
+  }
+  if (!GroupByExecutor::IsSupported(table.columns()[*output.col_idx],
+                                    output.type)) {
+    return base::ErrStatus("Unsupported output '%s'", spec.c_str());
+  }
+  return output;
+}
+
+base::StatusOr<std::unique_ptr<RuntimeTable>> GroupBy(
+    const NativeGroupBy::Context& ctx,
+    int argc,
+    sqlite3_value** argv) {
+  if (argc < 3) {
+    return base::ErrStatus("%s: expected at least 3 arguments",
+                           NativeGroupBy::kName);
+  }
+  std::vector<std::string> args;
+  for (int i = 0; i < argc; ++i) {
+    if (sqlite3_value_type(argv[i]) != SQLITE_TEXT) {
+      return base::ErrStatus("%s: all arguments must be strings",
+                             NativeGroupBy::kName);
+    }
+    args.emplace_back(
+        reinterpret_cast<const char*>(sqlite3_value_text(argv[i])));
+  }
+
+  const Table* table = ctx.get_table(args[0]);
+  if (!table) {
+    return base::ErrStatus("%s: unknown table '%s'", NativeGroupBy::kName,
+                           args[0].c_str());
+  }
+
+  std::vector<uint32_t> group_by;
+  for (const std::string& col : base::SplitString(args[1], ",")) {
+    std::optional<uint32_t> idx = ColumnIndex(*table, col);
+    if (!idx) {
+      return base::ErrStatus("%s: unknown column '%s'", NativeGroupBy::kName,
+                             col.c_str());
+    }
+    group_by.push_back(*idx);
+  }
+  if (group_by.empty()) {
+    return base::ErrStatus("%s: no group by columns", NativeGroupBy::kName);
+  }
+
+  std::vector<Output> outputs;
+  std::vector<std::string> col_names;
+  for (uint32_t i = 2; i < args.size(); ++i) {
+    base::StatusOr<Output> output = ParseOutputSpec(*table, args[i]);
+    if (!output.ok()) {
+      return base::ErrStatus("%s: %s", NativeGroupBy::kName,
+                             output.status().c_message());
+    }
+    outputs.push_back(*output);
+    col_names.push_back("c" + std::to_string(i - 2));
+  }
+  return GroupByExecutor::GroupBy(*table, group_by, outputs,
+                                  std::move(col_names), ctx.pool);
+}
+
+// Returns whether |tok| is an unquoted identifier.
+bool IsIdentifier(const SqliteTokenizer::Token& tok) {
+  return tok.token_type == SqliteTokenType::TK_ID && !tok.str.empty() &&
+         (isalpha(static_cast<unsigned char>(tok.str[0])) ||
+          tok.str[0] == '_');
+}
+
+bool IsKeyword(const SqliteTokenizer::Token& tok, const char* keyword) {
+  return tok.token_type == SqliteTokenType::TK_GENERIC_KEYWORD &&
+         base::CaseInsensitiveEqual(std::string(tok.str), keyword);
+}
+
+std::string QuoteName(std::string_view name) {
+  std::string res = "\"";
+  for (char c : name) {
+    res += c;
+    if (c == '"')
+      res += '"';
+  }
+  return res + "\"";
+}
+
+// Returns the names of the result columns of |sql| or std::nullopt if it
+// cannot be prepared.
+std::optional<std::vector<std::string>> ColumnNames(sqlite3* db,
+                                                    const SqlSource& sql) {
+  sqlite3_stmt* raw_stmt = nullptr;
+  int err = sqlite3_prepare_v2(db, sql.sql().c_str(),
+                               static_cast<int>(sql.sql().size()), &raw_stmt,
+                               nullptr);
+  ScopedStmt stmt(raw_stmt);
+  if (err != SQLITE_OK || !stmt) {
+    return std::nullopt;
+  }
+  std::vector<std::string> names;
+  for (int i = 0; i < sqlite3_column_count(stmt.get()); ++i) {
+    const char* name = sqlite3_column_name(stmt.get(), i);
+    if (!name) {
+      return std::nullopt;
+    }
+    names.emplace_back(name);
+  }
+  return names;
+}
+
+// A single result column of the SELECT statement being rewritten.
+struct SelectItem {
+  // The name of the aggregate function or std::nullopt for a column.
+  std::optional<Output::Type> aggregate;
+
+  // The column read by this item or empty for COUNT(*).
+  std::string_view column;
+};
+
+// Parses the result columns of the statement up to and including the FROM
+// keyword.
+std::optional<std::vector<SelectItem>> ParseSelectItems(
+    SqliteTokenizer& tokenizer) {
+  std::vector<SelectItem> items;
+  for (;;) {
+    SqliteTokenizer::Token start = tokenizer.NextNonWhitespace();
+    if (!IsIdentifier(start)) {
+      return std::nullopt;
+    }
+    SelectItem item;
+    SqliteTokenizer::Token next = tokenizer.NextNonWhitespace();
+    if (next.token_type == SqliteTokenType::TK_LP) {
+      item.aggregate = AggregateType(start.str);
+      if (!item.aggregate) {
+        return std::nullopt;
+      }
+      SqliteTokenizer::Token arg = tokenizer.NextNonWhitespace();
+      if (arg.token_type == SqliteTokenType::TK_STAR &&
+          *item.aggregate == Output::Type::kCount) {
+        item.column = {};
+      } else if (IsIdentifier(arg)) {
+        item.column = arg.str;
+      } else {
+        return std::nullopt;
+      }
+      if (tokenizer.NextNonWhitespace().token_type != SqliteTokenType::TK_RP) {
+        return std::nullopt;
+      }
+      next = tokenizer.NextNonWhitespace();
+    } else {
+      item.column = start.str;
+    }
+
+    if (IsKeyword(next, "as")) {
+      next = tokenizer.NextNonWhitespace();
+      if (!IsIdentifier(next)) {
+        return std::nullopt;
+      }
+    }
+    if (IsIdentifier(next)) {
+      next = tokenizer.NextNonWhitespace();
+    }
+    items.push_back(item);
+
+    if (IsKeyword(next, "from")) {
+      return items;
+    }
+    if (next.token_type != SqliteTokenType::TK_COMMA) {
+      return std::nullopt;
+    }
+  }
+}
+
+}  // namespace
+
+void NativeGroupBy::Step(sqlite3_context* ctx,
+                         int argc,
+                         sqlite3_value** argv) {
+  auto* context = static_cast<Context*>(sqlite3_user_data(ctx));
+  base::StatusOr<std::unique_ptr<RuntimeTable>> table =
+      GroupBy(*context, argc, argv);
+  if (!table.ok()) {
+    return sqlite::result::Error(ctx, table.status().c_message());
+  }
+  return sqlite::result::RawPointer(
+      ctx, table->release(), "TABLE",
+      [](void* ptr) { delete static_cast<RuntimeTable*>(ptr); });
+}
+
+std::optional<SqlSource> NativeGroupBy::Rewrite(
+    const SqlSource& sql,
+    const std::function<const Table*(std::string_view)>& get_table,
+    sqlite3* db) {
+  SqliteTokenizer tokenizer(sql);
+  if (!IsKeyword(tokenizer.NextNonWhitespace(), "select")) {
+    return std::nullopt;
+  }
+  std::optional<std::vector<SelectItem>> items = ParseSelectItems(tokenizer);
+  if (!items || items->size() > TablePointerModule::kBindableColumnCount) {
+    return std::nullopt;
+  }
+
+  SqliteTokenizer::Token table_name = tokenizer.NextNonWhitespace();
+  if (!IsIdentifier(table_name) ||
+      !IsKeyword(tokenizer.NextNonWhitespace(), "group") ||
+      !IsKeyword(tokenizer.NextNonWhitespace(), "by")) {
+    return std::nullopt;
+  }
+  const Table* table = get_table(table_name.str);
+  if (!table) {
+    return std::nullopt;
+  }
+
+  std::vector<std::string> group_by;
+  for (;;) {
+    SqliteTokenizer::Token col = tokenizer.NextNonWhitespace();
+    if (!IsIdentifier(col)) {
+      return std::nullopt;
+    }
+    std::optional<uint32_t> idx = ColumnIndex(*table, col.str);
+    if (!idx) {
+      return std::nullopt;
+    }
+    group_by.emplace_back(table->columns()[*idx].name());
+
+    SqliteTokenizer::Token next = tokenizer.NextNonWhitespace();
+    if (next.IsTerminal()) {
+      // Anything after the end of the statement is not expected.
+      if (!tokenizer.NextNonWhitespace().str.empty()) {
+        return std::nullopt;
+      }
+      break;
+    }
+    if (next.token_type != SqliteTokenType::TK_COMMA) {
+      return std::nullopt;
+    }
+  }
+
+  std::vector<std::string> specs;
+  for (const SelectItem& item : *items) {
+    Output::Type type = item.aggregate.value_or(Output::Type::kGroupByColumn);
+    std::string col_name;
+    if (!item.column.empty()) {
+      std::optional<uint32_t> idx = ColumnIndex(*table, item.column);
+      if (!idx) {
+        return std::nullopt;
+      }
+      col_name = table->columns()[*idx].name();
+      if (type == Output::Type::kGroupByColumn &&
+          std::find(group_by.begin(), group_by.end(), col_name) ==
+              group_by.end()) {
+        return std::nullopt;
+      }
+      if (!GroupByExecutor::IsSupported(table->columns()[*idx], type)) {
+        return std::nullopt;
+      }
+    }
+    specs.push_back(std::string(SpecPrefix(type)) + ":" + col_name);
+  }
+
+  // The names of the result columns are not necessarily the text of the
+  // items (e.g. unaliased columns are named as in the table schema): ask
+  // SQLite rather than second-guessing it.
+  std::optional<std::vector<std::string>> names = ColumnNames(db, sql);
+  if (!names || names->size() != items->size()) {
+    return std::nullopt;
+  }
+
+  std::vector<std::string> select;
+  std::vector<std::string> bind;
+  for (uint32_t i = 0; i < names->size(); ++i) {
+    std::string col = "c" + std::to_string(i);
+    select.push_back(col + " AS " + QuoteName((*names)[i]));
+    bind.push_back("__intrinsic_table_ptr_bind(" + col + ", '" + col + "')");
+  }
+  std::string args = "'" + std::string(table_name.str) + "', '" +
+                     base::Join(group_by, ",") + "'";
+  for (const std::string& spec : specs) {
+    args += ", '" + spec + "'";
+  }
+  std::string rewritten = "SELECT " + base::Join(select, ", ") +
+                          " FROM __intrinsic_table_ptr(" + kName + "(" + args +
+                          ")) WHERE " + base::Join(bind, " AND ");
+  return sql.RewriteAllIgnoreExisting(
+      SqlSource::FromTraceProcessorImplementation(std::move(rewritten)));
+}
+
+}  // namespace perfetto::trace_processor
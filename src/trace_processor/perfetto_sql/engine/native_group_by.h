@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_PERFETTO_SQL_ENGINE_NATIVE_GROUP_BY_H_
+#define SRC_TRACE_PROCESSOR_PERFETTO_SQL_ENGINE_NATIVE_GROUP_BY_H_
+
+#include <sqlite3.h>
+
+#include <functional>
+#include <optional>
+#include <string_view>
+
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/sqlite/sql_source.h"
+
+namespace perfetto::trace_processor {
+
+// Support for running simple GROUP BY queries on trace processor tables with
+// GroupByExecutor instead of SQLite's generic aggregation.
+//
+// Only queries of the form:
+//   SELECT <item> [, <item>...] FROM <table> GROUP BY <col> [, <col>...]
+// are handled, where <table> is a runtime or static table and each <item> is
+// either one of the group by columns or one of COUNT(*), COUNT(col),
+// SUM(col), MIN(col), MAX(col) and AVG(col), with an optional alias. Any
+// other query (WHERE, HAVING, ORDER BY, expressions, quoted names etc.) is
+// left to SQLite.
+//
+// Such queries are rewritten to iterate the result of
+// __intrinsic_group_by() with the __intrinsic_table_ptr module, preserving
+// the names SQLite gives to the result columns of the original query.
+struct NativeGroupBy {
+  static constexpr char kName[] = "__intrinsic_group_by";
+
+  struct Context {
+    // Returns the table with the given name or nullptr if there is none.
+    std::function<const Table*(std::string_view)> get_table;
+    StringPool* pool;
+  };
+
+  // __intrinsic_group_by(table_name, group_by_columns, output...)
+  //
+  // |group_by_columns| is a comma separated list of column names. Each
+  // |output| is one of "key:<col>", "count:", "count:<col>", "sum:<col>",
+  // "min:<col>", "max:<col>" or "avg:<col>". The i-th output is returned as
+  // the column "c<i>" of the returned table pointer.
+  static void Step(sqlite3_context*, int argc, sqlite3_value** argv);
+
+  // Returns the rewritten version of |sql| if it is a query which can be
+  // computed with __intrinsic_group_by or std::nullopt otherwise. |sql| is
+  // prepared on |db| (but not run) to name the result columns of the
+  // rewritten query like SQLite names those of |sql|.
+  static std::optional<SqlSource> Rewrite(
+      const SqlSource& sql,
+      const std::function<const Table*(std::string_view)>& get_table,
+      sqlite3* db);
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_PERFETTO_SQL_ENGINE_NATIVE_GROUP_BY_H_
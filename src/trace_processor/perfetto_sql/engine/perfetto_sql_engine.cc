@@ -33,6 +33,7 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/hash.h"
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
@@ -41,6 +42,8 @@
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/perfetto_sql/engine/created_function.h"
 #include "src/trace_processor/perfetto_sql/engine/function_util.h"
+#include "src/trace_processor/perfetto_sql/engine/module_table_cache.h"
+#include "src/trace_processor/perfetto_sql/engine/native_group_by.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_parser.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_preprocessor.h"
 #include "src/trace_processor/perfetto_sql/engine/runtime_table_function.h"
@@ -167,8 +170,11 @@ std::string GetTokenNamesAllowedInMacro() {
 
 }  // namespace
 
-PerfettoSqlEngine::PerfettoSqlEngine(StringPool* pool)
-    : pool_(pool), engine_(new SqliteEngine()) {
+PerfettoSqlEngine::PerfettoSqlEngine(StringPool* pool,
+                                     base::ThreadPool* query_thread_pool)
+    : pool_(pool),
+      query_thread_pool_(query_thread_pool),
+      engine_(new SqliteEngine()) {
   // Initialize `perfetto_tables` table, which will contain the names of all of
   // the registered tables.
   char* errmsg_raw = nullptr;
@@ -188,22 +194,40 @@ PerfettoSqlEngine::PerfettoSqlEngine(StringPool* pool)
   }
   {
     auto ctx = std::make_unique<DbSqliteModule::Context>();
+    ctx->thread_pool = query_thread_pool;
+    ctx->batch_functions = &batch_functions_;
     runtime_table_context_ = ctx.get();
     engine_->RegisterVirtualTableModule<DbSqliteModule>("runtime_table",
                                                         std::move(ctx));
   }
   {
     auto ctx = std::make_unique<DbSqliteModule::Context>();
+    ctx->thread_pool = query_thread_pool;
+    ctx->batch_functions = &batch_functions_;
     static_table_context_ = ctx.get();
     engine_->RegisterVirtualTableModule<DbSqliteModule>("static_table",
                                                         std::move(ctx));
   }
   {
     auto ctx = std::make_unique<DbSqliteModule::Context>();
+    ctx->thread_pool = query_thread_pool;
+    ctx->batch_functions = &batch_functions_;
     static_table_fn_context_ = ctx.get();
     engine_->RegisterVirtualTableModule<DbSqliteModule>("static_table_function",
                                                         std::move(ctx));
   }
+  {
+    auto ctx = std::make_unique<NativeGroupBy::Context>();
+    ctx->get_table = [this](std::string_view name) {
+      return GetTableOrNull(name);
+    };
+    ctx->pool = pool_;
+    base::Status status = engine_->RegisterFunction(
+        NativeGroupBy::kName, -1, &NativeGroupBy::Step, ctx.release(),
+        [](void* ptr) { delete static_cast<NativeGroupBy::Context*>(ptr); },
+        false);
+    PERFETTO_CHECK(status.ok());
+  }
 }
 
 void PerfettoSqlEngine::RegisterStaticTable(const Table& table,
@@ -251,6 +275,15 @@ void PerfettoSqlEngine::RegisterStaticTableFunction(
   PERFETTO_CHECK(!static_table_fn_context_->temporary_create_state);
 }
 
+void PerfettoSqlEngine::RegisterBatchFunction(
+    std::unique_ptr<BatchSqlFunction> fn) {
+  std::string name = base::ToLower(fn->Name());
+  // Tables keep pointers to the functions: they cannot be replaced.
+  bool inserted =
+      batch_functions_.Insert(std::move(name), std::move(fn)).second;
+  PERFETTO_CHECK(inserted);
+}
+
 base::StatusOr<PerfettoSqlEngine::ExecutionStats> PerfettoSqlEngine::Execute(
     SqlSource sql) {
   auto res = ExecuteUntilLastStatement(std::move(sql));
@@ -288,6 +321,11 @@ PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
   ExecutionStats stats;
   PerfettoSqlParser parser(std::move(sql_source), macros_);
   while (parser.Next()) {
+    // The tables read by functions can change between statements: drop the
+    // results they memoized automatically.
+    DropStatementMemoization();
+    function_memoization_.statement_generation++;
+
     std::optional<SqlSource> source;
     if (auto* cf = std::get_if<PerfettoSqlParser::CreateFunction>(
             &parser.statement())) {
@@ -313,13 +351,23 @@ PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
       auto sql = macro->sql;
       RETURN_IF_ERROR(ExecuteCreateMacro(*macro));
       source = RewriteToDummySql(sql);
+    } else if (auto* create_index = std::get_if<PerfettoSqlParser::CreateIndex>(
+                   &parser.statement())) {
+      RETURN_IF_ERROR(AddTracebackIfNeeded(ExecuteCreateIndex(*create_index),
+                                           parser.statement_sql()));
+      source = RewriteToDummySql(parser.statement_sql());
+    } else if (auto* drop_index = std::get_if<PerfettoSqlParser::DropIndex>(
+                   &parser.statement())) {
+      RETURN_IF_ERROR(AddTracebackIfNeeded(ExecuteDropIndex(*drop_index),
+                                           parser.statement_sql()));
+      source = RewriteToDummySql(parser.statement_sql());
     } else {
       // If none of the above matched, this must just be an SQL statement
       // directly executable by SQLite.
       auto* sql =
           std::get_if<PerfettoSqlParser::SqliteSql>(&parser.statement());
       PERFETTO_CHECK(sql);
-      source = parser.statement_sql();
+      source = MaybeRewriteGroupBy(parser.statement_sql());
     }
 
     // Try to get SQLite to prepare the statement.
@@ -382,9 +430,20 @@ PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
   // Update the output statement and column count.
   stats.column_count =
       static_cast<uint32_t>(sqlite3_column_count(res->sqlite_stmt()));
+  if (res->IsDone()) {
+    DropStatementMemoization();
+  }
   return ExecutionResult{std::move(*res), stats};
 }
 
+void PerfettoSqlEngine::DropStatementMemoization() {
+  // The droppers unregister themselves: move them out before calling them.
+  auto droppers = std::move(function_memoization_.statement_droppers);
+  for (auto it = droppers.GetIterator(); it; ++it) {
+    it.value()();
+  }
+}
+
 base::Status PerfettoSqlEngine::RegisterRuntimeFunction(
     bool replace,
     const FunctionPrototype& prototype,
@@ -434,7 +493,8 @@ base::Status PerfettoSqlEngine::ExecuteCreateTable(
                     [&create_table](metatrace::Record* record) {
                       record->AddArg("Table", create_table.name);
                     });
-  auto stmt_or = engine_->PrepareStatement(create_table.sql);
+  auto stmt_or =
+      engine_->PrepareStatement(MaybeRewriteGroupBy(create_table.sql));
   RETURN_IF_ERROR(stmt_or.status());
   SqliteEngine::PreparedStatement stmt = std::move(stmt_or);
 
@@ -446,47 +506,29 @@ base::Status PerfettoSqlEngine::ExecuteCreateTable(
   RETURN_IF_ERROR(ValidateColumnNames(column_names, create_table.schema,
                                       "CREATE PERFETTO TABLE"));
 
-  size_t column_count = column_names.size();
-  RuntimeTable::Builder builder(pool_, std::move(column_names));
-  uint32_t rows = 0;
-  int res;
-  for (res = sqlite3_step(stmt.sqlite_stmt()); res == SQLITE_ROW;
-       ++rows, res = sqlite3_step(stmt.sqlite_stmt())) {
-    for (uint32_t i = 0; i < column_count; ++i) {
-      int int_i = static_cast<int>(i);
-      switch (sqlite3_column_type(stmt.sqlite_stmt(), int_i)) {
-        case SQLITE_NULL:
-          RETURN_IF_ERROR(builder.AddNull(i));
-          break;
-        case SQLITE_INTEGER:
-          RETURN_IF_ERROR(builder.AddInteger(
-              i, sqlite3_column_int64(stmt.sqlite_stmt(), int_i)));
-          break;
-        case SQLITE_FLOAT:
-          RETURN_IF_ERROR(builder.AddFloat(
-              i, sqlite3_column_double(stmt.sqlite_stmt(), int_i)));
-          break;
-        case SQLITE_TEXT: {
-          RETURN_IF_ERROR(builder.AddText(
-              i, reinterpret_cast<const char*>(
-                     sqlite3_column_text(stmt.sqlite_stmt(), int_i))));
-          break;
-        }
-        case SQLITE_BLOB:
-          return base::ErrStatus(
-              "CREATE PERFETTO TABLE on column '%s' in table '%s': bytes "
-              "columns are not supported",
-              sqlite3_column_name(stmt.sqlite_stmt(), int_i),
-              create_table.name.c_str());
+  // Tables created while including a module only depend on the trace and on
+  // the SQL of the modules: try to load them from the cache before running
+  // the query.
+  std::string cache_key;
+  std::unique_ptr<RuntimeTable> table;
+  if (module_table_cache_ && current_include_.file) {
+    cache_key = module_table_cache_->KeyForTable(
+        current_include_.key, current_include_.file->sql, create_table.name,
+        ModulesHash());
+    table = module_table_cache_->Load(cache_key, pool_);
+  }
+  if (!table) {
+    ASSIGN_OR_RETURN(table,
+                     BuildRuntimeTable(create_table, stmt, column_names));
+    if (!cache_key.empty()) {
+      base::Status status =
+          module_table_cache_->Store(cache_key, column_names, *table);
+      if (!status.ok()) {
+        PERFETTO_ELOG("Failed to cache table %s: %s",
+                      create_table.name.c_str(), status.c_message());
       }
     }
   }
-  if (res != SQLITE_DONE) {
-    return base::ErrStatus("%s: SQLite error while creating table body: %s",
-                           create_table.name.c_str(),
-                           sqlite3_errmsg(engine_->db()));
-  }
-  ASSIGN_OR_RETURN(auto table, std::move(builder).Build(rows));
 
   // TODO(lalitm): unfortunately, in the (very unlikely) event that there is a
   // sqlite3_interrupt call between the DROP and CREATE, we can end up with the
@@ -529,6 +571,54 @@ base::Status PerfettoSqlEngine::ExecuteCreateTable(
   return status;
 }
 
+base::StatusOr<std::unique_ptr<RuntimeTable>>
+PerfettoSqlEngine::BuildRuntimeTable(
+    const PerfettoSqlParser::CreateTable& create_table,
+    SqliteEngine::PreparedStatement& stmt,
+    std::vector<std::string> column_names) {
+  size_t column_count = column_names.size();
+  RuntimeTable::Builder builder(pool_, std::move(column_names));
+  uint32_t rows = 0;
+  int res;
+  for (res = sqlite3_step(stmt.sqlite_stmt()); res == SQLITE_ROW;
+       ++rows, res = sqlite3_step(stmt.sqlite_stmt())) {
+    for (uint32_t i = 0; i < column_count; ++i) {
+      int int_i = static_cast<int>(i);
+      switch (sqlite3_column_type(stmt.sqlite_stmt(), int_i)) {
+        case SQLITE_NULL:
+          RETURN_IF_ERROR(builder.AddNull(i));
+          break;
+        case SQLITE_INTEGER:
+          RETURN_IF_ERROR(builder.AddInteger(
+              i, sqlite3_column_int64(stmt.sqlite_stmt(), int_i)));
+          break;
+        case SQLITE_FLOAT:
+          RETURN_IF_ERROR(builder.AddFloat(
+              i, sqlite3_column_double(stmt.sqlite_stmt(), int_i)));
+          break;
+        case SQLITE_TEXT: {
+          RETURN_IF_ERROR(builder.AddText(
+              i, reinterpret_cast<const char*>(
+                     sqlite3_column_text(stmt.sqlite_stmt(), int_i))));
+          break;
+        }
+        case SQLITE_BLOB:
+          return base::ErrStatus(
+              "CREATE PERFETTO TABLE on column '%s' in table '%s': bytes "
+              "columns are not supported",
+              sqlite3_column_name(stmt.sqlite_stmt(), int_i),
+              create_table.name.c_str());
+      }
+    }
+  }
+  if (res != SQLITE_DONE) {
+    return base::ErrStatus("%s: SQLite error while creating table body: %s",
+                           create_table.name.c_str(),
+                           sqlite3_errmsg(engine_->db()));
+  }
+  return std::move(builder).Build(rows);
+}
+
 base::Status PerfettoSqlEngine::ExecuteCreateView(
     const PerfettoSqlParser::CreateView& create_view) {
   // Verify that the underlying SQL statement is valid.
@@ -558,6 +648,56 @@ base::Status PerfettoSqlEngine::ExecuteCreateView(
   return base::OkStatus();
 }
 
+base::Status PerfettoSqlEngine::ExecuteCreateIndex(
+    const PerfettoSqlParser::CreateIndex& index) {
+  PERFETTO_TP_TRACE(metatrace::Category::QUERY_TIMELINE,
+                    "CREATE_PERFETTO_INDEX",
+                    [&index](metatrace::Record* record) {
+                      record->AddArg("Index", index.name);
+                      record->AddArg("Table", index.table_name);
+                    });
+  const Table* table = GetTableOrNull(index.table_name);
+  if (!table) {
+    return base::ErrStatus("CREATE PERFETTO INDEX: Table '%s' not found",
+                           index.table_name.c_str());
+  }
+
+  std::vector<uint32_t> col_idxs;
+  for (const std::string& col_name : index.col_names) {
+    const auto& cols = table->columns();
+    auto it = std::find_if(cols.begin(), cols.end(),
+                           [&col_name](const ColumnLegacy& col) {
+                             return col_name == col.name();
+                           });
+    if (it == cols.end()) {
+      return base::ErrStatus(
+          "CREATE PERFETTO INDEX: Column '%s' not found in table '%s'",
+          col_name.c_str(), index.table_name.c_str());
+    }
+    col_idxs.push_back(static_cast<uint32_t>(std::distance(cols.begin(), it)));
+  }
+  base::Status status =
+      table->CreateIndex(index.name, std::move(col_idxs), index.replace);
+  if (!status.ok()) {
+    return base::ErrStatus("CREATE PERFETTO INDEX: %s", status.c_message());
+  }
+  return base::OkStatus();
+}
+
+base::Status PerfettoSqlEngine::ExecuteDropIndex(
+    const PerfettoSqlParser::DropIndex& index) {
+  const Table* table = GetTableOrNull(index.table_name);
+  if (!table) {
+    return base::ErrStatus("DROP PERFETTO INDEX: Table '%s' not found",
+                           index.table_name.c_str());
+  }
+  base::Status status = table->DropIndex(index.name);
+  if (!status.ok()) {
+    return base::ErrStatus("DROP PERFETTO INDEX: %s", status.c_message());
+  }
+  return base::OkStatus();
+}
+
 base::Status PerfettoSqlEngine::EnableSqlFunctionMemoization(
     const std::string& name) {
   constexpr size_t kSupportedArgCount = 1;
@@ -629,7 +769,11 @@ base::Status PerfettoSqlEngine::IncludeFileImpl(
     return base::OkStatus();
   }
 
+  // Modules can include other modules: restore the including one after.
+  CurrentInclude previous = std::move(current_include_);
+  current_include_ = CurrentInclude{key, &file};
   auto it = Execute(SqlSource::FromModuleInclude(file.sql, key));
+  current_include_ = std::move(previous);
   if (!it.status().ok()) {
     return base::ErrStatus("%s%s",
                            parser.statement_sql().AsTraceback(0).c_str(),
@@ -641,6 +785,22 @@ base::Status PerfettoSqlEngine::IncludeFileImpl(
   return base::OkStatus();
 }
 
+uint64_t PerfettoSqlEngine::ModulesHash() {
+  if (!modules_hash_) {
+    // Combined with a sum so that the hash does not depend on the iteration
+    // order of the maps.
+    uint64_t hash = 0;
+    for (auto module = modules_.GetIterator(); module; ++module) {
+      for (auto file = module.value().include_key_to_file.GetIterator(); file;
+           ++file) {
+        hash += base::Hasher::Combine(file.key(), file.value().sql);
+      }
+    }
+    modules_hash_ = hash;
+  }
+  return *modules_hash_;
+}
+
 base::Status PerfettoSqlEngine::ExecuteCreateFunction(
     const PerfettoSqlParser::CreateFunction& cf) {
   if (!cf.is_table) {
@@ -925,4 +1085,21 @@ const Table* PerfettoSqlEngine::GetStaticTableOrNull(
   return state ? state->static_table : nullptr;
 }
 
+SqlSource PerfettoSqlEngine::MaybeRewriteGroupBy(const SqlSource& sql) const {
+  if (!native_group_by_enabled_) {
+    return sql;
+  }
+  std::optional<SqlSource> rewritten = NativeGroupBy::Rewrite(
+      sql, [this](std::string_view name) { return GetTableOrNull(name); },
+      engine_->db());
+  return rewritten ? *std::move(rewritten) : sql;
+}
+
+const Table* PerfettoSqlEngine::GetTableOrNull(std::string_view name) const {
+  if (const Table* runtime = GetRuntimeTableOrNull(name); runtime) {
+    return runtime;
+  }
+  return GetStaticTableOrNull(name);
+}
+
 }  // namespace perfetto::trace_processor
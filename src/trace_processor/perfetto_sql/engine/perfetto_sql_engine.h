@@ -18,7 +18,9 @@
 #define SRC_TRACE_PROCESSOR_PERFETTO_SQL_ENGINE_PERFETTO_SQL_ENGINE_H_
 
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -33,9 +35,11 @@
 #include "src/trace_processor/db/runtime_table.h"
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/perfetto_sql/engine/function_util.h"
+#include "src/trace_processor/perfetto_sql/engine/module_table_cache.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_parser.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_preprocessor.h"
 #include "src/trace_processor/perfetto_sql/engine/runtime_table_function.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/functions/batch_sql_function.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/sql_function.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/static_table_function.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_result.h"
@@ -64,7 +68,67 @@ class PerfettoSqlEngine {
     ExecutionStats stats;
   };
 
-  explicit PerfettoSqlEngine(StringPool* pool);
+  // Counters for the memoization of the results of the functions created with
+  // CREATE PERFETTO FUNCTION.
+  struct FunctionMemoizationStats {
+    // Calls whose result was memoized.
+    uint64_t hits = 0;
+    // Calls whose result had to be computed.
+    uint64_t misses = 0;
+    // Results dropped to keep the memory used by memoization bounded.
+    uint64_t evictions = 0;
+  };
+
+  // State shared by the memoizers of all the functions created with CREATE
+  // PERFETTO FUNCTION (see created_function.cc).
+  struct FunctionMemoization {
+    // Incremented each time a statement starts executing.
+    uint64_t statement_generation = 0;
+
+    // Number of recursive calls whose first pass is being evaluated: while
+    // this is not zero, results can depend on the placeholder values returned
+    // in the first pass and must not be memoized.
+    uint32_t first_passes_in_progress = 0;
+
+    // Counters of all the calls.
+    FunctionMemoizationStats stats;
+
+    // Counters of the query whose statements are being executed, if any (see
+    // ScopedQueryMemoizationStats).
+    FunctionMemoizationStats* query_stats = nullptr;
+
+    // Drop the results memoized automatically by each function during the
+    // current statement, by memoizer. Called (and cleared) by
+    // DropStatementMemoization() as soon as the statement is done.
+    base::FlatHashMap<const void*, std::function<void()>> statement_droppers;
+  };
+
+  // Charges the memoization of the function calls made while in scope to
+  // |stats|: used to attribute calls to the query whose statements are being
+  // stepped when the statements of several queries are interleaved.
+  class ScopedQueryMemoizationStats {
+   public:
+    ScopedQueryMemoizationStats(PerfettoSqlEngine* engine,
+                                FunctionMemoizationStats* stats)
+        : memoization_(engine->function_memoization()),
+          prev_stats_(memoization_->query_stats) {
+      memoization_->query_stats = stats;
+    }
+    ~ScopedQueryMemoizationStats() { memoization_->query_stats = prev_stats_; }
+
+    ScopedQueryMemoizationStats(const ScopedQueryMemoizationStats&) = delete;
+    ScopedQueryMemoizationStats& operator=(const ScopedQueryMemoizationStats&) =
+        delete;
+
+   private:
+    FunctionMemoization* memoization_;
+    FunctionMemoizationStats* prev_stats_;
+  };
+
+  // |query_thread_pool|, if not null, is used to parallelize filtering and
+  // sorting of large tables. It must outlive this object.
+  explicit PerfettoSqlEngine(StringPool* pool,
+                             base::ThreadPool* query_thread_pool = nullptr);
 
   // Executes all the statements in |sql| and returns a |ExecutionResult|
   // object. The metadata will reference all the statements executed and the
@@ -162,6 +226,18 @@ class PerfettoSqlEngine {
   // Enables memoization for the given SQL function.
   base::Status EnableSqlFunctionMemoization(const std::string& name);
 
+  FunctionMemoization* function_memoization() {
+    return &function_memoization_;
+  }
+
+  // Drops the results memoized automatically by functions during the
+  // statement which just completed: they are only valid for that statement.
+  void DropStatementMemoization();
+
+  const FunctionMemoizationStats& function_memoization_stats() const {
+    return function_memoization_.stats;
+  }
+
   // Registers a trace processor C++ table with SQLite with an SQL name of
   // |name|.
   void RegisterStaticTable(const Table&,
@@ -171,6 +247,12 @@ class PerfettoSqlEngine {
   // Registers a trace processor C++ table function with SQLite.
   void RegisterStaticTableFunction(std::unique_ptr<StaticTableFunction> fn);
 
+  // Registers a batch implementation of the function |fn->Name()|: when the
+  // function is called on a column of a trace processor table, it is
+  // computed for chunks of rows at a time. The scalar version of the function
+  // must be registered separately.
+  void RegisterBatchFunction(std::unique_ptr<BatchSqlFunction> fn);
+
   SqliteEngine* sqlite_engine() { return engine_.get(); }
 
   // Makes new SQL module available to import.
@@ -178,8 +260,27 @@ class PerfettoSqlEngine {
                       sql_modules::RegisteredModule module) {
     modules_.Erase(name);
     modules_.Insert(name, std::move(module));
+    modules_hash_.reset();
+  }
+
+  // Sets the cache used for the tables created by modules. Passing nullptr
+  // disables caching. |cache| must outlive this engine.
+  void set_module_table_cache(ModuleTableCache* cache) {
+    module_table_cache_ = cache;
   }
 
+  // Enables running simple GROUP BY queries on tables with GroupByExecutor
+  // (see native_group_by.h). Requires the __intrinsic_table_ptr module and
+  // the __intrinsic_table_ptr_bind function to be registered.
+  void EnableNativeGroupBy() { native_group_by_enabled_ = true; }
+
+  // Returns the thread pool used to parallelize queries or nullptr if queries
+  // run on a single thread.
+  base::ThreadPool* query_thread_pool() const { return query_thread_pool_; }
+
+  // Returns the string pool of the tables of the engine.
+  StringPool* string_pool() const { return pool_; }
+
   // Fetches registered SQL module.
   sql_modules::RegisteredModule* FindModule(const std::string& name) {
     return modules_.Find(name);
@@ -224,10 +325,26 @@ class PerfettoSqlEngine {
   base::Status ExecuteCreateTable(
       const PerfettoSqlParser::CreateTable& create_table);
 
+  // Builds a runtime table with the rows returned by |stmt|.
+  base::StatusOr<std::unique_ptr<RuntimeTable>> BuildRuntimeTable(
+      const PerfettoSqlParser::CreateTable& create_table,
+      SqliteEngine::PreparedStatement& stmt,
+      std::vector<std::string> column_names);
+
   base::Status ExecuteCreateView(const PerfettoSqlParser::CreateView&);
 
   base::Status ExecuteCreateMacro(const PerfettoSqlParser::CreateMacro&);
 
+  base::Status ExecuteCreateIndex(const PerfettoSqlParser::CreateIndex&);
+
+  base::Status ExecuteDropIndex(const PerfettoSqlParser::DropIndex&);
+
+  // Returns |sql| rewritten to use __intrinsic_group_by if possible.
+  SqlSource MaybeRewriteGroupBy(const SqlSource& sql) const;
+
+  // Finds a runtime or static table with the provided name.
+  const Table* GetTableOrNull(std::string_view) const;
+
   template <typename Function>
   base::Status RegisterFunctionWithSqlite(
       const char* name,
@@ -261,7 +378,17 @@ class PerfettoSqlEngine {
       const std::string& key,
       const PerfettoSqlParser& parser);
 
+  // Returns a hash of the SQL of all the registered modules.
+  uint64_t ModulesHash();
+
+  // The module file being included, if any.
+  struct CurrentInclude {
+    std::string key;
+    const sql_modules::RegisteredModule::ModuleFile* file = nullptr;
+  };
+
   StringPool* pool_ = nullptr;
+  base::ThreadPool* query_thread_pool_ = nullptr;
 
   uint64_t static_function_count_ = 0;
   uint64_t static_aggregate_function_count_ = 0;
@@ -274,6 +401,17 @@ class PerfettoSqlEngine {
   DbSqliteModule::Context* static_table_fn_context_ = nullptr;
   base::FlatHashMap<std::string, sql_modules::RegisteredModule> modules_;
   base::FlatHashMap<std::string, PerfettoSqlPreprocessor::Macro> macros_;
+
+  // Must be declared before |engine_| as the tables point to it.
+  DbSqliteModule::BatchFunctions batch_functions_;
+
+  ModuleTableCache* module_table_cache_ = nullptr;
+  bool native_group_by_enabled_ = false;
+  CurrentInclude current_include_;
+  std::optional<uint64_t> modules_hash_;
+
+  FunctionMemoization function_memoization_;
+
   std::unique_ptr<SqliteEngine> engine_;
 };
 
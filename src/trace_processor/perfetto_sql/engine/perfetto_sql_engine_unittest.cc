@@ -16,6 +16,16 @@
 
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "src/base/test/tmp_dir_tree.h"
+#include "src/trace_processor/perfetto_sql/engine/module_table_cache.h"
+#include "src/trace_processor/perfetto_sql/engine/native_group_by.h"
+#include "src/trace_processor/perfetto_sql/engine/table_pointer_module.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/functions/batch_sql_function.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/functions/sql_function.h"
 #include "src/trace_processor/sqlite/sql_source.h"
 #include "src/trace_processor/tables/slice_tables_py.h"
 #include "test/gtest_and_gmock.h"
@@ -40,6 +50,40 @@ sql_modules::RegisteredModule CreateTestModule(
   return result;
 }
 
+// Adds its two integer arguments.
+struct TestAdd : public SqlFunction {
+  static base::Status Run(void*,
+                          size_t,
+                          sqlite3_value** argv,
+                          SqlValue& out,
+                          Destructors&) {
+    out = SqlValue::Long(sqlite3_value_int64(argv[0]) +
+                         sqlite3_value_int64(argv[1]));
+    return base::OkStatus();
+  }
+};
+
+// Batch version of TestAdd which counts how many times it is run.
+class TestAddBatch : public BatchSqlFunction {
+ public:
+  explicit TestAddBatch(uint32_t* run_count) : run_count_(run_count) {}
+
+  std::string Name() override { return "TEST_ADD"; }
+
+  base::Status Run(const std::vector<SqlValue>& first,
+                   const std::vector<SqlValue>& rest,
+                   std::vector<SqlValue>& out) override {
+    (*run_count_)++;
+    for (const SqlValue& value : first) {
+      out.push_back(SqlValue::Long(value.AsLong() + rest[0].AsLong()));
+    }
+    return base::OkStatus();
+  }
+
+ private:
+  uint32_t* run_count_;
+};
+
 // These are the smoke tests for the perfetto SQL engine, focusing on
 // ensuring that the correct statements do not return an error and that
 // incorrect statements do.
@@ -69,6 +113,81 @@ TEST_F(PerfettoSqlEngineTest, Function_CreateWithArgs) {
   ASSERT_FALSE(res->stmt.Step());
 }
 
+TEST_F(PerfettoSqlEngineTest, Function_Memoization) {
+  auto res = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO FUNCTION foo(x INT, y STRING) RETURNS INT AS "
+      "SELECT $x + length($y);"
+      "WITH data(x, y) AS (VALUES (1, 'a'), (1, 'bc'), (1, 'a'), (2, 'a')) "
+      "SELECT SUM(foo(x, y)) FROM data"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  ASSERT_EQ(sqlite3_column_int64(res->stmt.sqlite_stmt(), 0), 10);
+  ASSERT_FALSE(res->stmt.Step());
+
+  // Only the third call has the same arguments as a previous one.
+  auto stats = engine_.function_memoization_stats();
+  ASSERT_EQ(stats.hits, 1u);
+  ASSERT_EQ(stats.misses, 3u);
+
+  // Results are not reused across statements.
+  res = engine_.ExecuteUntilLastStatement(
+      SqlSource::FromExecuteQuery("SELECT foo(1, 'a')"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  ASSERT_EQ(sqlite3_column_int64(res->stmt.sqlite_stmt(), 0), 2);
+  ASSERT_EQ(engine_.function_memoization_stats().hits, 1u);
+  ASSERT_EQ(engine_.function_memoization_stats().misses, 4u);
+}
+
+TEST_F(PerfettoSqlEngineTest, Function_MemoizationDroppedAtStatementEnd) {
+  auto res = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO FUNCTION foo(x INT) RETURNS INT AS SELECT $x + 1;"
+      "WITH data(x) AS (VALUES (1), (2), (1)) SELECT SUM(foo(x)) FROM data;"
+      "SELECT 1"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  ASSERT_EQ(engine_.function_memoization_stats().hits, 1u);
+
+  // The values memoized by the second statement are dropped before the third
+  // one runs, not the next time foo() is called.
+  ASSERT_EQ(engine_.function_memoization()->statement_droppers.size(), 0u);
+}
+
+TEST_F(PerfettoSqlEngineTest, Function_NotMemoizedIfNonDeterministic) {
+  auto res = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO FUNCTION noisy(x INT) RETURNS INT AS "
+      "SELECT $x + RANDOM() % 1000;"
+      "CREATE PERFETTO FUNCTION calls_noisy(x INT) RETURNS INT AS "
+      "SELECT noisy($x);"
+      "WITH data(x) AS (VALUES (1), (1), (1)) "
+      "SELECT COUNT(noisy(x)), COUNT(calls_noisy(x)) FROM data"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  ASSERT_EQ(sqlite3_column_int64(res->stmt.sqlite_stmt(), 0), 3);
+
+  // noisy() calls random() and calls_noisy() calls noisy(): neither of them
+  // is memoized.
+  ASSERT_EQ(engine_.function_memoization_stats().hits, 0u);
+  ASSERT_EQ(engine_.function_memoization_stats().misses, 9u);
+}
+
+TEST_F(PerfettoSqlEngineTest, Function_MemoizationStopsWithoutRepeats) {
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO FUNCTION foo(x INT) RETURNS INT AS SELECT $x + 1"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  // The first kMaxMissesWithoutHit (1024) calls have distinct arguments: the
+  // repeats which follow are not memoized anymore.
+  res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "WITH RECURSIVE r(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM r "
+      "WHERE i < 2047) SELECT SUM(foo(i % 1024)) FROM r"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  ASSERT_EQ(engine_.function_memoization_stats().hits, 0u);
+  ASSERT_EQ(engine_.function_memoization_stats().misses, 2048u);
+
+  // Memoization starts again with the next statement.
+  res = engine_.Execute(
+      SqlSource::FromExecuteQuery("SELECT foo(1) + foo(1)"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  ASSERT_EQ(engine_.function_memoization_stats().hits, 1u);
+}
+
 TEST_F(PerfettoSqlEngineTest, Function_Invalid) {
   auto res = engine_.ExecuteUntilLastStatement(
       SqlSource::FromExecuteQuery("creatE PeRfEttO FUNCTION foo(x INT, y LONG) "
@@ -172,6 +291,46 @@ TEST_F(PerfettoSqlEngineTest, Table_Duplicates) {
   ASSERT_TRUE(res.ok()) << res.status().c_message();
 }
 
+TEST_F(PerfettoSqlEngineTest, Index_Create) {
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO TABLE foo AS SELECT 1 AS bar, 2 AS baz"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO INDEX foo_idx ON foo(bar, baz)"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  res = engine_.Execute(
+      SqlSource::FromExecuteQuery("CREATE PERFETTO INDEX foo_idx ON foo(bar)"));
+  ASSERT_FALSE(res.ok());
+
+  res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE OR REPLACE PERFETTO INDEX foo_idx ON foo(bar)"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  res = engine_.Execute(
+      SqlSource::FromExecuteQuery("DROP PERFETTO INDEX foo_idx ON foo"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  res = engine_.Execute(
+      SqlSource::FromExecuteQuery("DROP PERFETTO INDEX foo_idx ON foo"));
+  ASSERT_FALSE(res.ok());
+}
+
+TEST_F(PerfettoSqlEngineTest, Index_Invalid) {
+  auto res = engine_.Execute(
+      SqlSource::FromExecuteQuery("CREATE PERFETTO INDEX idx ON foo(bar)"));
+  ASSERT_FALSE(res.ok());
+
+  res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO TABLE foo AS SELECT 1 AS bar"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  res = engine_.Execute(
+      SqlSource::FromExecuteQuery("CREATE PERFETTO INDEX idx ON foo(baz)"));
+  ASSERT_FALSE(res.ok());
+}
+
 TEST_F(PerfettoSqlEngineTest, View_Create) {
   auto res = engine_.Execute(SqlSource::FromExecuteQuery(
       "CREATE PERFETTO VIEW foo AS SELECT 42 AS bar"));
@@ -295,6 +454,155 @@ TEST_F(PerfettoSqlEngineTest, Include_Module) {
       engine_.FindModule("bar")->include_key_to_file["bar.bar"].included);
 }
 
+TEST_F(PerfettoSqlEngineTest, Include_CachedTable) {
+  base::TmpDirTree tmp;
+  ModuleTableCache cache(tmp.path(), "trace");
+  std::vector<std::pair<std::string, std::string>> files = {
+      {"foo.foo", "CREATE PERFETTO TABLE foo AS SELECT x FROM src"}};
+
+  engine_.set_module_table_cache(&cache);
+  engine_.RegisterModule("foo", CreateTestModule(files));
+  auto res = engine_.Execute(
+      SqlSource::FromExecuteQuery("CREATE TABLE src AS SELECT 1 AS x;"
+                                  "INCLUDE PERFETTO MODULE foo.foo"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  // A different engine including the same module loads the table from the
+  // cache instead of running its query.
+  PerfettoSqlEngine other(&pool_);
+  other.set_module_table_cache(&cache);
+  other.RegisterModule("foo", CreateTestModule(files));
+  auto res_other = other.ExecuteUntilLastStatement(
+      SqlSource::FromExecuteQuery("CREATE TABLE src AS SELECT 2 AS x;"
+                                  "INCLUDE PERFETTO MODULE foo.foo;"
+                                  "SELECT x FROM foo"));
+  ASSERT_TRUE(res_other.ok()) << res_other.status().c_message();
+  ASSERT_FALSE(res_other->stmt.IsDone());
+  ASSERT_EQ(sqlite3_column_int64(res_other->stmt.sqlite_stmt(), 0), 1);
+  ASSERT_FALSE(res_other->stmt.Step());
+
+  std::vector<std::string> cached;
+  ASSERT_TRUE(base::ListFilesRecursive(tmp.path(), cached).ok());
+  for (const std::string& file : cached) {
+    tmp.TrackFile(file);
+  }
+}
+
+TEST_F(PerfettoSqlEngineTest, BatchFunction) {
+  tables::SliceTable table(&pool_);
+  for (int64_t i = 0; i < 100; ++i) {
+    tables::SliceTable::Row row;
+    row.ts = 1000 + i;
+    table.Insert(row);
+  }
+  engine_.RegisterStaticTable(table, "test_slice",
+                              tables::SliceTable::ComputeStaticSchema());
+  ASSERT_TRUE(
+      engine_.RegisterStaticFunction<TestAdd>("TEST_ADD", 2, nullptr).ok());
+  uint32_t run_count = 0;
+  engine_.RegisterBatchFunction(std::make_unique<TestAddBatch>(&run_count));
+
+  // Called on a column: computed a chunk of rows at a time.
+  auto res = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+      "SELECT TEST_ADD(ts, 1), TEST_ADD(ts, 2) FROM test_slice"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  for (int64_t i = 0; i < 100; ++i) {
+    ASSERT_FALSE(res->stmt.IsDone());
+    ASSERT_EQ(sqlite3_column_int64(res->stmt.sqlite_stmt(), 0), 1001 + i);
+    ASSERT_EQ(sqlite3_column_int64(res->stmt.sqlite_stmt(), 1), 1002 + i);
+    res->stmt.Step();
+  }
+  ASSERT_TRUE(res->stmt.IsDone());
+  ASSERT_LT(run_count, 40u);
+
+  // Called on an expression: still correct.
+  res = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+      "SELECT TEST_ADD(ts - 1, 1) FROM test_slice"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  for (int64_t i = 0; i < 100; ++i) {
+    ASSERT_FALSE(res->stmt.IsDone());
+    ASSERT_EQ(sqlite3_column_int64(res->stmt.sqlite_stmt(), 0), 1000 + i);
+    res->stmt.Step();
+  }
+  ASSERT_TRUE(res->stmt.IsDone());
+}
+
+TEST_F(PerfettoSqlEngineTest, BatchFunctionOnColumnsWithEqualValues) {
+  tables::SliceTable table(&pool_);
+  for (int64_t i = 0; i < 100; ++i) {
+    tables::SliceTable::Row row;
+    row.ts = 1000 + i;
+    row.dur = i % 2 == 0 ? row.ts : 2000 + i;
+    table.Insert(row);
+  }
+  engine_.RegisterStaticTable(table, "test_slice",
+                              tables::SliceTable::ComputeStaticSchema());
+  ASSERT_TRUE(
+      engine_.RegisterStaticFunction<TestAdd>("TEST_ADD", 2, nullptr).ok());
+  uint32_t run_count = 0;
+  engine_.RegisterBatchFunction(std::make_unique<TestAddBatch>(&run_count));
+
+  // The function is computed on the column it is called on, even if another
+  // column has the same value in the first row.
+  auto res = engine_.ExecuteUntilLastStatement(
+      SqlSource::FromExecuteQuery("SELECT TEST_ADD(dur, 1) FROM test_slice"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  for (int64_t i = 0; i < 100; ++i) {
+    ASSERT_FALSE(res->stmt.IsDone());
+    ASSERT_EQ(sqlite3_column_int64(res->stmt.sqlite_stmt(), 0),
+              (i % 2 == 0 ? 1000 + i : 2000 + i) + 1);
+    res->stmt.Step();
+  }
+  ASSERT_TRUE(res->stmt.IsDone());
+  ASSERT_LT(run_count, 20u);
+
+  // Self joins: rows of every cursor are computed in batches until there are
+  // more cursors than batch slots, then row by row.
+  run_count = 0;
+  res = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+      "SELECT TEST_ADD(a.ts, 1), TEST_ADD(b.dur, 2), TEST_ADD(c.ts, 3) "
+      "FROM test_slice a JOIN test_slice b USING (id) "
+      "JOIN test_slice c USING (id) ORDER BY a.id"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  for (int64_t i = 0; i < 100; ++i) {
+    ASSERT_FALSE(res->stmt.IsDone());
+    ASSERT_EQ(sqlite3_column_int64(res->stmt.sqlite_stmt(), 0), 1001 + i);
+    ASSERT_EQ(sqlite3_column_int64(res->stmt.sqlite_stmt(), 1),
+              (i % 2 == 0 ? 1000 + i : 2000 + i) + 2);
+    ASSERT_EQ(sqlite3_column_int64(res->stmt.sqlite_stmt(), 2), 1003 + i);
+    res->stmt.Step();
+  }
+  ASSERT_TRUE(res->stmt.IsDone());
+}
+
+TEST_F(PerfettoSqlEngineTest, HashIndexDroppedAtQueryEnd) {
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(R"(
+    CREATE PERFETTO TABLE probe AS
+    WITH RECURSIVE n(x) AS (SELECT 0 UNION ALL SELECT x + 1 FROM n WHERE x < 19)
+    SELECT x, (x * 7) % 20 AS v FROM n;
+    CREATE PERFETTO TABLE build AS
+    WITH RECURSIVE n(x) AS (SELECT 0 UNION ALL SELECT x + 1 FROM n WHERE x < 99)
+    SELECT x, (x * 13) % 20 AS k FROM n;
+  )"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  auto hash_index_count = [this]() {
+    return engine_.GetRuntimeTableOrNull("probe")->hash_index_count() +
+           engine_.GetRuntimeTableOrNull("build")->hash_index_count();
+  };
+
+  // The join creates a hash index on the table filtered repeatedly, which
+  // only lives as long as the query.
+  auto it = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+      "SELECT COUNT(*) FROM probe p JOIN build b ON b.k = p.v"));
+  ASSERT_TRUE(it.ok()) << it.status().c_message();
+  ASSERT_FALSE(it->stmt.IsDone());
+  ASSERT_EQ(sqlite3_column_int64(it->stmt.sqlite_stmt(), 0), 100);
+  ASSERT_EQ(hash_index_count(), 1u);
+  it->stmt.Step();
+  ASSERT_TRUE(it->stmt.IsDone());
+  ASSERT_EQ(hash_index_count(), 0u);
+}
+
 TEST_F(PerfettoSqlEngineTest, MismatchedRange) {
   tables::SliceTable parent(&pool_);
   tables::ExpectedFrameTimelineSliceTable child(&pool_, &parent);
@@ -318,6 +626,93 @@ TEST_F(PerfettoSqlEngineTest, MismatchedRange) {
   ASSERT_TRUE(res.ok()) << res.status().c_message();
 }
 
+TEST_F(PerfettoSqlEngineTest, NativeGroupBy) {
+  engine_.sqlite_engine()->RegisterVirtualTableModule<TablePointerModule>(
+      "__intrinsic_table_ptr", nullptr);
+  ASSERT_TRUE(engine_.sqlite_engine()
+                  ->RegisterFunction(
+                      "__intrinsic_table_ptr_bind", -1,
+                      [](sqlite3_context* ctx, int, sqlite3_value**) {
+                        sqlite3_result_error(ctx, "unexpected call", -1);
+                      },
+                      nullptr, nullptr, true)
+                  .ok());
+  engine_.EnableNativeGroupBy();
+
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(R"(
+    CREATE PERFETTO TABLE t AS
+    WITH RECURSIVE r(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM r WHERE i < 99)
+    SELECT
+      i AS id,
+      i % 7 AS utid,
+      IIF(i % 5 = 0, NULL, i * 3) AS dur,
+      i * 0.5 AS value,
+      IIF(i % 3 = 0, NULL, 'n' || (i % 4)) AS name
+    FROM r;
+  )"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  auto rows = [this](const std::string& sql) {
+    auto stmt = engine_.ExecuteUntilLastStatement(
+        SqlSource::FromExecuteQuery(sql));
+    EXPECT_TRUE(stmt.ok()) << stmt.status().c_message();
+    std::vector<std::string> result;
+    sqlite3_stmt* s = stmt->stmt.sqlite_stmt();
+    for (int i = 0; i < sqlite3_column_count(s); ++i) {
+      result.emplace_back(sqlite3_column_name(s, i));
+    }
+    for (; !stmt->stmt.IsDone(); stmt->stmt.Step()) {
+      for (int i = 0; i < sqlite3_column_count(s); ++i) {
+        const auto* text = sqlite3_column_text(s, i);
+        result.emplace_back(text ? reinterpret_cast<const char*>(text)
+                                 : "NULL");
+      }
+    }
+    EXPECT_TRUE(stmt->stmt.status().ok());
+    return result;
+  };
+
+  // The same query with a WHERE clause is always computed by SQLite.
+  const char kSelect[] =
+      "SELECT name, UTID, count(*), COUNT(dur) AS c, sum( dur ), min(value) "
+      "mn, MAX(name), avg(dur) FROM t";
+  ASSERT_EQ(rows(std::string(kSelect) + " GROUP BY utid, name"),
+            rows(std::string(kSelect) + " WHERE id >= 0 GROUP BY utid, name"));
+  ASSERT_EQ(rows("SELECT SUM(value) FROM t GROUP BY name"),
+            rows("SELECT SUM(value) FROM t WHERE id >= 0 GROUP BY name"));
+
+  // Result columns keep the names SQLite gives them without the rewrite,
+  // whatever the spelling of the items.
+  auto column_names = [this](const std::string& sql) {
+    auto stmt = engine_.ExecuteUntilLastStatement(
+        SqlSource::FromExecuteQuery(sql));
+    EXPECT_TRUE(stmt.ok()) << stmt.status().c_message();
+    std::vector<std::string> names;
+    sqlite3_stmt* s = stmt->stmt.sqlite_stmt();
+    for (int i = 0; i < sqlite3_column_count(s); ++i) {
+      names.emplace_back(sqlite3_column_name(s, i));
+    }
+    return names;
+  };
+  for (const char* sql : {
+           "SELECT UTID, Name FROM t GROUP BY utid, name",
+           "SELECT utid AS U, COUNT ( * ), Sum(dur)total FROM t GROUP BY utid",
+           "SELECT min(  value ), max(name) AS Mx FROM t GROUP BY Utid",
+       }) {
+    ASSERT_TRUE(NativeGroupBy::Rewrite(
+                    SqlSource::FromExecuteQuery(sql),
+                    [this](std::string_view name) -> const Table* {
+                      return engine_.GetRuntimeTableOrNull(name);
+                    },
+                    engine_.sqlite_engine()->db()))
+        << sql;
+    std::string without_rewrite(sql);
+    without_rewrite.insert(without_rewrite.find(" GROUP BY"),
+                           " WHERE id >= 0");
+    ASSERT_EQ(column_names(sql), column_names(without_rewrite)) << sql;
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -48,6 +48,8 @@ enum class State {
   kCreateOrReplace,
   kCreateOrReplacePerfetto,
   kCreatePerfetto,
+  kDrop,
+  kDropPerfetto,
   kPassthrough,
 };
 
@@ -153,6 +155,8 @@ bool PerfettoSqlParser::Next() {
           state = State::kCreate;
         } else if (TokenIsCustomKeyword("include", token)) {
           state = State::kInclude;
+        } else if (TokenIsSqliteKeyword("drop", token)) {
+          state = State::kDrop;
         } else {
           state = State::kPassthrough;
         }
@@ -172,6 +176,17 @@ bool PerfettoSqlParser::Next() {
           return ErrorAtToken(token,
                               "Use 'INCLUDE PERFETTO MODULE {include_key}'.");
         }
+      case State::kDrop:
+        state = TokenIsCustomKeyword("perfetto", token) ? State::kDropPerfetto
+                                                        : State::kPassthrough;
+        break;
+      case State::kDropPerfetto:
+        if (TokenIsSqliteKeyword("index", token)) {
+          return ParseDropPerfettoIndex(*first_non_space_token);
+        } else {
+          return ErrorAtToken(
+              token, "Use 'DROP PERFETTO INDEX {index_name} ON {table_name}'.");
+        }
       case State::kCreate:
         if (TokenIsSqliteKeyword("trigger", token)) {
           // TODO(lalitm): add this to the "errors" documentation page
@@ -213,9 +228,12 @@ bool PerfettoSqlParser::Next() {
         if (TokenIsCustomKeyword("macro", token)) {
           return ParseCreatePerfettoMacro(replace);
         }
+        if (TokenIsSqliteKeyword("index", token)) {
+          return ParseCreatePerfettoIndex(replace, *first_non_space_token);
+        }
         base::StackString<1024> err(
-            "Expected 'FUNCTION', 'TABLE' or 'MACRO' after 'CREATE PERFETTO', "
-            "received '%*s'.",
+            "Expected 'FUNCTION', 'TABLE', 'VIEW', 'MACRO' or 'INDEX' after "
+            "'CREATE PERFETTO', received '%*s'.",
             static_cast<int>(token.str.size()), token.str.data());
         return ErrorAtToken(token, err.c_str());
     }
@@ -420,6 +438,90 @@ bool PerfettoSqlParser::ParseCreatePerfettoMacro(bool replace) {
   return true;
 }
 
+bool PerfettoSqlParser::ParseCreatePerfettoIndex(bool replace,
+                                                 Token first_non_space_token) {
+  std::string name;
+  std::string table_name;
+  if (!ParseIndexNameAndTable(name, table_name)) {
+    return false;
+  }
+
+  // TK_LP == '(' (i.e. left parenthesis).
+  if (Token lp = tokenizer_.NextNonWhitespace();
+      lp.token_type != SqliteTokenType::TK_LP) {
+    return ErrorAtToken(lp, "Malformed index: '(' expected");
+  }
+
+  std::vector<std::string> cols;
+  for (;;) {
+    // Column names are allowed to be SQLite keywords (e.g. |key| in the args
+    // table) as they are always followed by ',' or ')'.
+    Token col = tokenizer_.NextNonWhitespace();
+    if (col.token_type != SqliteTokenType::TK_ID &&
+        col.token_type != SqliteTokenType::TK_GENERIC_KEYWORD) {
+      base::StackString<1024> err("Invalid column name %.*s",
+                                  static_cast<int>(col.str.size()),
+                                  col.str.data());
+      return ErrorAtToken(col, err.c_str());
+    }
+    cols.emplace_back(col.str);
+
+    Token sep = tokenizer_.NextNonWhitespace();
+    if (sep.token_type == SqliteTokenType::TK_RP) {
+      break;
+    }
+    if (sep.token_type != SqliteTokenType::TK_COMMA) {
+      return ErrorAtToken(sep, "')' or ',' expected");
+    }
+  }
+
+  Token terminal = tokenizer_.NextTerminal();
+  statement_ = CreateIndex{replace, std::move(name), std::move(table_name),
+                           std::move(cols)};
+  statement_sql_ = tokenizer_.Substr(first_non_space_token, terminal);
+  return true;
+}
+
+bool PerfettoSqlParser::ParseDropPerfettoIndex(Token first_non_space_token) {
+  std::string name;
+  std::string table_name;
+  if (!ParseIndexNameAndTable(name, table_name)) {
+    return false;
+  }
+  Token terminal = tokenizer_.NextTerminal();
+  statement_ = DropIndex{std::move(name), std::move(table_name)};
+  statement_sql_ = tokenizer_.Substr(first_non_space_token, terminal);
+  return true;
+}
+
+bool PerfettoSqlParser::ParseIndexNameAndTable(std::string& index_name,
+                                               std::string& table_name) {
+  Token index_name_tok = tokenizer_.NextNonWhitespace();
+  if (index_name_tok.token_type != SqliteTokenType::TK_ID) {
+    base::StackString<1024> err("Invalid index name %.*s",
+                                static_cast<int>(index_name_tok.str.size()),
+                                index_name_tok.str.data());
+    return ErrorAtToken(index_name_tok, err.c_str());
+  }
+
+  if (Token on = tokenizer_.NextNonWhitespace();
+      !TokenIsSqliteKeyword("on", on)) {
+    return ErrorAtToken(on, "Expected keyword 'ON'");
+  }
+
+  Token table_name_tok = tokenizer_.NextNonWhitespace();
+  if (table_name_tok.token_type != SqliteTokenType::TK_ID) {
+    base::StackString<1024> err("Invalid table name %.*s",
+                                static_cast<int>(table_name_tok.str.size()),
+                                table_name_tok.str.data());
+    return ErrorAtToken(table_name_tok, err.c_str());
+  }
+
+  index_name = std::string(index_name_tok.str);
+  table_name = std::string(table_name_tok.str);
+  return true;
+}
+
 bool PerfettoSqlParser::ParseRawArguments(std::vector<RawArgument>& args) {
   enum TokenType {
     kIdOrRp,
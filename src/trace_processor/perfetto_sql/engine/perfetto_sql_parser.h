@@ -91,12 +91,28 @@ class PerfettoSqlParser {
     SqlSource returns;
     SqlSource sql;
   };
+  // Indicates that the specified SQL was a CREATE PERFETTO INDEX statement
+  // with the following parameters.
+  struct CreateIndex {
+    bool replace;
+    std::string name;
+    std::string table_name;
+    std::vector<std::string> col_names;
+  };
+  // Indicates that the specified SQL was a DROP PERFETTO INDEX statement
+  // with the following parameters.
+  struct DropIndex {
+    std::string name;
+    std::string table_name;
+  };
   using Statement = std::variant<SqliteSql,
                                  CreateFunction,
                                  CreateTable,
                                  CreateView,
                                  Include,
-                                 CreateMacro>;
+                                 CreateMacro,
+                                 CreateIndex,
+                                 DropIndex>;
 
   // Creates a new SQL parser with the a block of PerfettoSQL statements.
   // Concretely, the passed string can contain >1 statement.
@@ -162,6 +178,16 @@ class PerfettoSqlParser {
 
   bool ParseCreatePerfettoMacro(bool replace);
 
+  bool ParseCreatePerfettoIndex(bool replace,
+                                SqliteTokenizer::Token first_non_space_token);
+
+  bool ParseDropPerfettoIndex(SqliteTokenizer::Token first_non_space_token);
+
+  // Parses "{index_name} ON {table_name}" as found in both CREATE and DROP
+  // PERFETTO INDEX statements.
+  bool ParseIndexNameAndTable(std::string& index_name,
+                              std::string& table_name);
+
   // Convert a "raw" argument (i.e. one that points to specific tokens) to the
   // argument definition consumed by the rest of the SQL code.
   // Guarantees to call ErrorAtToken if std::nullopt is returned.
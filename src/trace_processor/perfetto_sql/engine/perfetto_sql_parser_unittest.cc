@@ -37,6 +37,8 @@ using CreateTable = PerfettoSqlParser::CreateTable;
 using CreateView = PerfettoSqlParser::CreateView;
 using Include = PerfettoSqlParser::Include;
 using CreateMacro = PerfettoSqlParser::CreateMacro;
+using CreateIndex = PerfettoSqlParser::CreateIndex;
+using DropIndex = PerfettoSqlParser::DropIndex;
 
 namespace {
 
@@ -362,6 +364,55 @@ TEST_F(PerfettoSqlParserTest, CreatePerfettoViewWithSchema) {
   ASSERT_FALSE(parser.Next());
 }
 
+TEST_F(PerfettoSqlParserTest, CreatePerfettoIndex) {
+  auto res = SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO INDEX foo_idx ON foo(bar, key)");
+  PerfettoSqlParser parser(res, macros_);
+  ASSERT_TRUE(parser.Next());
+  ASSERT_EQ(parser.statement(),
+            Statement(CreateIndex{false, "foo_idx", "foo", {"bar", "key"}}));
+  ASSERT_FALSE(parser.Next());
+}
+
+TEST_F(PerfettoSqlParserTest, CreateOrReplacePerfettoIndexAndOther) {
+  auto res = SqlSource::FromExecuteQuery(
+      "CREATE OR REPLACE PERFETTO INDEX foo_idx ON foo(bar); select 1");
+  PerfettoSqlParser parser(res, macros_);
+  ASSERT_TRUE(parser.Next());
+  ASSERT_EQ(parser.statement(),
+            Statement(CreateIndex{true, "foo_idx", "foo", {"bar"}}));
+  ASSERT_TRUE(parser.Next());
+  ASSERT_EQ(parser.statement(), Statement(SqliteSql{}));
+  ASSERT_EQ(parser.statement_sql(), FindSubstr(res, "select 1"));
+  ASSERT_FALSE(parser.Next());
+}
+
+TEST_F(PerfettoSqlParserTest, CreatePerfettoIndexError) {
+  auto missing_cols = Parse(
+      SqlSource::FromExecuteQuery("CREATE PERFETTO INDEX foo ON bar"));
+  ASSERT_FALSE(missing_cols.ok());
+
+  auto missing_on = Parse(
+      SqlSource::FromExecuteQuery("CREATE PERFETTO INDEX foo bar(a)"));
+  ASSERT_FALSE(missing_on.ok());
+
+  auto missing_comma = Parse(
+      SqlSource::FromExecuteQuery("CREATE PERFETTO INDEX foo ON bar(a b)"));
+  ASSERT_FALSE(missing_comma.ok());
+}
+
+TEST_F(PerfettoSqlParserTest, DropPerfettoIndex) {
+  auto res = SqlSource::FromExecuteQuery(
+      "DROP PERFETTO INDEX foo_idx ON foo; DROP TABLE foo");
+  PerfettoSqlParser parser(res, macros_);
+  ASSERT_TRUE(parser.Next());
+  ASSERT_EQ(parser.statement(), Statement(DropIndex{"foo_idx", "foo"}));
+  ASSERT_TRUE(parser.Next());
+  ASSERT_EQ(parser.statement(), Statement(SqliteSql{}));
+  ASSERT_EQ(parser.statement_sql(), FindSubstr(res, "DROP TABLE foo"));
+  ASSERT_FALSE(parser.Next());
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -61,6 +61,17 @@ constexpr bool operator==(const PerfettoSqlParser::CreateMacro& a,
          std::tie(b.replace, b.name, b.sql, b.args);
 }
 
+inline bool operator==(const PerfettoSqlParser::CreateIndex& a,
+                       const PerfettoSqlParser::CreateIndex& b) {
+  return std::tie(a.replace, a.name, a.table_name, a.col_names) ==
+         std::tie(b.replace, b.name, b.table_name, b.col_names);
+}
+
+inline bool operator==(const PerfettoSqlParser::DropIndex& a,
+                       const PerfettoSqlParser::DropIndex& b) {
+  return std::tie(a.name, a.table_name) == std::tie(b.name, b.table_name);
+}
+
 inline std::ostream& operator<<(std::ostream& stream, const SqlSource& sql) {
   return stream << "SqlSource(sql=" << testing::PrintToString(sql.sql()) << ")";
 }
@@ -92,6 +103,19 @@ inline std::ostream& operator<<(std::ostream& stream,
                   << ", replace=" << testing::PrintToString(macro->replace)
                   << ", sql=" << testing::PrintToString(macro->sql) << ")";
   }
+  if (auto* idx = std::get_if<PerfettoSqlParser::CreateIndex>(&line)) {
+    return stream << "CreateIndex(name=" << testing::PrintToString(idx->name)
+                  << ", table_name="
+                  << testing::PrintToString(idx->table_name)
+                  << ", col_names=" << testing::PrintToString(idx->col_names)
+                  << ", replace=" << testing::PrintToString(idx->replace)
+                  << ")";
+  }
+  if (auto* idx = std::get_if<PerfettoSqlParser::DropIndex>(&line)) {
+    return stream << "DropIndex(name=" << testing::PrintToString(idx->name)
+                  << ", table_name="
+                  << testing::PrintToString(idx->table_name) << ")";
+  }
   PERFETTO_FATAL("Unknown type");
 }
 
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_FUNCTIONS_BATCH_SQL_FUNCTION_H_
+#define SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_FUNCTIONS_BATCH_SQL_FUNCTION_H_
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/trace_processor/basic_types.h"
+
+namespace perfetto::trace_processor {
+
+// Interface which can be implemented to compute a scalar function for many
+// rows at once.
+//
+// When a function with a batch implementation is called on a column of a db
+// table (e.g. EXTRACT_ARG(arg_set_id, 'foo') on the slice table), the table
+// computes it for a chunk of the upcoming rows with a single call to |Run|
+// rather than once per row: this amortizes the per-call setup of the function
+// (e.g. looking up its constant arguments) over the whole chunk.
+//
+// The scalar version of the function, with the same name, must also be
+// registered with SQLite: it is used whenever the batch version cannot be
+// (e.g. when the first argument is not a column of a db table).
+class BatchSqlFunction {
+ public:
+  virtual ~BatchSqlFunction();
+
+  // Returns the name of the function.
+  virtual std::string Name() = 0;
+
+  // Computes the function for each value of the first argument in |first|,
+  // with |rest| as the other arguments (which are the same for all the rows).
+  // Exactly one value must be appended to |out| for each value in |first|.
+  //
+  // As the function can be computed for rows which SQLite ends up not asking
+  // for, implementations must not have side effects. If an error is
+  // returned, the function is computed again for the current row only so
+  // that errors are only reported for the rows which need them.
+  virtual base::Status Run(const std::vector<SqlValue>& first,
+                           const std::vector<SqlValue>& rest,
+                           std::vector<SqlValue>& out) = 0;
+
+  // Whether the strings returned by |Run| are valid for the lifetime of trace
+  // processor (e.g. because they come from the string pool) rather than until
+  // the next call to |Run|: this avoids SQLite copying them.
+  virtual bool ReturnsStaticStrings() { return false; }
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_FUNCTIONS_BATCH_SQL_FUNCTION_H_
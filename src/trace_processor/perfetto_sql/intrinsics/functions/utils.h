@@ -29,6 +29,7 @@
 #include "src/trace_processor/db/column/utils.h"
 #include "src/trace_processor/export_json.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/functions/batch_sql_function.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/sql_function.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
 #include "src/trace_processor/util/regex.h"
@@ -267,6 +268,30 @@ base::Status WriteFile::Run(TraceStorage*,
   return util::OkStatus();
 }
 
+// Converts the value of an arg to the value returned by EXTRACT_ARG.
+inline SqlValue ArgValueToSqlValue(const TraceStorage& storage,
+                                   const Variadic& value) {
+  switch (value.type) {
+    case Variadic::kNull:
+      return SqlValue();
+    case Variadic::kInt:
+      return SqlValue::Long(value.int_value);
+    case Variadic::kUint:
+      return SqlValue::Long(static_cast<int64_t>(value.uint_value));
+    case Variadic::kString:
+      return SqlValue::String(storage.GetString(value.string_value).data());
+    case Variadic::kReal:
+      return SqlValue::Double(value.real_value);
+    case Variadic::kBool:
+      return SqlValue::Long(value.bool_value);
+    case Variadic::kPointer:
+      return SqlValue::Long(static_cast<int64_t>(value.pointer_value));
+    case Variadic::kJson:
+      return SqlValue::String(storage.GetString(value.json_value).data());
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
 struct ExtractArg : public SqlFunction {
   using Context = TraceStorage;
   static base::Status Run(TraceStorage* storage,
@@ -297,8 +322,18 @@ base::Status ExtractArg::Run(TraceStorage* storage,
   uint32_t arg_set_id = static_cast<uint32_t>(sqlite3_value_int(argv[0]));
   const char* key = reinterpret_cast<const char*>(sqlite3_value_text(argv[1]));
 
+  // If the key was never interned, no arg can have it.
+  std::optional<StringPool::Id> key_id = storage->string_pool().GetId(key);
+  if (!key_id)
+    return base::OkStatus();
+
   std::optional<Variadic> opt_value;
-  RETURN_IF_ERROR(storage->ExtractArg(arg_set_id, key, &opt_value));
+  if (const auto* column =
+          storage->mutable_arg_key_columns()->GetColumn(*key_id)) {
+    opt_value = column->Get(arg_set_id);
+  } else {
+    RETURN_IF_ERROR(storage->ExtractArg(arg_set_id, key, &opt_value));
+  }
 
   if (!opt_value)
     return base::OkStatus();
@@ -307,33 +342,98 @@ base::Status ExtractArg::Run(TraceStorage* storage,
   // of the TraceStorage thread pool) so prevent SQLite from making copies.
   destructors.string_destructor = sqlite::utils::kSqliteStatic;
 
-  switch (opt_value->type) {
-    case Variadic::kNull:
-      return base::OkStatus();
-    case Variadic::kInt:
-      out = SqlValue::Long(opt_value->int_value);
-      return base::OkStatus();
-    case Variadic::kUint:
-      out = SqlValue::Long(static_cast<int64_t>(opt_value->uint_value));
-      return base::OkStatus();
-    case Variadic::kString:
-      out =
-          SqlValue::String(storage->GetString(opt_value->string_value).data());
-      return base::OkStatus();
-    case Variadic::kReal:
-      out = SqlValue::Double(opt_value->real_value);
-      return base::OkStatus();
-    case Variadic::kBool:
-      out = SqlValue::Long(opt_value->bool_value);
-      return base::OkStatus();
-    case Variadic::kPointer:
-      out = SqlValue::Long(static_cast<int64_t>(opt_value->pointer_value));
-      return base::OkStatus();
-    case Variadic::kJson:
-      out = SqlValue::String(storage->GetString(opt_value->json_value).data());
-      return base::OkStatus();
+  out = ArgValueToSqlValue(*storage, *opt_value);
+  return base::OkStatus();
+}
+
+// Batch version of EXTRACT_ARG: the key is looked up once for all the rows and
+// args are found directly from the sorted arg_set_id column instead of
+// running a query for each row.
+class ExtractArgBatch : public BatchSqlFunction {
+ public:
+  explicit ExtractArgBatch(TraceStorage* storage) : storage_(storage) {}
+
+  std::string Name() override { return "EXTRACT_ARG"; }
+
+  base::Status Run(const std::vector<SqlValue>& first,
+                   const std::vector<SqlValue>& rest,
+                   std::vector<SqlValue>& out) override;
+
+  bool ReturnsStaticStrings() override { return true; }
+
+ private:
+  TraceStorage* storage_;
+};
+
+base::Status ExtractArgBatch::Run(const std::vector<SqlValue>& first,
+                                  const std::vector<SqlValue>& rest,
+                                  std::vector<SqlValue>& out) {
+  if (rest.size() != 1)
+    return base::ErrStatus("EXTRACT_ARG: 2 args required");
+
+  // If the key was never interned, no arg can have it.
+  std::optional<StringPool::Id> key_id;
+  if (rest[0].type == SqlValue::kString) {
+    key_id = storage_->string_pool().GetId(rest[0].AsString());
   }
-  PERFETTO_FATAL("For GCC");
+
+  const ArgKeyColumns::Column* column =
+      key_id ? storage_->mutable_arg_key_columns()->GetColumn(
+                   *key_id, static_cast<uint32_t>(first.size()))
+             : nullptr;
+
+  const auto& args = storage_->arg_table();
+  const auto& arg_set_ids = args.arg_set_id();
+  const auto& keys = args.key();
+  const uint32_t row_count = args.row_count();
+  for (const SqlValue& value : first) {
+    // Same checks, in the same order, as ExtractArg.
+    if (value.is_null()) {
+      out.emplace_back();
+      continue;
+    }
+    if (value.type != SqlValue::kLong)
+      return base::ErrStatus("EXTRACT_ARG: 1st argument should be arg set id");
+    if (rest[0].type != SqlValue::kString)
+      return base::ErrStatus("EXTRACT_ARG: 2nd argument should be key");
+    if (!key_id) {
+      out.emplace_back();
+      continue;
+    }
+
+    auto arg_set_id = static_cast<uint32_t>(value.long_value);
+    if (column) {
+      std::optional<Variadic> arg = column->Get(arg_set_id);
+      out.push_back(arg ? ArgValueToSqlValue(*storage_, *arg) : SqlValue());
+      continue;
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = row_count;
+    while (lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (arg_set_ids[mid] < arg_set_id) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    std::optional<uint32_t> arg_row;
+    for (uint32_t row = lo; row < row_count && arg_set_ids[row] == arg_set_id;
+         ++row) {
+      if (keys[row] != *key_id)
+        continue;
+      if (arg_row) {
+        return base::ErrStatus(
+            "EXTRACT_ARG: received multiple args matching arg set id and key");
+      }
+      arg_row = row;
+    }
+    out.push_back(arg_row ? ArgValueToSqlValue(*storage_,
+                                               storage_->GetArgValue(*arg_row))
+                          : SqlValue());
+  }
+  return base::OkStatus();
 }
 
 struct SourceGeq : public SqlFunction {
@@ -34,6 +34,8 @@
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_result.h"
@@ -49,6 +51,12 @@ namespace perfetto::trace_processor {
 
 namespace {
 
+// The number of rows of the child tables joined by a single task.
+constexpr uint32_t kRowsPerChunk = 64 * 1024;
+
+// The maximum number of chunks joined concurrently before returning rows.
+constexpr uint32_t kChunksPerRound = 16;
+
 constexpr char kTsColumnName[] = "ts";
 constexpr char kDurColumnName[] = "dur";
 
@@ -131,6 +139,30 @@ std::string EscapedSqliteValueAsString(sqlite3_value* value) {
   }
 }
 
+void ReportSpanValue(sqlite3_context* ctx,
+                     const SpanJoinOperatorModule::Spans& spans,
+                     uint32_t row,
+                     size_t col) {
+  if (row == SpanJoinOperatorModule::OutputRow::kShadow) {
+    return sqlite::result::Null(ctx);
+  }
+  const SqlValue& value = spans.values[row * spans.col_count + col];
+  switch (value.type) {
+    case SqlValue::kLong:
+      return sqlite::result::Long(ctx, value.long_value);
+    case SqlValue::kDouble:
+      return sqlite::result::Double(ctx, value.double_value);
+    case SqlValue::kString:
+      // Strings are in the string pool so outlive the query.
+      return sqlite::result::StaticString(ctx, value.string_value);
+    case SqlValue::kBytes:
+      return sqlite::result::TransientBytes(
+          ctx, value.bytes_value, static_cast<int>(value.bytes_count));
+    case SqlValue::kNull:
+      return sqlite::result::Null(ctx);
+  }
+}
+
 }  // namespace
 
 void SpanJoinOperatorModule::State::PopulateColumnLocatorMap(uint32_t offset) {
@@ -308,20 +340,121 @@ std::string SpanJoinOperatorModule::State::GetNameForGlobalColumnIndex(
   return defn.columns()[locator.col_index].second;
 }
 
-SpanJoinOperatorModule::Query::Query(SpanJoinOperatorModule::State* state,
-                                     const TableDefinition* definition)
-    : defn_(definition), in_state_(state) {
+void SpanJoinOperatorModule::Spans::Clear() {
+  ts.clear();
+  dur.clear();
+  partition.clear();
+  values.clear();
+  buffers.clear();
+}
+
+base::Status SpanJoinOperatorModule::SpanReader::Start(
+    PerfettoSqlEngine* engine,
+    const TableDefinition* defn,
+    const std::string& sql) {
+  defn_ = defn;
+  pool_ = engine->string_pool();
+  stmt_ = engine->sqlite_engine()->PrepareStatement(
+      SqlSource::FromTraceProcessorImplementation(sql));
+  RETURN_IF_ERROR(stmt_->status());
+  return Step();
+}
+
+base::Status SpanJoinOperatorModule::SpanReader::Step() {
+  sqlite3_stmt* stmt = stmt_->sqlite_stmt();
+  auto partition_idx = static_cast<int>(defn_->partition_idx());
+  while (stmt_->Step()) {
+    if (!defn_->IsPartitioned()) {
+      eof_ = false;
+      return base::OkStatus();
+    }
+    // Skip any rows with null partition keys.
+    int type = sqlite3_column_type(stmt, partition_idx);
+    if (type == SQLITE_NULL) {
+      continue;
+    }
+    if (type != SQLITE_INTEGER) {
+      return base::ErrStatus("SPAN_JOIN: partition is not an INT column");
+    }
+    partition_ = sqlite3_column_int64(stmt, partition_idx);
+    eof_ = false;
+    return base::OkStatus();
+  }
+  eof_ = true;
+  return stmt_->status();
+}
+
+base::StatusOr<uint32_t> SpanJoinOperatorModule::SpanReader::ReadPartition(
+    Spans* spans) {
+  sqlite3_stmt* stmt = stmt_->sqlite_stmt();
+  auto col_count = static_cast<int>(defn_->columns().size());
+  auto ts_idx = static_cast<int>(defn_->ts_idx());
+  auto dur_idx = static_cast<int>(defn_->dur_idx());
+  spans->col_count = static_cast<uint32_t>(col_count);
+
+  uint32_t count = 0;
+  int64_t partition = partition_;
+  while (!eof_ && (!defn_->IsPartitioned() || partition_ == partition)) {
+    if (defn_->IsPartitioned()) {
+      spans->partition.push_back(partition_);
+    }
+    spans->ts.push_back(sqlite3_column_int64(stmt, ts_idx));
+    spans->dur.push_back(sqlite3_column_int64(stmt, dur_idx));
+    for (int i = 0; i < col_count; ++i) {
+      switch (sqlite3_column_type(stmt, i)) {
+        case SQLITE_INTEGER:
+          spans->values.push_back(
+              SqlValue::Long(sqlite3_column_int64(stmt, i)));
+          break;
+        case SQLITE_FLOAT:
+          spans->values.push_back(
+              SqlValue::Double(sqlite3_column_double(stmt, i)));
+          break;
+        case SQLITE_TEXT: {
+          // Most strings come from tables and so are already in the pool:
+          // interning them does not copy them.
+          const auto* text =
+              reinterpret_cast<const char*>(sqlite3_column_text(stmt, i));
+          auto size = static_cast<size_t>(sqlite3_column_bytes(stmt, i));
+          StringPool::Id id = pool_->InternString(base::StringView(text, size));
+          spans->values.push_back(id.is_null()
+                                      ? SqlValue()
+                                      : SqlValue::String(pool_->Get(id).c_str()));
+          break;
+        }
+        case SQLITE_BLOB: {
+          const auto* data =
+              static_cast<const char*>(sqlite3_column_blob(stmt, i));
+          auto size = static_cast<size_t>(sqlite3_column_bytes(stmt, i));
+          const std::string& bytes = spans->buffers.emplace_back(
+              data ? std::string(data, size) : std::string());
+          spans->values.push_back(SqlValue::Bytes(bytes.data(), size));
+          break;
+        }
+        default:
+          spans->values.emplace_back();
+          break;
+      }
+    }
+    ++count;
+    RETURN_IF_ERROR(Step());
+  }
+  return count;
+}
+
+SpanJoinOperatorModule::Query::Query(const TableDefinition* definition,
+                                     const Spans* spans)
+    : defn_(definition), spans_(spans) {
   PERFETTO_DCHECK(!defn_->IsPartitioned() ||
                   defn_->partition_idx() < defn_->columns().size());
 }
 
-SpanJoinOperatorModule::Query::~Query() = default;
-
 base::Status SpanJoinOperatorModule::Query::Initialize(
-    std::string sql_query,
+    uint32_t begin,
+    uint32_t end,
     InitialEofBehavior eof_behavior) {
-  *this = Query(in_state_, definition());
-  sql_query_ = std::move(sql_query);
+  begin_ = begin;
+  end_ = end;
   base::Status status = Rewind();
   if (!status.ok())
     return status;
@@ -375,7 +508,7 @@ base::Status SpanJoinOperatorModule::Query::NextSliceState() {
   switch (state_) {
     case State::kReal: {
       // Forward the cursor to figure out where the next slice should be.
-      RETURN_IF_ERROR(CursorNext());
+      CursorNext();
 
       // Depending on the next slice, we can do two things here:
       // 1. If the next slice is on the same partition, we can just emit a
@@ -409,6 +542,7 @@ base::Status SpanJoinOperatorModule::Query::NextSliceState() {
         state_ = State::kReal;
         ts_ = CursorTs();
         ts_end_ = ts_ + CursorDur();
+        row_ = cursor_;
 
         PERFETTO_DCHECK(!defn_->IsPartitioned() ||
                         partition_ == CursorPartition());
@@ -444,13 +578,8 @@ base::Status SpanJoinOperatorModule::Query::NextSliceState() {
 }
 
 base::Status SpanJoinOperatorModule::Query::Rewind() {
-  auto res = in_state_->engine->sqlite_engine()->PrepareStatement(
-      SqlSource::FromTraceProcessorImplementation(sql_query_));
-  cursor_eof_ = false;
-  RETURN_IF_ERROR(res.status());
-  stmt_ = std::move(res);
-
-  RETURN_IF_ERROR(CursorNext());
+  cursor_ = begin_;
+  cursor_eof_ = cursor_ >= end_;
 
   // Setup the first slice as a missing partition shadow from the lowest
   // partition until the first slice partition. We will handle finding the real
@@ -472,53 +601,8 @@ base::Status SpanJoinOperatorModule::Query::Rewind() {
   return FindNextValidSlice();
 }
 
-base::Status SpanJoinOperatorModule::Query::CursorNext() {
-  if (defn_->IsPartitioned()) {
-    auto partition_idx = static_cast<int>(defn_->partition_idx());
-    // Fastforward through any rows with null partition keys.
-    int row_type;
-    do {
-      cursor_eof_ = !stmt_->Step();
-      RETURN_IF_ERROR(stmt_->status());
-      row_type = sqlite3_column_type(stmt_->sqlite_stmt(), partition_idx);
-    } while (!cursor_eof_ && row_type == SQLITE_NULL);
-
-    if (!cursor_eof_ && row_type != SQLITE_INTEGER) {
-      return base::ErrStatus("SPAN_JOIN: partition is not an INT column");
-    }
-  } else {
-    cursor_eof_ = !stmt_->Step();
-  }
-  return base::OkStatus();
-}
-
-void SpanJoinOperatorModule::Query::ReportSqliteResult(sqlite3_context* context,
-                                                       size_t index) {
-  if (state_ != State::kReal) {
-    return sqlite::result::Null(context);
-  }
-
-  sqlite3_stmt* stmt = stmt_->sqlite_stmt();
-  int idx = static_cast<int>(index);
-  switch (sqlite3_column_type(stmt, idx)) {
-    case SQLITE_INTEGER:
-      return sqlite::result::Long(context, sqlite3_column_int64(stmt, idx));
-    case SQLITE_FLOAT:
-      return sqlite::result::Double(context, sqlite3_column_double(stmt, idx));
-    case SQLITE_TEXT: {
-      // TODO(lalitm): note for future optimizations: if we knew the addresses
-      // of the string intern pool, we could check if the string returned here
-      // comes from the pool, and pass it as non-transient.
-      const auto* ptr =
-          reinterpret_cast<const char*>(sqlite3_column_text(stmt, idx));
-      return sqlite::result::TransientString(context, ptr);
-    }
-    case SQLITE_BLOB: {
-      return sqlite::result::TransientBytes(context,
-                                            sqlite3_column_blob(stmt, idx),
-                                            sqlite3_column_bytes(stmt, idx));
-    }
-  }
+void SpanJoinOperatorModule::Query::CursorNext() {
+  cursor_eof_ = ++cursor_ >= end_;
 }
 
 SpanJoinOperatorModule::TableDefinition::TableDefinition(
@@ -837,10 +921,10 @@ int SpanJoinOperatorModule::Close(sqlite3_vtab_cursor* cursor) {
 int SpanJoinOperatorModule::Filter(sqlite3_vtab_cursor* cursor,
                                    int,
                                    const char* idxStr,
-                                   int argc,
+                                   int,
                                    sqlite3_value** argv) {
   PERFETTO_TP_TRACE(metatrace::Category::QUERY_DETAILED, "SPAN_JOIN_XFILTER");
-  PERFETTO_DLOG("SpanJoin::Filter: argc=%d, idxStr=%s", argc, idxStr);
+  PERFETTO_DLOG("SpanJoin::Filter: idxStr=%s", idxStr);
 
   Cursor* c = GetCursor(cursor);
   Vtab* table = GetVtab(cursor->pVtab);
@@ -848,32 +932,9 @@ int SpanJoinOperatorModule::Filter(sqlite3_vtab_cursor* cursor,
       table->state);
 
   base::StringSplitter splitter(std::string(idxStr), ',');
-  bool t1_partitioned_mixed =
-      c->t1.definition()->IsPartitioned() &&
-      state->partitioning == PartitioningType::kMixedPartitioning;
-  auto t1_eof = state->IsOuterJoin() && !t1_partitioned_mixed
-                    ? Query::InitialEofBehavior::kTreatAsMissingPartitionShadow
-                    : Query::InitialEofBehavior::kTreatAsEof;
-  base::Status status =
-      c->t1.Initialize(state->t1_defn.CreateSqlQuery(splitter, argv), t1_eof);
-  if (!status.ok()) {
-    return sqlite::utils::SetError(table, status.c_message());
-  }
-
-  bool t2_partitioned_mixed =
-      c->t2.definition()->IsPartitioned() &&
-      state->partitioning == PartitioningType::kMixedPartitioning;
-  auto t2_eof =
-      (state->IsLeftJoin() || state->IsOuterJoin()) && !t2_partitioned_mixed
-          ? Query::InitialEofBehavior::kTreatAsMissingPartitionShadow
-          : Query::InitialEofBehavior::kTreatAsEof;
-  status =
-      c->t2.Initialize(state->t2_defn.CreateSqlQuery(splitter, argv), t2_eof);
-  if (!status.ok()) {
-    return sqlite::utils::SetError(table, status.c_message());
-  }
-
-  status = c->FindOverlappingSpan();
+  std::string t1_sql = state->t1_defn.CreateSqlQuery(splitter, argv);
+  std::string t2_sql = state->t2_defn.CreateSqlQuery(splitter, argv);
+  base::Status status = c->Start(t1_sql, t2_sql);
   if (!status.ok()) {
     return sqlite::utils::SetError(table, status.c_message());
   }
@@ -882,21 +943,19 @@ int SpanJoinOperatorModule::Filter(sqlite3_vtab_cursor* cursor,
 
 int SpanJoinOperatorModule::Next(sqlite3_vtab_cursor* cursor) {
   Cursor* c = GetCursor(cursor);
-  Vtab* table = GetVtab(cursor->pVtab);
-  base::Status status = c->next_query->Next();
-  if (!status.ok()) {
-    return sqlite::utils::SetError(table, status.c_message());
+  if (++c->row < c->rows.size()) {
+    return SQLITE_OK;
   }
-  status = c->FindOverlappingSpan();
+  base::Status status = c->ComputeNextRows();
   if (!status.ok()) {
-    return sqlite::utils::SetError(table, status.c_message());
+    return sqlite::utils::SetError(GetVtab(cursor->pVtab), status.c_message());
   }
   return SQLITE_OK;
 }
 
 int SpanJoinOperatorModule::Eof(sqlite3_vtab_cursor* cur) {
   Cursor* c = GetCursor(cur);
-  return c->t1.IsEof() || c->t2.IsEof();
+  return c->row >= c->rows.size();
 }
 
 int SpanJoinOperatorModule::Column(sqlite3_vtab_cursor* cursor,
@@ -907,30 +966,23 @@ int SpanJoinOperatorModule::Column(sqlite3_vtab_cursor* cursor,
   State* state = sqlite::ModuleStateManager<SpanJoinOperatorModule>::GetState(
       table->state);
 
-  PERFETTO_DCHECK(c->t1.IsReal() || c->t2.IsReal());
+  const OutputRow& row = c->rows[c->row];
+  PERFETTO_DCHECK(row.t1_row != OutputRow::kShadow ||
+                  row.t2_row != OutputRow::kShadow);
 
   switch (N) {
     case Column::kTimestamp: {
-      auto max_ts = std::max(c->t1.ts(), c->t2.ts());
-      sqlite::result::Long(context, static_cast<sqlite3_int64>(max_ts));
+      sqlite::result::Long(context, static_cast<sqlite3_int64>(row.ts));
       break;
     }
     case Column::kDuration: {
-      auto max_start = std::max(c->t1.ts(), c->t2.ts());
-      auto min_end = std::min(c->t1.raw_ts_end(), c->t2.raw_ts_end());
-      auto dur = min_end - max_start;
-      sqlite::result::Long(context, static_cast<sqlite3_int64>(dur));
+      sqlite::result::Long(context, static_cast<sqlite3_int64>(row.dur));
       break;
     }
     case Column::kPartition: {
       if (state->partitioning != PartitioningType::kNoPartitioning) {
-        int64_t partition;
-        if (state->partitioning == PartitioningType::kMixedPartitioning) {
-          partition = c->last_mixed_partition_;
-        } else {
-          partition = c->t1.IsReal() ? c->t1.partition() : c->t2.partition();
-        }
-        sqlite::result::Long(context, static_cast<sqlite3_int64>(partition));
+        sqlite::result::Long(context,
+                             static_cast<sqlite3_int64>(row.partition));
         break;
       }
       PERFETTO_FALLTHROUGH;
@@ -939,10 +991,10 @@ int SpanJoinOperatorModule::Column(sqlite3_vtab_cursor* cursor,
       const auto* locator =
           state->global_index_to_column_locator.Find(static_cast<size_t>(N));
       PERFETTO_CHECK(locator);
-      if (locator->defn == c->t1.definition()) {
-        c->t1.ReportSqliteResult(context, locator->col_index);
+      if (locator->defn == &state->t1_defn) {
+        ReportSpanValue(context, c->t1_spans, row.t1_row, locator->col_index);
       } else {
-        c->t2.ReportSqliteResult(context, locator->col_index);
+        ReportSpanValue(context, c->t2_spans, row.t2_row, locator->col_index);
       }
     }
   }
@@ -967,7 +1019,7 @@ int SpanJoinOperatorModule::FindFunction(sqlite3_vtab*,
   return 0;
 }
 
-bool SpanJoinOperatorModule::Cursor::IsOverlappingSpan() const {
+bool SpanJoinOperatorModule::ChunkJoin::IsOverlappingSpan() const {
   // If either of the tables are eof, then we cannot possibly have an
   // overlapping span.
   if (t1.IsEof() || t2.IsEof())
@@ -998,7 +1050,7 @@ bool SpanJoinOperatorModule::Cursor::IsOverlappingSpan() const {
          (t2.ts() >= t1.ts() && t2.ts() < t1.AdjustedTsEnd());
 }
 
-base::Status SpanJoinOperatorModule::Cursor::FindOverlappingSpan() {
+base::Status SpanJoinOperatorModule::ChunkJoin::FindOverlappingSpan() {
   // We loop until we find a slice which overlaps from the two tables.
   while (true) {
     if (state->partitioning == PartitioningType::kMixedPartitioning) {
@@ -1043,7 +1095,7 @@ base::Status SpanJoinOperatorModule::Cursor::FindOverlappingSpan() {
 }
 
 SpanJoinOperatorModule::Query*
-SpanJoinOperatorModule::Cursor::FindEarliestFinishQuery() {
+SpanJoinOperatorModule::ChunkJoin::FindEarliestFinishQuery() {
   int64_t t1_part;
   int64_t t2_part;
 
@@ -1084,4 +1136,192 @@ SpanJoinOperatorModule::Cursor::FindEarliestFinishQuery() {
   return t1_less ? &t1 : &t2;
 }
 
+base::Status SpanJoinOperatorModule::ChunkJoin::Run(
+    const Chunk& chunk,
+    std::vector<OutputRow>* out) {
+  bool t1_partitioned_mixed =
+      t1.definition()->IsPartitioned() &&
+      state->partitioning == PartitioningType::kMixedPartitioning;
+  auto t1_eof = state->IsOuterJoin() && !t1_partitioned_mixed
+                    ? Query::InitialEofBehavior::kTreatAsMissingPartitionShadow
+                    : Query::InitialEofBehavior::kTreatAsEof;
+  RETURN_IF_ERROR(t1.Initialize(chunk.t1_begin, chunk.t1_end, t1_eof));
+
+  bool t2_partitioned_mixed =
+      t2.definition()->IsPartitioned() &&
+      state->partitioning == PartitioningType::kMixedPartitioning;
+  auto t2_eof =
+      (state->IsLeftJoin() || state->IsOuterJoin()) && !t2_partitioned_mixed
+          ? Query::InitialEofBehavior::kTreatAsMissingPartitionShadow
+          : Query::InitialEofBehavior::kTreatAsEof;
+  RETURN_IF_ERROR(t2.Initialize(chunk.t2_begin, chunk.t2_end, t2_eof));
+
+  RETURN_IF_ERROR(FindOverlappingSpan());
+  while (!t1.IsEof() && !t2.IsEof()) {
+    PERFETTO_DCHECK(t1.IsReal() || t2.IsReal());
+
+    OutputRow row;
+    row.ts = std::max(t1.ts(), t2.ts());
+    row.dur = std::min(t1.raw_ts_end(), t2.raw_ts_end()) - row.ts;
+    switch (state->partitioning) {
+      case PartitioningType::kNoPartitioning:
+        row.partition = 0;
+        break;
+      case PartitioningType::kSamePartitioning:
+        row.partition = t1.IsReal() ? t1.partition() : t2.partition();
+        break;
+      case PartitioningType::kMixedPartitioning:
+        row.partition = last_mixed_partition_;
+        break;
+    }
+    row.t1_row = t1.IsReal() ? t1.row() : OutputRow::kShadow;
+    row.t2_row = t2.IsReal() ? t2.row() : OutputRow::kShadow;
+    out->push_back(row);
+
+    RETURN_IF_ERROR(next_query->Next());
+    RETURN_IF_ERROR(FindOverlappingSpan());
+  }
+  return base::OkStatus();
+}
+
+base::Status SpanJoinOperatorModule::Cursor::Start(const std::string& t1_sql,
+                                                  const std::string& t2_sql) {
+  t1_spans.Clear();
+  t2_spans.Clear();
+  chunks.clear();
+  rows.clear();
+  row = 0;
+  RETURN_IF_ERROR(t1_reader.Start(state->engine, &state->t1_defn, t1_sql));
+  RETURN_IF_ERROR(t2_reader.Start(state->engine, &state->t2_defn, t2_sql));
+
+  // The table which is not partitioned is joined with every partition of the
+  // other table: read it completely once.
+  if (state->partitioning == PartitioningType::kMixedPartitioning) {
+    if (state->t1_defn.IsPartitioned()) {
+      RETURN_IF_ERROR(t2_reader.ReadPartition(&t2_spans).status());
+    } else {
+      RETURN_IF_ERROR(t1_reader.ReadPartition(&t1_spans).status());
+    }
+  }
+  return ComputeNextRows();
+}
+
+base::Status SpanJoinOperatorModule::Cursor::ReadNextChunks(uint32_t count) {
+  chunks.clear();
+  switch (state->partitioning) {
+    case PartitioningType::kNoPartitioning: {
+      // All the rows are in a single partition.
+      if (t1_reader.IsEof() && t2_reader.IsEof()) {
+        break;
+      }
+      t1_spans.Clear();
+      t2_spans.Clear();
+      RETURN_IF_ERROR(t1_reader.ReadPartition(&t1_spans).status());
+      RETURN_IF_ERROR(t2_reader.ReadPartition(&t2_spans).status());
+      chunks.push_back(Chunk{0, t1_spans.size(), 0, t2_spans.size()});
+      break;
+    }
+    case PartitioningType::kSamePartitioning: {
+      // Read the partitions of both tables in order, starting a new chunk at
+      // a partition boundary whenever the current one is large enough.
+      t1_spans.Clear();
+      t2_spans.Clear();
+      Chunk chunk{0, 0, 0, 0};
+      while (chunks.size() < count &&
+             (!t1_reader.IsEof() || !t2_reader.IsEof())) {
+        bool t1_next = t2_reader.IsEof() ||
+                       (!t1_reader.IsEof() &&
+                        t1_reader.partition() <= t2_reader.partition());
+        int64_t partition =
+            t1_next ? t1_reader.partition() : t2_reader.partition();
+        if (!t1_reader.IsEof() && t1_reader.partition() == partition) {
+          RETURN_IF_ERROR(t1_reader.ReadPartition(&t1_spans).status());
+        }
+        if (!t2_reader.IsEof() && t2_reader.partition() == partition) {
+          RETURN_IF_ERROR(t2_reader.ReadPartition(&t2_spans).status());
+        }
+        uint32_t t1_end = t1_spans.size();
+        uint32_t t2_end = t2_spans.size();
+        if ((t1_end - chunk.t1_begin) + (t2_end - chunk.t2_begin) >=
+            kRowsPerChunk) {
+          chunk.t1_end = t1_end;
+          chunk.t2_end = t2_end;
+          chunks.push_back(chunk);
+          chunk = Chunk{t1_end, t1_end, t2_end, t2_end};
+        }
+      }
+      if (chunk.t1_begin < t1_spans.size() ||
+          chunk.t2_begin < t2_spans.size()) {
+        chunks.push_back(Chunk{chunk.t1_begin, t1_spans.size(),
+                               chunk.t2_begin, t2_spans.size()});
+      }
+      break;
+    }
+    case PartitioningType::kMixedPartitioning: {
+      // Every partition of the partitioned table is joined with all the rows
+      // of the other table, which were read by Start.
+      bool t1_partitioned = state->t1_defn.IsPartitioned();
+      SpanReader& reader = t1_partitioned ? t1_reader : t2_reader;
+      Spans& partitioned = t1_partitioned ? t1_spans : t2_spans;
+      uint32_t other_size = t1_partitioned ? t2_spans.size() : t1_spans.size();
+      partitioned.Clear();
+      uint32_t begin = 0;
+      uint32_t rows_in_chunk = 0;
+      while (chunks.size() < count && !reader.IsEof()) {
+        ASSIGN_OR_RETURN(uint32_t read, reader.ReadPartition(&partitioned));
+        rows_in_chunk += read + other_size;
+        if (rows_in_chunk >= kRowsPerChunk || reader.IsEof()) {
+          uint32_t end = partitioned.size();
+          chunks.push_back(t1_partitioned ? Chunk{begin, end, 0, other_size}
+                                          : Chunk{0, other_size, begin, end});
+          begin = end;
+          rows_in_chunk = 0;
+        }
+      }
+      break;
+    }
+  }
+  return base::OkStatus();
+}
+
+base::Status SpanJoinOperatorModule::Cursor::ComputeNextRows() {
+  rows.clear();
+  row = 0;
+
+  base::ThreadPool* pool = state->engine->query_thread_pool();
+  while (rows.empty()) {
+    RETURN_IF_ERROR(ReadNextChunks(pool ? kChunksPerRound : 1));
+    if (chunks.empty()) {
+      break;
+    }
+    if (chunks.size() == 1) {
+      ChunkJoin join(state, &t1_spans, &t2_spans);
+      RETURN_IF_ERROR(join.Run(chunks[0], &rows));
+      continue;
+    }
+
+    // The chunks only read |t1_spans|, |t2_spans| and |state| so they can be
+    // joined concurrently.
+    auto count = static_cast<uint32_t>(chunks.size());
+    std::vector<std::vector<OutputRow>> results(count);
+    std::vector<base::Status> statuses(count);
+    base::WaitableEvent done;
+    for (uint32_t i = 0; i < count; ++i) {
+      const Chunk* chunk = &chunks[i];
+      pool->PostTask([this, chunk, &results, &statuses, &done, i] {
+        ChunkJoin join(state, &t1_spans, &t2_spans);
+        statuses[i] = join.Run(*chunk, &results[i]);
+        done.Notify();
+      });
+    }
+    done.Wait(count);
+
+    for (uint32_t i = 0; i < count; ++i) {
+      RETURN_IF_ERROR(statuses[i]);
+      rows.insert(rows.end(), results[i].begin(), results[i].end());
+    }
+  }
+  return base::OkStatus();
+}
+
 }  // namespace perfetto::trace_processor
@@ -19,6 +19,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <limits>
 #include <optional>
 #include <string>
@@ -28,9 +29,11 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/status_or.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_module.h"
 #include "src/trace_processor/sqlite/module_lifecycle_manager.h"
 #include "src/trace_processor/sqlite/sqlite_engine.h"
@@ -72,6 +75,15 @@ struct SpanJoinOperatorModule;
 //
 // All other columns apart from timestamp (ts), duration (dur) and the join key
 // are passed through unchanged.
+//
+// Implementation:
+// The rows of both tables are read (sorted by partition and ts) into memory a
+// few chunks of consecutive partitions at a time, as SQLite steps through the
+// output. The join is computed natively on each chunk: as the output for a
+// partition only depends on the rows of that partition, chunks are independent
+// and are processed on the query thread pool of the engine (if any). A table
+// which is not partitioned is joined with every partition of the other table
+// so it is read completely.
 struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
  public:
   static constexpr uint32_t kSourceGeqOpCode =
@@ -167,8 +179,69 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     uint32_t partition_idx_ = std::numeric_limits<uint32_t>::max();
   };
 
-  // Stores information about a single subquery into one of the two child
-  // tables.
+  // Rows of one of the child tables, sorted by partition and ts. Rows with a
+  // NULL partition are skipped.
+  struct Spans {
+    uint32_t size() const { return static_cast<uint32_t>(ts.size()); }
+
+    void Clear();
+
+    std::vector<int64_t> ts;
+    std::vector<int64_t> dur;
+
+    // Only populated if the table is partitioned.
+    std::vector<int64_t> partition;
+
+    // The values of all the columns of the table: |col_count| values for each
+    // row.
+    std::vector<SqlValue> values;
+    uint32_t col_count = 0;
+
+    // Owns the bytes pointed to by |values|. Strings are interned in the
+    // string pool of the engine instead, which keeps them alive.
+    std::deque<std::string> buffers;
+  };
+
+  // Reads the rows of a query on one of the child tables into |Spans|, one
+  // partition at a time.
+  class SpanReader {
+   public:
+    // Starts reading the rows of |sql|, which must be a query created by
+    // |defn|.
+    base::Status Start(PerfettoSqlEngine*,
+                       const TableDefinition* defn,
+                       const std::string& sql);
+
+    // Appends the rows of the next partition (or of all the remaining rows if
+    // the table is not partitioned) to |spans|. Returns the number of rows
+    // appended.
+    base::StatusOr<uint32_t> ReadPartition(Spans* spans);
+
+    // Returns whether all the rows were read.
+    bool IsEof() const { return eof_; }
+
+    // Returns the partition of the next row. Only valid if !IsEof() and the
+    // table is partitioned.
+    int64_t partition() const {
+      PERFETTO_DCHECK(!eof_ && defn_->IsPartitioned());
+      return partition_;
+    }
+
+   private:
+    // Steps the statement to the next row which does not have a NULL
+    // partition.
+    base::Status Step();
+
+    const TableDefinition* defn_ = nullptr;
+    StringPool* pool_ = nullptr;
+    std::optional<SqliteEngine::PreparedStatement> stmt_;
+    bool eof_ = true;
+
+    // The partition of the row the statement is on.
+    int64_t partition_ = 0;
+  };
+
+  // Iterates over a range of rows of one of the two child tables.
   //
   // This class is implemented as a state machine which steps from one slice to
   // the next.
@@ -177,7 +250,7 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     // Enum encoding the current state of the query in the state machine.
     enum class State {
       // Encodes that the current slice is a real slice (i.e. comes directly
-      // from the cursor).
+      // from the table).
       kReal,
 
       // Encodes that the current slice is on a partition for which there is a
@@ -192,20 +265,17 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
       kEof,
     };
 
-    Query(SpanJoinOperatorModule::State*, const TableDefinition*);
-    virtual ~Query();
-
-    Query(Query&&) noexcept = default;
-    Query& operator=(Query&&) = default;
+    Query(const TableDefinition*, const Spans*);
 
     enum class InitialEofBehavior {
       kTreatAsEof,
       kTreatAsMissingPartitionShadow
     };
 
-    // Initializes the query with the given constraints and query parameters.
+    // Initializes the query to iterate the rows [begin, end) of the table.
     base::Status Initialize(
-        std::string sql,
+        uint32_t begin,
+        uint32_t end,
         InitialEofBehavior eof_behavior = InitialEofBehavior::kTreatAsEof);
 
     // Forwards the query to the next valid slice.
@@ -216,9 +286,6 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     // partitions is rewound to the start on every new partition.
     base::Status Rewind();
 
-    // Reports the column at the given index to given context.
-    void ReportSqliteResult(sqlite3_context* context, size_t index);
-
     // Returns whether the cursor has reached eof.
     bool IsEof() const { return state_ == State::kEof; }
 
@@ -266,12 +333,16 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
       return ts_end_;
     }
 
+    // Returns the row of the table for the current slice. Only valid for real
+    // slices.
+    uint32_t row() const {
+      PERFETTO_DCHECK(IsReal());
+      return row_;
+    }
+
     const TableDefinition* definition() const { return defn_; }
 
    private:
-    Query(Query&) = delete;
-    Query& operator=(const Query&) = delete;
-
     // Returns whether the current slice pointed to is a valid slice.
     bool IsValidSlice();
 
@@ -282,7 +353,7 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     base::Status NextSliceState();
 
     // Forwards the cursor to point to the next real slice.
-    base::Status CursorNext();
+    void CursorNext();
 
     // Returns whether the current slice pointed to is a present partition
     // shadow.
@@ -306,21 +377,18 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
 
     int64_t CursorTs() const {
       PERFETTO_DCHECK(!cursor_eof_);
-      auto ts_idx = static_cast<int>(defn_->ts_idx());
-      return sqlite3_column_int64(stmt_->sqlite_stmt(), ts_idx);
+      return spans_->ts[cursor_];
     }
 
     int64_t CursorDur() const {
       PERFETTO_DCHECK(!cursor_eof_);
-      auto dur_idx = static_cast<int>(defn_->dur_idx());
-      return sqlite3_column_int64(stmt_->sqlite_stmt(), dur_idx);
+      return spans_->dur[cursor_];
     }
 
     int64_t CursorPartition() const {
       PERFETTO_DCHECK(!cursor_eof_);
       PERFETTO_DCHECK(defn_->IsPartitioned());
-      auto partition_idx = static_cast<int>(defn_->partition_idx());
-      return sqlite3_column_int64(stmt_->sqlite_stmt(), partition_idx);
+      return spans_->partition[cursor_];
     }
 
     State state_ = State::kMissingPartitionShadow;
@@ -333,15 +401,21 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     // Only valid when |state_| == kReal or |state_| == kPresentPartitionShadow.
     int64_t partition_ = std::numeric_limits<int64_t>::min();
 
+    // Only valid when |state_| == kReal.
+    uint32_t row_ = 0;
+
     // Only valid when |state_| == kMissingPartitionShadow.
     int64_t missing_partition_start_ = 0;
     int64_t missing_partition_end_ = 0;
 
-    std::string sql_query_;
-    std::optional<SqliteEngine::PreparedStatement> stmt_;
+    // The rows [begin_, end_) of |spans_| are iterated; |cursor_| is the next
+    // row to be read.
+    uint32_t begin_ = 0;
+    uint32_t end_ = 0;
+    uint32_t cursor_ = 0;
 
     const TableDefinition* defn_ = nullptr;
-    SpanJoinOperatorModule::State* in_state_ = nullptr;
+    const Spans* spans_ = nullptr;
   };
 
   // Columns of the span operator table.
@@ -409,13 +483,41 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     sqlite::ModuleStateManager<SpanJoinOperatorModule>::PerVtabState* state;
   };
 
-  // Base class for a cursor on the span table.
-  struct Cursor final : public sqlite3_vtab_cursor {
-    explicit Cursor(State* _state)
-        : t1(_state, &_state->t1_defn),
-          t2(_state, &_state->t2_defn),
+  // A range of consecutive partitions of the two tables which can be joined
+  // independently of the other partitions. The ranges are rows of the spans
+  // currently read by the cursor.
+  struct Chunk {
+    uint32_t t1_begin;
+    uint32_t t1_end;
+    uint32_t t2_begin;
+    uint32_t t2_end;
+  };
+
+  // A row of the span join table.
+  struct OutputRow {
+    static constexpr uint32_t kShadow = std::numeric_limits<uint32_t>::max();
+
+    int64_t ts;
+    int64_t dur;
+    int64_t partition;
+
+    // The rows of the child tables or kShadow if the slice of the table is a
+    // shadow.
+    uint32_t t1_row;
+    uint32_t t2_row;
+  };
+
+  // Computes the span join of a single chunk by stepping through the slices of
+  // both tables in lockstep.
+  struct ChunkJoin {
+    ChunkJoin(const State* _state, const Spans* t1_spans, const Spans* t2_spans)
+        : t1(&_state->t1_defn, t1_spans),
+          t2(&_state->t2_defn, t2_spans),
           state(_state) {}
 
+    // Appends the rows of the span join of |chunk| to |out|.
+    base::Status Run(const Chunk& chunk, std::vector<OutputRow>* out);
+
     bool IsOverlappingSpan() const;
     base::Status FindOverlappingSpan();
     Query* FindEarliestFinishQuery();
@@ -428,6 +530,37 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     // Only valid for kMixedPartition.
     int64_t last_mixed_partition_ = std::numeric_limits<int64_t>::min();
 
+    const State* state;
+  };
+
+  // Base class for a cursor on the span table.
+  struct Cursor final : public sqlite3_vtab_cursor {
+    explicit Cursor(State* _state) : state(_state) {}
+
+    // Starts reading the rows of the two tables.
+    base::Status Start(const std::string& t1_sql, const std::string& t2_sql);
+
+    // Reads the rows of the next |count| chunks of the two tables into
+    // |t1_spans| and |t2_spans|, replacing the rows of the previous chunks
+    // (except for a table which is not partitioned, which is read once).
+    base::Status ReadNextChunks(uint32_t count);
+
+    // Joins the next few chunks until there are rows to return or both tables
+    // were completely read and joined.
+    base::Status ComputeNextRows();
+
+    SpanReader t1_reader;
+    SpanReader t2_reader;
+
+    Spans t1_spans;
+    Spans t2_spans;
+
+    // The chunks of the rows in |t1_spans| and |t2_spans|.
+    std::vector<Chunk> chunks;
+
+    std::vector<OutputRow> rows;
+    uint32_t row = 0;
+
     State* state;
   };
 
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <sqlite3.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/operators/span_join_operator.h"
+#include "src/trace_processor/sqlite/scoped_db.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void SpanJoinArgs(benchmark::internal::Benchmark* b) {
+  // The number of threads of the query thread pool of the engine: 0 runs
+  // the join on the calling thread only.
+  for (int threads : {0, 2, 4, 8}) {
+    b->Arg(threads);
+  }
+  b->UseRealTime();
+}
+
+// Two tables partitioned by cpu, joined with SPAN_JOIN by an engine with
+// |threads| query threads.
+class SpanJoinForBenchmark {
+ public:
+  explicit SpanJoinForBenchmark(uint32_t threads) {
+    if (threads > 0) {
+      thread_pool_.emplace(threads);
+    }
+    engine_ = std::make_unique<PerfettoSqlEngine>(
+        &pool_, thread_pool_ ? &*thread_pool_ : nullptr);
+    engine_->sqlite_engine()->RegisterVirtualTableModule<SpanJoinOperatorModule>(
+        "span_join",
+        std::make_unique<SpanJoinOperatorModule::Context>(engine_.get()));
+
+    uint32_t rows = IsBenchmarkFunctionalOnly() ? 10000 : 1024 * 1024;
+    std::string populate = base::StackString<1024>(
+                               "CREATE TABLE f(ts BIGINT, dur BIGINT, cpu INT, "
+                               "name STRING);"
+                               "INSERT INTO f WITH RECURSIVE i(x) AS "
+                               "  (SELECT 0 UNION ALL SELECT x + 1 FROM i "
+                               "   WHERE x < %u) "
+                               "SELECT x / 1024 * 100, 60, x %% 1024, "
+                               "  'name' || (x %% 100) FROM i "
+                               "ORDER BY 3, 1;"
+                               "CREATE TABLE s(ts BIGINT, dur BIGINT, cpu INT);"
+                               "INSERT INTO s SELECT ts + 30, 50, cpu FROM f;"
+                               "CREATE VIRTUAL TABLE sp USING span_join("
+                               "  f PARTITIONED cpu, s PARTITIONED cpu);",
+                               rows - 1)
+                               .ToStdString();
+    PERFETTO_CHECK(sqlite3_exec(engine_->sqlite_engine()->db(),
+                                populate.c_str(), nullptr, nullptr,
+                                nullptr) == SQLITE_OK);
+  }
+
+  // Runs |sql| to completion and returns the number of rows it returned.
+  uint32_t Run(const char* sql) {
+    sqlite3_stmt* raw_stmt;
+    PERFETTO_CHECK(sqlite3_prepare_v2(engine_->sqlite_engine()->db(), sql, -1,
+                                      &raw_stmt, nullptr) == SQLITE_OK);
+    ScopedStmt stmt(raw_stmt);
+    uint32_t count = 0;
+    int ret;
+    while ((ret = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+      count++;
+    }
+    PERFETTO_CHECK(ret == SQLITE_DONE);
+    return count;
+  }
+
+ private:
+  std::optional<base::ThreadPool> thread_pool_;
+  StringPool pool_;
+  std::unique_ptr<PerfettoSqlEngine> engine_;
+};
+
+// Joins all the partitions: this is where joining chunks of partitions in
+// parallel helps.
+void BM_SpanJoinPartitioned(benchmark::State& state) {
+  SpanJoinForBenchmark span_join(static_cast<uint32_t>(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(span_join.Run("SELECT ts, dur, cpu FROM sp"));
+  }
+}
+BENCHMARK(BM_SpanJoinPartitioned)->Apply(SpanJoinArgs);
+
+// Only needs the first rows: only the first chunks of the tables are read.
+void BM_SpanJoinPartitionedLimit(benchmark::State& state) {
+  SpanJoinForBenchmark span_join(static_cast<uint32_t>(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        span_join.Run("SELECT ts, dur, cpu, name FROM sp LIMIT 10"));
+  }
+}
+BENCHMARK(BM_SpanJoinPartitionedLimit)->Apply(SpanJoinArgs);
+
+}  // namespace
+}  // namespace perfetto::trace_processor
@@ -23,6 +23,7 @@
 #include <string>
 #include <vector>
 
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
@@ -387,5 +388,86 @@ TEST_F(SpanJoinOperatorTableTest, CapitalizedLeftJoin) {
   ASSERT_EQ(sqlite3_step(stmt_.get()), SQLITE_DONE);
 }
 
+TEST_F(SpanJoinOperatorTableTest, ParallelPartitions) {
+  // Enough rows for the join to be split into multiple chunks.
+  constexpr char kPopulate[] =
+      "CREATE TEMP TABLE f(ts BIGINT, dur BIGINT, cpu UNSIGNED INT);"
+      "CREATE TEMP TABLE s(ts BIGINT, dur BIGINT, cpu UNSIGNED INT);"
+      "INSERT INTO f WITH RECURSIVE i(x) AS "
+      "  (SELECT 0 UNION ALL SELECT x + 1 FROM i WHERE x < 99999) "
+      "SELECT x / 100 * 10, 10, x % 100 FROM i;"
+      "INSERT INTO s WITH RECURSIVE i(x) AS "
+      "  (SELECT 0 UNION ALL SELECT x + 1 FROM i WHERE x < 99999) "
+      "SELECT x / 100 * 10 + 5, 3, x % 100 + 50 FROM i;"
+      "CREATE VIRTUAL TABLE sp USING span_outer_join("
+      "  f PARTITIONED cpu, s PARTITIONED cpu);";
+  constexpr char kQuery[] =
+      "SELECT COUNT(*), SUM(ts), SUM(dur), SUM(cpu) FROM sp";
+
+  base::ThreadPool thread_pool(4);
+  StringPool parallel_pool;
+  PerfettoSqlEngine parallel_engine(&parallel_pool, &thread_pool);
+
+  std::vector<int64_t> results[2];
+  PerfettoSqlEngine* engines[] = {&engine_, &parallel_engine};
+  for (size_t i = 0; i < 2; ++i) {
+    PerfettoSqlEngine* engine = engines[i];
+    engine->sqlite_engine()->RegisterVirtualTableModule<SpanJoinOperatorModule>(
+        "span_outer_join",
+        std::make_unique<SpanJoinOperatorModule::Context>(engine));
+    ASSERT_EQ(sqlite3_exec(engine->sqlite_engine()->db(), kPopulate, nullptr,
+                           nullptr, nullptr),
+              SQLITE_OK);
+
+    sqlite3_stmt* raw_stmt;
+    ASSERT_EQ(sqlite3_prepare_v2(engine->sqlite_engine()->db(), kQuery, -1,
+                                 &raw_stmt, nullptr),
+              SQLITE_OK);
+    ScopedStmt stmt(raw_stmt);
+    ASSERT_EQ(sqlite3_step(stmt.get()), SQLITE_ROW);
+    for (int col = 0; col < 4; ++col) {
+      results[i].push_back(sqlite3_column_int64(stmt.get(), col));
+    }
+    ASSERT_EQ(sqlite3_step(stmt.get()), SQLITE_DONE);
+  }
+  ASSERT_GT(results[0][0], 0);
+  ASSERT_EQ(results[0], results[1]);
+}
+
+TEST_F(SpanJoinOperatorTableTest, MixedPartitioningStringsAcrossChunks) {
+  // The partitioned table is read a chunk at a time: strings must stay valid
+  // across chunks and the unpartitioned table must be joined with all of
+  // them.
+  RunStatement(
+      "CREATE TEMP TABLE f(ts BIGINT, dur BIGINT, cpu UNSIGNED INT, "
+      "name STRING);");
+  RunStatement(
+      "INSERT INTO f WITH RECURSIVE i(x) AS "
+      "  (SELECT 0 UNION ALL SELECT x + 1 FROM i WHERE x < 199999) "
+      "SELECT x / 2000 * 10, 5, x % 2000, 'name' || (x % 7) FROM i;");
+  RunStatement("CREATE TEMP TABLE s(ts BIGINT, dur BIGINT, label STRING);");
+  RunStatement("INSERT INTO s VALUES (0, 500, 'first'), (500, 1000, 'last');");
+  RunStatement(
+      "CREATE VIRTUAL TABLE sp USING span_join(f PARTITIONED cpu, s);");
+
+  PrepareValidStatement(
+      "SELECT COUNT(*), SUM(name = 'name3'), SUM(label = 'last'), "
+      "SUM(LENGTH(name)) FROM sp");
+  AssertNextRow({200000, 200000 / 7, 100000, 200000 * 5});
+  ASSERT_EQ(sqlite3_step(stmt_.get()), SQLITE_DONE);
+
+  // Queries which stop early only read the first chunk.
+  PrepareValidStatement("SELECT ts, cpu, name, label FROM sp LIMIT 2");
+  AssertNextRow({0, 0});
+  ASSERT_STREQ(
+      reinterpret_cast<const char*>(sqlite3_column_text(stmt_.get(), 2)),
+      "name0");
+  ASSERT_STREQ(
+      reinterpret_cast<const char*>(sqlite3_column_text(stmt_.get(), 3)),
+      "first");
+  AssertNextRow({10, 0});
+  ASSERT_EQ(sqlite3_step(stmt_.get()), SQLITE_DONE);
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor
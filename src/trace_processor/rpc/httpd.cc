@@ -60,6 +60,7 @@ class Httpd : public base::HttpRequestHandler {
   // HttpRequestHandler implementation.
   void OnHttpRequest(const base::HttpRequest&) override;
   void OnWebsocketMessage(const base::WebsocketMessage&) override;
+  void OnHttpConnectionClosed(base::HttpServerConnection*) override;
 
   static void ServeHelpPage(const base::HttpRequest&);
 
@@ -253,11 +254,21 @@ void Httpd::OnWebsocketMessage(const base::WebsocketMessage& msg) {
       [&](const void* data, uint32_t len) {
         SendRpcChunk(msg.conn, data, len);
       });
+  global_trace_processor_rpc_.SetRpcClient(msg.conn);
   // OnRpcRequest() will call SendRpcChunk() one or more times.
   global_trace_processor_rpc_.OnRpcRequest(msg.data.data(), msg.data.size());
+  global_trace_processor_rpc_.SetRpcClient(nullptr);
   global_trace_processor_rpc_.SetRpcResponseFunction(nullptr);
 }
 
+void Httpd::OnHttpConnectionClosed(base::HttpServerConnection* conn) {
+  // Query cursors opened over a websocket cannot be read by anybody else once
+  // it goes away. Cursors opened via /rpc outlive the (one per request) HTTP
+  // connections and are only bounded by Rpc::kMaxQueryCursors.
+  if (conn->is_websocket())
+    global_trace_processor_rpc_.CloseQueryCursors(conn);
+}
+
 }  // namespace
 
 void RunHttpRPCServer(std::unique_ptr<TraceProcessor> preloaded_instance,
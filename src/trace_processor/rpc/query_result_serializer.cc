@@ -32,10 +32,12 @@ namespace {
 
 namespace pu = ::protozero::proto_utils;
 using BatchProto = protos::pbzero::QueryResult::CellsBatch;
+using ColumnProto = protos::pbzero::QueryResult::ColumnarBatch::Column;
 using ResultProto = protos::pbzero::QueryResult;
 
-// The reserved field in trace_processor.proto.
+// The reserved fields in trace_processor.proto.
 static constexpr uint32_t kPaddingFieldId = 7;
+static constexpr uint32_t kColumnPaddingFieldId = 8;
 
 uint8_t MakeLenDelimTag(uint32_t field_num) {
   uint32_t tag = pu::MakeTagLengthDelimited(field_num);
@@ -43,10 +45,48 @@ uint8_t MakeLenDelimTag(uint32_t field_num) {
   return static_cast<uint8_t>(tag);
 }
 
+// Appends |data| as the length-delimited field |field_num| of |msg|, making
+// sure that the payload starts at a 64-bit aligned offset, so that JS and
+// numpy can access it by overlaying a TypedArray / ndarray, without extra
+// copies. If needed, a |padding_field_num| varint field is inserted before it.
+void AppendAligned(protozero::Message* msg,
+                   uint32_t field_num,
+                   uint32_t padding_field_num,
+                   const void* data,
+                   uint32_t size) {
+  const auto& writer = *msg->stream_writer();
+  uint8_t preamble[16];
+  uint8_t* preamble_end = &preamble[0];
+  *(preamble_end++) = MakeLenDelimTag(field_num);
+  preamble_end = pu::WriteVarInt(size, preamble_end);
+  uint32_t preamble_size = static_cast<uint32_t>(preamble_end - &preamble[0]);
+
+  // The byte after the preamble must start at a 64bit-aligned offset.
+  // The padding needs to be > 1 Byte because of proto encoding.
+  const uint32_t off = static_cast<uint32_t>(writer.written() + preamble_size);
+  const uint32_t aligned_off = (off + 7) & ~7u;
+  uint32_t padding = aligned_off - off;
+  padding = padding == 1 ? 9 : padding;
+  if (padding > 0) {
+    uint8_t pad_buf[10];
+    uint8_t* pad = pad_buf;
+    *(pad++) = pu::MakeTagVarInt(padding_field_num);
+    for (uint32_t i = 0; i < padding - 2; i++)
+      *(pad++) = 0x80;
+    *(pad++) = 0;
+    msg->AppendRawProtoBytes(pad_buf, static_cast<size_t>(pad - pad_buf));
+  }
+  msg->AppendRawProtoBytes(preamble, preamble_size);
+  PERFETTO_CHECK(writer.written() % 8 == 0);
+  msg->AppendRawProtoBytes(data, size);
+}
+
 }  // namespace
 
-QueryResultSerializer::QueryResultSerializer(Iterator iter)
-    : iter_(iter.take_impl()), num_cols_(iter_->ColumnCount()) {}
+QueryResultSerializer::QueryResultSerializer(Iterator iter, Encoding encoding)
+    : iter_(iter.take_impl()),
+      num_cols_(iter_->ColumnCount()),
+      encoding_(encoding) {}
 
 QueryResultSerializer::~QueryResultSerializer() = default;
 
@@ -71,7 +111,11 @@ bool QueryResultSerializer::Serialize(protos::pbzero::QueryResult* res) {
   // write an empty batch with the EOF marker. Errors can happen also in the
   // middle of a query, not just before starting it.
 
-  SerializeBatch(res);
+  if (encoding_ == Encoding::kColumnar) {
+    SerializeColumnarBatch(res);
+  } else {
+    SerializeBatch(res);
+  }
   MaybeSerializeError(res);
   return !eof_reached_;
 }
@@ -87,7 +131,6 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   // Note: this function uses uint32_t instead of size_t because Wasm doesn't
   // have yet native 64-bit integers and this is perf-sensitive.
 
-  const auto& writer = *res->stream_writer();
   auto* batch = res->add_batch();
 
   // Start the |string_cells|.
@@ -208,32 +251,9 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   // a TypedArray, without extra copies.
   const uint32_t doubles_size = static_cast<uint32_t>(doubles.size());
   if (doubles_size > 0) {
-    uint8_t preamble[16];
-    uint8_t* preamble_end = &preamble[0];
-    *(preamble_end++) = MakeLenDelimTag(BatchProto::kFloat64CellsFieldNumber);
-    preamble_end = pu::WriteVarInt(doubles_size, preamble_end);
-    uint32_t preamble_size = static_cast<uint32_t>(preamble_end - &preamble[0]);
-
-    // The byte after the preamble must start at a 64bit-aligned offset.
-    // The padding needs to be > 1 Byte because of proto encoding.
-    const uint32_t off =
-        static_cast<uint32_t>(writer.written() + preamble_size);
-    const uint32_t aligned_off = (off + 7) & ~7u;
-    uint32_t padding = aligned_off - off;
-    padding = padding == 1 ? 9 : padding;
-    if (padding > 0) {
-      uint8_t pad_buf[10];
-      uint8_t* pad = pad_buf;
-      *(pad++) = pu::MakeTagVarInt(kPaddingFieldId);
-      for (uint32_t i = 0; i < padding - 2; i++)
-        *(pad++) = 0x80;
-      *(pad++) = 0;
-      batch->AppendRawProtoBytes(pad_buf, static_cast<size_t>(pad - pad_buf));
-    }
-    batch->AppendRawProtoBytes(preamble, preamble_size);
-    PERFETTO_CHECK(writer.written() % 8 == 0);
-    batch->AppendRawProtoBytes(doubles.data(), doubles_size);
-  }  // if (doubles_size > 0)
+    AppendAligned(batch, BatchProto::kFloat64CellsFieldNumber, kPaddingFieldId,
+                  doubles.data(), doubles_size);
+  }
 
   // Append the blobs.
   if (blobs.size() > 0) {
@@ -250,6 +270,158 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   batch->Finalize();
 }
 
+void QueryResultSerializer::SerializeColumnarBatch(
+    protos::pbzero::QueryResult* res) {
+  // Unlike SerializeBatch(), the whole batch is buffered before writing it:
+  // the buffers of one column must be contiguous but the iterator returns the
+  // cells row by row.
+  struct ColumnBuffers {
+    std::vector<uint8_t> cell_types;
+    std::vector<int64_t> int64s;
+    std::vector<double> doubles;
+    std::vector<uint32_t> offsets;
+    std::vector<uint8_t> data;
+    uint32_t types_seen = 0;  // Bitmask of 1 << CellType.
+  };
+  std::vector<ColumnBuffers> columns(num_cols_);
+
+  // See the comments in SerializeBatch() for the batch splitting logic.
+  uint32_t approx_batch_size = 16;
+  uint32_t row = 0;
+  bool batch_full = false;
+  for (;; ++row) {
+    if (col_ >= num_cols_) {
+      col_ = 0;
+      if (!iter_->Next())
+        break;  // EOF or error.
+
+      // Unlike SerializeBatch() a batch always contains at least one row, even
+      // if it is larger than the limits.
+      if (row > 0 && ((row + 1) * num_cols_ > cells_per_batch_ ||
+                      approx_batch_size > batch_split_threshold_)) {
+        batch_full = true;
+        break;
+      }
+    }
+
+    for (; col_ < num_cols_; ++col_) {
+      ColumnBuffers& col = columns[col_];
+      auto value = iter_->Get(col_);
+      uint8_t cell_type = BatchProto::CELL_INVALID;
+      switch (value.type) {
+        case SqlValue::Type::kNull: {
+          cell_type = BatchProto::CELL_NULL;
+          break;
+        }
+        case SqlValue::Type::kLong: {
+          cell_type = BatchProto::CELL_VARINT;
+          col.int64s.resize(row);
+          col.int64s.push_back(value.long_value);
+          approx_batch_size += sizeof(int64_t);
+          break;
+        }
+        case SqlValue::Type::kDouble: {
+          cell_type = BatchProto::CELL_FLOAT64;
+          col.doubles.resize(row);
+          col.doubles.push_back(value.double_value);
+          approx_batch_size += sizeof(double);
+          break;
+        }
+        case SqlValue::Type::kString:
+        case SqlValue::Type::kBytes: {
+          const uint8_t* src;
+          uint32_t len;
+          if (value.type == SqlValue::Type::kString) {
+            cell_type = BatchProto::CELL_STRING;
+            src = reinterpret_cast<const uint8_t*>(value.string_value);
+            len = static_cast<uint32_t>(strlen(value.string_value));
+          } else {
+            cell_type = BatchProto::CELL_BLOB;
+            src = static_cast<const uint8_t*>(value.bytes_value);
+            len = static_cast<uint32_t>(value.bytes_count);
+          }
+          // The rows before this one which are not strings or blobs are empty.
+          col.offsets.resize(row + 1, static_cast<uint32_t>(col.data.size()));
+          col.data.insert(col.data.end(), src, src + len);
+          approx_batch_size += len + sizeof(uint32_t);
+          break;
+        }
+      }
+      PERFETTO_DCHECK(cell_type != BatchProto::CELL_INVALID);
+      col.cell_types.push_back(cell_type);
+      col.types_seen |= 1u << cell_type;
+    }
+  }  // for (row)
+  const uint32_t row_count = row;
+
+  auto* batch = res->add_columnar_batch();
+  batch->set_row_count(row_count);
+  for (ColumnBuffers& col : columns) {
+    auto* column = batch->add_columns();
+    const uint32_t null_bit = 1u << BatchProto::CELL_NULL;
+    const uint32_t non_null_types = col.types_seen & ~null_bit;
+    if (non_null_types == 0) {
+      column->set_type(BatchProto::CELL_NULL);
+    } else if ((non_null_types & (non_null_types - 1)) == 0) {
+      uint32_t type = 0;
+      while ((non_null_types >> type) != 1)
+        type++;
+      column->set_type(static_cast<BatchProto::CellType>(type));
+    } else {
+      column->set_cell_types(col.cell_types.data(), row_count);
+    }
+
+    if (non_null_types != 0 && (col.types_seen & null_bit)) {
+      std::vector<uint8_t> validity((row_count + 7) / 8);
+      for (uint32_t i = 0; i < row_count; ++i) {
+        if (col.cell_types[i] != BatchProto::CELL_NULL)
+          validity[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+      }
+      column->set_validity(validity.data(), validity.size());
+    }
+
+    // protozero shrinks the size field of messages shorter than 128 bytes when
+    // finalizing them, moving their payload by a few bytes: this would break
+    // the alignment of the buffers. Pad short columns to prevent that.
+    uint32_t payload_size = static_cast<uint32_t>(col.data.size());
+    payload_size += col.int64s.empty() ? 0 : row_count * sizeof(int64_t);
+    payload_size += col.doubles.empty() ? 0 : row_count * sizeof(double);
+    payload_size +=
+        col.offsets.empty() ? 0 : (row_count + 1) * sizeof(uint32_t);
+    if (payload_size > 0 && payload_size < 128) {
+      static constexpr uint8_t kZeros[128] = {};
+      column->AppendBytes(kColumnPaddingFieldId, kZeros, sizeof(kZeros));
+    }
+
+    if (!col.int64s.empty()) {
+      col.int64s.resize(row_count);
+      AppendAligned(column, ColumnProto::kInt64ValuesFieldNumber,
+                    kColumnPaddingFieldId, col.int64s.data(),
+                    row_count * static_cast<uint32_t>(sizeof(int64_t)));
+    }
+    if (!col.doubles.empty()) {
+      col.doubles.resize(row_count);
+      AppendAligned(column, ColumnProto::kFloat64ValuesFieldNumber,
+                    kColumnPaddingFieldId, col.doubles.data(),
+                    row_count * static_cast<uint32_t>(sizeof(double)));
+    }
+    if (!col.offsets.empty()) {
+      col.offsets.resize(row_count + 1, static_cast<uint32_t>(col.data.size()));
+      AppendAligned(column, ColumnProto::kOffsetsFieldNumber,
+                    kColumnPaddingFieldId, col.offsets.data(),
+                    (row_count + 1) * static_cast<uint32_t>(sizeof(uint32_t)));
+      column->set_data(col.data.data(), col.data.size());
+    }
+  }
+
+  // If this is the last batch, write the EOF field.
+  if (!batch_full) {
+    eof_reached_ = true;
+    batch->set_is_last_batch(true);
+  }
+  batch->Finalize();
+}
+
 void QueryResultSerializer::MaybeSerializeError(
     protos::pbzero::QueryResult* res) {
   if (iter_->Status().ok())
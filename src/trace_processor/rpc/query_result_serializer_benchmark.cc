@@ -21,10 +21,15 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/trace_processor.h"
 
+#include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
+
+using perfetto::protos::pbzero::QueryResult;
 using perfetto::trace_processor::Config;
 using perfetto::trace_processor::QueryResultSerializer;
 using perfetto::trace_processor::TraceProcessor;
 using VectorType = std::vector<uint8_t>;
+using BatchProto = QueryResult::CellsBatch;
+using ColumnProto = QueryResult::ColumnarBatch::Column;
 
 namespace {
 
@@ -46,6 +51,121 @@ void RunQueryChecked(TraceProcessor* tp, const std::string& query) {
   PERFETTO_CHECK(iter.Status().ok());
 }
 
+// Client side of the end-to-end benchmarks: reads every cell of the result,
+// the way a client converting it into a dataframe would.
+// Returns a checksum of the cells to keep the compiler honest.
+uint64_t DecodeCells(const VectorType& buf) {
+  uint64_t checksum = 0;
+  QueryResult::Decoder result(buf.data(), buf.size());
+  for (auto batch_it = result.batch(); batch_it; ++batch_it) {
+    BatchProto::Decoder batch(batch_it->as_bytes());
+    bool parse_error = false;
+    auto varint_it = batch.varint_cells(&parse_error);
+    auto double_it = batch.float64_cells(&parse_error);
+    protozero::ConstChars strings = batch.string_cells();
+    const char* str = strings.data;
+    for (auto it = batch.cells(&parse_error); it; ++it) {
+      switch (*it) {
+        case BatchProto::CELL_VARINT:
+          checksum += static_cast<uint64_t>(*varint_it);
+          ++varint_it;
+          break;
+        case BatchProto::CELL_FLOAT64:
+          checksum += static_cast<uint64_t>(*double_it);
+          ++double_it;
+          break;
+        case BatchProto::CELL_STRING: {
+          size_t len = strlen(str);
+          checksum += len;
+          str += len + 1;
+          break;
+        }
+        default:
+          break;
+      }
+    }
+    PERFETTO_CHECK(!parse_error);
+  }
+  return checksum;
+}
+
+uint64_t DecodeColumnar(const VectorType& buf) {
+  uint64_t checksum = 0;
+  QueryResult::Decoder result(buf.data(), buf.size());
+  for (auto batch_it = result.columnar_batch(); batch_it; ++batch_it) {
+    QueryResult::ColumnarBatch::Decoder batch(batch_it->as_bytes());
+    uint32_t row_count = batch.row_count();
+    for (auto col_it = batch.columns(); col_it; ++col_it) {
+      ColumnProto::Decoder column(col_it->as_bytes());
+      // The buffers are 64-bit aligned so they can be used in place.
+      const auto* int64s =
+          reinterpret_cast<const int64_t*>(column.int64_values().data);
+      const auto* doubles =
+          reinterpret_cast<const double*>(column.float64_values().data);
+      const auto* offsets =
+          reinterpret_cast<const uint32_t*>(column.offsets().data);
+      switch (column.type()) {
+        case BatchProto::CELL_VARINT:
+          for (uint32_t i = 0; i < row_count; ++i)
+            checksum += static_cast<uint64_t>(int64s[i]);
+          break;
+        case BatchProto::CELL_FLOAT64:
+          for (uint32_t i = 0; i < row_count; ++i)
+            checksum += static_cast<uint64_t>(doubles[i]);
+          break;
+        case BatchProto::CELL_STRING:
+          checksum += offsets[row_count] - offsets[0];
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  return checksum;
+}
+
+// Runs |query| and serializes its result with |encoding|. If |decode| is true
+// also decodes it, to measure the cost on both sides of the RPC.
+void BenchmarkQuery(benchmark::State& state,
+                    TraceProcessor* tp,
+                    const char* query,
+                    QueryResultSerializer::Encoding encoding,
+                    bool decode) {
+  VectorType buf;
+  for (auto _ : state) {
+    auto iter = tp->ExecuteQuery(query);
+    QueryResultSerializer serializer(std::move(iter), encoding);
+    serializer.set_batch_size_for_testing(
+        static_cast<uint32_t>(state.range(0)),
+        static_cast<uint32_t>(state.range(1)));
+    for (bool has_more = true; has_more;) {
+      has_more = serializer.Serialize(&buf);
+      if (decode) {
+        benchmark::DoNotOptimize(
+            encoding == QueryResultSerializer::Encoding::kColumnar
+                ? DecodeColumnar(buf)
+                : DecodeCells(buf));
+        buf.clear();
+      }
+    }
+    benchmark::DoNotOptimize(buf.data());
+    buf.clear();
+  }
+  benchmark::ClobberMemory();
+}
+
+std::unique_ptr<TraceProcessor> CreateWindowTable(int64_t rows) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  RunQueryChecked(tp.get(), "create virtual table win using window;");
+  RunQueryChecked(tp.get(), "update win set window_start=0, window_dur=" +
+                                std::to_string(rows) +
+                                ", quantum=1 where rowid = 0");
+  return tp;
+}
+
+constexpr char kNumericQuery[] =
+    "select ts, dur * 1.0 as dur, quantum_ts, ts * 2 as ts2 from win";
+
 }  // namespace
 
 static void BM_QueryResultSerializer_Mixed(benchmark::State& state) {
@@ -92,5 +212,35 @@ static void BM_QueryResultSerializer_Strings(benchmark::State& state) {
   benchmark::ClobberMemory();
 }
 
+static void BM_QueryResultSerializer_Numeric(benchmark::State& state) {
+  auto tp = CreateWindowTable(50000);
+  BenchmarkQuery(state, tp.get(), kNumericQuery,
+                 QueryResultSerializer::Encoding::kCells, false);
+}
+
+static void BM_QueryResultSerializer_NumericColumnar(benchmark::State& state) {
+  auto tp = CreateWindowTable(50000);
+  BenchmarkQuery(state, tp.get(), kNumericQuery,
+                 QueryResultSerializer::Encoding::kColumnar, false);
+}
+
+static void BM_QueryResultSerializer_NumericEndToEnd(benchmark::State& state) {
+  auto tp = CreateWindowTable(50000);
+  BenchmarkQuery(state, tp.get(), kNumericQuery,
+                 QueryResultSerializer::Encoding::kCells, true);
+}
+
+static void BM_QueryResultSerializer_NumericEndToEndColumnar(
+    benchmark::State& state) {
+  auto tp = CreateWindowTable(50000);
+  BenchmarkQuery(state, tp.get(), kNumericQuery,
+                 QueryResultSerializer::Encoding::kColumnar, true);
+}
+
 BENCHMARK(BM_QueryResultSerializer_Mixed)->Apply(BenchmarkArgs);
 BENCHMARK(BM_QueryResultSerializer_Strings)->Apply(BenchmarkArgs);
+BENCHMARK(BM_QueryResultSerializer_Numeric)->Apply(BenchmarkArgs);
+BENCHMARK(BM_QueryResultSerializer_NumericColumnar)->Apply(BenchmarkArgs);
+BENCHMARK(BM_QueryResultSerializer_NumericEndToEnd)->Apply(BenchmarkArgs);
+BENCHMARK(BM_QueryResultSerializer_NumericEndToEndColumnar)
+    ->Apply(BenchmarkArgs);
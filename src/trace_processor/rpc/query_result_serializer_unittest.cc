@@ -71,7 +71,9 @@ namespace {
 
 using ::testing::ElementsAre;
 using BatchProto = protos::pbzero::QueryResult::CellsBatch;
+using ColumnProto = protos::pbzero::QueryResult::ColumnarBatch::Column;
 using ResultProto = protos::pbzero::QueryResult;
+using Encoding = QueryResultSerializer::Encoding;
 
 void RunQueryChecked(TraceProcessor* tp, const std::string& query) {
   auto iter = tp->ExecuteQuery(query);
@@ -91,6 +93,10 @@ class TestDeserializer {
   bool eof_reached = false;
 
  private:
+  void DeserializeColumnarBatch(const uint8_t* buf_start,
+                                protozero::ConstBytes);
+  SqlValue CopyToSqlValue(uint8_t cell_type, const uint8_t* data, size_t size);
+
   std::vector<std::unique_ptr<char[]>> copied_buf_;
 };
 
@@ -191,6 +197,100 @@ void TestDeserializer::DeserializeBuffer(const uint8_t* start, size_t size) {
       EXPECT_EQ(num_cells % columns.size(), 0u);
     }
   }
+
+  for (auto batch_it = result.columnar_batch(); batch_it; ++batch_it) {
+    ASSERT_FALSE(eof_reached);
+    DeserializeColumnarBatch(start, batch_it->as_bytes());
+  }
+}
+
+void TestDeserializer::DeserializeColumnarBatch(const uint8_t* buf_start,
+                                                protozero::ConstBytes bytes) {
+  ResultProto::ColumnarBatch::Decoder batch(bytes);
+  eof_reached = batch.is_last_batch();
+  const uint32_t row_count = batch.row_count();
+
+  std::vector<std::vector<SqlValue>> values;
+  for (auto col_it = batch.columns(); col_it; ++col_it) {
+    ColumnProto::Decoder column(col_it->as_bytes());
+    protozero::ConstBytes int64s = column.int64_values();
+    protozero::ConstBytes doubles = column.float64_values();
+    protozero::ConstBytes offsets = column.offsets();
+    for (const auto& buf : {int64s, doubles, offsets}) {
+      if (buf.size > 0) {
+        EXPECT_EQ(static_cast<size_t>(buf.data - buf_start) % 8, 0u);
+      }
+    }
+    EXPECT_NE(column.has_type(), column.has_cell_types());
+
+    values.emplace_back();
+    for (uint32_t i = 0; i < row_count; ++i) {
+      bool valid = !column.has_validity() ||
+                   (column.validity().data[i / 8] >> (i % 8)) & 1;
+      uint8_t cell_type;
+      if (column.has_cell_types()) {
+        ASSERT_EQ(column.cell_types().size, row_count);
+        cell_type = column.cell_types().data[i];
+        EXPECT_EQ(valid, cell_type != BatchProto::CELL_NULL);
+      } else {
+        cell_type = valid ? static_cast<uint8_t>(column.type())
+                          : static_cast<uint8_t>(BatchProto::CELL_NULL);
+      }
+
+      switch (cell_type) {
+        case BatchProto::CELL_NULL:
+          values.back().emplace_back(SqlValue());
+          break;
+        case BatchProto::CELL_VARINT: {
+          ASSERT_EQ(int64s.size, row_count * sizeof(int64_t));
+          int64_t value;
+          memcpy(&value, int64s.data + i * sizeof(int64_t), sizeof(value));
+          values.back().emplace_back(SqlValue::Long(value));
+          break;
+        }
+        case BatchProto::CELL_FLOAT64: {
+          ASSERT_EQ(doubles.size, row_count * sizeof(double));
+          double value;
+          memcpy(&value, doubles.data + i * sizeof(double), sizeof(value));
+          values.back().emplace_back(SqlValue::Double(value));
+          break;
+        }
+        case BatchProto::CELL_STRING:
+        case BatchProto::CELL_BLOB: {
+          ASSERT_EQ(offsets.size, (row_count + 1) * sizeof(uint32_t));
+          uint32_t begin;
+          uint32_t end;
+          memcpy(&begin, offsets.data + i * sizeof(uint32_t), sizeof(begin));
+          memcpy(&end, offsets.data + (i + 1) * sizeof(uint32_t), sizeof(end));
+          ASSERT_LE(begin, end);
+          ASSERT_LE(end, column.data().size);
+          values.back().emplace_back(CopyToSqlValue(
+              cell_type, column.data().data + begin, end - begin));
+          break;
+        }
+        default:
+          FAIL() << "Unknown cell type " << cell_type;
+      }
+    }
+  }
+
+  ASSERT_EQ(values.size(), columns.size());
+  for (uint32_t row = 0; row < row_count; ++row) {
+    for (const auto& column_values : values)
+      cells.emplace_back(column_values[row]);
+  }
+}
+
+SqlValue TestDeserializer::CopyToSqlValue(uint8_t cell_type,
+                                          const uint8_t* data,
+                                          size_t size) {
+  copied_buf_.emplace_back(new char[size + 1]);
+  char* new_buf = copied_buf_.back().get();
+  memcpy(new_buf, data, size);
+  new_buf[size] = '\0';
+  if (cell_type == BatchProto::CELL_STRING)
+    return SqlValue::String(new_buf);
+  return SqlValue::Bytes(new_buf, size);
 }
 
 TEST(QueryResultSerializerTest, ShortBatch) {
@@ -316,13 +416,15 @@ TEST(QueryResultSerializerTest, LargeStringAndBlobs) {
   sql_values.resize(sql_values.size() - 1);  // Remove trailing comma.
   RunQueryChecked(tp.get(), "insert into tab (colz) values " + sql_values);
 
-  auto iter = tp->ExecuteQuery("select colz from tab");
-  QueryResultSerializer ser(std::move(iter));
-  TestDeserializer deser;
-  deser.SerializeAndDeserialize(&ser);
-  ASSERT_EQ(deser.cells.size(), expected.size());
-  for (size_t i = 0; i < expected.size(); i++) {
-    EXPECT_EQ(deser.cells[i], expected[i]) << "Cell " << i;
+  for (Encoding encoding : {Encoding::kCells, Encoding::kColumnar}) {
+    auto iter = tp->ExecuteQuery("select colz from tab");
+    QueryResultSerializer ser(std::move(iter), encoding);
+    TestDeserializer deser;
+    deser.SerializeAndDeserialize(&ser);
+    ASSERT_EQ(deser.cells.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      EXPECT_EQ(deser.cells[i], expected[i]) << "Cell " << i;
+    }
   }
 }
 
@@ -386,9 +488,10 @@ TEST(QueryResultSerializerTest, RandomSizes) {
   }
 
   // Serialize and de-serialize with different batch and payload sizes.
-  for (int rep = 0; rep < 10; rep++) {
+  for (int rep = 0; rep < 20; rep++) {
     auto iter = tp->ExecuteQuery("select * from tab");
-    QueryResultSerializer ser(std::move(iter));
+    QueryResultSerializer ser(
+        std::move(iter), rep % 2 ? Encoding::kColumnar : Encoding::kCells);
     uint32_t cells_per_batch = 1 << (rnd_engine() % 8 + 2);
     uint32_t binary_payload_size = 1 << (rnd_engine() % 8 + 8);
     ser.set_batch_size_for_testing(cells_per_batch, binary_payload_size);
@@ -401,6 +504,56 @@ TEST(QueryResultSerializerTest, RandomSizes) {
   }
 }
 
+TEST(QueryResultSerializerTest, ColumnarBatch) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+  RunQueryChecked(tp.get(), "create table tab (i, f, s, n, m)");
+  RunQueryChecked(tp.get(),
+                  "insert into tab (i, f, s, n, m) values "
+                  "(1, 1.5, 'a', NULL, 1), (NULL, 2.5, 'bc', NULL, 'x'), "
+                  "(3, 3.5, '', NULL, NULL)");
+  auto iter = tp->ExecuteQuery("select * from tab");
+  QueryResultSerializer ser(std::move(iter), Encoding::kColumnar);
+  std::vector<uint8_t> buf;
+  ASSERT_FALSE(ser.Serialize(&buf));
+
+  ResultProto::Decoder result(buf.data(), buf.size());
+  ASSERT_FALSE(result.has_batch());
+  ResultProto::ColumnarBatch::Decoder batch(
+      result.columnar_batch()->as_bytes());
+  EXPECT_EQ(batch.row_count(), 3u);
+  EXPECT_TRUE(batch.is_last_batch());
+
+  auto col_it = batch.columns();
+  ColumnProto::Decoder i((col_it++)->as_bytes());
+  EXPECT_EQ(i.type(), BatchProto::CELL_VARINT);
+  ASSERT_TRUE(i.has_validity());
+  EXPECT_EQ(i.validity().data[0], 0b101);
+  EXPECT_EQ(i.int64_values().size, 3 * sizeof(int64_t));
+
+  ColumnProto::Decoder f((col_it++)->as_bytes());
+  EXPECT_EQ(f.type(), BatchProto::CELL_FLOAT64);
+  EXPECT_FALSE(f.has_validity());
+  EXPECT_FALSE(f.has_int64_values());
+
+  ColumnProto::Decoder s((col_it++)->as_bytes());
+  EXPECT_EQ(s.type(), BatchProto::CELL_STRING);
+  EXPECT_EQ(s.data().ToStdString(), "abc");
+  EXPECT_EQ(s.offsets().size, 4 * sizeof(uint32_t));
+
+  ColumnProto::Decoder n((col_it++)->as_bytes());
+  EXPECT_EQ(n.type(), BatchProto::CELL_NULL);
+  EXPECT_FALSE(n.has_validity());
+
+  ColumnProto::Decoder m((col_it++)->as_bytes());
+  EXPECT_FALSE(m.has_type());
+  protozero::ConstBytes cell_types = m.cell_types();
+  EXPECT_THAT(std::vector<uint8_t>(cell_types.data,
+                                   cell_types.data + cell_types.size),
+              ElementsAre(BatchProto::CELL_VARINT, BatchProto::CELL_STRING,
+                          BatchProto::CELL_NULL));
+  EXPECT_FALSE(col_it);
+}
+
 TEST(QueryResultSerializerTest, ErrorBeforeStartingQuery) {
   auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
   auto iter = tp->ExecuteQuery("insert into incomplete_input");
@@ -428,6 +581,20 @@ TEST(QueryResultSerializerTest, ErrorAfterSomeResults) {
   EXPECT_TRUE(deser.eof_reached);
 }
 
+TEST(QueryResultSerializerTest, ColumnarErrorAfterSomeResults) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+  RunQueryChecked(tp.get(), "create table tab (x)");
+  RunQueryChecked(tp.get(), "insert into tab (x) values (0), (1), ('error')");
+  auto iter = tp->ExecuteQuery("select str_split('a;b', ';', x) as s from tab");
+  QueryResultSerializer ser(std::move(iter), Encoding::kColumnar);
+  TestDeserializer deser;
+  deser.SerializeAndDeserialize(&ser);
+  EXPECT_NE(deser.error, "");
+  EXPECT_THAT(deser.cells,
+              ElementsAre(SqlValue::String("a"), SqlValue::String("b")));
+  EXPECT_TRUE(deser.eof_reached);
+}
+
 TEST(QueryResultSerializerTest, NoResultQuery) {
   auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
   {
@@ -16,6 +16,7 @@
 
 #include "src/trace_processor/rpc/rpc.h"
 
+#include <algorithm>
 #include <cinttypes>
 #include <cstdint>
 #include <cstdio>
@@ -55,6 +56,18 @@ using RpcProto = protos::pbzero::TraceProcessorRpc;
 constexpr auto kSliceSize =
     QueryResultSerializer::kDefaultBatchSplitThreshold + 4096;
 
+constexpr char kErrFieldNotSet[] = "RPC error: request field not set";
+
+QueryResultSerializer::Encoding GetResultEncoding(const uint8_t* args,
+                                                  size_t len) {
+  protos::pbzero::QueryArgs::Decoder query(args, len);
+  if (query.result_encoding() ==
+      protos::pbzero::QueryArgs::RESULT_ENCODING_COLUMNAR) {
+    return QueryResultSerializer::Encoding::kColumnar;
+  }
+  return QueryResultSerializer::Encoding::kCells;
+}
+
 // Holds a trace_processor::TraceProcessorRpc pbzero message. Avoids extra
 // copies by doing direct scattered calls from the fragmented heap buffer onto
 // the RpcResponseFunction (the receiver is expected to deal with arbitrary
@@ -105,6 +118,8 @@ Rpc::Rpc() : Rpc(nullptr) {}
 Rpc::~Rpc() = default;
 
 void Rpc::ResetTraceProcessorInternal(const Config& config) {
+  // The cursors reference the queries of the old instance.
+  CloseAllQueryCursors();
   trace_processor_config_ = config;
   trace_processor_ = TraceProcessor::CreateInstance(config);
   bytes_parsed_ = bytes_last_progress_ = 0;
@@ -191,7 +206,6 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
 
   // The static cast is to prevent that the compiler breaks future proofness.
   const int req_type = static_cast<int>(req.request());
-  static const char kErrFieldNotSet[] = "RPC error: request field not set";
   switch (req_type) {
     case RpcProto::TPM_APPEND_TRACE_DATA: {
       Response resp(tx_seq_id_++, req_type);
@@ -223,7 +237,8 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
       } else {
         protozero::ConstBytes args = req.query_args();
         auto it = QueryInternal(args.data, args.size);
-        QueryResultSerializer serializer(std::move(it));
+        QueryResultSerializer serializer(
+            std::move(it), GetResultEncoding(args.data, args.size));
         for (bool has_more = true; has_more;) {
           Response resp(tx_seq_id_++, req_type);
           has_more = serializer.Serialize(resp->set_query_result());
@@ -253,7 +268,7 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
       break;
     }
     case RpcProto::TPM_RESTORE_INITIAL_TABLES: {
-      trace_processor_->RestoreInitialTables();
+      RestoreInitialTables();
       Response resp(tx_seq_id_++, req_type);
       resp.Send(rpc_response_fn_);
       break;
@@ -287,6 +302,23 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
       resp.Send(rpc_response_fn_);
       break;
     }
+    case RpcProto::TPM_QUERY_CURSOR_OPEN: {
+      protozero::ConstBytes args = req.query_cursor_args();
+      OpenQueryCursor(req_type, args.data, args.size);
+      break;
+    }
+    case RpcProto::TPM_QUERY_CURSOR_NEXT: {
+      protos::pbzero::QueryCursorArgs::Decoder args(req.query_cursor_args());
+      ReadQueryCursor(req_type, args.cursor_id(), args.max_batches());
+      break;
+    }
+    case RpcProto::TPM_QUERY_CURSOR_CLOSE: {
+      protos::pbzero::QueryCursorArgs::Decoder args(req.query_cursor_args());
+      CloseQueryCursor(args.cursor_id());
+      Response resp(tx_seq_id_++, req_type);
+      resp.Send(rpc_response_fn_);
+      break;
+    }
     default: {
       // This can legitimately happen if the client is newer. We reply with a
       // generic "unkown request" response, so the client can do feature
@@ -311,6 +343,8 @@ base::Status Rpc::Parse(const uint8_t* data, size_t len) {
     ResetTraceProcessorInternal(trace_processor_config_);
   }
 
+  // Parsing changes the tables the open queries are reading from.
+  CloseAllQueryCursors();
   eof_ = false;
   bytes_parsed_ += len;
   MaybePrintProgress();
@@ -328,6 +362,7 @@ void Rpc::NotifyEndOfFile() {
   PERFETTO_TP_TRACE(metatrace::Category::API_TIMELINE,
                     "RPC_NOTIFY_END_OF_FILE");
 
+  CloseAllQueryCursors();
   trace_processor_->NotifyEndOfFile();
   eof_ = true;
   MaybePrintProgress();
@@ -380,7 +415,8 @@ void Rpc::Query(const uint8_t* args,
                 size_t len,
                 const QueryResultBatchCallback& result_callback) {
   auto it = QueryInternal(args, len);
-  QueryResultSerializer serializer(std::move(it));
+  QueryResultSerializer serializer(std::move(it),
+                                   GetResultEncoding(args, len));
 
   std::vector<uint8_t> res;
   for (bool has_more = true; has_more;) {
@@ -390,6 +426,93 @@ void Rpc::Query(const uint8_t* args,
   }
 }
 
+void Rpc::OpenQueryCursor(int method, const uint8_t* data, size_t len) {
+  protos::pbzero::QueryCursorArgs::Decoder args(data, len);
+  if (!args.has_query_args()) {
+    Response resp(tx_seq_id_++, method);
+    resp->set_query_result()->set_error(kErrFieldNotSet);
+    resp.Send(rpc_response_fn_);
+    return;
+  }
+  if (query_cursors_.size() >= kMaxQueryCursors) {
+    auto lru = std::min_element(
+        query_cursors_.begin(), query_cursors_.end(),
+        [](const auto& a, const auto& b) {
+          return a.second.last_used < b.second.last_used;
+        });
+    PERFETTO_ELOG("[RPC] Too many query cursors, closing cursor %u",
+                  lru->first);
+    query_cursors_.erase(lru);
+  }
+
+  // Cursor ids are never reused (modulo wraparound) so that a stale id from a
+  // client cannot accidentally read the results of another query.
+  uint32_t cursor_id = ++last_cursor_id_;
+  if (cursor_id == 0) {
+    cursor_id = ++last_cursor_id_;
+  }
+  protozero::ConstBytes query_args = args.query_args();
+  QueryCursor& cursor = query_cursors_[cursor_id];
+  cursor.serializer = std::make_unique<QueryResultSerializer>(
+      QueryInternal(query_args.data, query_args.size),
+      GetResultEncoding(query_args.data, query_args.size));
+  cursor.client = rpc_client_;
+
+  // Reply straight away with the first batch(es): this is what gets the first
+  // rows on screen.
+  ReadQueryCursor(method, cursor_id, args.max_batches());
+}
+
+void Rpc::ReadQueryCursor(int method,
+                          uint32_t cursor_id,
+                          uint32_t max_batches) {
+  auto it = query_cursors_.find(cursor_id);
+  if (it == query_cursors_.end()) {
+    Response resp(tx_seq_id_++, method);
+    auto* result = resp->set_query_result();
+    result->set_cursor_id(cursor_id);
+    result->set_error("RPC error: unknown query cursor");
+    resp.Send(rpc_response_fn_);
+    return;
+  }
+  it->second.last_used = ++cursor_use_count_;
+
+  // Each batch is serialized and handed to the transport before the next one
+  // is computed: at most one batch of the result is ever buffered here. The
+  // cap bounds the time a single request keeps the RPC busy.
+  uint32_t num_batches =
+      std::clamp(max_batches, 1u, kMaxQueryCursorBatchesPerRequest);
+  bool has_more = true;
+  for (uint32_t i = 0; i < num_batches && has_more; ++i) {
+    Response resp(tx_seq_id_++, method);
+    auto* result = resp->set_query_result();
+    result->set_cursor_id(cursor_id);
+    has_more = it->second.serializer->Serialize(result);
+    resp.Send(rpc_response_fn_);
+  }
+  if (!has_more) {
+    query_cursors_.erase(it);
+  }
+}
+
+void Rpc::CloseQueryCursor(uint32_t cursor_id) {
+  query_cursors_.erase(cursor_id);
+}
+
+void Rpc::CloseQueryCursors(const void* client) {
+  for (auto it = query_cursors_.begin(); it != query_cursors_.end();) {
+    if (it->second.client == client) {
+      it = query_cursors_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void Rpc::CloseAllQueryCursors() {
+  query_cursors_.clear();
+}
+
 Iterator Rpc::QueryInternal(const uint8_t* args, size_t len) {
   protos::pbzero::QueryArgs::Decoder query(args, len);
   std::string sql = query.sql_query().ToStdString();
@@ -406,6 +529,8 @@ Iterator Rpc::QueryInternal(const uint8_t* args, size_t len) {
 }
 
 void Rpc::RestoreInitialTables() {
+  // Open queries would keep the tables being dropped alive.
+  CloseAllQueryCursors();
   trace_processor_->RestoreInitialTables();
 }
 
@@ -20,6 +20,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
@@ -39,6 +40,7 @@ class DisableAndReadMetatraceResult;
 namespace trace_processor {
 
 class Iterator;
+class QueryResultSerializer;
 class TraceProcessor;
 
 // This class handles the binary {,un}marshalling for the Trace Processor RPC
@@ -88,6 +90,11 @@ class Rpc {
     rpc_response_fn_ = std::move(f);
   }
 
+  // Identifies the client which sends the requests which follow (e.g. the
+  // websocket connection), so that the query cursors it opens can be closed
+  // when it goes away. Null if the transport doesn't tell clients apart.
+  void SetRpcClient(const void* client) { rpc_client_ = client; }
+
   // 2. TraceProcessor legacy RPC endpoints.
   // The methods below are exposed for the old RPC interfaces, where each RPC
   // implementation deals with the method demuxing: (i) wasm_bridge.cc has one
@@ -128,7 +135,39 @@ class Rpc {
       void(const uint8_t* /*buf*/, size_t /*len*/, bool /*has_more*/)>;
   void Query(const uint8_t*, size_t, const QueryResultBatchCallback&);
 
+  // Maximum number of query cursors (see QueryCursorArgs in
+  // trace_processor.proto) which can be open at the same time. Opening a
+  // cursor beyond this closes the least recently used one, so that clients
+  // which abandon cursors without closing them cannot leak queries.
+  static constexpr size_t kMaxQueryCursors = 16;
+
+  // Maximum number of batches returned by a single TPM_QUERY_CURSOR_OPEN or
+  // TPM_QUERY_CURSOR_NEXT request, whatever the |max_batches| asked for.
+  static constexpr uint32_t kMaxQueryCursorBatchesPerRequest = 64;
+
+  // Closes the query cursors opened by |client| (see SetRpcClient()). Used
+  // when the client goes away (e.g. the websocket is closed).
+  void CloseQueryCursors(const void* client);
+
+  // Returns the number of open query cursors.
+  size_t query_cursor_count() const { return query_cursors_.size(); }
+
  private:
+  struct QueryCursor {
+    std::unique_ptr<QueryResultSerializer> serializer;
+    uint64_t last_used = 0;
+    const void* client = nullptr;
+  };
+
+  void OpenQueryCursor(int method, const uint8_t*, size_t);
+  void ReadQueryCursor(int method, uint32_t cursor_id, uint32_t max_batches);
+  void CloseQueryCursor(uint32_t cursor_id);
+
+  // Closes all the query cursors: their queries would see the tables change
+  // under them (e.g. on Parse() or RestoreInitialTables()) or refer to a
+  // TraceProcessor which is going away. Other queries and metrics do not close
+  // cursors: their statements are stepped independently by SQLite.
+  void CloseAllQueryCursors();
   void ParseRpcRequest(const uint8_t*, size_t);
   void ResetTraceProcessorInternal(const Config&);
   void MaybePrintProgress();
@@ -142,6 +181,7 @@ class Rpc {
   Config trace_processor_config_;
   std::unique_ptr<TraceProcessor> trace_processor_;
   RpcResponseFunction rpc_response_fn_;
+  const void* rpc_client_ = nullptr;
   protozero::ProtoRingBuffer rxbuf_;
   int64_t tx_seq_id_ = 0;
   int64_t rx_seq_id_ = 0;
@@ -149,6 +189,12 @@ class Rpc {
   int64_t t_parse_started_ = 0;
   size_t bytes_last_progress_ = 0;
   size_t bytes_parsed_ = 0;
+
+  // Open query cursors, by cursor id. Each cursor holds a query which is only
+  // stepped when the client asks for more batches.
+  std::map<uint32_t, QueryCursor> query_cursors_;
+  uint32_t last_cursor_id_ = 0;
+  uint64_t cursor_use_count_ = 0;
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/rpc.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using RpcProto = protos::pbzero::TraceProcessorRpc;
+
+// 8 columns x 50000 rows: several batches of at most 50000 cells each.
+constexpr char kMultiBatchQuery[] =
+    "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+    "WHERE x < 50000) SELECT x, x, x, x, x, x, x, x FROM c";
+
+// The parts of a QueryResult response that the tests look at.
+struct QueryResponse {
+  int method = 0;
+  uint32_t cursor_id = 0;
+  std::string error;
+  size_t num_batches = 0;
+  size_t num_cells = 0;
+  bool is_last_batch = false;
+};
+
+class RpcTest : public ::testing::Test {
+ protected:
+  RpcTest() {
+    rpc_.SetRpcResponseFunction([this](const void* data, uint32_t len) {
+      const uint8_t* begin = static_cast<const uint8_t*>(data);
+      rx_buf_.insert(rx_buf_.end(), begin, begin + len);
+    });
+  }
+
+  // Sends a TPM_QUERY_CURSOR_* request and returns the responses.
+  std::vector<QueryResponse> SendCursorRequest(
+      RpcProto::TraceProcessorMethod method,
+      const std::string& sql,
+      uint32_t cursor_id,
+      uint32_t max_batches) {
+    protozero::HeapBuffered<protos::pbzero::TraceProcessorRpcStream> req;
+    auto* msg = req->add_msg();
+    msg->set_seq(++tx_seq_);
+    msg->set_request(method);
+    auto* args = msg->set_query_cursor_args();
+    if (!sql.empty())
+      args->set_query_args()->set_sql_query(sql);
+    if (cursor_id)
+      args->set_cursor_id(cursor_id);
+    if (max_batches)
+      args->set_max_batches(max_batches);
+    return Send(&req);
+  }
+
+  std::vector<QueryResponse> OpenCursor(const std::string& sql,
+                                        uint32_t max_batches) {
+    return SendCursorRequest(RpcProto::TPM_QUERY_CURSOR_OPEN, sql, 0,
+                             max_batches);
+  }
+
+  std::vector<QueryResponse> ReadCursor(uint32_t cursor_id,
+                                        uint32_t max_batches) {
+    return SendCursorRequest(RpcProto::TPM_QUERY_CURSOR_NEXT, "", cursor_id,
+                             max_batches);
+  }
+
+  std::vector<QueryResponse> CloseCursor(uint32_t cursor_id) {
+    return SendCursorRequest(RpcProto::TPM_QUERY_CURSOR_CLOSE, "", cursor_id,
+                             0);
+  }
+
+  std::vector<QueryResponse> Query(const std::string& sql) {
+    protozero::HeapBuffered<protos::pbzero::TraceProcessorRpcStream> req;
+    auto* msg = req->add_msg();
+    msg->set_seq(++tx_seq_);
+    msg->set_request(RpcProto::TPM_QUERY_STREAMING);
+    msg->set_query_args()->set_sql_query(sql);
+    return Send(&req);
+  }
+
+  Rpc rpc_;
+
+ private:
+  std::vector<QueryResponse> Send(
+      protozero::HeapBuffered<protos::pbzero::TraceProcessorRpcStream>* req) {
+    std::vector<uint8_t> req_buf = req->SerializeAsArray();
+    rpc_.OnRpcRequest(req_buf.data(), req_buf.size());
+
+    std::vector<QueryResponse> responses;
+    protos::pbzero::TraceProcessorRpcStream::Decoder stream(rx_buf_.data(),
+                                                            rx_buf_.size());
+    for (auto it = stream.msg(); it; ++it) {
+      RpcProto::Decoder rpc_msg(*it);
+      QueryResponse resp;
+      resp.method = rpc_msg.response();
+      protos::pbzero::QueryResult::Decoder result(rpc_msg.query_result());
+      resp.cursor_id = result.cursor_id();
+      resp.error = result.error().ToStdString();
+      for (auto batch_it = result.batch(); batch_it; ++batch_it) {
+        protos::pbzero::QueryResult::CellsBatch::Decoder batch(*batch_it);
+        resp.num_batches++;
+        bool parse_error = false;
+        for (auto cell_it = batch.cells(&parse_error); cell_it; ++cell_it)
+          resp.num_cells++;
+        EXPECT_FALSE(parse_error);
+        resp.is_last_batch = batch.is_last_batch();
+      }
+      responses.push_back(resp);
+    }
+    rx_buf_.clear();
+    return responses;
+  }
+
+  std::vector<uint8_t> rx_buf_;
+  int64_t tx_seq_ = 0;
+};
+
+TEST_F(RpcTest, QueryCursorPaging) {
+  std::vector<QueryResponse> resps = OpenCursor(kMultiBatchQuery, 1);
+  ASSERT_EQ(resps.size(), 1u);
+  ASSERT_EQ(resps[0].error, "");
+  ASSERT_FALSE(resps[0].is_last_batch);
+  uint32_t cursor_id = resps[0].cursor_id;
+  ASSERT_NE(cursor_id, 0u);
+  size_t num_cells = resps[0].num_cells;
+
+  resps = ReadCursor(cursor_id, 2);
+  ASSERT_EQ(resps.size(), 2u);
+  for (const QueryResponse& resp : resps) {
+    ASSERT_EQ(resp.method, RpcProto::TPM_QUERY_CURSOR_NEXT);
+    ASSERT_EQ(resp.cursor_id, cursor_id);
+    ASSERT_FALSE(resp.is_last_batch);
+    num_cells += resp.num_cells;
+  }
+
+  // Reads the rest of the result: the cursor is closed after the last batch.
+  for (bool is_last_batch = false; !is_last_batch;) {
+    resps = ReadCursor(cursor_id, 1);
+    ASSERT_EQ(resps.size(), 1u);
+    ASSERT_EQ(resps[0].error, "");
+    num_cells += resps[0].num_cells;
+    is_last_batch = resps[0].is_last_batch;
+  }
+  ASSERT_EQ(num_cells, 8u * 50000u);
+  ASSERT_EQ(rpc_.query_cursor_count(), 0u);
+
+  resps = ReadCursor(cursor_id, 1);
+  ASSERT_EQ(resps.size(), 1u);
+  ASSERT_NE(resps[0].error, "");
+}
+
+TEST_F(RpcTest, QueryCursorMaxBatchesIsCapped) {
+  // Enough cells for more batches than the cap.
+  std::string sql =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c "
+      "WHERE x < " +
+      std::to_string(Rpc::kMaxQueryCursorBatchesPerRequest * 50000 / 8 + 1) +
+      ") SELECT x, x, x, x, x, x, x, x FROM c";
+  std::vector<QueryResponse> resps = OpenCursor(sql, UINT32_MAX);
+  ASSERT_EQ(resps.size(), Rpc::kMaxQueryCursorBatchesPerRequest);
+  ASSERT_FALSE(resps.back().is_last_batch);
+  ASSERT_EQ(rpc_.query_cursor_count(), 1u);
+}
+
+TEST_F(RpcTest, QueryCursorClose) {
+  std::vector<QueryResponse> resps = OpenCursor(kMultiBatchQuery, 1);
+  ASSERT_EQ(resps.size(), 1u);
+  uint32_t cursor_id = resps[0].cursor_id;
+  ASSERT_EQ(rpc_.query_cursor_count(), 1u);
+
+  resps = CloseCursor(cursor_id);
+  ASSERT_EQ(resps.size(), 1u);
+  ASSERT_EQ(resps[0].method, RpcProto::TPM_QUERY_CURSOR_CLOSE);
+  ASSERT_EQ(rpc_.query_cursor_count(), 0u);
+
+  resps = ReadCursor(cursor_id, 1);
+  ASSERT_EQ(resps.size(), 1u);
+  ASSERT_NE(resps[0].error, "");
+}
+
+TEST_F(RpcTest, QueryCursorInvalidId) {
+  std::vector<QueryResponse> resps = ReadCursor(1234, 1);
+  ASSERT_EQ(resps.size(), 1u);
+  ASSERT_EQ(resps[0].method, RpcProto::TPM_QUERY_CURSOR_NEXT);
+  ASSERT_EQ(resps[0].cursor_id, 1234u);
+  ASSERT_EQ(resps[0].error, "RPC error: unknown query cursor");
+  ASSERT_EQ(resps[0].num_batches, 0u);
+
+  // Closing an unknown cursor is not an error.
+  resps = CloseCursor(1234);
+  ASSERT_EQ(resps.size(), 1u);
+  ASSERT_EQ(resps[0].error, "");
+}
+
+TEST_F(RpcTest, QueryCursorsClosedOnClientDisconnect) {
+  int client_1 = 0;
+  int client_2 = 0;
+  rpc_.SetRpcClient(&client_1);
+  std::vector<QueryResponse> resps = OpenCursor(kMultiBatchQuery, 1);
+  ASSERT_EQ(resps.size(), 1u);
+  uint32_t cursor_id_1 = resps[0].cursor_id;
+
+  rpc_.SetRpcClient(&client_2);
+  resps = OpenCursor(kMultiBatchQuery, 1);
+  ASSERT_EQ(resps.size(), 1u);
+  uint32_t cursor_id_2 = resps[0].cursor_id;
+  ASSERT_EQ(rpc_.query_cursor_count(), 2u);
+
+  // Only the cursors of the client which went away are closed.
+  rpc_.CloseQueryCursors(&client_1);
+  ASSERT_EQ(rpc_.query_cursor_count(), 1u);
+  resps = ReadCursor(cursor_id_1, 1);
+  ASSERT_EQ(resps.size(), 1u);
+  ASSERT_NE(resps[0].error, "");
+  resps = ReadCursor(cursor_id_2, 1);
+  ASSERT_EQ(resps.size(), 1u);
+  ASSERT_EQ(resps[0].error, "");
+  rpc_.SetRpcClient(nullptr);
+}
+
+TEST_F(RpcTest, QueryCursorSurvivesOtherQueries) {
+  std::vector<QueryResponse> resps = OpenCursor(kMultiBatchQuery, 1);
+  ASSERT_EQ(resps.size(), 1u);
+  ASSERT_FALSE(resps[0].is_last_batch);
+  uint32_t cursor_id = resps[0].cursor_id;
+  size_t num_cells = resps[0].num_cells;
+
+  // A query unrelated to the cursor runs to completion in between two pages.
+  std::vector<QueryResponse> other = Query("SELECT 1");
+  ASSERT_EQ(other.size(), 1u);
+  ASSERT_EQ(other[0].error, "");
+  ASSERT_EQ(other[0].num_cells, 1u);
+  ASSERT_EQ(rpc_.query_cursor_count(), 1u);
+
+  for (bool is_last_batch = false; !is_last_batch;) {
+    resps = ReadCursor(cursor_id, 1);
+    ASSERT_EQ(resps.size(), 1u);
+    ASSERT_EQ(resps[0].error, "");
+    ASSERT_EQ(resps[0].cursor_id, cursor_id);
+    num_cells += resps[0].num_cells;
+    is_last_batch = resps[0].is_last_batch;
+  }
+  ASSERT_EQ(num_cells, 8u * 50000u);
+}
+
+TEST_F(RpcTest, QueryCursorsClosedWhenTablesChange) {
+  ASSERT_EQ(OpenCursor(kMultiBatchQuery, 1).size(), 1u);
+  ASSERT_EQ(rpc_.query_cursor_count(), 1u);
+  rpc_.NotifyEndOfFile();
+  ASSERT_EQ(rpc_.query_cursor_count(), 0u);
+
+  ASSERT_EQ(OpenCursor(kMultiBatchQuery, 1).size(), 1u);
+  ASSERT_EQ(rpc_.query_cursor_count(), 1u);
+  rpc_.RestoreInitialTables();
+  ASSERT_EQ(rpc_.query_cursor_count(), 0u);
+
+  ASSERT_EQ(OpenCursor(kMultiBatchQuery, 1).size(), 1u);
+  ASSERT_EQ(rpc_.query_cursor_count(), 1u);
+  ASSERT_TRUE(rpc_.Parse(nullptr, 0).ok());
+  ASSERT_EQ(rpc_.query_cursor_count(), 0u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -22,9 +22,12 @@
 #include <limits>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/public/compiler.h"
 #include "src/trace_processor/importers/common/parser_types.h"
 #include "src/trace_processor/importers/common/trace_parser.h"
@@ -38,9 +41,89 @@
 
 namespace perfetto::trace_processor {
 
+namespace {
+
+constexpr int64_t kTsMax = std::numeric_limits<int64_t>::max();
+
+// A tournament (winner) tree over the heads of the sorter queues. Each leaf is
+// a queue, keyed by (is_empty, min_ts, leaf index): the root is the queue with
+// the earliest event (the first one in case of ties, like a linear scan would
+// pick). Both updating a leaf and finding the runner-up are O(log(#queues)),
+// rather than the O(#queues) of rescanning all the queues.
+class QueueHeadTree {
+ public:
+  explicit QueueHeadTree(size_t size) {
+    while (leaves_ < size)
+      leaves_ *= 2;
+    min_ts_.resize(leaves_, kTsMax);
+    empty_.resize(leaves_, true);
+    nodes_.resize(2 * leaves_);
+    for (uint32_t i = 0; i < leaves_; ++i)
+      nodes_[leaves_ + i] = i;
+  }
+
+  // Sets the key of |leaf|. Build() must be called after setting all leaves.
+  void Set(uint32_t leaf, bool empty, int64_t min_ts) {
+    empty_[leaf] = empty;
+    min_ts_[leaf] = min_ts;
+  }
+
+  void Build() {
+    for (uint32_t n = leaves_ - 1; n >= 1; --n)
+      nodes_[n] = Winner(nodes_[2 * n], nodes_[2 * n + 1]);
+  }
+
+  // Updates the key of |leaf| and replays the matches on its path to the root.
+  void Update(uint32_t leaf, bool empty, int64_t min_ts) {
+    Set(leaf, empty, min_ts);
+    for (uint32_t n = (leaves_ + leaf) / 2; n >= 1; n /= 2)
+      nodes_[n] = Winner(nodes_[2 * n], nodes_[2 * n + 1]);
+  }
+
+  bool all_empty() const { return empty_[winner()]; }
+  uint32_t winner() const { return nodes_[1]; }
+
+  // Returns the min_ts of the best non-empty leaf other than the winner, or
+  // kTsMax if there is none. The runner-up must have lost against the winner
+  // in one of the matches on the winner's path to the root.
+  int64_t RunnerUpMinTs() const {
+    uint32_t best = kNoLeaf;
+    for (uint32_t n = leaves_ + winner(); n > 1; n /= 2) {
+      uint32_t sibling = nodes_[n ^ 1];
+      best = best == kNoLeaf ? sibling : Winner(best, sibling);
+    }
+    return best == kNoLeaf || empty_[best] ? kTsMax : min_ts_[best];
+  }
+
+ private:
+  static constexpr uint32_t kNoLeaf = std::numeric_limits<uint32_t>::max();
+
+  uint32_t Winner(uint32_t a, uint32_t b) const {
+    if (empty_[a] != empty_[b])
+      return empty_[a] ? b : a;
+    if (min_ts_[a] != min_ts_[b])
+      return min_ts_[a] < min_ts_[b] ? a : b;
+    return std::min(a, b);
+  }
+
+  uint32_t leaves_ = 1;
+  std::vector<int64_t> min_ts_;
+  std::vector<bool> empty_;
+
+  // Heap-ordered: nodes_[1] is the root, the children of n are 2n and 2n+1
+  // and nodes_[leaves_ + i] is leaf i. Each node stores the winning leaf of
+  // its subtree.
+  std::vector<uint32_t> nodes_;
+};
+
+}  // namespace
+
 TraceSorter::TraceSorter(TraceProcessorContext* context,
                          SortingMode sorting_mode)
-    : sorting_mode_(sorting_mode), storage_(context->storage) {
+    : sorting_mode_(sorting_mode),
+      storage_(context->storage),
+      thread_pool_(context->thread_pool),
+      token_buffer_(context->config.ingestion_memory_budget_bytes) {
   AddMachineContext(context);
   const char* env = getenv("TRACE_PROCESSOR_SORT_ONLY");
   bypass_next_stage_for_testing_ = env && !strcmp(env, "1");
@@ -84,64 +167,89 @@ void TraceSorter::Queue::Sort() {
   PERFETTO_DCHECK(std::is_sorted(events_.begin(), events_.end()));
 }
 
+void TraceSorter::SortQueuesInParallel() {
+  PERFETTO_DCHECK(thread_pool_);
+  std::vector<Queue*> to_sort;
+  for (auto& sorter_data : sorter_data_by_machine_) {
+    for (auto& queue : sorter_data.queues) {
+      if (queue.needs_sorting())
+        to_sort.push_back(&queue);
+    }
+  }
+  if (to_sort.size() < 2) {
+    for (Queue* queue : to_sort)
+      queue->Sort();
+    return;
+  }
+
+  // Queues are independent of each other and Sort() only touches |events_|
+  // and the sort bookkeeping of its own queue.
+  base::WaitableEvent done;
+  for (Queue* queue : to_sort) {
+    thread_pool_->PostTask([queue, &done] {
+      queue->Sort();
+      done.Notify();
+    });
+  }
+  done.Wait(to_sort.size());
+}
+
 // Removes all the events in |queues_| that are earlier than the given
 // packet index and moves them to the next parser stages, respecting global
 // timestamp order. This function is a "extract min from N sorted queues", with
 // some little cleverness: we know that events tend to be bursty, so events are
 // not going to be randomly distributed on the N |queues_|.
-// Upon each iteration this function finds the first two queues (if any) that
-// have the oldest events, and extracts events from the 1st until hitting the
-// min_ts of the 2nd. Imagine the queues are as follows:
+// Upon each iteration this function finds the queue that has the oldest event
+// and the oldest event among all the other queues, and extracts events from
+// the former until hitting the min_ts of the latter. Imagine the queues are as
+// follows:
 //
 //  q0           {min_ts: 10  max_ts: 30}
 //  q1    {min_ts:5              max_ts: 35}
 //  q2              {min_ts: 12    max_ts: 40}
 //
 // We know that we can extract all events from q1 until we hit ts=10 without
-// looking at any other queue. After hitting ts=10, we need to re-look to all of
-// them to figure out the next min-event.
-// There are more suitable data structures to do this (e.g. keeping a min-heap
-// to avoid re-scanning all the queues all the times) but doesn't seem worth it.
-// With Android traces (that have 8 CPUs) this function accounts for ~1-3% cpu
-// time in a profiler.
+// looking at any other queue. After hitting ts=10, we need to find the next
+// min-event again.
+// The queue heads are kept in a tournament tree (QueueHeadTree) so that each
+// of these steps is O(log(N)) rather than a rescan of all the queues: this
+// matters for multi-machine traces which can have hundreds of queues.
 void TraceSorter::SortAndExtractEventsUntilAllocId(
-    BumpAllocator::AllocId limit_alloc_id) {
-  constexpr int64_t kTsMax = std::numeric_limits<int64_t>::max();
-  for (;;) {
-    size_t min_machine_idx = 0;
-    size_t min_queue_idx = 0;  // The index of the queue with the min(ts).
-
-    // The top-2 min(ts) among all queues.
-    // queues_[min_queue_idx].events.timestamp == min_queue_ts[0].
-    int64_t min_queue_ts[2]{kTsMax, kTsMax};
-
-    // This loop identifies the queue which starts with the earliest event and
-    // also remembers the earliest event of the 2nd queue (in min_queue_ts[1]).
-    bool all_queues_empty = true;
-    for (size_t m = 0; m < sorter_data_by_machine_.size(); m++) {
-      TraceSorterData& sorter_data = sorter_data_by_machine_[m];
-      for (size_t i = 0; i < sorter_data.queues.size(); i++) {
-        auto& queue = sorter_data.queues[i];
-        if (queue.events_.empty())
-          continue;
-        PERFETTO_DCHECK(queue.max_ts_ <= append_max_ts_);
-
-        // Checking for |all_queues_empty| is necessary here as in fuzzer cases
-        // we can end up with |int64::max()| as the value here.
-        // See https://crbug.com/oss-fuzz/69164 for an example.
-        if (all_queues_empty || queue.min_ts_ < min_queue_ts[0]) {
-          min_queue_ts[1] = min_queue_ts[0];
-          min_queue_ts[0] = queue.min_ts_;
-          min_queue_idx = i;
-          min_machine_idx = m;
-        } else if (queue.min_ts_ < min_queue_ts[1]) {
-          min_queue_ts[1] = queue.min_ts_;
-        }
-        all_queues_empty = false;
-      }
+    BumpAllocator::AllocId limit_alloc_id,
+    int64_t limit_ts) {
+  if (thread_pool_)
+    SortQueuesInParallel();
+
+  // Flatten the queues of all the machines into the leaves of the tree. No
+  // queue can be added while extracting, as the parsing stage never pushes
+  // events back into the sorter.
+  std::vector<std::pair<uint32_t, uint32_t>> leaf_to_queue;
+  for (size_t m = 0; m < sorter_data_by_machine_.size(); m++) {
+    size_t queue_count = sorter_data_by_machine_[m].queues.size();
+    for (size_t i = 0; i < queue_count; i++) {
+      leaf_to_queue.emplace_back(static_cast<uint32_t>(m),
+                                 static_cast<uint32_t>(i));
     }
-    if (all_queues_empty)
-      break;
+  }
+  QueueHeadTree tree(leaf_to_queue.size());
+  for (uint32_t leaf = 0; leaf < leaf_to_queue.size(); leaf++) {
+    auto [m, i] = leaf_to_queue[leaf];
+    const Queue& queue = sorter_data_by_machine_[m].queues[i];
+    PERFETTO_DCHECK(queue.events_.empty() || queue.max_ts_ <= append_max_ts_);
+
+    // Checking for emptiness rather than relying on |min_ts_| is necessary as
+    // in fuzzer cases we can end up with |int64::max()| as the value here.
+    // See https://crbug.com/oss-fuzz/69164 for an example.
+    tree.Set(leaf, queue.events_.empty(), queue.min_ts_);
+  }
+  tree.Build();
+
+  while (!tree.all_empty()) {
+    uint32_t min_leaf = tree.winner();
+    auto [min_machine_idx, min_queue_idx] = leaf_to_queue[min_leaf];
+
+    // The min(ts) among all the other queues.
+    int64_t next_queue_min_ts = tree.RunnerUpMinTs();
 
     auto& sorter_data = sorter_data_by_machine_[min_machine_idx];
     auto& queue = sorter_data.queues[min_queue_idx];
@@ -151,17 +259,17 @@ void TraceSorter::SortAndExtractEventsUntilAllocId(
     PERFETTO_DCHECK(queue.min_ts_ == events.front().ts);
 
     // Now that we identified the min-queue, extract all events from it until
-    // we hit either: (1) the min-ts of the 2nd queue or (2) the packet index
-    // limit, whichever comes first.
+    // we hit either: (1) the min-ts of the 2nd queue, (2) the packet index
+    // limit or (3) the timestamp limit, whichever comes first.
     size_t num_extracted = 0;
     for (auto& event : events) {
-      if (event.alloc_id() >= limit_alloc_id) {
+      if (event.alloc_id() >= limit_alloc_id || event.ts >= limit_ts) {
         break;
       }
 
-      if (event.ts > min_queue_ts[1]) {
+      if (event.ts > next_queue_min_ts) {
         // We should never hit this condition on the first extraction as by
-        // the algorithm above (event.ts =) min_queue_ts[0] <= min_queue[1].
+        // the algorithm above (event.ts =) min_queue_ts <= next_queue_min_ts.
         PERFETTO_DCHECK(num_extracted > 0);
         break;
       }
@@ -190,7 +298,13 @@ void TraceSorter::SortAndExtractEventsUntilAllocId(
     } else {
       queue.min_ts_ = queue.events_.front().ts;
     }
-  }  // for(;;)
+    tree.Update(min_leaf, events.empty(), queue.min_ts_);
+  }  // while (!tree.all_empty())
+
+  if (token_buffer_.spilled_bytes() > 0) {
+    storage_->SetStats(stats::sorter_spilled_bytes,
+                       static_cast<int64_t>(token_buffer_.spilled_bytes()));
+  }
 }
 
 void TraceSorter::ParseTracePacket(TraceProcessorContext& context,
@@ -44,6 +44,10 @@
 #include "src/trace_processor/types/trace_processor_context.h"
 #include "src/trace_processor/util/bump_allocator.h"
 
+namespace perfetto::base {
+class ThreadPool;
+}  // namespace perfetto::base
+
 namespace perfetto::trace_processor {
 
 // This class takes care of sorting events parsed from the trace stream in
@@ -92,6 +96,11 @@ namespace perfetto::trace_processor {
 // We use a logarithmic bound search operation to figure out what is the index
 // within the first partition where sorting should start, and sort all events
 // from there to the end.
+//
+// When the context has a thread pool (Config::ingestion_thread_count > 1), all
+// the queues which need sorting are sorted concurrently before the merge, as
+// each queue is independent of the others. The merge itself is always serial
+// as it pushes events to the (single-threaded) parsing stage.
 class TraceSorter {
  public:
   enum class SortingMode {
@@ -234,6 +243,14 @@ class TraceSorter {
     flushes_since_extraction_ = 0;
   }
 
+  // Extracts all the events with a timestamp strictly smaller than |ts|,
+  // regardless of the flush and read buffer events seen so far. Used by live
+  // ingestion (see Config::live_ingestion_window_ns) to commit the events old
+  // enough to not be reordered anymore.
+  void ExtractEventsUntilTimestamp(int64_t ts) {
+    SortAndExtractEventsUntilAllocId(token_buffer_.PastTheEndAllocId(), ts);
+  }
+
   void NotifyFlushEvent() { flushes_since_extraction_++; }
 
   void NotifyReadBufferEvent() {
@@ -355,7 +372,14 @@ class TraceSorter {
     int64_t sort_min_ts_ = std::numeric_limits<int64_t>::max();
   };
 
-  void SortAndExtractEventsUntilAllocId(BumpAllocator::AllocId alloc_id);
+  // Extracts the events allocated before |alloc_id| and with a timestamp
+  // smaller than |limit_ts|.
+  void SortAndExtractEventsUntilAllocId(
+      BumpAllocator::AllocId alloc_id,
+      int64_t limit_ts = std::numeric_limits<int64_t>::max());
+
+  // Sorts all the queues which need sorting on |thread_pool_|.
+  void SortQueuesInParallel();
 
   inline Queue* GetQueue(size_t index,
                          std::optional<MachineId> machine_id = std::nullopt) {
@@ -430,6 +454,10 @@ class TraceSorter {
 
   std::shared_ptr<TraceStorage> storage_;
 
+  // Shared with the TraceProcessorContext. Null unless ingestion is allowed to
+  // use multiple threads.
+  std::shared_ptr<base::ThreadPool> thread_pool_;
+
   // Buffer for storing tokenized objects while the corresponding events are
   // being sorted.
   TraceTokenBuffer token_buffer_;
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <random>
+
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/trace_processor/ref_counted.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/importers/common/parser_types.h"
+#include "src/trace_processor/sorter/trace_sorter.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+constexpr uint32_t kEventsPerQueue = 2000;
+
+void SortArgs(benchmark::internal::Benchmark* b) {
+  // {number of queues, number of threads}.
+  for (int queues : {8, 64, 512}) {
+    for (int threads : {1, 8}) {
+      b->Args({queues, threads});
+    }
+  }
+}
+
+// Measures ExtractEventsForced() with many ftrace queues (e.g. a multi-machine
+// trace with hundreds of CPUs), each of them slightly out of order so that
+// every queue needs to be sorted before the merge.
+void BM_TraceSorterSortAndExtract(benchmark::State& state) {
+  // Skip the parsing stage: only the sorting and merging is measured.
+  setenv("TRACE_PROCESSOR_SORT_ONLY", "1", 1);
+
+  uint32_t queues = static_cast<uint32_t>(state.range(0));
+  uint32_t threads = static_cast<uint32_t>(state.range(1));
+
+  TraceBlobView tbv(TraceBlob::Allocate(1));
+  std::minstd_rand0 rnd_engine(42);
+  for (auto _ : state) {
+    state.PauseTiming();
+    TraceProcessorContext context;
+    context.storage = std::make_shared<TraceStorage>();
+    if (threads > 1)
+      context.thread_pool = std::make_shared<base::ThreadPool>(threads);
+    TraceSorter sorter(&context, TraceSorter::SortingMode::kFullSort);
+    for (uint32_t i = 0; i < kEventsPerQueue; ++i) {
+      for (uint32_t cpu = 0; cpu < queues; ++cpu) {
+        // Jitter the timestamps so that each queue is mostly, but not fully,
+        // sorted, like ftrace data usually is.
+        int64_t ts = static_cast<int64_t>(i) * 1000 +
+                     static_cast<int64_t>(rnd_engine() % 4000);
+        sorter.PushFtraceEvent(cpu, ts, tbv.copy(),
+                               RefPtr<PacketSequenceStateGeneration>());
+      }
+    }
+    state.ResumeTiming();
+
+    sorter.ExtractEventsForced();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          kEventsPerQueue * queues);
+}
+BENCHMARK(BM_TraceSorterSortAndExtract)->Apply(SortArgs);
+
+}  // namespace
+}  // namespace perfetto::trace_processor
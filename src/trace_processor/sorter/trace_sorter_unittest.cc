@@ -15,10 +15,13 @@
  */
 #include "src/trace_processor/sorter/trace_sorter.h"
 
+#include <algorithm>
 #include <map>
+#include <memory>
 #include <random>
 #include <vector>
 
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/trace_blob.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
@@ -207,6 +210,39 @@ TEST_F(TraceSorterTest, IncrementalExtraction) {
   context_.sorter->ExtractEventsForced();
 }
 
+TEST_F(TraceSorterTest, ExtractUntilTimestamp) {
+  auto state = PacketSequenceStateGeneration::CreateFirst(&context_);
+
+  TraceBlobView view_1 = test_buffer_.slice_off(0, 1);
+  TraceBlobView view_2 = test_buffer_.slice_off(0, 2);
+  TraceBlobView view_3 = test_buffer_.slice_off(0, 3);
+  TraceBlobView view_4 = test_buffer_.slice_off(0, 4);
+
+  context_.sorter->PushTracePacket(1200, state, std::move(view_2));
+  context_.sorter->PushFtraceEvent(0 /*cpu*/, 1300 /*timestamp*/,
+                                   std::move(view_3), state);
+  context_.sorter->PushTracePacket(1100, state, std::move(view_1));
+
+  // Only the events before the timestamp should be extracted, even in full
+  // sort mode.
+  {
+    InSequence s;
+    EXPECT_CALL(*parser_, MOCK_ParseTracePacket(1100, test_buffer_.data(), 1));
+    EXPECT_CALL(*parser_, MOCK_ParseTracePacket(1200, test_buffer_.data(), 2));
+  }
+  context_.sorter->ExtractEventsUntilTimestamp(1300);
+  ::testing::Mock::VerifyAndClearExpectations(parser_);
+
+  context_.sorter->PushTracePacket(1400, state, std::move(view_4));
+  {
+    InSequence s;
+    EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, 1300, test_buffer_.data(),
+                                                 3, kNullMachineId));
+    EXPECT_CALL(*parser_, MOCK_ParseTracePacket(1400, test_buffer_.data(), 4));
+  }
+  context_.sorter->ExtractEventsForced();
+}
+
 // Simulate a producer bug where the third packet is emitted
 // out of order. Verify that we track the stats correctly.
 TEST_F(TraceSorterTest, OutOfOrder) {
@@ -314,6 +350,42 @@ TEST_F(TraceSorterTest, MultiQueueSorting) {
   EXPECT_TRUE(expectations.empty());
 }
 
+// Same as MultiQueueSorting but with the queues sorted on a thread pool.
+TEST_F(TraceSorterTest, MultiQueueSortingWithThreadPool) {
+  context_.thread_pool = std::make_shared<base::ThreadPool>(4);
+  CreateSorter();
+
+  auto state = PacketSequenceStateGeneration::CreateFirst(&context_);
+  std::minstd_rand0 rnd_engine(0);
+  std::map<int64_t /*ts*/, std::vector<uint32_t /*cpu*/>> expectations;
+
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(_, _, _, _, _))
+      .WillRepeatedly(Invoke([&expectations](uint32_t cpu, int64_t timestamp,
+                                             const uint8_t*, size_t,
+                                             std::optional<MachineId>) {
+        EXPECT_EQ(expectations.begin()->first, timestamp);
+        auto& cpus = expectations.begin()->second;
+        auto it = std::find(cpus.begin(), cpus.end(), cpu);
+        ASSERT_NE(it, cpus.end());
+        cpus.erase(it);
+        if (cpus.empty())
+          expectations.erase(expectations.begin());
+      }));
+
+  // Use many more queues than CPUs on a typical device, so that every queue
+  // ends up out of order and needs sorting.
+  TraceBlobView tbv(TraceBlob::Allocate(5000));
+  for (uint16_t i = 0; i < 5000; i++) {
+    int64_t ts = abs(static_cast<int64_t>(rnd_engine()));
+    uint32_t cpu = static_cast<uint32_t>(rnd_engine() % 256);
+    expectations[ts].push_back(cpu);
+    context_.sorter->PushFtraceEvent(cpu, ts, tbv.slice_off(i, 1), state);
+  }
+
+  context_.sorter->ExtractEventsForced();
+  EXPECT_TRUE(expectations.empty());
+}
+
 // An generalized version of MultiQueueSorting with multiple machines.
 TEST_F(TraceSorterTest, MultiMachineSorting) {
   auto state = PacketSequenceStateGeneration::CreateFirst(&context_);
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/sorter/trace_token_buffer.h"
 
+#include "perfetto/base/build_config.h"
+
 #include <stdint.h>
 #include <algorithm>
 #include <cstdint>
@@ -26,7 +28,17 @@
 #include <type_traits>
 #include <utility>
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 #include "perfetto/base/compiler.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/trace_processor/trace_blob.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/parser_types.h"
@@ -37,7 +49,7 @@ namespace trace_processor {
 namespace {
 
 struct alignas(8) TrackEventDataDescriptor {
-  static constexpr uint8_t kMaxOffsetFromInternedBlobBits = 25;
+  static constexpr uint8_t kMaxOffsetFromInternedBlobBits = 24;
   static constexpr uint32_t kMaxOffsetFromInternedBlob =
       (1Ul << kMaxOffsetFromInternedBlobBits) - 1;
 
@@ -49,6 +61,7 @@ struct alignas(8) TrackEventDataDescriptor {
   uint16_t intern_blob_index;
   uint16_t intern_seq_index;
   uint32_t intern_blob_offset : kMaxOffsetFromInternedBlobBits;
+  uint32_t is_spilled : 1;
   uint32_t has_thread_timestamp : 1;
   uint32_t has_thread_instruction_count : 1;
   uint32_t has_counter_value : 1;
@@ -77,6 +90,7 @@ uint8_t* AppendToPtr(uint8_t* ptr, T value) {
 uint32_t GetAllocSize(const TrackEventDataDescriptor& desc) {
   uint32_t alloc_size = sizeof(TrackEventDataDescriptor);
   alloc_size += sizeof(uint64_t);
+  alloc_size += desc.is_spilled * sizeof(uint64_t);
   alloc_size += desc.has_thread_instruction_count * sizeof(int64_t);
   alloc_size += desc.has_thread_timestamp * sizeof(int64_t);
   alloc_size += desc.has_counter_value * sizeof(double);
@@ -84,8 +98,36 @@ uint32_t GetAllocSize(const TrackEventDataDescriptor& desc) {
   return alloc_size;
 }
 
+// Reads or writes exactly |size| bytes at |offset| in |fd|.
+void ReadAt(int fd, uint64_t offset, void* dst, size_t size) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  PERFETTO_CHECK(_lseeki64(fd, static_cast<int64_t>(offset), SEEK_SET) >= 0);
+  PERFETTO_CHECK(base::Read(fd, dst, size) == static_cast<ssize_t>(size));
+#else
+  ssize_t res =
+      PERFETTO_EINTR(pread(fd, dst, size, static_cast<off_t>(offset)));
+  PERFETTO_CHECK(res == static_cast<ssize_t>(size));
+#endif
+}
+
+void WriteAt(int fd, uint64_t offset, const void* src, size_t size) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  PERFETTO_CHECK(_lseeki64(fd, static_cast<int64_t>(offset), SEEK_SET) >= 0);
+  PERFETTO_CHECK(base::WriteAll(fd, src, size) == static_cast<ssize_t>(size));
+#else
+  ssize_t res =
+      PERFETTO_EINTR(pwrite(fd, src, size, static_cast<off_t>(offset)));
+  PERFETTO_CHECK(res == static_cast<ssize_t>(size));
+#endif
+}
+
 }  // namespace
 
+TraceTokenBuffer::TraceTokenBuffer(uint64_t memory_budget_bytes)
+    : memory_budget_bytes_(memory_budget_bytes) {}
+
+TraceTokenBuffer::~TraceTokenBuffer() = default;
+
 TraceTokenBuffer::Id TraceTokenBuffer::Append(TrackEventData ted) {
   // TrackEventData (and TracePacketData) are two big contributors to the size
   // of the peak memory usage by sorted. The main reasons for this are a) object
@@ -104,17 +146,36 @@ TraceTokenBuffer::Id TraceTokenBuffer::Append(TrackEventData ted) {
   desc.has_counter_value = std::not_equal_to<double>()(ted.counter_value, 0);
   desc.extra_counter_count = ted.CountExtraCounterValues();
 
+  // If keeping the TraceBlob of this packet alive would exceed the budget,
+  // write the contents of the packet to the spill file instead. Packets of a
+  // blob which is already kept alive come for free.
+  const TracePacketData& tpd = ted.trace_packet_data;
+  desc.is_spilled =
+      memory_budget_bytes_ > 0 &&
+      in_memory_bytes_ + RetainBlobCost(tpd.packet.blob().get()) >
+          memory_budget_bytes_;
+
   // Allocate enough memory using the BumpAllocator to store the data in |ted|.
   // Also figure out the interned index.
-  BumpAllocator::AllocId alloc_id =
-      AllocAndResizeInternedVectors(GetAllocSize(desc));
+  uint32_t alloc_size = GetAllocSize(desc);
+  BumpAllocator::AllocId alloc_id = AllocAndResizeInternedVectors(alloc_size);
   InternedIndex interned_index = GetInternedIndex(alloc_id);
+  in_memory_bytes_ += alloc_size;
 
   // Compute the interning information for the TrackBlob and the SequenceState.
-  const TracePacketData& tpd = ted.trace_packet_data;
-  desc.intern_blob_offset = InternTraceBlob(interned_index, tpd.packet);
-  desc.intern_blob_index =
-      static_cast<uint16_t>(interned_blobs_.at(interned_index).size() - 1);
+  uint64_t spill_offset = 0;
+  if (desc.is_spilled) {
+    spill_offset = SpillPacket(tpd.packet);
+    desc.intern_blob_offset = 0;
+    desc.intern_blob_index = 0;
+  } else {
+    if (memory_budget_bytes_ > 0) {
+      RetainBlob(tpd.packet.blob().get());
+    }
+    desc.intern_blob_offset = InternTraceBlob(interned_index, tpd.packet);
+    desc.intern_blob_index =
+        static_cast<uint16_t>(interned_blobs_.at(interned_index).size() - 1);
+  }
   desc.intern_seq_index =
       InternSeqState(interned_index, std::move(tpd.sequence_state));
 
@@ -125,6 +186,9 @@ TraceTokenBuffer::Id TraceTokenBuffer::Append(TrackEventData ted) {
   // Store the packet sizes.
   uint64_t packet_size = static_cast<uint64_t>(tpd.packet.size());
   ptr = AppendToPtr(ptr, packet_size);
+  if (desc.is_spilled) {
+    ptr = AppendToPtr(ptr, spill_offset);
+  }
 
   // Add the "optional" fields of TrackEventData based on whether or not they
   // are non-null.
@@ -151,11 +215,20 @@ TrackEventData TraceTokenBuffer::Extract<TrackEventData>(Id id) {
   uint64_t packet_size = ExtractFromPtr<uint64_t>(&ptr);
 
   InternedIndex interned_index = GetInternedIndex(id.alloc_id);
-  BlobWithOffset& bwo =
-      interned_blobs_.at(interned_index)[desc.intern_blob_index];
-  TraceBlobView tbv(RefPtr<TraceBlob>::FromReleasedUnsafe(bwo.blob),
-                    bwo.offset_in_blob + desc.intern_blob_offset,
-                    static_cast<uint32_t>(packet_size));
+  TraceBlobView tbv;
+  if (desc.is_spilled) {
+    uint64_t spill_offset = ExtractFromPtr<uint64_t>(&ptr);
+    tbv = UnspillPacket(spill_offset, static_cast<size_t>(packet_size));
+  } else {
+    BlobWithOffset& bwo =
+        interned_blobs_.at(interned_index)[desc.intern_blob_index];
+    tbv = TraceBlobView(RefPtr<TraceBlob>::FromReleasedUnsafe(bwo.blob),
+                        bwo.offset_in_blob + desc.intern_blob_offset,
+                        static_cast<uint32_t>(packet_size));
+    if (memory_budget_bytes_ > 0) {
+      ReleaseBlob(bwo.blob);
+    }
+  }
   auto seq = RefPtr<PacketSequenceStateGeneration>::FromReleasedUnsafe(
       interned_seqs_.at(interned_index)[desc.intern_seq_index]);
 
@@ -173,6 +246,7 @@ TrackEventData TraceTokenBuffer::Extract<TrackEventData>(Id id) {
     ted.extra_counter_values[i] = ExtractFromPtr<double>(&ptr);
   }
   allocator_.Free(id.alloc_id);
+  in_memory_bytes_ -= GetAllocSize(desc);
   return ted;
 }
 
@@ -241,6 +315,64 @@ uint32_t TraceTokenBuffer::AddTraceBlob(InternedIndex interned_index,
   return 0u;
 }
 
+uint64_t TraceTokenBuffer::RetainBlobCost(const TraceBlob* blob) const {
+  if (!blob || retained_blobs_.Find(reinterpret_cast<uintptr_t>(blob))) {
+    return 0;
+  }
+  return blob->size();
+}
+
+void TraceTokenBuffer::RetainBlob(const TraceBlob* blob) {
+  if (!blob) {
+    return;
+  }
+  auto it_and_inserted =
+      retained_blobs_.Insert(reinterpret_cast<uintptr_t>(blob), 0);
+  if (it_and_inserted.second) {
+    in_memory_bytes_ += blob->size();
+  }
+  ++*it_and_inserted.first;
+}
+
+void TraceTokenBuffer::ReleaseBlob(const TraceBlob* blob) {
+  if (!blob) {
+    return;
+  }
+  uintptr_t key = reinterpret_cast<uintptr_t>(blob);
+  uint32_t* count = retained_blobs_.Find(key);
+  PERFETTO_DCHECK(count && *count > 0);
+  if (--*count == 0) {
+    retained_blobs_.Erase(key);
+    in_memory_bytes_ -= blob->size();
+  }
+}
+
+uint64_t TraceTokenBuffer::SpillPacket(const TraceBlobView& tbv) {
+  if (!spill_file_) {
+    spill_file_ = base::TempFile::CreateUnlinked();
+  }
+  uint64_t offset = spill_file_end_;
+  WriteAt(spill_file_->fd(), offset, tbv.data(), tbv.size());
+  spill_file_end_ += tbv.size();
+  spilled_bytes_ += tbv.size();
+  spilled_packet_count_++;
+  return offset;
+}
+
+TraceBlobView TraceTokenBuffer::UnspillPacket(uint64_t offset, size_t size) {
+  PERFETTO_DCHECK(spill_file_);
+  PERFETTO_DCHECK(spilled_packet_count_ > 0);
+  TraceBlob blob = TraceBlob::Allocate(size);
+  if (size > 0) {
+    ReadAt(spill_file_->fd(), offset, blob.data(), size);
+  }
+  // Once no spilled packet is left, the file can be overwritten from the start.
+  if (--spilled_packet_count_ == 0) {
+    spill_file_end_ = 0;
+  }
+  return TraceBlobView(std::move(blob));
+}
+
 void TraceTokenBuffer::FreeMemory() {
   uint64_t erased = allocator_.EraseFrontFreeChunks();
   PERFETTO_CHECK(erased <= std::numeric_limits<size_t>::max());
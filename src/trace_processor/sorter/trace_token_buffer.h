@@ -25,6 +25,8 @@
 
 #include "perfetto/base/compiler.h"
 #include "perfetto/ext/base/circular_queue.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/trace_processor/trace_blob.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
@@ -44,8 +46,20 @@ namespace trace_processor {
 // complexity in this class for big reductions in the peak use.
 //
 // go/perfetto-tp-memory-use gives an overview of trace processor memory usage.
+//
+// When constructed with a non-zero memory budget, the contents of the packets
+// which would make the buffer exceed the budget are "spilled" to a temporary
+// file instead of keeping a reference to their TraceBlob: they are read back
+// into a new TraceBlob on |Extract|. The memory of the buffer is the size of
+// its entries plus the size of the TraceBlobs its packets keep alive, however
+// small the packets. The budget is approximate: the heap memory owned by the
+// objects appended (e.g. the strings of JSON events) is not counted and only
+// TrackEventData and TracePacketData can be spilled.
 class TraceTokenBuffer {
  public:
+  explicit TraceTokenBuffer(uint64_t memory_budget_bytes = 0);
+  ~TraceTokenBuffer();
+
   // Identifier returned when appending items to this buffer. This id can
   // later by passed to |Extract| to retrieve the event.
   struct Id {
@@ -61,6 +75,7 @@ class TraceTokenBuffer {
     static_assert(alignof(T) == 8, "Alignment must be 8");
     BumpAllocator::AllocId id = AllocAndResizeInternedVectors(sizeof(T));
     new (allocator_.GetPointer(id)) T(std::move(object));
+    in_memory_bytes_ += sizeof(T);
     return Id{id};
   }
   PERFETTO_WARN_UNUSED_RESULT Id Append(TrackEventData);
@@ -81,6 +96,7 @@ class TraceTokenBuffer {
     T object(std::move(*typed_ptr));
     typed_ptr->~T();
     allocator_.Free(id.alloc_id);
+    in_memory_bytes_ -= sizeof(T);
     return object;
   }
 
@@ -97,6 +113,10 @@ class TraceTokenBuffer {
   // allocator. The amount of memory free is implementation defined.
   void FreeMemory();
 
+  // Returns the total number of bytes of packets which were written to the
+  // spill file.
+  uint64_t spilled_bytes() const { return spilled_bytes_; }
+
  private:
   struct BlobWithOffset {
     TraceBlob* blob;
@@ -113,12 +133,43 @@ class TraceTokenBuffer {
   uint16_t InternSeqState(InternedIndex, RefPtr<PacketSequenceStateGeneration>);
   uint32_t AddTraceBlob(InternedIndex, const TraceBlobView&);
 
+  // Functions to count the TraceBlobs kept alive by the packets in memory:
+  // a blob counts towards |in_memory_bytes_| as long as one of them refers to
+  // it. Only used when spilling is enabled.
+  uint64_t RetainBlobCost(const TraceBlob*) const;
+  void RetainBlob(const TraceBlob*);
+  void ReleaseBlob(const TraceBlob*);
+
   BumpAllocator::AllocId AllocAndResizeInternedVectors(uint32_t size);
   InternedIndex GetInternedIndex(BumpAllocator::AllocId);
 
+  // Functions to write the contents of a packet to the spill file and read
+  // them back.
+  uint64_t SpillPacket(const TraceBlobView&);
+  TraceBlobView UnspillPacket(uint64_t offset, size_t size);
+
   BumpAllocator allocator_;
   base::CircularQueue<BlobWithOffsets> interned_blobs_;
   base::CircularQueue<SequenceStates> interned_seqs_;
+
+  // The budget for |in_memory_bytes_|: packets are spilled once exceeded. Zero
+  // if spilling is disabled.
+  uint64_t memory_budget_bytes_ = 0;
+
+  // The sum of the sizes of the entries stored in the buffer and of the
+  // TraceBlobs referred to by the packets which were not spilled.
+  uint64_t in_memory_bytes_ = 0;
+
+  // The number of packets in memory referring to each TraceBlob, keyed by
+  // address.
+  base::FlatHashMap<uintptr_t, uint32_t> retained_blobs_;
+
+  // Created when the first packet is spilled. The file is reused from the
+  // start once all the spilled packets have been extracted.
+  std::optional<base::TempFile> spill_file_;
+  uint64_t spill_file_end_ = 0;
+  uint64_t spilled_packet_count_ = 0;
+  uint64_t spilled_bytes_ = 0;
 };
 
 // GCC7 does not like us declaring these inside the class so define these
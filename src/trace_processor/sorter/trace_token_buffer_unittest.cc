@@ -16,7 +16,9 @@
 
 #include "src/trace_processor/sorter/trace_token_buffer.h"
 
+#include <cstring>
 #include <optional>
+#include <vector>
 
 #include "perfetto/base/compiler.h"
 #include "perfetto/trace_processor/ref_counted.h"
@@ -114,6 +116,47 @@ TEST_F(TraceTokenBufferUnittest, ManySequenceState) {
   }
 }
 
+TEST_F(TraceTokenBufferUnittest, SpillOverBudget) {
+  TraceTokenBuffer spill_store(2048);
+  TraceBlobView tbv_1(TraceBlob::Allocate(1024));
+  TraceBlob blob = TraceBlob::Allocate(1024);
+  for (size_t i = 0; i < blob.size(); ++i) {
+    blob.data()[i] = static_cast<uint8_t>(i);
+  }
+  TraceBlobView root(std::move(blob));
+  TraceBlobView tbv_2 = root.slice_off(0, 512);
+  TraceBlobView tbv_3 = root.slice_off(512, 512);
+
+  // The blob of the first packet fits in the budget, the blob of the others
+  // doesn't: they are spilled.
+  TraceTokenBuffer::Id id_1 =
+      spill_store.Append(TracePacketData{tbv_1.copy(), state});
+  TraceTokenBuffer::Id id_2 =
+      spill_store.Append(TracePacketData{tbv_2.copy(), state});
+  TraceTokenBuffer::Id id_3 =
+      spill_store.Append(TracePacketData{tbv_3.copy(), state});
+  ASSERT_EQ(spill_store.spilled_bytes(), 1024u);
+
+  TracePacketData extracted_1 = spill_store.Extract<TracePacketData>(id_1);
+  ASSERT_EQ(extracted_1.packet, tbv_1);
+  ASSERT_EQ(extracted_1.sequence_state, state);
+
+  TracePacketData extracted_3 = spill_store.Extract<TracePacketData>(id_3);
+  ASSERT_EQ(extracted_3.packet.size(), tbv_3.size());
+  ASSERT_EQ(memcmp(extracted_3.packet.data(), tbv_3.data(), tbv_3.size()), 0);
+  ASSERT_EQ(extracted_3.sequence_state, state);
+
+  TracePacketData extracted_2 = spill_store.Extract<TracePacketData>(id_2);
+  ASSERT_EQ(extracted_2.packet.size(), tbv_2.size());
+  ASSERT_EQ(memcmp(extracted_2.packet.data(), tbv_2.data(), tbv_2.size()), 0);
+
+  // Memory was freed by the extractions so the next packet is kept in memory.
+  TraceTokenBuffer::Id id_4 =
+      spill_store.Append(TracePacketData{tbv_2.copy(), state});
+  ASSERT_EQ(spill_store.spilled_bytes(), 1024u);
+  ASSERT_EQ(spill_store.Extract<TracePacketData>(id_4).packet, tbv_2);
+}
+
 TEST_F(TraceTokenBufferUnittest, PacketLargeOffset) {
   TraceBlobView tbv(TraceBlob::Allocate(256ul * 1024));
 
@@ -132,6 +175,52 @@ TEST_F(TraceTokenBufferUnittest, PacketLargeOffset) {
   ASSERT_EQ(out_2.sequence_state, state);
 }
 
+TEST_F(TraceTokenBufferUnittest, SpillSmallPacketsOfLargeBlobs) {
+  static constexpr size_t kBlobSize = 64 * 1024;
+  static constexpr size_t kNumBlobs = 16;
+  static constexpr size_t kPacketSize = 64;
+  static constexpr size_t kPacketsPerBlob = 8;
+
+  // Room for two blobs (and the entries).
+  TraceTokenBuffer spill_store(2 * kBlobSize + 1024);
+  std::vector<TraceBlobView> packets;
+  std::vector<TraceTokenBuffer::Id> ids;
+  for (size_t i = 0; i < kNumBlobs; ++i) {
+    TraceBlob blob = TraceBlob::Allocate(kBlobSize);
+    for (size_t j = 0; j < blob.size(); ++j) {
+      blob.data()[j] = static_cast<uint8_t>(i + j);
+    }
+    TraceBlobView root(std::move(blob));
+    for (size_t j = 0; j < kPacketsPerBlob; ++j) {
+      packets.push_back(root.slice_off(j * kPacketSize, kPacketSize));
+      ids.push_back(
+          spill_store.Append(TracePacketData{packets.back().copy(), state}));
+    }
+  }
+
+  // The packets of the first two blobs keep them alive, the packets of the
+  // others are spilled, however small they are.
+  ASSERT_EQ(spill_store.spilled_bytes(),
+            (kNumBlobs - 2) * kPacketsPerBlob * kPacketSize);
+
+  for (size_t i = 0; i < ids.size(); ++i) {
+    TracePacketData extracted = spill_store.Extract<TracePacketData>(ids[i]);
+    ASSERT_EQ(extracted.packet.size(), kPacketSize);
+    ASSERT_EQ(memcmp(extracted.packet.data(), packets[i].data(), kPacketSize),
+              0);
+    ASSERT_EQ(extracted.sequence_state, state);
+  }
+
+  // All the blobs were released by the extractions.
+  TraceBlobView tbv(TraceBlob::Allocate(kBlobSize));
+  TraceTokenBuffer::Id id =
+      spill_store.Append(TracePacketData{tbv.slice_off(0, kPacketSize), state});
+  ASSERT_EQ(spill_store.spilled_bytes(),
+            (kNumBlobs - 2) * kPacketsPerBlob * kPacketSize);
+  ASSERT_EQ(spill_store.Extract<TracePacketData>(id).packet,
+            tbv.slice_off(0, kPacketSize));
+}
+
 TEST_F(TraceTokenBufferUnittest, TrackEventDataInOut) {
   TraceBlobView tbv(TraceBlob::Allocate(1234));
   TrackEventData ted(tbv.copy(), state);
@@ -21,6 +21,7 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <iterator>
 #include <memory>
 #include <numeric>
@@ -43,7 +44,9 @@
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/runtime_table.h"
 #include "src/trace_processor/db/table.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/functions/batch_sql_function.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/static_table_function.h"
+#include "src/trace_processor/sqlite/bindings/sqlite_result.h"
 #include "src/trace_processor/sqlite/module_lifecycle_manager.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
 #include "src/trace_processor/tp_metatrace.h"
@@ -225,44 +228,43 @@ int ReadIdxStrAndUpdateCursor(DbSqliteModule::Cursor* cursor,
   return SQLITE_OK;
 }
 
-PERFETTO_ALWAYS_INLINE void TryCacheCreateSortedTable(
-    DbSqliteModule::Cursor* cursor,
-    const Table::Schema& schema,
-    bool is_same_idx) {
+// Repeated equality constraints with the same constraint set are what SQLite
+// generates for the inner loop of a join: for these, create a hash index on
+// the joined column so that each probe is a hash lookup instead of a scan of
+// the whole table. The index lives on the table so it is shared by all the
+// open cursors using it, and is freed once they are all closed.
+PERFETTO_ALWAYS_INLINE void TryCreateHashIndex(DbSqliteModule::Cursor* cursor,
+                                               const Table::Schema& schema,
+                                               bool is_same_idx) {
   if (!is_same_idx) {
     cursor->repeated_cache_count = 0;
     return;
   }
 
-  // Only try and create the cached table on exactly the third time we see
-  // this constraint set.
+  // Only try and create the index on exactly the third time we see this
+  // constraint set.
   constexpr uint32_t kRepeatedThreshold = 3;
-  if (cursor->sorted_cache_table ||
-      cursor->repeated_cache_count++ != kRepeatedThreshold) {
+  if (cursor->repeated_cache_count++ != kRepeatedThreshold) {
     return;
   }
 
-  // If we have more than one constraint, we can't cache the table using
-  // this method.
-  if (cursor->query.constraints.size() != 1) {
-    return;
-  }
-
-  // If the constraing is not an equality constraint, there's little
-  // benefit to caching
-  const auto& c = cursor->query.constraints.front();
-  if (c.op != FilterOp::kEq) {
-    return;
+  // Equality constraints on id, sorted and set id columns are already cheap
+  // (constant time or binary search): no need for an index.
+  for (const auto& c : cursor->query.constraints) {
+    const auto& col = schema.columns[c.col_idx];
+    bool is_cheap = col.is_id || col.is_sorted || col.is_set_id;
+    if (c.op == FilterOp::kEq && is_cheap) {
+      return;
+    }
   }
-
-  // If the column is already sorted, we don't need to cache at all.
-  if (schema.columns[c.col_idx].is_sorted) {
-    return;
+  for (const auto& c : cursor->query.constraints) {
+    if (c.op == FilterOp::kEq && !c.value.is_null()) {
+      if (auto id = cursor->upstream_table->CreateHashIndex(c.col_idx); id) {
+        cursor->hash_index_ids.push_back(*id);
+      }
+      return;
+    }
   }
-
-  // Try again to get the result or start caching it.
-  cursor->sorted_cache_table =
-      cursor->upstream_table->Sort({Order{c.col_idx, false}});
 }
 
 void FilterAndSortMetatrace(const std::string& table_name,
@@ -340,6 +342,236 @@ void FilterAndSortMetatrace(const std::string& table_name,
   }
 }
 
+// The maximum number of rows a batch function is computed for at once.
+constexpr uint32_t kMaxBatchSize = 1024;
+
+bool IsSameValue(const SqlValue& a, const SqlValue& b) {
+  if (a.type != b.type) {
+    return false;
+  }
+  switch (a.type) {
+    case SqlValue::kNull:
+      return true;
+    case SqlValue::kLong:
+      return a.long_value == b.long_value;
+    case SqlValue::kDouble:
+      return a.double_value == b.double_value;
+    case SqlValue::kString:
+      return strcmp(a.string_value, b.string_value) == 0;
+    case SqlValue::kBytes:
+      return a.bytes_count == b.bytes_count &&
+             memcmp(a.bytes_value, b.bytes_value, a.bytes_count) == 0;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+// Values of the columns of cursors with a batch slot are tagged with a
+// subtype identifying the slot and the column: batch functions use it to know
+// exactly which rows they are called on. The high bit keeps the tags apart
+// from the subtypes used by SQLite itself (e.g. 'J' for JSON values).
+constexpr uint32_t kBatchTagBit = 0x80;
+constexpr uint32_t kBatchTagColumnBits = 6;
+constexpr uint32_t kMaxBatchTagColumns = 1u << kBatchTagColumnBits;
+static_assert((DbSqliteModule::kMaxBatchCursors << kBatchTagColumnBits) <=
+              kBatchTagBit);
+
+struct BatchColumn {
+  uint32_t slot;
+  uint32_t column;
+};
+
+// Returns the cursor slot and column |value| was read from or std::nullopt
+// if it was not read from a tagged column.
+std::optional<BatchColumn> GetBatchColumn(sqlite3_value* value) {
+  uint32_t subtype = sqlite3_value_subtype(value);
+  if ((subtype & kBatchTagBit) == 0) {
+    return std::nullopt;
+  }
+  uint32_t slot = (subtype & ~kBatchTagBit) >> kBatchTagColumnBits;
+  if (slot >= DbSqliteModule::kMaxBatchCursors) {
+    return std::nullopt;
+  }
+  return BatchColumn{slot, subtype & (kMaxBatchTagColumns - 1)};
+}
+
+// The results of a batch function at one call site for a chunk of the rows
+// of a cursor.
+//
+// Results are only ever returned for the same arguments they were computed
+// for: if SQLite calls the function on a row which is not in the chunk or
+// with different arguments, the chunk is simply recomputed.
+struct BatchState {
+  // Returns the result for the current row of the function called on
+  // |column| with |first| and |argv| if it was computed by the last call to
+  // |Refill|.
+  const SqlValue* Find(const DbSqliteModule::Vtab& vtab,
+                       const BatchColumn& col,
+                       const SqlValue& first,
+                       int argc,
+                       sqlite3_value** argv) {
+    if (col.slot != slot || col.column != column ||
+        vtab.batch_cursors[slot] != cursor || cursor->filter_id != filter_id ||
+        cursor->mode != DbSqliteModule::Cursor::Mode::kTable || cursor->eof) {
+      return nullptr;
+    }
+    uint32_t row = cursor->iterator->row();
+    if (row < start || row - start >= first_values.size() ||
+        !IsSameValue(first_values[row - start], first)) {
+      return nullptr;
+    }
+    for (int i = 1; i < argc; ++i) {
+      if (!IsSameValue(rest[static_cast<size_t>(i - 1)],
+                       sqlite::utils::SqliteValueToSqlValue(argv[i]))) {
+        return nullptr;
+      }
+    }
+    hits++;
+    return &results[row - start];
+  }
+
+  // Computes |function| for a chunk of the rows starting at the current row
+  // of the cursor and column |col| was read from. Returns the result for the
+  // current row or nullptr if |first| is not the current value of the column
+  // (e.g. because SQLite kept a copy of the value of a previous row).
+  const SqlValue* Refill(const DbSqliteModule::Vtab& vtab,
+                         BatchSqlFunction* function,
+                         const BatchColumn& col,
+                         const SqlValue& first,
+                         int argc,
+                         sqlite3_value** argv) {
+    DbSqliteModule::Cursor* c = vtab.batch_cursors[col.slot];
+    if (!c || c->mode != DbSqliteModule::Cursor::Mode::kTable || c->eof ||
+        col.column >= c->upstream_table->columns().size() ||
+        !IsSameValue(c->iterator->Get(col.column), first)) {
+      return nullptr;
+    }
+
+    // Start again from small chunks if most of the previous one was unused
+    // (e.g. because SQLite filtered out most rows) to avoid wasting work.
+    if (hits * 2 < results.size()) {
+      batch_size = 1;
+    }
+
+    SetRest(argc, argv);
+    first_values.clear();
+    c->iterator->GetNextRows(col.column, batch_size, first_values);
+    results.clear();
+    base::Status status = function->Run(first_values, rest, results);
+    if (!status.ok() || results.size() != first_values.size()) {
+      first_values.clear();
+      results.clear();
+      return nullptr;
+    }
+    cursor = c;
+    filter_id = c->filter_id;
+    slot = col.slot;
+    column = col.column;
+    start = c->iterator->row();
+    hits = 1;
+    batch_size = std::min(batch_size * 2, kMaxBatchSize);
+    return &results[0];
+  }
+
+  // Stores a copy of the arguments after the first one.
+  void SetRest(int argc, sqlite3_value** argv) {
+    rest.clear();
+    rest_storage.clear();
+    rest_storage.reserve(static_cast<size_t>(argc));
+    for (int i = 1; i < argc; ++i) {
+      SqlValue value = sqlite::utils::SqliteValueToSqlValue(argv[i]);
+      if (value.type == SqlValue::kString) {
+        value.string_value =
+            rest_storage.emplace_back(value.string_value).data();
+      } else if (value.type == SqlValue::kBytes) {
+        const auto* bytes = static_cast<const char*>(value.bytes_value);
+        value.bytes_value =
+            rest_storage.emplace_back(bytes, value.bytes_count).data();
+      }
+      rest.push_back(value);
+    }
+  }
+
+  const DbSqliteModule::Cursor* cursor = nullptr;
+  uint64_t filter_id = 0;
+  uint32_t slot = 0;
+  uint32_t column = 0;
+  uint32_t start = 0;
+  uint32_t batch_size = 1;
+  uint32_t hits = 0;
+
+  std::vector<SqlValue> rest;
+  std::vector<std::string> rest_storage;
+  std::vector<SqlValue> first_values;
+  std::vector<SqlValue> results;
+};
+
+void ReportBatchResult(sqlite3_context* ctx,
+                       BatchSqlFunction* function,
+                       const SqlValue& value) {
+  auto destructor = function->ReturnsStaticStrings()
+                        ? sqlite::utils::kSqliteStatic
+                        : sqlite::utils::kSqliteTransient;
+  sqlite::utils::ReportSqlValue(ctx, value, destructor,
+                                sqlite::utils::kSqliteTransient);
+}
+
+// Implementation of the functions overloaded by FindFunction.
+void CallBatchFunction(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+  auto* overload = static_cast<DbSqliteModule::BatchFunctionOverload*>(
+      sqlite3_user_data(ctx));
+  BatchSqlFunction* function = overload->function;
+  SqlValue first = sqlite::utils::SqliteValueToSqlValue(argv[0]);
+
+  // The state is attached to the last argument: SQLite only keeps it across
+  // rows if that argument is a constant (e.g. the key of EXTRACT_ARG), which
+  // is what makes it specific to this call site. If the first argument was
+  // not read from a tagged column, the rows are unknown: fall back to
+  // computing the function for this row only.
+  std::optional<BatchColumn> col = GetBatchColumn(argv[0]);
+  std::unique_ptr<BatchState> new_state;
+  BatchState* state = nullptr;
+  if (argc > 1 && col) {
+    state = static_cast<BatchState*>(sqlite3_get_auxdata(ctx, argc - 1));
+    if (state) {
+      if (const SqlValue* res =
+              state->Find(*overload->vtab, *col, first, argc, argv);
+          res) {
+        ReportBatchResult(ctx, function, *res);
+        return;
+      }
+    } else {
+      new_state = std::make_unique<BatchState>();
+      state = new_state.get();
+    }
+    if (const SqlValue* res =
+            state->Refill(*overload->vtab, function, *col, first, argc, argv);
+        res) {
+      ReportBatchResult(ctx, function, *res);
+      if (new_state) {
+        // Must be last: SQLite can free the state immediately.
+        sqlite3_set_auxdata(ctx, argc - 1, new_state.release(), [](void* p) {
+          delete static_cast<BatchState*>(p);
+        });
+      }
+      return;
+    }
+  }
+
+  // Compute the function for this row only.
+  std::vector<SqlValue> rest;
+  for (int i = 1; i < argc; ++i) {
+    rest.push_back(sqlite::utils::SqliteValueToSqlValue(argv[i]));
+  }
+  std::vector<SqlValue> results;
+  base::Status status = function->Run({first}, rest, results);
+  if (!status.ok()) {
+    sqlite::result::Error(ctx, status.c_message());
+    return;
+  }
+  PERFETTO_CHECK(results.size() == 1);
+  ReportBatchResult(ctx, function, results[0]);
+}
+
 }  // namespace
 
 int DbSqliteModule::Create(sqlite3* db,
@@ -360,6 +592,8 @@ int DbSqliteModule::Create(sqlite3* db,
   std::unique_ptr<Vtab> res = std::make_unique<Vtab>();
   res->state = context->manager.OnCreate(argv, std::move(state));
   res->table_name = argv[2];
+  res->thread_pool = context->thread_pool;
+  res->batch_functions = context->batch_functions;
   *vtab = res.release();
   return SQLITE_OK;
 }
@@ -389,6 +623,8 @@ int DbSqliteModule::Connect(sqlite3* db,
   std::unique_ptr<Vtab> res = std::make_unique<Vtab>();
   res->state = context->manager.OnConnect(argv);
   res->table_name = argv[2];
+  res->thread_pool = context->thread_pool;
+  res->batch_functions = context->batch_functions;
 
   auto* state =
       sqlite::ModuleStateManager<DbSqliteModule>::GetState(res->state);
@@ -638,6 +874,12 @@ int DbSqliteModule::Open(sqlite3_vtab* tab, sqlite3_vtab_cursor** cursor) {
   auto* t = GetVtab(tab);
   auto* s = sqlite::ModuleStateManager<DbSqliteModule>::GetState(t->state);
   std::unique_ptr<Cursor> c = std::make_unique<Cursor>();
+  auto slot = std::find(t->batch_cursors.begin(), t->batch_cursors.end(),
+                        nullptr);
+  if (slot != t->batch_cursors.end()) {
+    *slot = c.get();
+    c->batch_slot = static_cast<int>(slot - t->batch_cursors.begin());
+  }
   switch (s->computation) {
     case TableComputation::kStatic:
       c->upstream_table = s->static_table;
@@ -656,6 +898,13 @@ int DbSqliteModule::Open(sqlite3_vtab* tab, sqlite3_vtab_cursor** cursor) {
 
 int DbSqliteModule::Close(sqlite3_vtab_cursor* cursor) {
   std::unique_ptr<Cursor> c(GetCursor(cursor));
+  auto* t = GetVtab(cursor->pVtab);
+  if (c->batch_slot >= 0) {
+    t->batch_cursors[static_cast<size_t>(c->batch_slot)] = nullptr;
+  }
+  for (uint64_t id : c->hash_index_ids) {
+    c->upstream_table->ReleaseHashIndex(id);
+  }
   return SQLITE_OK;
 }
 
@@ -671,6 +920,7 @@ int DbSqliteModule::Filter(sqlite3_vtab_cursor* cursor,
   // Clear out the iterator before filtering to ensure the destructor is run
   // before the table's destructor.
   c->iterator = std::nullopt;
+  c->filter_id = ++t->filter_count;
 
   size_t offset = c->table_function_arguments.size();
   bool is_same_idx = idx_num == c->last_idx_num;
@@ -694,9 +944,9 @@ int DbSqliteModule::Filter(sqlite3_vtab_cursor* cursor,
   switch (s->computation) {
     case TableComputation::kStatic:
     case TableComputation::kRuntime:
-      // Tries to create a sorted cached table which can be used to speed up
-      // filters below.
-      TryCacheCreateSortedTable(c, s->schema, is_same_idx);
+      // Tries to create a hash index which can be used to speed up filters
+      // below.
+      TryCreateHashIndex(c, s->schema, is_same_idx);
       break;
     case TableComputation::kTableFunction: {
       PERFETTO_TP_TRACE(
@@ -725,9 +975,8 @@ int DbSqliteModule::Filter(sqlite3_vtab_cursor* cursor,
                       FilterAndSortMetatrace(t->table_name, s->schema, c, r);
                     });
 
-  const auto* source_table =
-      c->sorted_cache_table ? &*c->sorted_cache_table : c->upstream_table;
-  RowMap filter_map = source_table->QueryToRowMap(c->query);
+  const auto* source_table = c->upstream_table;
+  RowMap filter_map = source_table->QueryToRowMap(c->query, t->thread_pool);
   if (filter_map.IsRange() && filter_map.size() <= 1) {
     // Currently, our criteria where we have a special fast path is if it's
     // a single ranged row. We have this fast path for joins on id columns
@@ -770,8 +1019,7 @@ int DbSqliteModule::Column(sqlite3_vtab_cursor* cursor,
                            int N) {
   Cursor* c = GetCursor(cursor);
   auto idx = static_cast<uint32_t>(N);
-  const auto* source_table =
-      c->sorted_cache_table ? &*c->sorted_cache_table : c->upstream_table;
+  const auto* source_table = c->upstream_table;
   SqlValue value = c->mode == Cursor::Mode::kSingleRow
                        ? source_table->columns()[idx].Get(*c->single_row)
                        : c->iterator->Get(idx);
@@ -784,6 +1032,16 @@ int DbSqliteModule::Column(sqlite3_vtab_cursor* cursor,
   // about the bytes pointer.
   sqlite::utils::ReportSqlValue(ctx, value, sqlite::utils::kSqliteStatic,
                                 sqlite::utils::kSqliteStatic);
+
+  // Only tag the values if batch functions can be called on the table.
+  auto* t = GetVtab(cursor->pVtab);
+  if (c->batch_slot >= 0 && c->mode == Cursor::Mode::kTable &&
+      idx < kMaxBatchTagColumns && t->batch_overloads.size() > 0) {
+    sqlite3_result_subtype(
+        ctx, kBatchTagBit |
+                 (static_cast<uint32_t>(c->batch_slot) << kBatchTagColumnBits) |
+                 idx);
+  }
   return SQLITE_OK;
 }
 
@@ -791,6 +1049,30 @@ int DbSqliteModule::Rowid(sqlite3_vtab_cursor*, sqlite_int64*) {
   return SQLITE_ERROR;
 }
 
+int DbSqliteModule::FindFunction(sqlite3_vtab* vtab,
+                                 int,
+                                 const char* name,
+                                 FindFunctionFn** fn,
+                                 void** args) {
+  auto* t = GetVtab(vtab);
+  if (!t->batch_functions) {
+    return 0;
+  }
+  std::string key = base::ToLower(name);
+  auto* function = t->batch_functions->Find(key);
+  if (!function) {
+    return 0;
+  }
+  auto [overload, inserted] = t->batch_overloads.Insert(key, nullptr);
+  if (inserted) {
+    *overload = std::make_unique<BatchFunctionOverload>(
+        BatchFunctionOverload{t, function->get()});
+  }
+  *fn = &CallBatchFunction;
+  *args = overload->get();
+  return 1;
+}
+
 DbSqliteModule::QueryCost DbSqliteModule::EstimateCost(
     const Table::Schema& schema,
     uint32_t row_count,
@@ -842,12 +1124,12 @@ DbSqliteModule::QueryCost DbSqliteModule::EstimateCost(
       current_row_count = 1;
     } else if (sqlite::utils::IsOpEq(c.op)) {
       // If there is only a single equality constraint, we have special logic
-      // to sort by that column and then binary search if we see the
-      // constraint set often. Model this by dividing by the log of the number
-      // of rows as a good approximation. Otherwise, we'll need to do a full
-      // table scan. Alternatively, if the column is sorted, we can use the
-      // same binary search logic so we have the same low cost (even
-      // better because we don't // have to sort at all).
+      // to create a hash index on that column if we see the constraint set
+      // often. Model this by the log of the number of rows as a (pessimistic)
+      // approximation. Otherwise, we'll need to do a full table scan.
+      // Alternatively, if the column is sorted, we can binary search it so we
+      // have the same low cost (even better because we don't have to build
+      // an index at all).
       filter_cost += cs_idxes.size() == 1 || col_schema.is_sorted
                          ? log2(current_row_count)
                          : current_row_count;
@@ -18,16 +18,19 @@
 #define SRC_TRACE_PROCESSOR_SQLITE_DB_SQLITE_TABLE_H_
 
 #include <sqlite3.h>
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <optional>
 #include <string>
 #include <vector>
 
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/runtime_table.h"
 #include "src/trace_processor/db/table.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/functions/batch_sql_function.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/static_table_function.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_module.h"
 #include "src/trace_processor/sqlite/module_lifecycle_manager.h"
@@ -47,6 +50,24 @@ enum class TableComputation {
 
 // Implements the SQLite table interface for db tables.
 struct DbSqliteModule : public sqlite::Module<DbSqliteModule> {
+  struct Cursor;
+  struct Vtab;
+
+  // Batch functions by (lowercase) name.
+  using BatchFunctions =
+      base::FlatHashMap<std::string, std::unique_ptr<BatchSqlFunction>>;
+
+  // Overload of a batch function for a given table: passed to SQLite as the
+  // user data of the function.
+  struct BatchFunctionOverload {
+    Vtab* vtab;
+    BatchSqlFunction* function;
+  };
+
+  // The maximum number of open cursors on a table whose rows batch functions
+  // can be computed for.
+  static constexpr uint32_t kMaxBatchCursors = 2;
+
   struct State {
     State(const Table*, Table::Schema);
     explicit State(std::unique_ptr<RuntimeTable>);
@@ -71,11 +92,33 @@ struct DbSqliteModule : public sqlite::Module<DbSqliteModule> {
   struct Context {
     std::unique_ptr<State> temporary_create_state;
     sqlite::ModuleStateManager<DbSqliteModule> manager;
+
+    // Thread pool used to parallelize filtering and sorting of large tables.
+    // Null if queries should only run on the calling thread.
+    base::ThreadPool* thread_pool = nullptr;
+
+    // Functions which are computed a chunk of rows at a time when called on
+    // a column of the table. Can be null.
+    const BatchFunctions* batch_functions = nullptr;
   };
   struct Vtab : public sqlite::Module<DbSqliteModule>::Vtab {
     sqlite::ModuleStateManager<DbSqliteModule>::PerVtabState* state;
     int best_index_num = 0;
     std::string table_name;
+    base::ThreadPool* thread_pool = nullptr;
+
+    const BatchFunctions* batch_functions = nullptr;
+    base::FlatHashMap<std::string, std::unique_ptr<BatchFunctionOverload>>
+        batch_overloads;
+
+    // The open cursors whose column values are tagged with their slot in
+    // this array (see Column()): this is how batch functions know which
+    // cursor and column they are called on. Cursors opened while all the
+    // slots are used are not tagged.
+    std::array<Cursor*, kMaxBatchCursors> batch_cursors{};
+
+    // The number of calls to Filter on the cursors of this table.
+    uint64_t filter_count = 0;
   };
   struct Cursor : public sqlite::Module<DbSqliteModule>::Cursor {
     enum class Mode {
@@ -97,21 +140,26 @@ struct DbSqliteModule : public sqlite::Module<DbSqliteModule> {
 
     bool eof = true;
 
-    // Stores a sorted version of |db_table| sorted on a repeated equals
-    // constraint. This allows speeding up repeated subqueries in joins
-    // significantly.
-    std::optional<Table> sorted_cache_table;
-
     // Stores the count of repeated equality queries to decide whether it is
-    // wortwhile to sort |db_table| to create |sorted_cache_table|.
+    // worthwhile to create a hash index on |upstream_table|.
     uint32_t repeated_cache_count = 0;
 
+    // The hash indexes created on |upstream_table| for this cursor: released
+    // when the cursor is closed, i.e. when the query ends.
+    std::vector<uint64_t> hash_index_ids;
+
     Mode mode = Mode::kSingleRow;
 
     int last_idx_num = -1;
     Query query;
 
     std::vector<SqlValue> table_function_arguments;
+
+    // Identifies the last call to Filter on this cursor.
+    uint64_t filter_id = 0;
+
+    // Index of this cursor in |Vtab::batch_cursors| or -1 if it has none.
+    int batch_slot = -1;
   };
   struct QueryCost {
     double cost;
@@ -119,7 +167,7 @@ struct DbSqliteModule : public sqlite::Module<DbSqliteModule> {
   };
 
   static constexpr bool kSupportsWrites = false;
-  static constexpr bool kDoesOverloadFunctions = false;
+  static constexpr bool kDoesOverloadFunctions = true;
 
   static int Create(sqlite3*,
                     void*,
@@ -151,6 +199,11 @@ struct DbSqliteModule : public sqlite::Module<DbSqliteModule> {
   static int Eof(sqlite3_vtab_cursor*);
   static int Column(sqlite3_vtab_cursor*, sqlite3_context*, int);
   static int Rowid(sqlite3_vtab_cursor*, sqlite_int64*);
+  static int FindFunction(sqlite3_vtab*,
+                          int,
+                          const char*,
+                          FindFunctionFn**,
+                          void**);
 
   // static for testing.
   static QueryCost EstimateCost(const Table::Schema&,
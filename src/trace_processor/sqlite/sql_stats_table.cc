@@ -37,6 +37,9 @@ int SqlStatsModule::Connect(sqlite3* db,
       started BIGINT,
       first_next BIGINT,
       ended BIGINT,
+      memoization_hits BIGINT,
+      memoization_misses BIGINT,
+      memoization_evictions BIGINT,
       PRIMARY KEY(started)
     ) WITHOUT ROWID
   )";
@@ -109,6 +112,15 @@ int SqlStatsModule::Column(sqlite3_vtab_cursor* cursor,
     case Column::kTimeEnded:
       sqlite::result::Long(ctx, stats.times_ended()[c->row]);
       break;
+    case Column::kMemoizationHits:
+      sqlite::result::Long(ctx, stats.memoization_hits()[c->row]);
+      break;
+    case Column::kMemoizationMisses:
+      sqlite::result::Long(ctx, stats.memoization_misses()[c->row]);
+      break;
+    case Column::kMemoizationEvictions:
+      sqlite::result::Long(ctx, stats.memoization_evictions()[c->row]);
+      break;
     default:
       PERFETTO_FATAL("Unknown column %d", N);
       break;
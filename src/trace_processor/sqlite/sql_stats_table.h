@@ -43,6 +43,9 @@ struct SqlStatsModule : sqlite::Module<SqlStatsModule> {
     kTimeStarted = 1,
     kTimeFirstNext = 2,
     kTimeEnded = 3,
+    kMemoizationHits = 4,
+    kMemoizationMisses = 5,
+    kMemoizationEvictions = 6,
   };
 
   static constexpr auto kType = kEponymousOnly;
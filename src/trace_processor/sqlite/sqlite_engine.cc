@@ -20,11 +20,13 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/public/compiler.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
 #include "src/trace_processor/sqlite/sql_source.h"
@@ -44,6 +46,12 @@ extern "C" int sqlite3_percentile_init(sqlite3* db,
 namespace perfetto::trace_processor {
 namespace {
 
+// The functions built into SQLite whose result can change between calls with
+// the same arguments.
+constexpr const char* kNonDeterministicBuiltinFunctions[] = {
+    "changes", "last_insert_rowid", "random", "randomblob", "total_changes",
+};
+
 void EnsureSqliteInitialized() {
   // sqlite3_initialize isn't actually thread-safe in standalone builds because
   // we build with SQLITE_THREADSAFE=0. Ensure it's only called from a single
@@ -144,6 +152,9 @@ base::Status SqliteEngine::RegisterFunction(const char* name,
                                             FnCtxDestructor* destructor,
                                             bool deterministic) {
   int flags = SQLITE_UTF8 | (deterministic ? SQLITE_DETERMINISTIC : 0);
+  if (!deterministic) {
+    MarkFunctionNonDeterministic(name);
+  }
   int ret =
       sqlite3_create_function_v2(db_.get(), name, static_cast<int>(argc), flags,
                                  ctx, fn, nullptr, nullptr, destructor);
@@ -163,6 +174,9 @@ base::Status SqliteEngine::RegisterAggregateFunction(
     FnCtxDestructor* destructor,
     bool deterministic) {
   int flags = SQLITE_UTF8 | (deterministic ? SQLITE_DETERMINISTIC : 0);
+  if (!deterministic) {
+    MarkFunctionNonDeterministic(name);
+  }
   int ret =
       sqlite3_create_function_v2(db_.get(), name, static_cast<int>(argc), flags,
                                  ctx, nullptr, step, final, destructor);
@@ -182,6 +196,9 @@ base::Status SqliteEngine::RegisterWindowFunction(const char* name,
                                                   FnCtxDestructor* destructor,
                                                   bool deterministic) {
   int flags = SQLITE_UTF8 | (deterministic ? SQLITE_DETERMINISTIC : 0);
+  if (!deterministic) {
+    MarkFunctionNonDeterministic(name);
+  }
   int ret = sqlite3_create_window_function(
       db_.get(), name, static_cast<int>(argc), flags, ctx, step, final, value,
       inverse, destructor);
@@ -216,6 +233,20 @@ void* SqliteEngine::GetFunctionContext(const std::string& name, int argc) {
   return res ? *res : nullptr;
 }
 
+bool SqliteEngine::IsFunctionNonDeterministic(std::string_view name) const {
+  std::string lower = base::ToLower(std::string(name));
+  for (const char* builtin : kNonDeterministicBuiltinFunctions) {
+    if (lower == builtin) {
+      return true;
+    }
+  }
+  return non_deterministic_fns_.Find(lower) != nullptr;
+}
+
+void SqliteEngine::MarkFunctionNonDeterministic(std::string_view name) {
+  non_deterministic_fns_.Insert(base::ToLower(std::string(name)), true);
+}
+
 std::optional<uint32_t> SqliteEngine::GetErrorOffset() const {
   return GetErrorOffsetDb(db_.get());
 }
@@ -23,6 +23,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
 
@@ -140,6 +141,15 @@ class SqliteEngine {
   // Gets the context for a registered SQL function.
   void* GetFunctionContext(const std::string& name, int argc);
 
+  // Returns whether calls of the function |name| with the same arguments can
+  // return different values: true for functions registered with
+  // |deterministic| false or with MarkFunctionNonDeterministic() and for
+  // SQLite's built-in non-deterministic functions (e.g. random()).
+  bool IsFunctionNonDeterministic(std::string_view name) const;
+
+  // Marks the function |name| as non-deterministic (see above).
+  void MarkFunctionNonDeterministic(std::string_view name);
+
   sqlite3* db() const { return db_.get(); }
 
  private:
@@ -155,6 +165,8 @@ class SqliteEngine {
   std::optional<uint32_t> GetErrorOffset() const;
 
   base::FlatHashMap<std::pair<std::string, int>, void*, FnHasher> fn_ctx_;
+  // Lowercase names of the functions marked as non-deterministic.
+  base::FlatHashMap<std::string, bool> non_deterministic_fns_;
   ScopedDb db_;
 };
 
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/arg_key_columns.h"
+
+#include <cstdint>
+#include <memory>
+
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+const ArgKeyColumns::Column* ArgKeyColumns::GetColumn(StringPool::Id key,
+                                                      uint32_t lookups) {
+  if (promotion_threshold_ == 0)
+    return nullptr;
+
+  std::unique_ptr<Column>* column = columns_.Find(key);
+  if (!column) {
+    uint32_t& count = lookup_counts_[key];
+    count += lookups;
+    if (count < promotion_threshold_)
+      return nullptr;
+    lookup_counts_.Erase(key);
+    column = columns_.Insert(key, std::make_unique<Column>()).first;
+  }
+  Column* col = column->get();
+  UpdateColumn(key, col);
+  return col->has_duplicates_ ? nullptr : col;
+}
+
+void ArgKeyColumns::UpdateColumn(StringPool::Id key, Column* column) {
+  const auto& args = storage_->arg_table();
+  const uint32_t row_count = args.row_count();
+  if (column->has_duplicates_ || column->next_row_ == row_count) {
+    column->next_row_ = row_count;
+    return;
+  }
+
+  const auto& arg_set_ids = args.arg_set_id();
+  const auto& keys = args.key();
+  for (uint32_t row = column->next_row_; row < row_count; ++row) {
+    if (keys[row] != key)
+      continue;
+
+    // Arg sets are appended to the args table in increasing order of id so
+    // an id below the size of the BitVector means that the arg set has the
+    // key more than once.
+    uint32_t arg_set_id = arg_set_ids[row];
+    if (arg_set_id < column->has_key_.size()) {
+      column->has_duplicates_ = true;
+      column->has_key_ = BitVector();
+      column->values_.clear();
+      column->values_.shrink_to_fit();
+      break;
+    }
+    column->has_key_.Resize(arg_set_id);
+    column->has_key_.AppendTrue();
+    column->values_.push_back(storage_->GetArgValue(row));
+  }
+  column->next_row_ = row_count;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
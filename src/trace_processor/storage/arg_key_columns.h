@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_STORAGE_ARG_KEY_COLUMNS_H_
+#define SRC_TRACE_PROCESSOR_STORAGE_ARG_KEY_COLUMNS_H_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/types/variadic.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceStorage;
+
+// Dedicated columns for the keys of the args table which are looked up the
+// most (e.g. by EXTRACT_ARG).
+//
+// Finding the value of a key in an arg set in the args table needs a binary
+// search on the arg_set_id column followed by a scan of the args of the set.
+// Once a key has been looked up |promotion_threshold| times, it is promoted
+// to a column indexed by arg set id: a BitVector of the arg sets which have
+// the key and the values of the key in these arg sets, which turns each lookup
+// into a rank query on the BitVector and an array access.
+//
+// Rows are only ever appended to the args table, so promoted columns are
+// brought up to date with the args added since they were built the next time
+// they are looked up.
+class ArgKeyColumns {
+ public:
+  class Column {
+   public:
+    // Returns the value of the key in the arg set |arg_set_id| or
+    // std::nullopt if the arg set does not have the key.
+    std::optional<Variadic> Get(uint32_t arg_set_id) const {
+      if (arg_set_id >= has_key_.size() || !has_key_.IsSet(arg_set_id))
+        return std::nullopt;
+      return values_[has_key_.CountSetBits(arg_set_id)];
+    }
+
+   private:
+    friend class ArgKeyColumns;
+
+    BitVector has_key_;
+    std::vector<Variadic> values_;
+
+    // The first row of the args table not yet added to the column.
+    uint32_t next_row_ = 0;
+
+    // Set if an arg set has the key more than once: lookups of the key have
+    // to report an error which is left to the args table.
+    bool has_duplicates_ = false;
+  };
+
+  explicit ArgKeyColumns(const TraceStorage* storage) : storage_(storage) {}
+
+  // Sets the number of lookups of a key after which the key is promoted to a
+  // column. 0 (the default) disables promotion.
+  void set_promotion_threshold(uint32_t threshold) {
+    promotion_threshold_ = threshold;
+  }
+
+  // Records |lookups| lookups of |key| and returns the column for |key| if the
+  // key is promoted. Returns nullptr otherwise, in which case the value should
+  // be looked up in the args table.
+  //
+  // The returned pointer is valid until the next call to this function.
+  const Column* GetColumn(StringPool::Id key, uint32_t lookups = 1);
+
+  // Returns the number of promoted keys.
+  uint32_t column_count() const {
+    return static_cast<uint32_t>(columns_.size());
+  }
+
+ private:
+  // Adds the rows of the args table added since the last update of |column|.
+  void UpdateColumn(StringPool::Id key, Column* column);
+
+  const TraceStorage* storage_;
+  uint32_t promotion_threshold_ = 0;
+  base::FlatHashMap<StringPool::Id, uint32_t> lookup_counts_;
+  base::FlatHashMap<StringPool::Id, std::unique_ptr<Column>> columns_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_STORAGE_ARG_KEY_COLUMNS_H_
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/arg_key_columns.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/variadic.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class ArgKeyColumnsTest : public ::testing::Test {
+ protected:
+  ArgKeyColumnsTest() {
+    Config config;
+    config.arg_column_promotion_threshold = 2;
+    storage_ = std::make_unique<TraceStorage>(config);
+  }
+
+  void AddIntArg(uint32_t arg_set_id, const char* key, int64_t value) {
+    tables::ArgTable::Row row;
+    row.arg_set_id = arg_set_id;
+    row.flat_key = storage_->InternString(key);
+    row.key = storage_->InternString(key);
+    row.int_value = value;
+    row.value_type = storage_->GetIdForVariadicType(Variadic::kInt);
+    storage_->mutable_arg_table()->Insert(row);
+  }
+
+  std::unique_ptr<TraceStorage> storage_;
+};
+
+TEST_F(ArgKeyColumnsTest, PromotedAfterThreshold) {
+  AddIntArg(0, "foo", 1);
+  AddIntArg(0, "bar", 2);
+  AddIntArg(1, "bar", 3);
+  AddIntArg(2, "foo", 4);
+
+  ArgKeyColumns* columns = storage_->mutable_arg_key_columns();
+  StringId foo = storage_->InternString("foo");
+  ASSERT_EQ(columns->GetColumn(foo), nullptr);
+
+  const ArgKeyColumns::Column* column = columns->GetColumn(foo);
+  ASSERT_NE(column, nullptr);
+  ASSERT_EQ(columns->column_count(), 1u);
+  ASSERT_EQ(column->Get(0)->int_value, 1);
+  ASSERT_FALSE(column->Get(1).has_value());
+  ASSERT_EQ(column->Get(2)->int_value, 4);
+  ASSERT_FALSE(column->Get(3).has_value());
+  ASSERT_FALSE(column->Get(100).has_value());
+}
+
+TEST_F(ArgKeyColumnsTest, BatchLookupsCountTowardsThreshold) {
+  AddIntArg(0, "foo", 1);
+
+  StringId foo = storage_->InternString("foo");
+  const ArgKeyColumns::Column* column =
+      storage_->mutable_arg_key_columns()->GetColumn(foo, 10);
+  ASSERT_NE(column, nullptr);
+  ASSERT_EQ(column->Get(0)->int_value, 1);
+}
+
+TEST_F(ArgKeyColumnsTest, UpdatedWithNewArgs) {
+  AddIntArg(0, "foo", 1);
+
+  ArgKeyColumns* columns = storage_->mutable_arg_key_columns();
+  StringId foo = storage_->InternString("foo");
+  ASSERT_NE(columns->GetColumn(foo, 2), nullptr);
+
+  AddIntArg(1, "bar", 2);
+  AddIntArg(2, "foo", 3);
+
+  const ArgKeyColumns::Column* column = columns->GetColumn(foo);
+  ASSERT_NE(column, nullptr);
+  ASSERT_EQ(column->Get(0)->int_value, 1);
+  ASSERT_FALSE(column->Get(1).has_value());
+  ASSERT_EQ(column->Get(2)->int_value, 3);
+}
+
+TEST_F(ArgKeyColumnsTest, DuplicateKeyNotPromoted) {
+  AddIntArg(0, "foo", 1);
+  AddIntArg(0, "foo", 2);
+
+  StringId foo = storage_->InternString("foo");
+  ASSERT_EQ(storage_->mutable_arg_key_columns()->GetColumn(foo, 10), nullptr);
+}
+
+TEST(ArgKeyColumnsDisabledTest, NoPromotionByDefault) {
+  TraceStorage storage;
+  tables::ArgTable::Row row;
+  row.arg_set_id = 0;
+  row.flat_key = storage.InternString("foo");
+  row.key = storage.InternString("foo");
+  row.int_value = 1;
+  row.value_type = storage.GetIdForVariadicType(Variadic::kInt);
+  storage.mutable_arg_table()->Insert(row);
+
+  StringId foo = storage.InternString("foo");
+  ASSERT_EQ(storage.mutable_arg_key_columns()->GetColumn(foo, 1000), nullptr);
+  ASSERT_EQ(storage.mutable_arg_key_columns()->column_count(), 0u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -284,6 +284,10 @@ namespace stats {
       "the tracing service. This happens if the ftrace buffers were not "      \
       "cleared properly. These packets are silently dropped by trace "         \
       "processor."),                                                           \
+  F(sorter_spilled_bytes,                 kSingle,  kInfo,     kTrace,         \
+      "Number of bytes of trace packets written to a temporary file while "    \
+      "waiting to be sorted because the packets buffered in memory exceeded "  \
+      "Config::ingestion_memory_budget_bytes."),                               \
   F(sorter_push_event_out_of_order,       kSingle, kError,     kTrace,         \
       "Trace events are out of order event after sorting. This can happen "    \
       "due to many factors including clock sync drift, producers emitting "    \
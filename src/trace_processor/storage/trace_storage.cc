@@ -70,7 +70,9 @@ const std::vector<NullTermStringView>& GetRefTypeStringMap() {
   return map.ref();
 }
 
-TraceStorage::TraceStorage(const Config&) {
+TraceStorage::TraceStorage(const Config& config) {
+  arg_key_columns_.set_promotion_threshold(
+      config.arg_column_promotion_threshold);
   for (uint32_t i = 0; i < variadic_type_ids_.size(); ++i) {
     variadic_type_ids_[i] = InternString(Variadic::kTypeNames[i]);
   }
@@ -85,12 +87,18 @@ uint32_t TraceStorage::SqlStats::RecordQueryBegin(const std::string& query,
     times_started_.pop_front();
     times_first_next_.pop_front();
     times_ended_.pop_front();
+    memoization_hits_.pop_front();
+    memoization_misses_.pop_front();
+    memoization_evictions_.pop_front();
     popped_queries_++;
   }
   queries_.push_back(query);
   times_started_.push_back(time_started);
   times_first_next_.push_back(0);
   times_ended_.push_back(0);
+  memoization_hits_.push_back(0);
+  memoization_misses_.push_back(0);
+  memoization_evictions_.push_back(0);
   return static_cast<uint32_t>(popped_queries_ + queries_.size() - 1);
 }
 
@@ -115,6 +123,20 @@ void TraceStorage::SqlStats::RecordQueryEnd(uint32_t row, int64_t time_ended) {
   times_ended_[queue_row] = time_ended;
 }
 
+void TraceStorage::SqlStats::RecordQueryMemoization(uint32_t row,
+                                                    int64_t hits,
+                                                    int64_t misses,
+                                                    int64_t evictions) {
+  // As above, the query might have been popped off the queue already.
+  if (popped_queries_ > row)
+    return;
+  uint32_t queue_row = row - popped_queries_;
+  PERFETTO_DCHECK(queue_row < queries_.size());
+  memoization_hits_[queue_row] = hits;
+  memoization_misses_[queue_row] = misses;
+  memoization_evictions_[queue_row] = evictions;
+}
+
 std::pair<int64_t, int64_t> TraceStorage::GetTraceTimestampBoundsNs() const {
   int64_t start_ns = std::numeric_limits<int64_t>::max();
   int64_t end_ns = std::numeric_limits<int64_t>::min();
@@ -39,6 +39,7 @@
 #include "src/trace_processor/containers/null_term_string_view.h"
 #include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/storage/arg_key_columns.h"
 #include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/tables/android_tables_py.h"
 #include "src/trace_processor/tables/counter_tables_py.h"
@@ -198,6 +199,13 @@ class TraceStorage {
     uint32_t RecordQueryBegin(const std::string& query, int64_t time_started);
     void RecordQueryFirstNext(uint32_t row, int64_t time_first_next);
     void RecordQueryEnd(uint32_t row, int64_t time_end);
+    // Records the number of calls to functions created with CREATE PERFETTO
+    // FUNCTION which were memoized and not while running the query, as well as
+    // the number of results evicted from the memoization caches.
+    void RecordQueryMemoization(uint32_t row,
+                                int64_t hits,
+                                int64_t misses,
+                                int64_t evictions);
     size_t size() const { return queries_.size(); }
     const std::deque<std::string>& queries() const { return queries_; }
     const std::deque<int64_t>& times_started() const { return times_started_; }
@@ -205,6 +213,15 @@ class TraceStorage {
       return times_first_next_;
     }
     const std::deque<int64_t>& times_ended() const { return times_ended_; }
+    const std::deque<int64_t>& memoization_hits() const {
+      return memoization_hits_;
+    }
+    const std::deque<int64_t>& memoization_misses() const {
+      return memoization_misses_;
+    }
+    const std::deque<int64_t>& memoization_evictions() const {
+      return memoization_evictions_;
+    }
 
    private:
     uint32_t popped_queries_ = 0;
@@ -213,6 +230,9 @@ class TraceStorage {
     std::deque<int64_t> times_started_;
     std::deque<int64_t> times_first_next_;
     std::deque<int64_t> times_ended_;
+    std::deque<int64_t> memoization_hits_;
+    std::deque<int64_t> memoization_misses_;
+    std::deque<int64_t> memoization_evictions_;
   };
 
   struct Stats {
@@ -531,6 +551,8 @@ class TraceStorage {
   const tables::ArgTable& arg_table() const { return arg_table_; }
   tables::ArgTable* mutable_arg_table() { return &arg_table_; }
 
+  ArgKeyColumns* mutable_arg_key_columns() { return &arg_key_columns_; }
+
   const tables::RawTable& raw_table() const { return raw_table_; }
   tables::RawTable* mutable_raw_table() { return &raw_table_; }
 
@@ -1054,6 +1076,9 @@ class TraceStorage {
   // Args for all other tables.
   tables::ArgTable arg_table_{&string_pool_};
 
+  // Columns for the keys of |arg_table_| which are looked up the most.
+  ArgKeyColumns arg_key_columns_{this};
+
   // Information about all the threads and processes in the trace.
   tables::ThreadTable thread_table_{&string_pool_};
   tables::ProcessTable process_table_{&string_pool_};
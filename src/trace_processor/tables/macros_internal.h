@@ -82,6 +82,9 @@ class MacroTable : public Table {
   MacroTable(MacroTable&&) = delete;
   MacroTable& operator=(MacroTable&&) noexcept = delete;
 
+  // The table extended by this table or nullptr for root tables.
+  const MacroTable* parent() const { return parent_; }
+
  protected:
   // Constructors for tables created by the regular constructor.
   PERFETTO_NO_INLINE explicit MacroTable(StringPool* pool,
@@ -229,8 +229,10 @@ RAW_TABLE = Table(
         C('name', CppString()),
         C('utid', CppTableId(THREAD_TABLE)),
         C('arg_set_id', CppUint32()),
-        C('common_flags', CppUint32()),
-        C('ucpu', CppTableId(CPU_TABLE))
+        C('common_flags', CppUint32(), flags=ColumnFlag.RUN_LENGTH_ENCODED),
+        C('ucpu',
+          CppTableId(CPU_TABLE),
+          flags=ColumnFlag.DICTIONARY_ENCODED),
     ],
     tabledoc=TableDoc(
         doc='''
@@ -269,8 +269,8 @@ PERF_SAMPLE_TABLE = Table(
     columns=[
         C('ts', CppInt64(), flags=ColumnFlag.SORTED),
         C('utid', CppUint32()),
-        C('cpu', CppUint32()),
-        C('cpu_mode', CppString()),
+        C('cpu', CppUint32(), flags=ColumnFlag.DICTIONARY_ENCODED),
+        C('cpu_mode', CppString(), flags=ColumnFlag.DICTIONARY_ENCODED),
         C('callsite_id', CppOptional(CppTableId(STACK_PROFILE_CALLSITE_TABLE))),
         C('unwind_error', CppOptional(CppString())),
         C('perf_session_id', CppTableId(PERF_SESSION_TABLE)),
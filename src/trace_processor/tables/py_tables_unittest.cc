@@ -15,14 +15,20 @@
  */
 
 #include <cstdint>
+#include <optional>
+#include <string>
 #include <utility>
 #include <vector>
 
+#include "perfetto/protozero/field.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/db/column.h"
 #include "src/trace_processor/db/column_storage.h"
+#include "src/trace_processor/db/compare.h"
+#include "src/trace_processor/db/table.h"
 #include "src/trace_processor/tables/py_tables_unittest_py.h"
 
+#include "protos/perfetto/trace_processor/serialization.pbzero.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto::trace_processor::tables {
@@ -31,9 +37,48 @@ TestEventTable::~TestEventTable() = default;
 TestEventChildTable::~TestEventChildTable() = default;
 TestSliceTable::~TestSliceTable() = default;
 TestArgsTable::~TestArgsTable() = default;
+TestEncodedTable::~TestEncodedTable() = default;
+TestEncodedChildTable::~TestEncodedChildTable() = default;
+TestNullableChildTable::~TestNullableChildTable() = default;
 
 namespace {
 
+// Serializes |table| and restores the result into |out|.
+base::Status SerializeAndDeserialize(const Table& table, Table* out) {
+  std::vector<std::vector<uint8_t>> packets;
+  table.Serialize("table", /*rows_per_chunk=*/3,
+                  [&packets](std::vector<uint8_t> packet) {
+                    packets.push_back(std::move(packet));
+                  });
+
+  protozero::ConstBytes table_packet{};
+  std::vector<protozero::ConstBytes> column_packets;
+  for (const auto& packet : packets) {
+    protos::pbzero::SerializedTraceProcessorPacket::Decoder decoder(
+        packet.data(), packet.size());
+    if (decoder.has_table()) {
+      table_packet = decoder.table();
+    } else {
+      column_packets.push_back(decoder.column());
+    }
+  }
+  return out->Deserialize(table_packet, column_packets);
+}
+
+void AssertSameRows(const Table& expected, const Table& actual) {
+  ASSERT_EQ(expected.row_count(), actual.row_count());
+  ASSERT_EQ(expected.columns().size(), actual.columns().size());
+  for (uint32_t c = 0; c < expected.columns().size(); ++c) {
+    for (uint32_t r = 0; r < expected.row_count(); ++r) {
+      SqlValue expected_value = expected.columns()[c].Get(r);
+      SqlValue actual_value = actual.columns()[c].Get(r);
+      ASSERT_EQ(expected_value.type, actual_value.type);
+      ASSERT_EQ(compare::SqlValue(expected_value, actual_value), 0)
+          << expected.columns()[c].name() << " " << r;
+    }
+  }
+}
+
 class PyTablesUnittest : public ::testing::Test {
  protected:
   StringPool pool_;
@@ -314,5 +359,184 @@ TEST_F(PyTablesUnittest, SetIdColumns) {
   }
 }
 
+TEST_F(PyTablesUnittest, EncodedColumns) {
+  TestEncodedTable table{&pool_};
+  ASSERT_EQ(TestEncodedTable::ColumnFlag::cpu,
+            ColumnLegacy::Flag::kRunLengthEncoded |
+                ColumnLegacy::Flag::kNonNull);
+
+  StringPool::Id running = pool_.InternString("R");
+  StringPool::Id sleeping = pool_.InternString("S");
+  for (uint32_t i = 0; i < 100; ++i) {
+    table.Insert({i / 40, i % 3 == 0 ? running : sleeping});
+  }
+
+  table.mutable_cpu()->Set(50, 7);
+  table.mutable_state()->Set(1, running);
+  ASSERT_EQ(table.cpu()[50], 7u);
+  ASSERT_EQ(table.cpu()[51], 1u);
+  ASSERT_EQ(table.state()[1], running);
+
+  Query q;
+  q.constraints = {table.cpu().eq(1), table.state().eq("R")};
+  auto res = table.QueryToRowMap(q);
+  ASSERT_EQ(res.size(), 13u);
+  for (auto it = table.ApplyAndIterateRows(std::move(res)); it; ++it) {
+    ASSERT_EQ(it.Get(TestEncodedTable::ColumnIndex::cpu).AsLong(), 1);
+    ASSERT_STREQ(it.Get(TestEncodedTable::ColumnIndex::state).AsString(), "R");
+  }
+}
+
+TEST_F(PyTablesUnittest, ExtendParentWithEncodedColumn) {
+  ColumnStorage<uint32_t> cpu;
+  for (uint32_t i = 0; i < 10; ++i) {
+    event_.Insert(TestEventTable::Row(i, 0));
+    cpu.Append(i / 4);
+  }
+
+  auto child = TestEncodedChildTable::ExtendParent(event_, std::move(cpu));
+  const auto& cpu_col = static_cast<const TestEncodedChildTable::ColumnType::cpu&>(
+      child->columns()[TestEncodedChildTable::ColumnIndex::cpu]);
+  ASSERT_EQ(cpu_col[5], 1u);
+
+  Query q;
+  q.constraints = {cpu_col.eq(2)};
+  ASSERT_EQ(child->QueryToRowMap(q).size(), 2u);
+}
+
+TEST_F(PyTablesUnittest, SerializeDeserialize) {
+  TestNullableChildTable nullable_child{&pool_, &slice_};
+  TestEncodedTable encoded{&pool_};
+  for (uint32_t i = 0; i < 20; ++i) {
+    auto name = pool_.InternString(
+        base::StringView("name" + std::to_string(i % 4)));
+    switch (i % 3) {
+      case 0:
+        event_.Insert(TestEventTable::Row(i, i / 4));
+        break;
+      case 1:
+        slice_.Insert(TestSliceTable::Row(i, 0, i * 10));
+        break;
+      case 2:
+        nullable_child.Insert(TestNullableChildTable::Row(
+            i, 0, 5, name, i % 4 ? std::make_optional(i) : std::nullopt,
+            i % 5 ? std::nullopt : std::make_optional<int64_t>(-i)));
+        break;
+    }
+    encoded.Insert(TestEncodedTable::Row(i / 8, name));
+    args_.Insert(TestArgsTable::Row(i / 3, i));
+  }
+
+  StringPool::Id foo = pool_.InternString("foo");
+  TestEventTable event{&pool_};
+  TestSliceTable slice{&pool_, &event};
+  TestNullableChildTable restored_nullable_child{&pool_, &slice};
+  TestEncodedTable restored_encoded{&pool_};
+  TestArgsTable restored_args{&pool_};
+
+  // Rows already present in the tables are replaced.
+  slice.Insert(TestSliceTable::Row(0, 0, 0));
+  restored_nullable_child.Insert(TestNullableChildTable::Row(0, 0, 0, foo));
+  restored_encoded.Insert(TestEncodedTable::Row(100, foo));
+
+  ASSERT_TRUE(SerializeAndDeserialize(event_, &event).ok());
+  ASSERT_TRUE(SerializeAndDeserialize(slice_, &slice).ok());
+  ASSERT_TRUE(SerializeAndDeserialize(nullable_child, &restored_nullable_child)
+                  .ok());
+  ASSERT_TRUE(SerializeAndDeserialize(encoded, &restored_encoded).ok());
+  ASSERT_TRUE(SerializeAndDeserialize(args_, &restored_args).ok());
+
+  AssertSameRows(event_, event);
+  AssertSameRows(slice_, slice);
+  AssertSameRows(nullable_child, restored_nullable_child);
+  AssertSameRows(encoded, restored_encoded);
+  AssertSameRows(args_, restored_args);
+
+  // Queries and inserts keep working on the restored tables.
+  Query q;
+  q.constraints = {restored_encoded.cpu().eq(1)};
+  ASSERT_EQ(restored_encoded.QueryToRowMap(q).size(), 8u);
+  q.constraints = {restored_nullable_child.depth().is_null()};
+  ASSERT_EQ(restored_nullable_child.QueryToRowMap(q).size(), 1u);
+
+  auto id = restored_nullable_child
+                .Insert(TestNullableChildTable::Row(100, 0, 0, foo, 3u))
+                .id;
+  ASSERT_EQ(id.value, event_.row_count());
+  ASSERT_EQ(slice.row_count(), slice_.row_count() + 1);
+  ASSERT_EQ(restored_nullable_child.depth()[restored_nullable_child.row_count() -
+                                            1],
+            3u);
+}
+
+TEST_F(PyTablesUnittest, DeserializeRejectsMismatchedTable) {
+  for (uint32_t i = 0; i < 10; ++i) {
+    slice_.Insert(TestSliceTable::Row(i, 0, i));
+  }
+  // The slice table has a parent table and a column the args table does not.
+  TestArgsTable args{&pool_};
+  ASSERT_FALSE(SerializeAndDeserialize(slice_, &args).ok());
+
+  // The rows of the parent table need to be restored first.
+  TestEventTable event{&pool_};
+  TestSliceTable slice{&pool_, &event};
+  ASSERT_FALSE(SerializeAndDeserialize(slice_, &slice).ok());
+}
+
+TEST_F(PyTablesUnittest, HashIndexInvalidatedBySet) {
+  for (uint32_t i = 0; i < 10; ++i) {
+    event_.Insert(TestEventTable::Row(i, i % 3));
+  }
+  ASSERT_TRUE(event_.CreateHashIndex(TestEventTable::ColumnIndex::arg_set_id));
+
+  Query q;
+  q.constraints = {event_.arg_set_id().eq(1)};
+  ASSERT_THAT(event_.QueryToRowMap(q).TakeAsIndexVector(),
+              testing::ElementsAre(1u, 4u, 7u));
+
+  // Updating the column in place makes the index stale.
+  event_.mutable_arg_set_id()->Set(0, 1);
+  ASSERT_THAT(event_.QueryToRowMap(q).TakeAsIndexVector(),
+              testing::ElementsAre(0u, 1u, 4u, 7u));
+}
+
+TEST_F(PyTablesUnittest, IndexInvalidatedBySet) {
+  for (uint32_t i = 0; i < 10; ++i) {
+    event_.Insert(TestEventTable::Row(i, i % 3));
+  }
+  ASSERT_TRUE(event_
+                  .CreateIndex("idx", {TestEventTable::ColumnIndex::arg_set_id},
+                               false)
+                  .ok());
+
+  Query q;
+  q.constraints = {event_.arg_set_id().eq(1)};
+  ASSERT_THAT(event_.QueryToRowMap(q).TakeAsIndexVector(),
+              testing::ElementsAre(1u, 4u, 7u));
+
+  // Updating the column in place makes the index stale.
+  event_.mutable_arg_set_id()->Set(0, 1);
+  ASSERT_THAT(event_.QueryToRowMap(q).TakeAsIndexVector(),
+              testing::ElementsAre(0u, 1u, 4u, 7u));
+}
+
+TEST_F(PyTablesUnittest, HashIndexInvalidatedBySetInChild) {
+  event_.Insert(TestEventTable::Row(0, 1));
+  slice_.Insert(TestSliceTable::Row(1, 2, 10));
+  slice_.Insert(TestSliceTable::Row(2, 1, 10));
+  ASSERT_TRUE(event_.CreateHashIndex(TestEventTable::ColumnIndex::arg_set_id));
+
+  Query q;
+  q.constraints = {event_.arg_set_id().eq(1)};
+  ASSERT_THAT(event_.QueryToRowMap(q).TakeAsIndexVector(),
+              testing::ElementsAre(0u, 2u));
+
+  // The child shares the storage of the parent's columns: updating a row
+  // through the child also makes the parent's index stale.
+  slice_.mutable_arg_set_id()->Set(0, 1);
+  ASSERT_THAT(event_.QueryToRowMap(q).TakeAsIndexVector(),
+              testing::ElementsAre(0u, 1u, 2u));
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor::tables
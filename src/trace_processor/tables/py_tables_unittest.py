@@ -16,6 +16,8 @@
 from python.generators.trace_processor_table.public import Column as C
 from python.generators.trace_processor_table.public import ColumnFlag
 from python.generators.trace_processor_table.public import CppInt64
+from python.generators.trace_processor_table.public import CppOptional
+from python.generators.trace_processor_table.public import CppString
 from python.generators.trace_processor_table.public import Table
 from python.generators.trace_processor_table.public import CppUint32
 
@@ -55,10 +57,42 @@ ARGS_TABLE = Table(
         C("int_value", CppInt64()),
     ])
 
+ENCODED_TABLE = Table(
+    python_module=__file__,
+    class_name="TestEncodedTable",
+    sql_name="encoded",
+    columns=[
+        C("cpu", CppUint32(), flags=ColumnFlag.RUN_LENGTH_ENCODED),
+        C("state", CppString(), flags=ColumnFlag.DICTIONARY_ENCODED),
+    ])
+
+ENCODED_CHILD_TABLE = Table(
+    python_module=__file__,
+    class_name="TestEncodedChildTable",
+    sql_name="encoded_child",
+    parent=EVENT_TABLE,
+    columns=[
+        C("cpu", CppUint32(), flags=ColumnFlag.RUN_LENGTH_ENCODED),
+    ])
+
+NULLABLE_CHILD_TABLE = Table(
+    python_module=__file__,
+    class_name="TestNullableChildTable",
+    sql_name="nullable_child",
+    parent=SLICE_TABLE,
+    columns=[
+        C("name", CppString()),
+        C("depth", CppOptional(CppUint32())),
+        C("thread_dur", CppOptional(CppInt64()), flags=ColumnFlag.DENSE),
+    ])
+
 # Keep this list sorted.
 ALL_TABLES = [
     ARGS_TABLE,
+    ENCODED_CHILD_TABLE,
+    ENCODED_TABLE,
     EVENT_TABLE,
     EVENT_CHILD_TABLE,
+    NULLABLE_CHILD_TABLE,
     SLICE_TABLE,
 ]
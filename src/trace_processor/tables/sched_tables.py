@@ -37,9 +37,11 @@ SCHED_SLICE_TABLE = Table(
         C('ts', CppInt64(), flags=ColumnFlag.SORTED),
         C('dur', CppInt64()),
         C('utid', CppUint32()),
-        C('end_state', CppString()),
-        C('priority', CppInt32()),
-        C('ucpu', CppTableId(CPU_TABLE)),
+        C('end_state', CppString(), flags=ColumnFlag.DICTIONARY_ENCODED),
+        C('priority', CppInt32(), flags=ColumnFlag.DICTIONARY_ENCODED),
+        C('ucpu',
+          CppTableId(CPU_TABLE),
+          flags=ColumnFlag.DICTIONARY_ENCODED),
     ],
     tabledoc=TableDoc(
         doc='''
@@ -125,7 +127,7 @@ THREAD_STATE_TABLE = Table(
         C('ts', CppInt64(), flags=ColumnFlag.SORTED),
         C('dur', CppInt64()),
         C('utid', CppUint32()),
-        C('state', CppString()),
+        C('state', CppString(), flags=ColumnFlag.DICTIONARY_ENCODED),
         C('io_wait', CppOptional(CppUint32())),
         C('blocked_function', CppOptional(CppString())),
         C('waker_utid', CppOptional(CppUint32())),
@@ -15,8 +15,11 @@
  */
 
 #include "src/trace_processor/types/trace_processor_context.h"
+
+#include <memory>
 #include <optional>
 
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "src/trace_processor/forwarding_trace_parser.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/args_translation_table.h"
@@ -60,6 +63,12 @@ TraceProcessorContext::TraceProcessorContext(const InitArgs& args)
   machine_tracker.reset(new MachineTracker(this, args.raw_machine_id));
   if (!machine_id()) {
     multi_machine_trace_manager.reset(new MultiMachineTraceManager(this));
+    // Remote machines share the pool of the default context: see
+    // MultiMachineTraceManager::GetOrCreateReader().
+    if (config.ingestion_thread_count > 1) {
+      thread_pool =
+          std::make_shared<base::ThreadPool>(config.ingestion_thread_count);
+    }
   }
   track_tracker.reset(new TrackTracker(this));
   async_track_set_tracker.reset(new AsyncTrackSetTracker(this));
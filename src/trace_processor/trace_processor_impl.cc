@@ -22,6 +22,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <limits>
+#include <map>
 #include <memory>
 #include <optional>
 #include <string>
@@ -33,10 +34,12 @@
 #include "perfetto/base/status.h"
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/hash.h"
 #include "perfetto/ext/base/small_vector.h"
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/version.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/public/compiler.h"
 #include "perfetto/trace_processor/basic_types.h"
@@ -46,6 +49,7 @@
 #include "src/trace_processor/importers/android_bugreport/android_bugreport_parser.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
 #include "src/trace_processor/importers/common/metadata_tracker.h"
+#include "src/trace_processor/importers/common/system_info_tracker.h"
 #include "src/trace_processor/importers/common/trace_parser.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_trace_parser.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_trace_tokenizer.h"
@@ -66,6 +70,7 @@
 #include "src/trace_processor/metrics/metrics.descriptor.h"
 #include "src/trace_processor/metrics/metrics.h"
 #include "src/trace_processor/metrics/sql/amalgamated_sql_metrics.h"
+#include "src/trace_processor/perfetto_sql/engine/module_table_cache.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 #include "src/trace_processor/perfetto_sql/engine/table_pointer_module.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/base64.h"
@@ -113,6 +118,7 @@
 #include "src/trace_processor/tp_metatrace.h"
 #include "src/trace_processor/trace_processor_storage_impl.h"
 #include "src/trace_processor/trace_reader_registry.h"
+#include "src/trace_processor/trace_snapshot.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 #include "src/trace_processor/types/variadic.h"
 #include "src/trace_processor/util/descriptors.h"
@@ -339,10 +345,41 @@ void InitializePreludeTablesViews(sqlite3* db) {
   }
 }
 
+// Returns the part of the module cache key which depends on how this instance
+// imports traces: tables cached by a different build of trace processor, or
+// by an instance importing the trace with different options, cannot be reused.
+std::string ModuleCacheConfigKey(const Config& config) {
+  base::Hasher hasher;
+  hasher.Update(base::GetVersionString());
+  hasher.Update(static_cast<int>(config.sorting_mode));
+  hasher.Update(config.ingest_ftrace_in_raw_table);
+  hasher.Update(static_cast<int>(config.drop_ftrace_data_before));
+  hasher.Update(static_cast<int>(config.soft_drop_ftrace_data_before));
+  hasher.Update(static_cast<int>(config.drop_track_event_data_before));
+  hasher.Update(config.analyze_trace_proto_content);
+  hasher.Update(config.arg_column_promotion_threshold);
+  hasher.Update(config.live_ingestion_window_ns);
+  hasher.Update(config.enable_dev_features);
+  // |dev_flags| is unordered: hash its entries in a stable order.
+  std::map<std::string, std::string> dev_flags(config.dev_flags.begin(),
+                                               config.dev_flags.end());
+  for (const auto& [name, value] : dev_flags) {
+    hasher.Update(name);
+    hasher.Update(value);
+  }
+  base::StackString<32> key("%016" PRIx64, hasher.digest());
+  return key.ToStdString();
+}
+
 }  // namespace
 
 TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
     : TraceProcessorStorageImpl(cfg), config_(cfg) {
+  if (config_.query_thread_count > 1) {
+    query_thread_pool_ =
+        std::make_unique<base::ThreadPool>(config_.query_thread_count);
+  }
+
   context_.reader_registry->RegisterTraceReader<FuchsiaTraceTokenizer>(
       kFuchsiaTraceType);
   context_.fuchsia_record_parser =
@@ -418,7 +455,15 @@ TraceProcessorImpl::~TraceProcessorImpl() = default;
 
 base::Status TraceProcessorImpl::Parse(TraceBlobView blob) {
   bytes_parsed_ += blob.size();
-  return TraceProcessorStorageImpl::Parse(std::move(blob));
+  int64_t watermark = ingestion_watermark();
+  base::Status status = TraceProcessorStorageImpl::Parse(std::move(blob));
+  if (ingestion_watermark() != watermark) {
+    // Live ingestion committed new events to the tables: make sure the trace
+    // bounds cover them.
+    BuildBoundsTable(engine_->sqlite_engine()->db(),
+                     context_.storage->GetTraceTimestampBoundsNs());
+  }
+  return status;
 }
 
 std::string TraceProcessorImpl::GetCurrentTraceName() {
@@ -463,7 +508,10 @@ void TraceProcessorImpl::NotifyEndOfFile() {
 
   TraceProcessorStorageImpl::NotifyEndOfFile();
   context_.storage->ShrinkToFitTables();
+  OnTraceFullyLoaded();
+}
 
+void TraceProcessorImpl::OnTraceFullyLoaded() {
   // Rebuild the bounds table once everything has been completed: we do this
   // so that if any data was added to tables in
   // TraceProcessorStorageImpl::NotifyEndOfFile, this will be counted in
@@ -472,9 +520,70 @@ void TraceProcessorImpl::NotifyEndOfFile() {
   BuildBoundsTable(engine_->sqlite_engine()->db(),
                    context_.storage->GetTraceTimestampBoundsNs());
 
+  // The tables created by modules can only be cached once the trace is fully
+  // loaded: their contents would change if more data was added.
+  if (!config_.module_cache_dir.empty()) {
+    std::optional<SqlValue> uuid =
+        context_.metadata_tracker->GetMetadata(metadata::trace_uuid);
+    if (uuid && uuid->type == SqlValue::kString) {
+      // The size of the trace is included in the key to avoid reusing the
+      // tables of a trace which was only partially loaded.
+      std::string trace_key = std::string(uuid->AsString()) + ":" +
+                              std::to_string(bytes_parsed_) + ":" +
+                              ModuleCacheConfigKey(config_);
+      module_table_cache_ = std::make_unique<ModuleTableCache>(
+          config_.module_cache_dir, std::move(trace_key));
+      engine_->set_module_table_cache(module_table_cache_.get());
+    }
+  }
+
   TraceProcessorStorageImpl::DestroyContext();
 }
 
+base::Status TraceProcessorImpl::WriteSnapshot(const std::string& path) {
+  if (!notify_eof_called_) {
+    return base::ErrStatus(
+        "Snapshots can only be written once the trace is fully loaded");
+  }
+  return WriteTraceSnapshot(*context_.storage, snapshot_tables_, path);
+}
+
+base::Status TraceProcessorImpl::LoadSnapshot(const std::string& path) {
+  if (notify_eof_called_ || bytes_parsed_ > 0) {
+    return base::ErrStatus("Snapshots cannot be loaded after a trace");
+  }
+  notify_eof_called_ = true;
+  RETURN_IF_ERROR(
+      LoadTraceSnapshot(path, context_.storage.get(), snapshot_tables_));
+
+  // Restore the state which NotifyEndOfFile computes from the trace.
+  std::optional<SqlValue> size =
+      context_.metadata_tracker->GetMetadata(metadata::trace_size_bytes);
+  if (size && size->type == SqlValue::kLong) {
+    bytes_parsed_ = static_cast<uint64_t>(size->long_value);
+  }
+  std::optional<SqlValue> system_name =
+      context_.metadata_tracker->GetMetadata(metadata::system_name);
+  std::optional<SqlValue> system_release =
+      context_.metadata_tracker->GetMetadata(metadata::system_release);
+  if (system_name && system_name->type == SqlValue::kString &&
+      system_release && system_release->type == SqlValue::kString) {
+    SystemInfoTracker::GetOrCreate(&context_)->SetKernelVersion(
+        system_name->AsString(), system_release->AsString());
+  }
+  if (current_trace_name_.empty())
+    current_trace_name_ = "Unnamed trace";
+
+  OnTraceFullyLoaded();
+  return base::OkStatus();
+}
+
+bool TraceProcessorImpl::IsSnapshotTable(const Table* table) const {
+  return std::any_of(
+      snapshot_tables_.begin(), snapshot_tables_.end(),
+      [table](const SnapshotTable& t) { return t.table == table; });
+}
+
 size_t TraceProcessorImpl::RestoreInitialTables() {
   // We should always have at least as many objects now as we did in the
   // constructor.
@@ -497,12 +606,16 @@ Iterator TraceProcessorImpl::ExecuteQuery(const std::string& sql) {
   uint32_t sql_stats_row =
       context_.storage->mutable_sql_stats()->RecordQueryBegin(
           sql, base::GetWallTimeNs().count());
+  PerfettoSqlEngine::FunctionMemoizationStats memoization_stats;
+  PerfettoSqlEngine::ScopedQueryMemoizationStats scoped_memoization_stats(
+      engine_.get(), &memoization_stats);
   std::string non_breaking_sql = base::ReplaceAll(sql, "\u00A0", " ");
   base::StatusOr<PerfettoSqlEngine::ExecutionResult> result =
       engine_->ExecuteUntilLastStatement(
           SqlSource::FromExecuteQuery(std::move(non_breaking_sql)));
   std::unique_ptr<IteratorImpl> impl(
-      new IteratorImpl(this, std::move(result), sql_stats_row));
+      new IteratorImpl(this, std::move(result), sql_stats_row,
+                       memoization_stats));
   return Iterator(std::move(impl));
 }
 
@@ -667,7 +780,10 @@ void TraceProcessorImpl::EnableMetatrace(MetatraceConfig config) {
 }
 
 void TraceProcessorImpl::InitPerfettoSqlEngine() {
-  engine_.reset(new PerfettoSqlEngine(context_.storage->mutable_string_pool()));
+  snapshot_tables_.clear();
+  engine_.reset(new PerfettoSqlEngine(context_.storage->mutable_string_pool(),
+                                      query_thread_pool_.get()));
+  engine_->set_module_table_cache(module_table_cache_.get());
   sqlite3* db = engine_->sqlite_engine()->db();
   sqlite3_str_split_init(db);
 
@@ -686,6 +802,8 @@ void TraceProcessorImpl::InitPerfettoSqlEngine() {
                                context_.storage.get(), false);
   RegisterFunction<ExtractArg>(engine_.get(), "EXTRACT_ARG", 2,
                                context_.storage.get());
+  engine_->RegisterBatchFunction(
+      std::make_unique<ExtractArgBatch>(context_.storage.get()));
   RegisterFunction<AbsTimeStr>(engine_.get(), "ABS_TIME_STR", 1,
                                context_.clock_converter.get());
   RegisterFunction<Reverse>(engine_.get(), "REVERSE", 1);
@@ -803,6 +921,7 @@ void TraceProcessorImpl::InitPerfettoSqlEngine() {
                                                                     storage);
   engine_->sqlite_engine()->RegisterVirtualTableModule<TablePointerModule>(
       "__intrinsic_table_ptr", nullptr);
+  engine_->EnableNativeGroupBy();
 
   // New style db-backed tables.
   // Note: if adding a table here which might potentially contain many rows
@@ -853,6 +972,9 @@ void TraceProcessorImpl::InitPerfettoSqlEngine() {
 
   RegisterStaticTable(storage->symbol_table());
   RegisterStaticTable(storage->heap_profile_allocation_table());
+  // The parent of cpu_profile_stack_sample is not queryable on its own but
+  // its rows are needed in snapshots.
+  RegisterSnapshotTable(storage->stack_sample_table());
   RegisterStaticTable(storage->cpu_profile_stack_sample_table());
   RegisterStaticTable(storage->perf_session_table());
   RegisterStaticTable(storage->perf_sample_table());
@@ -27,16 +27,20 @@
 #include <unordered_map>
 #include <vector>
 
+#include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "perfetto/trace_processor/trace_processor.h"
 #include "src/trace_processor/iterator_impl.h"
 #include "src/trace_processor/metrics/metrics.h"
+#include "src/trace_processor/perfetto_sql/engine/module_table_cache.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/create_function.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/create_view_function.h"
 #include "src/trace_processor/trace_processor_storage_impl.h"
+#include "src/trace_processor/trace_snapshot.h"
 #include "src/trace_processor/util/descriptors.h"
 
 namespace perfetto::trace_processor {
@@ -92,6 +96,9 @@ class TraceProcessorImpl : public TraceProcessor,
   std::string GetCurrentTraceName() override;
   void SetCurrentTraceName(const std::string&) override;
 
+  base::Status WriteSnapshot(const std::string& path) override;
+  base::Status LoadSnapshot(const std::string& path) override;
+
   void EnableMetatrace(MetatraceConfig config) override;
 
   base::Status DisableAndReadMetatrace(
@@ -105,13 +112,39 @@ class TraceProcessorImpl : public TraceProcessor,
   void RegisterStaticTable(const Table& table) {
     engine_->RegisterStaticTable(table, Table::Name(),
                                  Table::ComputeStaticSchema());
+    RegisterSnapshotTable(table);
   }
 
+  // Adds |table| to the tables stored in snapshots: tables extending another
+  // table must be added after it.
+  template <typename Table>
+  void RegisterSnapshotTable(const Table& table) {
+    PERFETTO_CHECK(!table.parent() || IsSnapshotTable(table.parent()));
+    // Tables are owned by |context_.storage| which is mutable.
+    snapshot_tables_.push_back({Table::Name(), const_cast<Table*>(&table)});
+  }
+
+  bool IsSnapshotTable(const Table* table) const;
+
+  // Common steps of NotifyEndOfFile and LoadSnapshot once all the data of the
+  // trace is in the tables.
+  void OnTraceFullyLoaded();
+
   bool IsRootMetricField(const std::string& metric_name);
 
   void InitPerfettoSqlEngine();
 
   const Config config_;
+
+  // Used by |engine_| to parallelize queries: must be declared before it so
+  // that it is destroyed after it. Null if |config_.query_thread_count| <= 1.
+  std::unique_ptr<base::ThreadPool> query_thread_pool_;
+
+  // Used by |engine_| to cache the tables created by modules: must be
+  // declared before it for the same reason. Null until the trace is fully
+  // loaded and if |config_.module_cache_dir| is empty.
+  std::unique_ptr<ModuleTableCache> module_table_cache_;
+
   std::unique_ptr<PerfettoSqlEngine> engine_;
 
   DescriptorPool pool_;
@@ -126,6 +159,10 @@ class TraceProcessorImpl : public TraceProcessor,
   // Track the number of objects registered with SQLite after the constructor.
   uint64_t sqlite_objects_post_constructor_initialization_ = 0;
 
+  // The tables stored in snapshots, parents before the tables extending
+  // them.
+  std::vector<SnapshotTable> snapshot_tables_;
+
   std::string current_trace_name_;
   uint64_t bytes_parsed_ = 0;
 
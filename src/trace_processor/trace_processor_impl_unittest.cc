@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/trace_processor_impl.h"
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/iterator.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/common/sys_stats_counters.pbzero.h"
+#include "protos/perfetto/trace/sys_stats/sys_stats.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+
+class LiveIngestionTest : public ::testing::Test {
+ protected:
+  LiveIngestionTest() {
+    Config config;
+    config.live_ingestion_window_ns = 1000;
+    tp_ = std::make_unique<TraceProcessorImpl>(config);
+  }
+
+  // Parses a chunk of trace with a meminfo counter at each of |timestamps|.
+  void ParseCounters(std::initializer_list<int64_t> timestamps) {
+    protozero::HeapBuffered<protos::pbzero::Trace> trace;
+    for (int64_t ts : timestamps) {
+      auto* packet = trace->add_packet();
+      packet->set_timestamp(static_cast<uint64_t>(ts));
+      auto* meminfo = packet->set_sys_stats()->add_meminfo();
+      meminfo->set_key(protos::pbzero::MEMINFO_MEM_FREE);
+      meminfo->set_value(static_cast<uint64_t>(ts));
+    }
+    std::vector<uint8_t> buf = trace.SerializeAsArray();
+    ASSERT_TRUE(
+        tp_->Parse(TraceBlobView(TraceBlob::CopyFrom(buf.data(), buf.size())))
+            .ok());
+  }
+
+  // Returns the first column of the rows returned by |sql|.
+  std::vector<int64_t> QueryLongs(const std::string& sql) {
+    std::vector<int64_t> values;
+    auto it = tp_->ExecuteQuery(sql);
+    while (it.Next()) {
+      values.push_back(it.Get(0).AsLong());
+    }
+    EXPECT_TRUE(it.Status().ok()) << it.Status().message();
+    return values;
+  }
+
+  std::vector<int64_t> CounterTimestamps() {
+    return QueryLongs("SELECT ts FROM counter ORDER BY ts");
+  }
+
+  std::vector<int64_t> Watermark() {
+    return QueryLongs(
+        "SELECT int_value FROM metadata WHERE name = 'ingestion_watermark_ns'");
+  }
+
+  std::vector<int64_t> Bounds() {
+    return QueryLongs(
+        "SELECT start_ts FROM trace_bounds UNION ALL "
+        "SELECT end_ts FROM trace_bounds");
+  }
+
+  std::vector<int64_t> Stat(const std::string& name) {
+    return QueryLongs("SELECT value FROM stats WHERE name = '" + name + "'");
+  }
+
+  std::unique_ptr<TraceProcessorImpl> tp_;
+};
+
+TEST_F(LiveIngestionTest, CommitsEventsOlderThanWindow) {
+  // The watermark is 1000ns before the latest event: nothing is committed
+  // until an event is older than that.
+  ParseCounters({1000, 1500});
+  ASSERT_THAT(CounterTimestamps(), ElementsAre());
+  ASSERT_THAT(Watermark(), ElementsAre(500));
+
+  // Queries see the events strictly before the watermark and the bounds of
+  // the trace cover them.
+  ParseCounters({3000});
+  ASSERT_THAT(CounterTimestamps(), ElementsAre(1000, 1500));
+  ASSERT_THAT(Watermark(), ElementsAre(2000));
+  ASSERT_THAT(Bounds(), ElementsAre(1000, 1500));
+
+  // Events out of order by less than the window are sorted before being
+  // committed.
+  ParseCounters({2500, 4500});
+  ASSERT_THAT(CounterTimestamps(), ElementsAre(1000, 1500, 2500, 3000));
+  ASSERT_THAT(Watermark(), ElementsAre(3500));
+  ASSERT_THAT(Bounds(), ElementsAre(1000, 3000));
+
+  // The committed events are kept and the rest is committed at the end.
+  tp_->NotifyEndOfFile();
+  ASSERT_THAT(CounterTimestamps(), ElementsAre(1000, 1500, 2500, 3000, 4500));
+  ASSERT_THAT(Bounds(), ElementsAre(1000, 4500));
+  ASSERT_THAT(Stat("sorter_push_event_out_of_order"), ElementsAre(0));
+}
+
+TEST_F(LiveIngestionTest, EventsBeforeWatermark) {
+  ParseCounters({1000, 3000});
+  ASSERT_THAT(CounterTimestamps(), ElementsAre(1000));
+  ASSERT_THAT(Watermark(), ElementsAre(2000));
+
+  // An event before the watermark but after all the committed events is
+  // committed with the next batch.
+  ParseCounters({1200, 5000});
+  ASSERT_THAT(CounterTimestamps(), ElementsAre(1000, 1200, 3000));
+  ASSERT_THAT(Watermark(), ElementsAre(4000));
+  ASSERT_THAT(Stat("sorter_push_event_out_of_order"), ElementsAre(0));
+
+  // One before committed events is still parsed, as it would be without live
+  // ingestion, but counted as out of order.
+  ParseCounters({1100});
+  tp_->NotifyEndOfFile();
+  ASSERT_THAT(Stat("sorter_push_event_out_of_order"), ElementsAre(1));
+  ASSERT_THAT(CounterTimestamps(), ElementsAre(1000, 1200, 3000, 5000));
+  ASSERT_THAT(Stat("counter_events_out_of_order"), ElementsAre(1));
+}
+
+TEST(TraceProcessorImplTest, MemoizationStatsPerQuery) {
+  TraceProcessorImpl tp{Config()};
+  {
+    auto it = tp.ExecuteQuery(
+        "CREATE PERFETTO FUNCTION f(x INT) RETURNS INT AS SELECT $x");
+    while (it.Next()) {
+    }
+    ASSERT_TRUE(it.Status().ok()) << it.Status().message();
+  }
+
+  // The first query computes its first row, then the second query runs to
+  // completion before the first one computes the others: the calls of each
+  // query are only counted in its own stats.
+  {
+    auto a = tp.ExecuteQuery(
+        "WITH d(x) AS (VALUES (1), (1), (1)) SELECT f(x) AS a FROM d");
+    {
+      auto b = tp.ExecuteQuery(
+          "WITH d(x) AS (VALUES (2), (2)) SELECT f(x) AS b FROM d");
+      while (b.Next()) {
+      }
+      ASSERT_TRUE(b.Status().ok()) << b.Status().message();
+    }
+    while (a.Next()) {
+    }
+    ASSERT_TRUE(a.Status().ok()) << a.Status().message();
+  }
+
+  auto it = tp.ExecuteQuery(
+      "SELECT memoization_hits, memoization_misses FROM sqlstats "
+      "WHERE query GLOB '*SELECT f(x) AS b FROM d' "
+      "UNION ALL "
+      "SELECT memoization_hits + memoization_misses, 0 FROM sqlstats "
+      "WHERE query GLOB '*SELECT f(x) AS a FROM d'");
+  using Row = std::pair<int64_t, int64_t>;
+  std::vector<Row> rows;
+  while (it.Next()) {
+    rows.emplace_back(it.Get(0).AsLong(), it.Get(1).AsLong());
+  }
+  ASSERT_TRUE(it.Status().ok()) << it.Status().message();
+  ASSERT_THAT(rows, ElementsAre(Row(1, 1), Row(3, 0)));
+}
+
+// Returns the rows returned by |sql| with the values of each row joined by
+// commas.
+std::vector<std::string> QueryRows(TraceProcessor* tp, const std::string& sql) {
+  std::vector<std::string> rows;
+  auto it = tp->ExecuteQuery(sql);
+  while (it.Next()) {
+    std::string row;
+    for (uint32_t i = 0; i < it.ColumnCount(); ++i) {
+      SqlValue value = it.Get(i);
+      switch (value.type) {
+        case SqlValue::kNull:
+          row += "[NULL]";
+          break;
+        case SqlValue::kLong:
+          row += std::to_string(value.AsLong());
+          break;
+        case SqlValue::kDouble:
+          row += std::to_string(value.AsDouble());
+          break;
+        case SqlValue::kString:
+          row += value.AsString();
+          break;
+        case SqlValue::kBytes:
+          row += "[BYTES]";
+          break;
+      }
+      row += ",";
+    }
+    rows.push_back(std::move(row));
+  }
+  EXPECT_TRUE(it.Status().ok()) << it.Status().message();
+  return rows;
+}
+
+TEST(TraceProcessorImplTest, SnapshotRoundTrip) {
+  TraceProcessorImpl tp{Config()};
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  for (uint64_t ts = 1000; ts < 1100; ts += 10) {
+    auto* packet = trace->add_packet();
+    packet->set_timestamp(ts);
+    auto* sys_stats = packet->set_sys_stats();
+    auto* meminfo = sys_stats->add_meminfo();
+    meminfo->set_key(protos::pbzero::MEMINFO_MEM_FREE);
+    meminfo->set_value(ts * 2);
+    auto* vmstat = sys_stats->add_vmstat();
+    vmstat->set_key(protos::pbzero::VMSTAT_NR_FREE_PAGES);
+    vmstat->set_value(ts * 3);
+  }
+  std::vector<uint8_t> buf = trace.SerializeAsArray();
+  ASSERT_TRUE(
+      tp.Parse(TraceBlobView(TraceBlob::CopyFrom(buf.data(), buf.size())))
+          .ok());
+
+  base::TempFile snapshot = base::TempFile::Create();
+  ASSERT_FALSE(tp.WriteSnapshot(snapshot.path()).ok());
+  tp.NotifyEndOfFile();
+  ASSERT_TRUE(tp.WriteSnapshot(snapshot.path()).ok());
+
+  TraceProcessorImpl restored{Config()};
+  base::Status status = restored.LoadSnapshot(snapshot.path());
+  ASSERT_TRUE(status.ok()) << status.message();
+
+  const char* kQueries[] = {
+      "SELECT ts, value, track_id FROM counter ORDER BY id",
+      "SELECT id, type, name, machine_id FROM counter_track ORDER BY id",
+      "SELECT id, type, name FROM track ORDER BY id",
+      "SELECT name, key_type, int_value, str_value FROM metadata ORDER BY id",
+      "SELECT name, idx, value FROM stats WHERE value != 0",
+      "SELECT start_ts, end_ts FROM trace_bounds",
+  };
+  for (const char* query : kQueries) {
+    std::vector<std::string> rows = QueryRows(&tp, query);
+    ASSERT_FALSE(rows.empty()) << query;
+    ASSERT_EQ(rows, QueryRows(&restored, query)) << query;
+  }
+  ASSERT_EQ(tp.GetCurrentTraceName(), restored.GetCurrentTraceName());
+
+  // Snapshots can only be loaded in place of a trace.
+  ASSERT_FALSE(restored.LoadSnapshot(snapshot.path()).ok());
+}
+
+TEST(TraceProcessorImplTest, LoadSnapshotRejectsTrace) {
+  base::TempFile file = base::TempFile::Create();
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  trace->add_packet()->set_timestamp(1000);
+  std::vector<uint8_t> buf = trace.SerializeAsArray();
+  ASSERT_TRUE(base::WriteAll(file.fd(), buf.data(), buf.size()) > 0);
+
+  TraceProcessorImpl tp{Config()};
+  ASSERT_FALSE(tp.LoadSnapshot(file.path()).ok());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -674,6 +674,8 @@ struct CommandLineOptions {
   std::string trace_file_path;
   std::string port_number;
   std::string override_stdlib_path;
+  std::string module_cache_dir;
+  std::string snapshot_output_path;
   std::vector<std::string> override_sql_module_paths;
   std::vector<std::string> raw_metric_extensions;
   bool launch_shell = false;
@@ -681,6 +683,7 @@ struct CommandLineOptions {
   bool enable_stdiod = false;
   bool wide = false;
   bool force_full_sort = false;
+  bool load_snapshot = false;
   std::string metatrace_path;
   size_t metatrace_buffer_capacity = 0;
   metatrace::MetatraceCategories metatrace_categories =
@@ -691,6 +694,10 @@ struct CommandLineOptions {
   bool no_ftrace_raw = false;
   bool analyze_trace_proto_content = false;
   bool crop_track_events = false;
+  uint32_t ingestion_threads = 1;
+  uint64_t ingestion_memory_budget_mb = 0;
+  uint32_t query_threads = 1;
+  uint32_t arg_column_threshold = 0;
   std::vector<std::string> dev_flags;
 };
 
@@ -723,6 +730,12 @@ Options:
  -e, --export FILE                    Export the contents of trace processor
                                       into an SQLite database after running any
                                       metrics or queries specified.
+ --write-snapshot FILE                Writes a snapshot of the loaded trace to
+                                      FILE, which --snapshot loads much faster
+                                      than the trace.
+ --snapshot                           Loads trace_file.pb as a snapshot written
+                                      by --write-snapshot with the same version
+                                      of trace processor.
 
 Feature flags:
  --full-sort                          Forces the trace processor into performing
@@ -737,6 +750,20 @@ Feature flags:
                                       trace processor.
  --crop-track-events                  Ignores track event outside of the
                                       range of interest in trace processor.
+ --ingestion-threads N                Uses N threads to decompress compressed
+                                      trace packets while loading the trace.
+ --ingestion-memory-budget-mb N       Writes trace packets waiting to be sorted
+                                      to a temporary file once they take more
+                                      than N MB of memory.
+ --query-threads N                    Uses N threads to filter and sort large
+                                      tables when running queries.
+ --arg-column-threshold N             Stores the values of arg keys in a
+                                      dedicated column once EXTRACT_ARG looked
+                                      them up N times.
+ --module-cache-dir DIR               Caches the tables created by SQL modules
+                                      in DIR so that including them again on
+                                      the same trace (e.g. in a later run of
+                                      trace processor) loads them from disk.
  --dev                                Enables features which are reserved for
                                       local development use only and
                                       *should not* be enabled on production
@@ -806,8 +833,15 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     OPT_METATRACE_CATEGORIES,
     OPT_ANALYZE_TRACE_PROTO_CONTENT,
     OPT_CROP_TRACK_EVENTS,
+    OPT_INGESTION_THREADS,
+    OPT_INGESTION_MEMORY_BUDGET_MB,
+    OPT_QUERY_THREADS,
+    OPT_ARG_COLUMN_THRESHOLD,
+    OPT_MODULE_CACHE_DIR,
     OPT_DEV_FLAG,
     OPT_STDIOD,
+    OPT_WRITE_SNAPSHOT,
+    OPT_SNAPSHOT,
   };
 
   static const option long_options[] = {
@@ -821,6 +855,8 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"stdiod", no_argument, nullptr, OPT_STDIOD},
       {"interactive", no_argument, nullptr, 'i'},
       {"export", required_argument, nullptr, 'e'},
+      {"write-snapshot", required_argument, nullptr, OPT_WRITE_SNAPSHOT},
+      {"snapshot", no_argument, nullptr, OPT_SNAPSHOT},
       {"metatrace", required_argument, nullptr, 'm'},
       {"metatrace-buffer-capacity", required_argument, nullptr,
        OPT_METATRACE_BUFFER_CAPACITY},
@@ -831,6 +867,13 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"analyze-trace-proto-content", no_argument, nullptr,
        OPT_ANALYZE_TRACE_PROTO_CONTENT},
       {"crop-track-events", no_argument, nullptr, OPT_CROP_TRACK_EVENTS},
+      {"ingestion-threads", required_argument, nullptr, OPT_INGESTION_THREADS},
+      {"ingestion-memory-budget-mb", required_argument, nullptr,
+       OPT_INGESTION_MEMORY_BUDGET_MB},
+      {"query-threads", required_argument, nullptr, OPT_QUERY_THREADS},
+      {"arg-column-threshold", required_argument, nullptr,
+       OPT_ARG_COLUMN_THRESHOLD},
+      {"module-cache-dir", required_argument, nullptr, OPT_MODULE_CACHE_DIR},
       {"dev", no_argument, nullptr, OPT_DEV},
       {"add-sql-module", required_argument, nullptr, OPT_ADD_SQL_MODULE},
       {"override-sql-module", required_argument, nullptr,
@@ -907,6 +950,16 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_WRITE_SNAPSHOT) {
+      command_line_options.snapshot_output_path = optarg;
+      continue;
+    }
+
+    if (option == OPT_SNAPSHOT) {
+      command_line_options.load_snapshot = true;
+      continue;
+    }
+
     if (option == OPT_METATRACE_BUFFER_CAPACITY) {
       command_line_options.metatrace_buffer_capacity =
           static_cast<size_t>(atoi(optarg));
@@ -939,6 +992,52 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_INGESTION_THREADS) {
+      std::optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads || *threads == 0) {
+        PERFETTO_ELOG("Invalid value for --ingestion-threads: %s", optarg);
+        exit(1);
+      }
+      command_line_options.ingestion_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_INGESTION_MEMORY_BUDGET_MB) {
+      std::optional<uint64_t> budget = base::CStringToUInt64(optarg);
+      if (!budget || *budget == 0) {
+        PERFETTO_ELOG("Invalid value for --ingestion-memory-budget-mb: %s",
+                      optarg);
+        exit(1);
+      }
+      command_line_options.ingestion_memory_budget_mb = *budget;
+      continue;
+    }
+
+    if (option == OPT_QUERY_THREADS) {
+      std::optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads || *threads == 0) {
+        PERFETTO_ELOG("Invalid value for --query-threads: %s", optarg);
+        exit(1);
+      }
+      command_line_options.query_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_ARG_COLUMN_THRESHOLD) {
+      std::optional<uint32_t> threshold = base::CStringToUInt32(optarg);
+      if (!threshold || *threshold == 0) {
+        PERFETTO_ELOG("Invalid value for --arg-column-threshold: %s", optarg);
+        exit(1);
+      }
+      command_line_options.arg_column_threshold = *threshold;
+      continue;
+    }
+
+    if (option == OPT_MODULE_CACHE_DIR) {
+      command_line_options.module_cache_dir = optarg;
+      continue;
+    }
+
     if (option == OPT_DEV) {
       command_line_options.dev = true;
       continue;
@@ -1078,6 +1177,17 @@ base::Status LoadTrace(const std::string& trace_file_path, double* size_mb) {
   return base::OkStatus();
 }
 
+base::Status LoadSnapshot(const std::string& snapshot_path, double* size_mb) {
+  base::Status status = g_tp->LoadSnapshot(snapshot_path);
+  if (!status.ok()) {
+    return base::ErrStatus("Could not load snapshot (path: %s): %s",
+                           snapshot_path.c_str(), status.c_message());
+  }
+  std::optional<uint64_t> size = base::GetFileSize(snapshot_path);
+  *size_mb = static_cast<double>(size.value_or(0)) / 1E6;
+  return base::OkStatus();
+}
+
 base::Status RunQueries(const std::string& query_file_path,
                         bool expect_output) {
   std::string queries;
@@ -1558,6 +1668,18 @@ base::Status TraceProcessorMain(int argc, char** argv) {
                             : SortingMode::kDefaultHeuristics;
   config.ingest_ftrace_in_raw_table = !options.no_ftrace_raw;
   config.analyze_trace_proto_content = options.analyze_trace_proto_content;
+  config.ingestion_thread_count = options.ingestion_threads;
+  config.ingestion_memory_budget_bytes =
+      options.ingestion_memory_budget_mb * 1024 * 1024;
+  config.query_thread_count = options.query_threads;
+  config.arg_column_promotion_threshold = options.arg_column_threshold;
+  if (!options.module_cache_dir.empty()) {
+    if (!base::Mkdir(options.module_cache_dir) && errno != EEXIST) {
+      return base::ErrStatus("Failed to create module cache directory %s",
+                             options.module_cache_dir.c_str());
+    }
+    config.module_cache_dir = options.module_cache_dir;
+  }
   config.drop_track_event_data_before =
       options.crop_track_events
           ? DropTrackEventDataBefore::kTrackEventRangeOfInterest
@@ -1622,13 +1744,21 @@ base::Status TraceProcessorMain(int argc, char** argv) {
   if (!options.trace_file_path.empty()) {
     base::TimeNanos t_load_start = base::GetWallTimeNs();
     double size_mb = 0;
-    RETURN_IF_ERROR(LoadTrace(options.trace_file_path, &size_mb));
+    if (options.load_snapshot) {
+      RETURN_IF_ERROR(LoadSnapshot(options.trace_file_path, &size_mb));
+    } else {
+      RETURN_IF_ERROR(LoadTrace(options.trace_file_path, &size_mb));
+    }
     t_load = base::GetWallTimeNs() - t_load_start;
 
     double t_load_s = static_cast<double>(t_load.count()) / 1E9;
     PERFETTO_ILOG("Trace loaded: %.2f MB in %.2fs (%.1f MB/s)", size_mb,
                   t_load_s, size_mb / t_load_s);
 
+    if (!options.snapshot_output_path.empty()) {
+      RETURN_IF_ERROR(g_tp->WriteSnapshot(options.snapshot_output_path));
+    }
+
     RETURN_IF_ERROR(PrintStats());
   }
 
@@ -15,6 +15,8 @@
  */
 
 #include "src/trace_processor/trace_processor_storage_impl.h"
+#include <cstdint>
+#include <limits>
 #include <memory>
 
 #include "perfetto/base/logging.h"
@@ -90,9 +92,30 @@ util::Status TraceProcessorStorageImpl::Parse(TraceBlobView blob) {
 
   util::Status status = context_.chunk_reader->Parse(std::move(blob));
   unrecoverable_parse_error_ |= !status.ok();
+  if (status.ok())
+    MaybeAdvanceIngestionWatermark();
   return status;
 }
 
+void TraceProcessorStorageImpl::MaybeAdvanceIngestionWatermark() {
+  int64_t window = context_.config.live_ingestion_window_ns;
+  if (window <= 0 || !context_.sorter)
+    return;
+
+  int64_t max_ts = context_.sorter->max_timestamp();
+  if (max_ts < std::numeric_limits<int64_t>::min() + window)
+    return;
+  int64_t watermark = max_ts - window;
+  if (watermark <= ingestion_watermark_)
+    return;
+
+  context_.sorter->ExtractEventsUntilTimestamp(watermark);
+  context_.args_tracker->Flush();
+  ingestion_watermark_ = watermark;
+  context_.metadata_tracker->SetMetadata(metadata::ingestion_watermark_ns,
+                                         Variadic::Integer(watermark));
+}
+
 void TraceProcessorStorageImpl::Flush() {
   if (unrecoverable_parse_error_)
     return;
@@ -17,6 +17,8 @@
 #ifndef SRC_TRACE_PROCESSOR_TRACE_PROCESSOR_STORAGE_IMPL_H_
 #define SRC_TRACE_PROCESSOR_TRACE_PROCESSOR_STORAGE_IMPL_H_
 
+#include <cstdint>
+#include <limits>
 #include <memory>
 
 #include "perfetto/ext/base/hash.h"
@@ -41,11 +43,20 @@ class TraceProcessorStorageImpl : public TraceProcessorStorage {
 
   TraceProcessorContext* context() { return &context_; }
 
+  // Returns the timestamp before which all the events have been committed to
+  // the tables by live ingestion (see Config::live_ingestion_window_ns).
+  int64_t ingestion_watermark() const { return ingestion_watermark_; }
+
  protected:
+  // Commits the events older than the live ingestion window to the tables if
+  // live ingestion is enabled.
+  void MaybeAdvanceIngestionWatermark();
+
   base::Hasher trace_hash_;
   TraceProcessorContext context_;
   bool unrecoverable_parse_error_ = false;
   size_t hash_input_size_remaining_ = 4096;
+  int64_t ingestion_watermark_ = std::numeric_limits<int64_t>::min();
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/trace_snapshot.h"
+
+#include <fcntl.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/scoped_mmap.h"
+#include "perfetto/ext/base/version.h"
+#include "perfetto/protozero/field.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/util/status_macros.h"
+
+#include "protos/perfetto/trace_processor/serialization.pbzero.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+// Incremented whenever the layout of snapshots changes in a way which is not
+// covered by the version of trace processor.
+constexpr uint32_t kFormatVersion = 1;
+
+// Number of rows of a column in each SerializedColumn packet: keeps packets
+// of 64-bit columns well below the maximum size of protozero messages.
+constexpr uint32_t kRowsPerChunk = 1u << 22;
+
+using protos::pbzero::SerializedTraceProcessor;
+using protos::pbzero::SerializedTraceProcessorPacket;
+
+class SnapshotWriter {
+ public:
+  explicit SnapshotWriter(base::ScopedFile fd) : fd_(std::move(fd)) {}
+
+  // Appends |packet|, a SerializedTraceProcessorPacket, to the file. Failures
+  // are reported by |ok|.
+  void WritePacket(const std::vector<uint8_t>& packet) {
+    if (!ok_)
+      return;
+    uint8_t preamble[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+    uint8_t* end = protozero::proto_utils::WriteVarInt(
+        protozero::proto_utils::MakeTagLengthDelimited(
+            SerializedTraceProcessor::kPacketFieldNumber),
+        preamble);
+    end = protozero::proto_utils::WriteVarInt(packet.size(), end);
+    auto preamble_size = static_cast<size_t>(end - preamble);
+    ok_ = base::WriteAll(*fd_, preamble, preamble_size) ==
+              static_cast<ssize_t>(preamble_size) &&
+          base::WriteAll(*fd_, packet.data(), packet.size()) ==
+              static_cast<ssize_t>(packet.size());
+  }
+
+  bool ok() const { return ok_; }
+
+ private:
+  base::ScopedFile fd_;
+  bool ok_ = true;
+};
+
+// Checks that every string of |current| has the same Id in |restored|, the
+// string pool of the snapshot: strings interned before the snapshot is loaded
+// (e.g. by the constructor of TraceStorage) can then still be referenced by
+// their Id.
+bool ContainsWithSameIds(const StringPool& restored,
+                         const StringPool& current) {
+  for (auto it = current.CreateIterator(); it; ++it) {
+    StringPool::Id id = it.StringId();
+    if (id.is_null())
+      continue;
+    if (restored.GetId(it.StringView()) != id)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+base::Status WriteTraceSnapshot(const TraceStorage& storage,
+                                const std::vector<SnapshotTable>& tables,
+                                const std::string& path) {
+  base::ScopedFile fd(base::OpenFile(path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  if (!fd) {
+    return base::ErrStatus("Failed to create %s", path.c_str());
+  }
+  SnapshotWriter writer(std::move(fd));
+  auto write_packet = [&writer](const std::vector<uint8_t>& packet) {
+    writer.WritePacket(packet);
+  };
+
+  {
+    protozero::HeapBuffered<SerializedTraceProcessorPacket> packet;
+    auto* header = packet->set_snapshot_header();
+    header->set_format_version(kFormatVersion);
+    header->set_trace_processor_version(base::GetVersionString());
+    write_packet(packet.SerializeAsArray());
+  }
+
+  // Blocks of the string pool can be as large as a packet can be: each one
+  // goes in its own packet.
+  storage.string_pool().Serialize(
+      [&](protozero::ConstBytes bytes, bool is_large_string) {
+        protozero::HeapBuffered<SerializedTraceProcessorPacket> packet;
+        auto* pool = packet->set_string_pool();
+        if (is_large_string) {
+          pool->add_large_strings(bytes.data, bytes.size);
+        } else {
+          pool->add_blocks(bytes.data, bytes.size);
+        }
+        write_packet(packet.SerializeAsArray());
+      });
+
+  {
+    protozero::HeapBuffered<SerializedTraceProcessorPacket> packet;
+    auto* stats = packet->set_stats();
+    for (size_t key = 0; key < stats::kNumKeys; ++key) {
+      const TraceStorage::Stats& value = storage.stats()[key];
+      if (value.value == 0 && value.indexed_values.empty())
+        continue;
+      auto* stat = stats->add_stats();
+      stat->set_key(static_cast<uint32_t>(key));
+      stat->set_value(value.value);
+      for (const auto& [index, indexed_value] : value.indexed_values) {
+        auto* indexed = stat->add_indexed_values();
+        indexed->set_index(index);
+        indexed->set_value(indexed_value);
+      }
+    }
+    write_packet(packet.SerializeAsArray());
+  }
+
+  for (const SnapshotTable& table : tables) {
+    table.table->Serialize(table.name, kRowsPerChunk, write_packet);
+  }
+
+  if (!writer.ok()) {
+    return base::ErrStatus("Failed to write %s", path.c_str());
+  }
+  return base::OkStatus();
+}
+
+base::Status LoadTraceSnapshot(const std::string& path,
+                               TraceStorage* storage,
+                               const std::vector<SnapshotTable>& tables) {
+  // Values are copied out of the file into the tables: the file only needs to
+  // be mapped while the snapshot is loaded.
+  protozero::ConstBytes file{};
+#if PERFETTO_HAS_MMAP()
+  base::ScopedMmap mapped = base::ReadMmapWholeFile(path.c_str());
+  if (mapped.IsValid()) {
+    file = {static_cast<const uint8_t*>(mapped.data()), mapped.length()};
+  }
+#endif
+  std::string buf;
+  if (!file.data) {
+    if (!base::ReadFile(path, &buf)) {
+      return base::ErrStatus("Failed to read %s", path.c_str());
+    }
+    file = {reinterpret_cast<const uint8_t*>(buf.data()), buf.size()};
+  }
+
+  SerializedTraceProcessor::Decoder snapshot(file);
+  if (snapshot.bytes_left() != 0) {
+    return base::ErrStatus("%s is not a valid snapshot", path.c_str());
+  }
+  auto it = snapshot.packet();
+  {
+    if (!it) {
+      return base::ErrStatus("%s is not a valid snapshot", path.c_str());
+    }
+    SerializedTraceProcessorPacket::Decoder packet(*it);
+    if (!packet.has_snapshot_header()) {
+      return base::ErrStatus("%s is not a valid snapshot", path.c_str());
+    }
+    protos::pbzero::SerializedSnapshotHeader::Decoder header(
+        packet.snapshot_header());
+    if (header.format_version() != kFormatVersion ||
+        header.trace_processor_version().ToStdString() !=
+            base::GetVersionString()) {
+      return base::ErrStatus(
+          "%s was written by a different version of trace processor (%s)",
+          path.c_str(),
+          header.trace_processor_version().ToStdString().c_str());
+    }
+    ++it;
+  }
+
+  struct TablePackets {
+    Table* table;
+    protozero::ConstBytes table_packet;
+    std::vector<protozero::ConstBytes> columns;
+  };
+  base::FlatHashMap<std::string, Table*> tables_by_name;
+  for (const SnapshotTable& table : tables) {
+    tables_by_name.Insert(table.name, table.table);
+  }
+
+  std::vector<protozero::ConstBytes> blocks;
+  std::vector<protozero::ConstBytes> large_strings;
+  std::optional<protozero::ConstBytes> stats;
+  std::vector<TablePackets> table_packets;
+  for (; it; ++it) {
+    SerializedTraceProcessorPacket::Decoder packet(*it);
+    if (packet.has_string_pool()) {
+      protos::pbzero::SerializedStringPool::Decoder pool(packet.string_pool());
+      for (auto block = pool.blocks(); block; ++block) {
+        blocks.push_back(*block);
+      }
+      for (auto str = pool.large_strings(); str; ++str) {
+        large_strings.push_back(*str);
+      }
+    } else if (packet.has_stats()) {
+      stats = packet.stats();
+    } else if (packet.has_table()) {
+      protos::pbzero::SerializedTable::Decoder table(packet.table());
+      std::string name = table.table_name().ToStdString();
+      Table** table_ptr = tables_by_name.Find(name);
+      if (!table_ptr) {
+        return base::ErrStatus("Unknown table %s in snapshot", name.c_str());
+      }
+      table_packets.push_back({*table_ptr, packet.table(), {}});
+    } else if (packet.has_column()) {
+      if (table_packets.empty()) {
+        return base::ErrStatus("Column without table in snapshot");
+      }
+      table_packets.back().columns.push_back(packet.column());
+    } else {
+      return base::ErrStatus("Unexpected packet in snapshot");
+    }
+  }
+  if (table_packets.size() != tables.size()) {
+    return base::ErrStatus("Mismatched tables in snapshot");
+  }
+
+  StringPool pool;
+  if (!pool.Deserialize(blocks, large_strings) ||
+      !ContainsWithSameIds(pool, storage->string_pool())) {
+    return base::ErrStatus("Invalid string pool in snapshot");
+  }
+  // Tables keep a pointer to the string pool of the storage: the restored one
+  // replaces its contents.
+  *storage->mutable_string_pool() = std::move(pool);
+
+  if (stats) {
+    protos::pbzero::SerializedStats::Decoder stats_decoder(*stats);
+    for (auto stat_it = stats_decoder.stats(); stat_it; ++stat_it) {
+      protos::pbzero::SerializedStats::Stat::Decoder stat(*stat_it);
+      size_t key = stat.key();
+      if (key >= stats::kNumKeys) {
+        return base::ErrStatus("Invalid stat in snapshot");
+      }
+      if (stats::kTypes[key] == stats::kIndexed) {
+        for (auto value_it = stat.indexed_values(); value_it; ++value_it) {
+          protos::pbzero::SerializedStats::IndexedValue::Decoder value(
+              *value_it);
+          storage->SetIndexedStats(key, value.index(), value.value());
+        }
+      } else {
+        storage->SetStats(key, stat.value());
+      }
+    }
+  }
+
+  // Tables are serialized after their parents, which is the order they
+  // need to be restored in.
+  for (const TablePackets& table : table_packets) {
+    RETURN_IF_ERROR(table.table->Deserialize(table.table_packet, table.columns));
+  }
+  return base::OkStatus();
+}
+
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_TRACE_SNAPSHOT_H_
+#define SRC_TRACE_PROCESSOR_TRACE_SNAPSHOT_H_
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+
+namespace perfetto::trace_processor {
+
+class Table;
+class TraceStorage;
+
+// A table of a TraceStorage stored in snapshots.
+struct SnapshotTable {
+  std::string name;
+  Table* table;
+};
+
+// Writes a snapshot of the contents of |storage| to |path|: the string pool,
+// the stats and the rows of |tables|, which must list the parents of tables
+// before the tables extending them.
+//
+// The snapshot is a SerializedTraceProcessor proto (see serialization.proto)
+// which can only be loaded by the same version of trace processor.
+base::Status WriteTraceSnapshot(const TraceStorage& storage,
+                                const std::vector<SnapshotTable>& tables,
+                                const std::string& path);
+
+// Replaces the contents of |storage| with the snapshot written at |path| by
+// |WriteTraceSnapshot| with the same |tables|. |storage| must not contain any
+// data from a trace. If an error is returned, the contents of |storage| are
+// unspecified.
+base::Status LoadTraceSnapshot(const std::string& path,
+                               TraceStorage* storage,
+                               const std::vector<SnapshotTable>& tables);
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_TRACE_SNAPSHOT_H_
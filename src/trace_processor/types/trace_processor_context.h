@@ -26,6 +26,10 @@
 #include "src/trace_processor/util/trace_type.h"
 
 namespace perfetto {
+namespace base {
+class ThreadPool;
+}  // namespace base
+
 namespace trace_processor {
 
 class ArgsTracker;
@@ -89,6 +93,11 @@ class TraceProcessorContext {
   // |storage| is shared among multiple contexts in multi-machine tracing.
   std::shared_ptr<TraceStorage> storage;
 
+  // Used to parallelize CPU-bound ingestion work which does not touch
+  // |storage| (e.g. decompression and sorting). Only set when
+  // |config.ingestion_thread_count| > 1 and shared among multiple machines.
+  std::shared_ptr<base::ThreadPool> thread_pool;
+
   std::unique_ptr<TraceReaderRegistry> reader_registry;
 
   std::unique_ptr<ChunkedTraceReader> chunk_reader;
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/zstd_utils.h"
+
+// For bazel build.
+#include "perfetto/base/build_config.h"
+
+#include <cstring>
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace perfetto {
+namespace trace_processor {
+namespace util {
+
+namespace {
+// Little endian encoding of ZSTD_MAGICNUMBER.
+constexpr uint8_t kZstdMagic[] = {0x28, 0xb5, 0x2f, 0xfd};
+}  // namespace
+
+bool IsZstdSupported() {
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool IsZstdFrame(const uint8_t* data, size_t size) {
+  return size >= sizeof(kZstdMagic) &&
+         memcmp(data, kZstdMagic, sizeof(kZstdMagic)) == 0;
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)  // Real Implementation
+
+bool ZstdDecompress(const uint8_t* data,
+                    size_t size,
+                    std::vector<uint8_t>* output) {
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  if (!dctx)
+    return false;
+
+  ZSTD_inBuffer in{data, size, 0};
+  size_t ret = 0;
+  bool ok = true;
+  while (in.pos < in.size || ret != 0) {
+    // Decompress directly at the end of |output|, growing it as needed.
+    size_t offset = output->size();
+    output->resize(offset + ZSTD_DStreamOutSize());
+    ZSTD_outBuffer out{output->data() + offset, ZSTD_DStreamOutSize(), 0};
+    size_t in_pos = in.pos;
+    ret = ZSTD_decompressStream(dctx, &out, &in);
+    output->resize(offset + out.pos);
+    if (ZSTD_isError(ret)) {
+      ok = false;
+      break;
+    }
+    // No progress: the last frame is truncated.
+    if (in.pos == in_pos && out.pos == 0) {
+      ok = false;
+      break;
+    }
+  }
+  ZSTD_freeDCtx(dctx);
+  return ok;
+}
+
+#else  // PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+
+bool ZstdDecompress(const uint8_t*, size_t, std::vector<uint8_t>*) {
+  return false;
+}
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+
+}  // namespace util
+}  // namespace trace_processor
+}  // namespace perfetto
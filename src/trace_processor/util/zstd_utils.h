@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_UTIL_ZSTD_UTILS_H_
+#define SRC_TRACE_PROCESSOR_UTIL_ZSTD_UTILS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace perfetto {
+namespace trace_processor {
+namespace util {
+
+// Returns whether zstd related functionality is supported with the current
+// build flags.
+bool IsZstdSupported();
+
+// Returns whether |data| starts with the magic number of a zstd frame.
+bool IsZstdFrame(const uint8_t* data, size_t size);
+
+// Decompresses the zstd frames in |data| and appends the result to |output|.
+// Returns false if |data| is not a complete zstd stream or if zstd is not
+// supported.
+bool ZstdDecompress(const uint8_t* data,
+                    size_t size,
+                    std::vector<uint8_t>* output);
+
+}  // namespace util
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_UTIL_ZSTD_UTILS_H_
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/zstd_utils.h"
+
+#include <zstd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace util {
+namespace {
+
+std::vector<uint8_t> Compress(const std::string& input) {
+  std::vector<uint8_t> output(ZSTD_compressBound(input.size()));
+  size_t size = ZSTD_compress(output.data(), output.size(), input.data(),
+                              input.size(), ZSTD_CLEVEL_DEFAULT);
+  EXPECT_FALSE(ZSTD_isError(size));
+  output.resize(size);
+  return output;
+}
+
+std::string Decompress(const std::vector<uint8_t>& input, bool* ok) {
+  std::vector<uint8_t> output;
+  *ok = ZstdDecompress(input.data(), input.size(), &output);
+  return std::string(output.begin(), output.end());
+}
+
+TEST(ZstdUtilsTest, IsZstdFrame) {
+  std::vector<uint8_t> compressed = Compress("abc");
+  EXPECT_TRUE(IsZstdFrame(compressed.data(), compressed.size()));
+  EXPECT_FALSE(IsZstdFrame(compressed.data(), 3));
+
+  // Start of a zlib stream.
+  const uint8_t zlib[] = {0x78, 0x9c, 0x4b, 0x4c};
+  EXPECT_FALSE(IsZstdFrame(zlib, sizeof(zlib)));
+}
+
+TEST(ZstdUtilsTest, RoundTrip) {
+  std::string input;
+  for (uint32_t i = 0; i < 100000; ++i)
+    input += std::to_string(i);
+
+  bool ok = false;
+  EXPECT_EQ(Decompress(Compress(input), &ok), input);
+  EXPECT_TRUE(ok);
+}
+
+TEST(ZstdUtilsTest, MultipleFrames) {
+  std::vector<uint8_t> compressed = Compress("abc");
+  std::vector<uint8_t> second = Compress("def");
+  compressed.insert(compressed.end(), second.begin(), second.end());
+
+  bool ok = false;
+  EXPECT_EQ(Decompress(compressed, &ok), "abcdef");
+  EXPECT_TRUE(ok);
+}
+
+TEST(ZstdUtilsTest, Truncated) {
+  std::vector<uint8_t> compressed = Compress(std::string(10000, 'a'));
+  compressed.resize(compressed.size() - 1);
+
+  bool ok = true;
+  Decompress(compressed, &ok);
+  EXPECT_FALSE(ok);
+}
+
+TEST(ZstdUtilsTest, Corrupted) {
+  std::vector<uint8_t> compressed = Compress("abc");
+  for (size_t i = 4; i < compressed.size(); ++i)
+    compressed[i] = 0xff;
+
+  bool ok = true;
+  Decompress(compressed, &ok);
+  EXPECT_FALSE(ok);
+}
+
+}  // namespace
+}  // namespace util
+}  // namespace trace_processor
+}  // namespace perfetto
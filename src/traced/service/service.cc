@@ -15,12 +15,18 @@
  */
 
 #include <stdio.h>
+
 #include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/getopt.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/unix_socket.h"
 #include "perfetto/ext/base/unix_task_runner.h"
 #include "perfetto/ext/base/utils.h"
@@ -40,6 +46,10 @@
 #include "src/tracing/service/zlib_compressor.h"
 #endif
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+#include "src/tracing/service/zstd_compressor.h"
+#endif
+
 namespace perfetto {
 namespace {
 void PrintUsage(const char* prog_name) {
@@ -130,10 +140,34 @@ int PERFETTO_EXPORT_ENTRYPOINT ServiceMain(int argc, char** argv) {
   }
 
   base::UnixTaskRunner task_runner;
+  // Filter and compress the packets read from the buffers (and write them
+  // into files), so that large reads don't delay the handling of commits and
+  // IPCs on |task_runner|. Each tracing session which filters or compresses is
+  // assigned to one of them, so that sessions don't delay each other either.
+  // The threads are only started when such sessions need them. Reading the
+  // buffers still happens on |task_runner|.
+  static constexpr size_t kMaxPacketProcessingThreads = 8;
+  std::vector<std::unique_ptr<base::ThreadTaskRunner>>
+      packet_processing_task_runners;
   std::unique_ptr<ServiceIPCHost> svc;
   TracingService::InitOpts init_opts = {};
+  // hardware_concurrency() returns 0 if unknown.
+  init_opts.max_packet_processing_task_runners = std::clamp<size_t>(
+      std::thread::hardware_concurrency(), 1, kMaxPacketProcessingThreads);
+  init_opts.create_packet_processing_task_runner =
+      [&packet_processing_task_runners]() -> base::TaskRunner* {
+    std::string name =
+        "traced.pkt." + std::to_string(packet_processing_task_runners.size());
+    packet_processing_task_runners.push_back(
+        std::make_unique<base::ThreadTaskRunner>(
+            base::ThreadTaskRunner::CreateAndStart(name)));
+    return packet_processing_task_runners.back().get();
+  };
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
   init_opts.compressor_fn = &ZlibCompressFn;
+#endif
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+  init_opts.zstd_compressor_fn = &ZstdCompressFn;
 #endif
   if (enable_relay_endpoint)
     init_opts.enable_relay_endpoint = true;
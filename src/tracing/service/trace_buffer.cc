@@ -16,6 +16,7 @@
 
 #include "src/tracing/service/trace_buffer.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "perfetto/base/logging.h"
@@ -41,6 +42,14 @@ constexpr uint8_t kLastPacketContinuesOnNextChunk =
     SharedMemoryABI::ChunkHeader::kLastPacketContinuesOnNextChunk;
 constexpr uint8_t kChunkNeedsPatching =
     SharedMemoryABI::ChunkHeader::kChunkNeedsPatching;
+
+// Orders the sequences of the index by {ProducerID, WriterID}.
+struct SequenceLess {
+  template <typename ChunkSequence>
+  bool operator()(const ChunkSequence& seq, ProducerAndWriterID id) const {
+    return seq.producer_and_writer_id() < id;
+  }
+};
 }  // namespace.
 
 const size_t TraceBuffer::InlineChunkHeaderSize = sizeof(ChunkRecord);
@@ -81,8 +90,7 @@ bool TraceBuffer::Initialize(size_t size) {
   max_chunk_size_ = std::min(size, ChunkRecord::kMaxSize);
   wptr_ = begin();
   index_.clear();
-  last_chunk_id_written_.clear();
-  read_iter_ = GetReadIterForSequence(index_.end());
+  read_iter_ = GetReadIterForSequence(index_.size());
   return true;
 }
 
@@ -144,9 +152,9 @@ void TraceBuffer::CopyChunkUntrusted(
   // before receiving commit requests for them from the producer. Note that the
   // service may scrape and thus override chunks in arbitrary order since the
   // chunks aren't ordered in the SMB.
-  const auto it = index_.find(key);
-  if (PERFETTO_UNLIKELY(it != index_.end())) {
-    ChunkMeta* record_meta = &it->second;
+  ChunkSequence* seq = FindSequence(producer_id_trusted, writer_id);
+  ChunkMeta* record_meta = seq ? seq->Find(chunk_id) : nullptr;
+  if (PERFETTO_UNLIKELY(record_meta)) {
     ChunkRecord* prev = GetChunkRecordAt(begin() + record_meta->record_off);
 
     // Verify that the old chunk's metadata corresponds to the new one.
@@ -178,13 +186,11 @@ void TraceBuffer::CopyChunkUntrusted(
     // chunk N after having read from chunk N+1, thereby violating sequential
     // read of packets. This shouldn't happen if the producer is well-behaved,
     // because it shouldn't start chunk N+1 before completing chunk N.
-    ChunkMeta::Key subsequent_key = key;
     static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                   "ChunkID wraps");
-    subsequent_key.chunk_id++;
-    const auto subsequent_it = index_.find(subsequent_key);
-    if (subsequent_it != index_.end() &&
-        subsequent_it->second.num_fragments_read > 0) {
+    const ChunkMeta* subsequent_meta =
+        seq->Find(static_cast<ChunkID>(chunk_id + 1));
+    if (subsequent_meta && subsequent_meta->num_fragments_read > 0) {
       stats_.set_abi_violations(stats_.abi_violations() + 1);
       PERFETTO_DCHECK(suppress_client_dchecks_for_testing_);
       return;
@@ -263,11 +269,11 @@ void TraceBuffer::CopyChunkUntrusted(
   stats_.set_chunks_written(stats_.chunks_written() + 1);
   stats_.set_bytes_written(stats_.bytes_written() + record_size);
 
+  // |seq| is nullptr if this is the first chunk of the sequence.
+  seq = GetOrCreateSequence(producer_id_trusted, writer_id);
   uint32_t chunk_off = GetOffset(GetChunkRecordAt(wptr_));
-  auto it_and_inserted =
-      index_.emplace(key, ChunkMeta(chunk_off, num_fragments, chunk_complete,
-                                    chunk_flags, client_identity_trusted));
-  PERFETTO_DCHECK(it_and_inserted.second);
+  seq->Insert(ChunkMeta(chunk_id, chunk_off, num_fragments, chunk_complete,
+                        chunk_flags, client_identity_trusted));
   TRACE_BUFFER_DLOG("  copying @ [%" PRIdPTR " - %" PRIdPTR "] %zu", wptr_ - begin(),
                     uintptr_t(wptr_ - begin()) + record_size, record_size);
   WriteChunkRecord(wptr_, record, src, size);
@@ -292,8 +298,7 @@ void TraceBuffer::CopyChunkUntrusted(
   // last_chunk_id shouldn't be updated even though it's larger (e.g. |chunk_id|
   // = kMaxChunkId and |last_chunk_id| = 1; chunk_id - last_chunk_id =
   // kMaxChunkId - 1).
-  auto producer_and_writer_id = std::make_pair(producer_id_trusted, writer_id);
-  ChunkID& last_chunk_id = last_chunk_id_written_[producer_and_writer_id];
+  ChunkID& last_chunk_id = seq->last_chunk_id_written;
   static_assert(std::numeric_limits<ChunkID>::max() == kMaxChunkID,
                 "This code assumes that ChunkID wraps at kMaxChunkID");
   if (chunk_id - last_chunk_id < kMaxChunkID / 2) {
@@ -318,7 +323,9 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
   TRACE_BUFFER_DLOG("Delete [%zu %zu]", wptr_ - begin(), search_end - begin());
   DcheckIsAlignedAndWithinBounds(wptr_);
   PERFETTO_DCHECK(search_end <= end());
-  std::vector<ChunkMap::iterator> index_delete;
+  // The chunks are removed from the index only at the end, as the deletion
+  // is aborted if it would overwrite unread chunks in kDiscard mode.
+  std::vector<std::pair<ChunkSequence*, ChunkID>> index_delete;
   uint64_t chunks_overwritten = stats_.chunks_overwritten();
   uint64_t bytes_overwritten = stats_.bytes_overwritten();
   uint64_t padding_bytes_cleared = stats_.padding_bytes_cleared();
@@ -344,17 +351,17 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
     // records are not part of the index).
     if (PERFETTO_LIKELY(!next_chunk.is_padding)) {
       ChunkMeta::Key key(next_chunk);
-      auto it = index_.find(key);
+      ChunkSequence* seq = FindSequence(key.producer_id, key.writer_id);
+      const ChunkMeta* meta = seq ? seq->Find(key.chunk_id) : nullptr;
       bool will_remove = false;
-      if (PERFETTO_LIKELY(it != index_.end())) {
-        const ChunkMeta& meta = it->second;
-        if (PERFETTO_UNLIKELY(meta.num_fragments_read < meta.num_fragments)) {
+      if (PERFETTO_LIKELY(meta)) {
+        if (PERFETTO_UNLIKELY(meta->num_fragments_read < meta->num_fragments)) {
           if (overwrite_policy_ == kDiscard)
             return -1;
           chunks_overwritten++;
           bytes_overwritten += next_chunk.size;
         }
-        index_delete.push_back(it);
+        index_delete.emplace_back(seq, key.chunk_id);
         will_remove = true;
       }
       TRACE_BUFFER_DLOG(
@@ -376,9 +383,11 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
     PERFETTO_CHECK(next_chunk_ptr <= end());
   }
 
-  // Remove from the index.
-  for (auto it : index_delete) {
-    index_.erase(it);
+  // Remove from the index. The chunks are looked up again, as erasing a chunk
+  // invalidates the pointers to the others in the same sequence.
+  for (const auto& seq_and_chunk_id : index_delete) {
+    ChunkSequence* seq = seq_and_chunk_id.first;
+    seq->Erase(seq->Find(seq_and_chunk_id.second));
   }
   stats_.set_chunks_overwritten(chunks_overwritten);
   stats_.set_bytes_overwritten(bytes_overwritten);
@@ -407,12 +416,13 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
                                         bool other_patches_pending) {
   PERFETTO_CHECK(!read_only_);
   ChunkMeta::Key key(producer_id, writer_id, chunk_id);
-  auto it = index_.find(key);
-  if (it == index_.end()) {
+  ChunkSequence* seq = FindSequence(producer_id, writer_id);
+  ChunkMeta* meta = seq ? seq->Find(chunk_id) : nullptr;
+  if (!meta) {
     stats_.set_patches_failed(stats_.patches_failed() + 1);
     return false;
   }
-  ChunkMeta& chunk_meta = it->second;
+  ChunkMeta& chunk_meta = *meta;
 
   // Check that the index is consistent with the actual ProducerID/WriterID
   // stored in the ChunkRecord.
@@ -459,77 +469,136 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
 }
 
 void TraceBuffer::BeginRead() {
-  read_iter_ = GetReadIterForSequence(index_.begin());
+  read_iter_ = GetReadIterForSequence(0);
 #if PERFETTO_DCHECK_IS_ON()
   changed_since_last_read_ = false;
 #endif
 }
 
 TraceBuffer::SequenceIterator TraceBuffer::GetReadIterForSequence(
-    ChunkMap::iterator seq_begin) {
+    size_t seq_idx) {
+  // Skip the sequences whose chunks have all been overwritten.
+  while (seq_idx < index_.size() && index_[seq_idx].empty())
+    seq_idx++;
+
   SequenceIterator iter;
-  iter.seq_begin = seq_begin;
-  if (seq_begin == index_.end()) {
-    iter.cur = iter.seq_end = index_.end();
+  if (seq_idx >= index_.size()) {
+    iter.seq_idx = index_.size();
     return iter;
   }
-
-#if PERFETTO_DCHECK_IS_ON()
-  // Either |seq_begin| is == index_.begin() or the item immediately before must
-  // belong to a different {ProducerID, WriterID} sequence.
-  if (seq_begin != index_.begin() && seq_begin != index_.end()) {
-    auto prev_it = seq_begin;
-    prev_it--;
-    PERFETTO_DCHECK(
-        seq_begin == index_.begin() ||
-        std::tie(prev_it->first.producer_id, prev_it->first.writer_id) <
-            std::tie(seq_begin->first.producer_id, seq_begin->first.writer_id));
-  }
-#endif
-
-  // Find the first entry that has a greater {ProducerID, WriterID} (or just
-  // index_.end() if we reached the end).
-  ChunkMeta::Key key = seq_begin->first;  // Deliberate copy.
-  key.chunk_id = kMaxChunkID;
-  iter.seq_end = index_.upper_bound(key);
-  PERFETTO_DCHECK(iter.seq_begin != iter.seq_end);
-
-  // Now find the first entry between [seq_begin, seq_end) that is
-  // > last_chunk_id_written_. This is where we the sequence will start (see
-  // notes about wrapping of IDs in the header).
-  auto producer_and_writer_id = std::make_pair(key.producer_id, key.writer_id);
-  PERFETTO_DCHECK(last_chunk_id_written_.count(producer_and_writer_id));
-  iter.wrapping_id = last_chunk_id_written_[producer_and_writer_id];
-  key.chunk_id = iter.wrapping_id;
-  iter.cur = index_.upper_bound(key);
+  ChunkSequence& seq = index_[seq_idx];
+  iter.seq_idx = seq_idx;
+  iter.seq = &seq;
+  iter.seq_begin = seq.begin();
+  iter.seq_end = seq.end();
+
+  // Now find the first chunk that is > |last_chunk_id_written|. This is where
+  // the sequence will start (see notes about wrapping of IDs in the header).
+  iter.wrapping_id = seq.last_chunk_id_written;
+  iter.cur = seq.UpperBound(iter.wrapping_id);
   if (iter.cur == iter.seq_end)
     iter.cur = iter.seq_begin;
   return iter;
 }
 
+TraceBuffer::ChunkSequence* TraceBuffer::FindSequence(ProducerID producer_id,
+                                                      WriterID writer_id) {
+  const ProducerAndWriterID id = MkProducerAndWriterID(producer_id, writer_id);
+  auto it = std::lower_bound(index_.begin(), index_.end(), id, SequenceLess());
+  if (it == index_.end() || it->producer_and_writer_id() != id)
+    return nullptr;
+  return &*it;
+}
+
+TraceBuffer::ChunkSequence* TraceBuffer::GetOrCreateSequence(
+    ProducerID producer_id,
+    WriterID writer_id) {
+  const ProducerAndWriterID id = MkProducerAndWriterID(producer_id, writer_id);
+  auto it = std::lower_bound(index_.begin(), index_.end(), id, SequenceLess());
+  if (it == index_.end() || it->producer_and_writer_id() != id)
+    it = index_.emplace(it, producer_id, writer_id);
+  return &*it;
+}
+
+TraceBuffer::ChunkMeta* TraceBuffer::ChunkSequence::UpperBound(
+    ChunkID chunk_id) {
+  // Fast path for the common case of reading after the last chunk written.
+  if (empty() || chunks.back().chunk_id <= chunk_id)
+    return end();
+  return std::upper_bound(begin(), end(), chunk_id,
+                          [](ChunkID value, const ChunkMeta& meta) {
+                            return value < meta.chunk_id;
+                          });
+}
+
+TraceBuffer::ChunkMeta* TraceBuffer::ChunkSequence::Find(ChunkID chunk_id) {
+  ChunkMeta* it = std::lower_bound(begin(), end(), chunk_id,
+                                   [](const ChunkMeta& meta, ChunkID value) {
+                                     return meta.chunk_id < value;
+                                   });
+  if (it == end() || it->chunk_id != chunk_id)
+    return nullptr;
+  return it;
+}
+
+void TraceBuffer::ChunkSequence::Insert(const ChunkMeta& meta) {
+  // Fast path: chunks are usually copied in order.
+  if (empty() || chunks.back().chunk_id < meta.chunk_id) {
+    chunks.push_back(meta);
+    return;
+  }
+  ChunkMeta* it = UpperBound(meta.chunk_id);
+  PERFETTO_DCHECK(it == begin() || (it - 1)->chunk_id != meta.chunk_id);
+  if (it == begin() && first > 0) {
+    // Reuse the slot of a removed chunk.
+    chunks[--first] = meta;
+    return;
+  }
+  chunks.insert(chunks.begin() + (it - chunks.data()), meta);
+}
+
+void TraceBuffer::ChunkSequence::Erase(ChunkMeta* meta) {
+  PERFETTO_DCHECK(meta >= begin() && meta < end());
+  if (meta == begin()) {
+    first++;
+  } else {
+    chunks.erase(chunks.begin() + (meta - chunks.data()));
+  }
+  if (empty()) {
+    chunks.clear();
+    first = 0;
+  } else if (first >= 64 && first * 2 >= chunks.size()) {
+    // Compact, so that the removed chunks don't waste more than half of the
+    // array.
+    auto compacted_end = chunks.begin() + static_cast<ptrdiff_t>(first);
+    chunks.erase(chunks.begin(), compacted_end);
+    first = 0;
+  }
+}
+
 void TraceBuffer::SequenceIterator::MoveNext() {
   // Stop iterating when we reach the end of the sequence.
   // Note: |seq_begin| might be == |seq_end|.
-  if (cur == seq_end || cur->first.chunk_id == wrapping_id) {
+  if (cur == seq_end || cur->chunk_id == wrapping_id) {
     cur = seq_end;
     return;
   }
 
   // If the current chunk wasn't completed yet, we shouldn't advance past it as
   // it may be rewritten with additional packets.
-  if (!cur->second.is_complete()) {
+  if (!cur->is_complete()) {
     cur = seq_end;
     return;
   }
 
-  ChunkID last_chunk_id = cur->first.chunk_id;
+  ChunkID last_chunk_id = cur->chunk_id;
   if (++cur == seq_end)
     cur = seq_begin;
 
   // There may be a missing chunk in the sequence of chunks, in which case the
   // next chunk's ID won't follow the last one's. If so, skip the rest of the
   // sequence. We'll return to it later once the hole is filled.
-  if (last_chunk_id + 1 != cur->first.chunk_id)
+  if (last_chunk_id + 1 != cur->chunk_id)
     cur = seq_end;
 }
 
@@ -560,16 +629,17 @@ bool TraceBuffer::ReadNextTracePacket(
   for (;; read_iter_.MoveNext()) {
     if (PERFETTO_UNLIKELY(!read_iter_.is_valid())) {
       // We ran out of chunks in the current {ProducerID, WriterID} sequence or
-      // we just reached the index_.end().
+      // we just reached the end of the index.
 
-      if (PERFETTO_UNLIKELY(read_iter_.seq_end == index_.end()))
+      if (PERFETTO_UNLIKELY(read_iter_.seq_idx >= index_.size()))
         return false;
 
       // We reached the end of sequence, move to the next one.
-      // Note: ++read_iter_.seq_end might become index_.end(), but
+      // Note: |seq_idx| + 1 might be past the last sequence, but
       // GetReadIterForSequence() knows how to deal with that.
-      read_iter_ = GetReadIterForSequence(read_iter_.seq_end);
-      PERFETTO_DCHECK(read_iter_.is_valid() && read_iter_.cur != index_.end());
+      read_iter_ = GetReadIterForSequence(read_iter_.seq_idx + 1);
+      if (PERFETTO_UNLIKELY(!read_iter_.is_valid()))
+        return false;  // Only empty sequences were left.
       previous_packet_dropped = true;
     }
 
@@ -918,7 +988,6 @@ TraceBuffer::TraceBuffer(CloneCtor, const TraceBuffer& src)
 
   EnsureCommitted(src.used_size_);
   memcpy(data_.Get(), src.data_.Get(), src.used_size_);
-  last_chunk_id_written_ = src.last_chunk_id_written_;
 
   stats_ = src.stats_;
   stats_.set_bytes_read(0);
@@ -927,14 +996,15 @@ TraceBuffer::TraceBuffer(CloneCtor, const TraceBuffer& src)
   stats_.set_readaheads_succeeded(0);
 
   // Copy the index of chunk metadata and reset the read states.
-  index_ = ChunkMap(src.index_);
-  for (auto& kv : index_) {
-    ChunkMeta& chunk_meta = kv.second;
-    chunk_meta.num_fragments_read = 0;
-    chunk_meta.cur_fragment_offset = 0;
-    chunk_meta.set_last_read_packet_skipped(false);
+  index_ = src.index_;
+  for (ChunkSequence& seq : index_) {
+    for (ChunkMeta& chunk_meta : seq.chunks) {
+      chunk_meta.num_fragments_read = 0;
+      chunk_meta.cur_fragment_offset = 0;
+      chunk_meta.set_last_read_packet_skipped(false);
+    }
   }
-  read_iter_ = SequenceIterator();
+  read_iter_ = GetReadIterForSequence(index_.size());
 }
 
 }  // namespace perfetto
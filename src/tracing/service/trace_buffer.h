@@ -22,8 +22,8 @@
 
 #include <array>
 #include <limits>
-#include <map>
 #include <tuple>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/flat_hash_map.h"
@@ -114,7 +114,12 @@ class TracePacket;
 //
 // However, in order to keep some operations (patching and reading) fast, a
 // lookaside index is maintained (in |index_|), keeping each chunk in the buffer
-// indexed by their {ProducerID, WriterID, ChunkID} tuple.
+// indexed by their {ProducerID, WriterID, ChunkID} tuple. The index is a flat
+// array of sequences (one per {ProducerID, WriterID}), each holding a flat
+// array of the metadata of its chunks sorted by ChunkID, rather than a tree
+// with one node for each chunk: with thousands of writers and hundreds of MB of
+// buffer, allocating and chasing one node per chunk dominates the cost of
+// copying and reading back chunks.
 //
 // Patching data out-of-band
 // -------------------------
@@ -355,18 +360,18 @@ class TraceBuffer {
         std::numeric_limits<decltype(size)>::max();
   };
 
-  // Lookaside index entry. This serves two purposes:
+  // Lookaside index entry, stored in the ChunkSequence of its
+  // {ProducerID, WriterID}. This serves two purposes:
   // 1) Allow a fast lookup of ChunkRecord by their ID (the tuple
   //   {ProducerID, WriterID, ChunkID}). This is used when applying out-of-band
   //   patches to the contents of the chunks after they have been copied into
   //   the TraceBuffer.
-  // 2) keep the chunks ordered by their ID. This is used when reading back.
-  // 3) Keep metadata about the status of the chunk, e.g. whether the contents
+  // 2) Keep metadata about the status of the chunk, e.g. whether the contents
   //    have been read already and should be skipped in a future read pass.
   // This struct should not have any field that is essential for reconstructing
   // the contents of the buffer from a crash dump.
   struct ChunkMeta {
-    // Key used for sorting in the map.
+    // The full ID of a chunk.
     struct Key {
       Key(ProducerID p, WriterID w, ChunkID c)
           : producer_id{p}, writer_id{w}, chunk_id{c} {}
@@ -377,14 +382,6 @@ class TraceBuffer {
       explicit Key(const ChunkRecord& cr)
           : Key(cr.producer_id, cr.writer_id, cr.chunk_id) {}
 
-      // Note that this sorting doesn't keep into account the fact that ChunkID
-      // will wrap over at some point. The extra logic in SequenceIterator deals
-      // with that.
-      bool operator<(const Key& other) const {
-        return std::tie(producer_id, writer_id, chunk_id) <
-               std::tie(other.producer_id, other.writer_id, other.chunk_id);
-      }
-
       bool operator==(const Key& other) const {
         return std::tie(producer_id, writer_id, chunk_id) ==
                std::tie(other.producer_id, other.writer_id, other.chunk_id);
@@ -413,12 +410,14 @@ class TraceBuffer {
       kLastReadPacketSkipped = 1 << 1
     };
 
-    ChunkMeta(uint32_t _record_off,
+    ChunkMeta(ChunkID _chunk_id,
+              uint32_t _record_off,
               uint16_t _num_fragments,
               bool complete,
               uint8_t _flags,
               const ClientIdentity& client_identity)
-        : record_off{_record_off},
+        : chunk_id{_chunk_id},
+          record_off{_record_off},
           client_identity_trusted(client_identity),
           flags{_flags},
           num_fragments{_num_fragments} {
@@ -427,6 +426,7 @@ class TraceBuffer {
     }
 
     ChunkMeta(const ChunkMeta&) noexcept = default;
+    ChunkMeta& operator=(const ChunkMeta&) noexcept = default;
 
     bool is_complete() const { return index_flags & kComplete; }
 
@@ -450,8 +450,11 @@ class TraceBuffer {
       }
     }
 
-    const uint32_t record_off;  // Offset of ChunkRecord within |data_|.
-    const ClientIdentity client_identity_trusted;
+    // Matches |chunk_record->chunk_id|. The ProducerID and WriterID are stored
+    // only once in the ChunkSequence.
+    ChunkID chunk_id;
+    uint32_t record_off;  // Offset of ChunkRecord within |data_|.
+    ClientIdentity client_identity_trusted;
     // Flags set by TraceBuffer to track the state of the chunk in the index.
     uint8_t index_flags = 0;
 
@@ -471,12 +474,63 @@ class TraceBuffer {
     uint16_t cur_fragment_offset = 0;
   };
 
-  using ChunkMap = std::map<ChunkMeta::Key, ChunkMeta>;
+  // The chunks of a {ProducerID, WriterID} sequence, sorted by ChunkID. Note
+  // that this sorting doesn't keep into account the fact that ChunkID will wrap
+  // over at some point. The extra logic in SequenceIterator deals with that.
+  //
+  // Chunks are almost always added with a ChunkID greater than all the others
+  // and overwritten (and hence removed) oldest first, so |chunks| is used as a
+  // queue: removing the first chunk just advances |first|, and the array is
+  // compacted only once most of it is made of removed entries.
+  struct ChunkSequence {
+    ChunkSequence(ProducerID p, WriterID w) : producer_id{p}, writer_id{w} {}
+
+    ProducerAndWriterID producer_and_writer_id() const {
+      return MkProducerAndWriterID(producer_id, writer_id);
+    }
+
+    ChunkMeta* begin() { return chunks.data() + first; }
+    ChunkMeta* end() { return chunks.data() + chunks.size(); }
+    bool empty() const { return first == chunks.size(); }
+    size_t size() const { return chunks.size() - first; }
+
+    // Returns the first chunk with a ChunkID > |chunk_id|, or end().
+    ChunkMeta* UpperBound(ChunkID chunk_id);
+
+    // Returns the chunk with the given ID, or nullptr.
+    ChunkMeta* Find(ChunkID chunk_id);
+
+    // Adds a chunk, which must not be in the sequence already.
+    void Insert(const ChunkMeta&);
+
+    // Removes the chunk. Invalidates the pointers to the other chunks.
+    void Erase(ChunkMeta*);
+
+    ProducerID producer_id;
+    WriterID writer_id;
+
+    // The highest ChunkID written, taking into account a potential overflow of
+    // ChunkIDs. In the case of overflow, stores the highest ChunkID written
+    // since the overflow.
+    ChunkID last_chunk_id_written = 0;
+
+    // Only the entries in [|first|, end) are valid.
+    std::vector<ChunkMeta> chunks;
+    size_t first = 0;
+  };
+
+  // Sorted by {ProducerID, WriterID}. A sequence is kept even after all its
+  // chunks have been overwritten, to remember |last_chunk_id_written|.
+  //
+  // TODO(primiano): should clean up empty sequences. Right now this grows
+  // without bounds (although realistically is not a problem unless we have too
+  // many producers/writers within the same trace session).
+  using ChunkIndex = std::vector<ChunkSequence>;
 
-  // Allows to iterate over a sub-sequence of |index_| for all keys belonging to
-  // the same {ProducerID,WriterID}. Furthermore takes into account the wrapping
-  // of ChunkID. Instances are valid only as long as the |index_| is not altered
-  // (can be used safely only between adjacent ReadNextTracePacket() calls).
+  // Allows to iterate over the chunks of a ChunkSequence, taking into account
+  // the wrapping of ChunkID. Instances are valid only as long as the |index_|
+  // is not altered (can be used safely only between adjacent
+  // ReadNextTracePacket() calls).
   // The order of the iteration will proceed in the following order:
   // |wrapping_id| + 1 -> |seq_end|, |seq_begin| -> |wrapping_id|.
   // Practical example:
@@ -487,38 +541,45 @@ class TraceBuffer {
   //   through a CopyChunkUntrusted()).
   // The resulting iteration order will be: c5, c6, c7, c0, c1, c2, c3, c4.
   struct SequenceIterator {
-    // Points to the 1st key (the one with the numerically min ChunkID).
-    ChunkMap::iterator seq_begin;
+    // Index of the sequence in |index_|, == index_.size() past the last one.
+    size_t seq_idx = 0;
+
+    // The sequence being iterated, nullptr past the last one.
+    const ChunkSequence* seq = nullptr;
 
-    // Points one past the last key (the one with the numerically max ChunkID).
-    ChunkMap::iterator seq_end;
+    // Points to the 1st chunk (the one with the numerically min ChunkID).
+    ChunkMeta* seq_begin = nullptr;
 
-    // Current iterator, always >= seq_begin && <= seq_end.
-    ChunkMap::iterator cur;
+    // Points one past the last chunk (the one with the numerically max
+    // ChunkID).
+    ChunkMeta* seq_end = nullptr;
+
+    // Current chunk, always >= seq_begin && <= seq_end.
+    ChunkMeta* cur = nullptr;
 
     // The latest ChunkID written. Determines the start/end of the sequence.
-    ChunkID wrapping_id;
+    ChunkID wrapping_id = 0;
 
     bool is_valid() const { return cur != seq_end; }
 
     ProducerID producer_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.producer_id;
+      return seq->producer_id;
     }
 
     WriterID writer_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.writer_id;
+      return seq->writer_id;
     }
 
     ChunkID chunk_id() const {
       PERFETTO_DCHECK(is_valid());
-      return cur->first.chunk_id;
+      return cur->chunk_id;
     }
 
     ChunkMeta& operator*() {
       PERFETTO_DCHECK(is_valid());
-      return cur->second;
+      return *cur;
     }
 
     // Moves |cur| to the next chunk in the index.
@@ -552,14 +613,19 @@ class TraceBuffer {
 
   bool Initialize(size_t size);
 
-  // Returns an object that allows to iterate over chunks in the |index_| that
-  // have the same {ProducerID, WriterID} of
-  // |seq_begin.first.{producer,writer}_id|. |seq_begin| must be an iterator to
-  // the first entry in the |index_| that has a different {ProducerID, WriterID}
-  // from the previous one. It is valid for |seq_begin| to be == index_.end()
-  // (i.e. if the index is empty). The iteration takes care of ChunkID wrapping,
-  // by using |last_chunk_id_|.
-  SequenceIterator GetReadIterForSequence(ChunkMap::iterator seq_begin);
+  // Returns an object that allows to iterate over the chunks of the first
+  // non-empty sequence in |index_| at or after |seq_idx|. It is valid for
+  // |seq_idx| to be >= index_.size() (i.e. if the index is empty), in which
+  // case the returned iterator is not valid. The iteration takes care of
+  // ChunkID wrapping, by using |last_chunk_id_written|.
+  SequenceIterator GetReadIterForSequence(size_t seq_idx);
+
+  // Returns the sequence for the given IDs, or nullptr.
+  ChunkSequence* FindSequence(ProducerID, WriterID);
+
+  // Returns the sequence for the given IDs, adding it if it doesn't exist.
+  // Invalidates the pointers to the other sequences.
+  ChunkSequence* GetOrCreateSequence(ProducerID, WriterID);
 
   // Used as a last resort when a buffer corruption is detected.
   void ClearContentsAndResetRWCursors();
@@ -693,7 +759,7 @@ class TraceBuffer {
 
   // An index that keeps track of the positions and metadata of each
   // ChunkRecord.
-  ChunkMap index_;
+  ChunkIndex index_;
 
   // Read iterator used for ReadNext(). It is reset by calling BeginRead().
   // It becomes invalid after any call to methods that alters the |index_|.
@@ -710,15 +776,6 @@ class TraceBuffer {
   // a write fails because it would overwrite unread chunks.
   bool discard_writes_ = false;
 
-  // Keeps track of the highest ChunkID written for a given sequence, taking
-  // into account a potential overflow of ChunkIDs. In the case of overflow,
-  // stores the highest ChunkID written since the overflow.
-  //
-  // TODO(primiano): should clean up keys from this map. Right now it grows
-  // without bounds (although realistically is not a problem unless we have too
-  // many producers/writers within the same trace session).
-  std::map<std::pair<ProducerID, WriterID>, ChunkID> last_chunk_id_written_;
-
   // Statistics about buffer usage.
   TraceStats::BufferStats stats_;
 
@@ -0,0 +1,142 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/tracing/core/basic_types.h"
+#include "perfetto/ext/tracing/core/client_identity.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "src/tracing/service/trace_buffer.h"
+
+namespace {
+
+using perfetto::ChunkID;
+using perfetto::ClientIdentity;
+using perfetto::ProducerID;
+using perfetto::TraceBuffer;
+using perfetto::TracePacket;
+using perfetto::WriterID;
+
+constexpr size_t kBufferSize = 64 * 1024 * 1024;
+
+// Chunks as big as the SMB pages (i.e. 4KB, including the ChunkRecord) with 8
+// packets each.
+constexpr size_t kChunkPayloadSize = 4096 - 16;
+constexpr size_t kPacketsPerChunk = 8;
+
+// Chunks copied between two reads, in BM_TraceBufferCopyAndRead.
+constexpr size_t kChunksPerRead = 1024;
+
+std::vector<uint8_t> CreateChunkPayload() {
+  std::vector<uint8_t> payload(kChunkPayloadSize);
+  constexpr size_t kPacketSize = kChunkPayloadSize / kPacketsPerChunk;
+  constexpr size_t kHeaderSize =
+      protozero::proto_utils::kMessageLengthFieldSize;
+  for (size_t i = 0; i < kPacketsPerChunk; i++) {
+    uint8_t* packet = &payload[i * kPacketSize];
+    protozero::proto_utils::WriteRedundantVarInt(kPacketSize - kHeaderSize,
+                                                 packet);
+    memset(packet + kHeaderSize, 'x', kPacketSize - kHeaderSize);
+  }
+  return payload;
+}
+
+// Copies chunks for |num_writers| writers, spread over several producers, in
+// round robin.
+class ChunkWriter {
+ public:
+  explicit ChunkWriter(size_t num_writers)
+      : payload_(CreateChunkPayload()), next_chunk_ids_(num_writers) {}
+
+  void CopyNextChunk(TraceBuffer* buf) {
+    const size_t writer = next_writer_;
+    next_writer_ = (next_writer_ + 1) % next_chunk_ids_.size();
+    const auto producer_id = static_cast<ProducerID>(1 + writer / 256);
+    const auto writer_id = static_cast<WriterID>(1 + writer % 256);
+    buf->CopyChunkUntrusted(producer_id, ClientIdentity(1000, 1000), writer_id,
+                            next_chunk_ids_[writer]++,
+                            static_cast<uint16_t>(kPacketsPerChunk),
+                            /*chunk_flags=*/0, /*chunk_complete=*/true,
+                            payload_.data(), payload_.size());
+  }
+
+ private:
+  std::vector<uint8_t> payload_;
+  std::vector<ChunkID> next_chunk_ids_;
+  size_t next_writer_ = 0;
+};
+
+void ReadAll(TraceBuffer* buf) {
+  buf->BeginRead();
+  TracePacket packet;
+  TraceBuffer::PacketSequenceProperties sequence_properties;
+  bool previous_packet_dropped;
+  while (buf->ReadNextTracePacket(&packet, &sequence_properties,
+                                  &previous_packet_dropped)) {
+    packet = TracePacket();
+  }
+}
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+void WriterCounts(benchmark::internal::Benchmark* b) {
+  b->Arg(1)->Arg(64)->Arg(1024);
+  if (!IsBenchmarkFunctionalOnly())
+    b->Arg(8192);
+}
+
+}  // namespace
+
+static void BM_TraceBufferCopyChunks(benchmark::State& state) {
+  std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(kBufferSize);
+  PERFETTO_CHECK(buf);
+  ChunkWriter writer(static_cast<size_t>(state.range(0)));
+
+  // Fill the buffer first, so that each copy overwrites an older chunk.
+  for (size_t i = 0; i < kBufferSize / (kChunkPayloadSize + 16); i++)
+    writer.CopyNextChunk(buf.get());
+
+  for (auto _ : state)
+    writer.CopyNextChunk(buf.get());
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_TraceBufferCopyChunks)->Apply(WriterCounts);
+
+static void BM_TraceBufferCopyAndRead(benchmark::State& state) {
+  std::unique_ptr<TraceBuffer> buf = TraceBuffer::Create(kBufferSize);
+  PERFETTO_CHECK(buf);
+  ChunkWriter writer(static_cast<size_t>(state.range(0)));
+  for (size_t i = 0; i < kBufferSize / (kChunkPayloadSize + 16); i++)
+    writer.CopyNextChunk(buf.get());
+  ReadAll(buf.get());
+
+  for (auto _ : state) {
+    for (size_t i = 0; i < kChunksPerRead; i++)
+      writer.CopyNextChunk(buf.get());
+    ReadAll(buf.get());
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * kChunksPerRead));
+}
+BENCHMARK(BM_TraceBufferCopyAndRead)->Apply(WriterCounts);
@@ -145,9 +145,13 @@ class TraceBufferTest : public testing::Test {
   }
 
   SequenceIterator GetReadIterForSequence(ProducerID p, WriterID w) {
-    TraceBuffer::ChunkMeta::Key key(p, w, 0);
-    return trace_buffer_->GetReadIterForSequence(
-        trace_buffer_->index_.lower_bound(key));
+    const auto& index = trace_buffer_->index_;
+    size_t seq_idx = 0;
+    while (seq_idx < index.size() && (index[seq_idx].producer_id != p ||
+                                      index[seq_idx].writer_id != w)) {
+      seq_idx++;
+    }
+    return trace_buffer_->GetReadIterForSequence(seq_idx);
   }
 
   void SuppressClientDchecksForTesting() {
@@ -156,9 +160,10 @@ class TraceBufferTest : public testing::Test {
 
   std::vector<ChunkMetaKey> GetIndex() {
     std::vector<ChunkMetaKey> keys;
-    keys.reserve(trace_buffer_->index_.size());
-    for (const auto& it : trace_buffer_->index_)
-      keys.push_back(it.first);
+    for (auto& seq : trace_buffer_->index_) {
+      for (const auto* it = seq.begin(); it != seq.end(); ++it)
+        keys.emplace_back(seq.producer_id, seq.writer_id, it->chunk_id);
+    }
     return keys;
   }
 
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/service/trace_file_writer.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include <algorithm>
+#include <tuple>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/sys_types.h"
+#include "perfetto/ext/base/utils.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace perfetto {
+namespace {
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) || PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+struct iovec {
+  void* iov_base;  // Address
+  size_t iov_len;  // Block size
+};
+
+// Simple implementation of writev. Note that this does not give the atomicity
+// guarantees of a real writev, but we don't depend on these (we aren't writing
+// to the same file from another thread).
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+  ssize_t total_size = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    ssize_t current_size = base::WriteAll(fd, iov[i].iov_base, iov[i].iov_len);
+    if (current_size != static_cast<ssize_t>(iov[i].iov_len))
+      return -1;
+    total_size += current_size;
+  }
+  return total_size;
+}
+
+#define IOV_MAX 1024  // Linux compatible limit.
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) ||
+        // PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+
+// writev() can take at most IOV_MAX entries per call.
+constexpr size_t kMaxSegments = IOV_MAX;
+
+}  // namespace
+
+TraceFileWriter::TraceFileWriter() = default;
+TraceFileWriter::~TraceFileWriter() = default;
+TraceFileWriter::TraceFileWriter(TraceFileWriter&&) noexcept = default;
+TraceFileWriter& TraceFileWriter::operator=(TraceFileWriter&&) = default;
+
+uint64_t TraceFileWriter::WritePackets(int fd,
+                                       TracePacket* packets,
+                                       size_t num_packets) {
+  if (!staging_buf_)
+    staging_buf_.reset(new uint8_t[kStagingBufferSize]);
+  PERFETTO_DCHECK(segments_.empty() && staging_used_ == 0);
+  bytes_written_ = 0;
+
+  bool ok = true;
+  for (size_t i = 0; i < num_packets && ok; i++) {
+    TracePacket& packet = packets[i];
+    char* preamble;
+    size_t preamble_size;
+    std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
+    ok = Append(fd, preamble, preamble_size);
+    for (auto it = packet.slices().begin(); it != packet.slices().end() && ok;
+         ++it) {
+      ok = Append(fd, it->start, it->size);
+    }
+  }
+  if (ok)
+    Flush(fd);
+
+  segments_.clear();
+  staging_used_ = 0;
+  return bytes_written_;
+}
+
+bool TraceFileWriter::Append(int fd, const void* data, size_t size) {
+  if (size == 0)
+    return true;
+
+  if (size > kMaxCopiedSliceSize) {
+    if (segments_.size() == kMaxSegments && !Flush(fd))
+      return false;
+    segments_.push_back({data, size});
+    return true;
+  }
+
+  if (staging_used_ + size > kStagingBufferSize ||
+      segments_.size() == kMaxSegments) {
+    if (!Flush(fd))
+      return false;
+  }
+  uint8_t* dst = &staging_buf_[staging_used_];
+  memcpy(dst, data, size);
+  staging_used_ += size;
+
+  // Extend the last segment if it ends where the copy starts, i.e. if the
+  // previous slice was copied too.
+  if (!segments_.empty()) {
+    Segment& last = segments_.back();
+    if (static_cast<const uint8_t*>(last.data) + last.size == dst) {
+      last.size += size;
+      return true;
+    }
+  }
+  segments_.push_back({dst, size});
+  return true;
+}
+
+bool TraceFileWriter::Flush(int fd) {
+  std::vector<struct iovec> iovecs(segments_.size());
+  for (size_t i = 0; i < segments_.size(); i++) {
+    // writev() doesn't change the passed pointer. However, struct iovec
+    // take a non-const ptr because it's the same struct used by readv().
+    // Hence the const_cast here.
+    iovecs[i].iov_base = const_cast<void*>(segments_[i].data);
+    iovecs[i].iov_len = segments_[i].size;
+  }
+  segments_.clear();
+  staging_used_ = 0;
+
+  // writev() can write less than requested (e.g. if interrupted by a signal
+  // after writing some data), in which case the rest is written again.
+  size_t first = 0;
+  while (first < iovecs.size()) {
+    ssize_t wr_size = PERFETTO_EINTR(writev(
+        fd, &iovecs[first], static_cast<int>(iovecs.size() - first)));
+    if (wr_size <= 0) {
+      PERFETTO_PLOG("writev() failed");
+      return false;
+    }
+    bytes_written_ += static_cast<uint64_t>(wr_size);
+    for (size_t left = static_cast<size_t>(wr_size); left > 0;) {
+      struct iovec& iov = iovecs[first];
+      size_t consumed = std::min(left, iov.iov_len);
+      iov.iov_base = static_cast<char*>(iov.iov_base) + consumed;
+      iov.iov_len -= consumed;
+      left -= consumed;
+      if (iov.iov_len == 0)
+        first++;
+    }
+  }
+  return true;
+}
+
+}  // namespace perfetto
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACING_SERVICE_TRACE_FILE_WRITER_H_
+#define SRC_TRACING_SERVICE_TRACE_FILE_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "perfetto/ext/tracing/core/trace_packet.h"
+
+namespace perfetto {
+
+// Writes TracePackets into a file so that the file is a perfetto.protos.Trace
+// proto, i.e. prepends each packet with its proto preamble.
+//
+// The slices of the packets read from the trace buffers point straight into
+// the chunks of the buffers. Large slices are written from there, without
+// copies. Small ones (the preambles, the trusted fields appended by the service
+// and the packets of data sources emitting tiny packets) are coalesced into a
+// staging buffer instead, as one iovec each would make for lots of small
+// writes (and one write() each where writev() is emulated). The writes are
+// batched until the staging buffer is full or IOV_MAX iovecs are pending.
+//
+// The staging buffer is kept across calls, to avoid allocating it for each
+// write: one instance should be kept for each file.
+class TraceFileWriter {
+ public:
+  // Slices (and preambles) up to this size are copied into the staging buffer.
+  static constexpr size_t kMaxCopiedSliceSize = 512;
+
+  // Size of the staging buffer.
+  static constexpr size_t kStagingBufferSize = 128 * 1024;
+
+  TraceFileWriter();
+  ~TraceFileWriter();
+  TraceFileWriter(TraceFileWriter&&) noexcept;
+  TraceFileWriter& operator=(TraceFileWriter&&);
+
+  // Writes the first `num_packets` of `packets` into `fd`. Returns the number
+  // of bytes written, which is smaller than the size of the packets and of
+  // their preambles only if a write failed.
+  uint64_t WritePackets(int fd, TracePacket* packets, size_t num_packets);
+
+ private:
+  struct Segment {
+    const void* data;
+    size_t size;
+  };
+
+  // Appends `size` bytes at `data` to the pending writes, copying them if
+  // they are small. Returns false if a write failed.
+  bool Append(int fd, const void* data, size_t size);
+
+  // Writes the pending segments. Returns false if a write failed.
+  bool Flush(int fd);
+
+  std::unique_ptr<uint8_t[]> staging_buf_;
+  size_t staging_used_ = 0;
+  std::vector<Segment> segments_;
+  uint64_t bytes_written_ = 0;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACING_SERVICE_TRACE_FILE_WRITER_H_
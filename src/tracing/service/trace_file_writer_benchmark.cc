@@ -0,0 +1,131 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/base/utils.h"
+#include "perfetto/ext/tracing/core/slice.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "src/tracing/service/trace_file_writer.h"
+
+namespace {
+
+using perfetto::Slice;
+using perfetto::TraceFileWriter;
+using perfetto::TracePacket;
+
+// The amount of packets written by each iteration, the same as the amount of
+// data read from the buffers by each write of TracingServiceImpl.
+constexpr size_t kBytesPerIteration = 1024 * 1024;
+
+// The file is truncated every this many bytes, to keep it in the page cache.
+constexpr size_t kMaxFileSize = 64 * 1024 * 1024;
+
+// Packets like the ones read from the buffers: a payload slice (which points
+// into the chunks of the buffer) followed by the trusted fields appended by the
+// service.
+std::vector<TracePacket> CreatePackets(size_t payload_size) {
+  static uint8_t* chunk_memory = new uint8_t[kBytesPerIteration]();
+  std::vector<TracePacket> packets;
+  for (size_t offset = 0; offset + payload_size <= kBytesPerIteration;
+       offset += payload_size) {
+    TracePacket packet;
+    packet.AddSlice(&chunk_memory[offset], payload_size);
+    Slice trusted = Slice::Allocate(12);
+    memset(trusted.own_data(), 0, trusted.size);
+    packet.AddSlice(std::move(trusted));
+    packets.push_back(std::move(packet));
+  }
+  return packets;
+}
+
+void SetCounters(benchmark::State& state, uint64_t bytes) {
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+  // CPU seconds per MB written (benchmark rates use the CPU time).
+  state.counters["cpu_s_per_mb"] = benchmark::Counter(
+      static_cast<double>(bytes) / (1024 * 1024),
+      benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+void MaybeTruncate(int fd, uint64_t* file_size) {
+  if (*file_size < kMaxFileSize)
+    return;
+  PERFETTO_CHECK(ftruncate(fd, 0) == 0);
+  PERFETTO_CHECK(lseek(fd, 0, SEEK_SET) == 0);
+  *file_size = 0;
+}
+
+}  // namespace
+
+static void BM_TraceFileWriter(benchmark::State& state) {
+  std::vector<TracePacket> packets =
+      CreatePackets(static_cast<size_t>(state.range(0)));
+  perfetto::base::TempFile tmp_file = perfetto::base::TempFile::Create();
+  TraceFileWriter writer;
+  uint64_t bytes = 0;
+  uint64_t file_size = 0;
+  for (auto _ : state) {
+    uint64_t written =
+        writer.WritePackets(tmp_file.fd(), packets.data(), packets.size());
+    bytes += written;
+    file_size += written;
+    MaybeTruncate(tmp_file.fd(), &file_size);
+  }
+  SetCounters(state, bytes);
+}
+BENCHMARK(BM_TraceFileWriter)->Arg(64)->Arg(512)->Arg(4096);
+
+// The previous implementation, for comparison: one iovec for each preamble and
+// slice, written IOV_MAX at a time.
+static void BM_TraceFileWriterIovecPerSlice(benchmark::State& state) {
+  std::vector<TracePacket> packets =
+      CreatePackets(static_cast<size_t>(state.range(0)));
+  perfetto::base::TempFile tmp_file = perfetto::base::TempFile::Create();
+  uint64_t bytes = 0;
+  uint64_t file_size = 0;
+  for (auto _ : state) {
+    std::vector<struct iovec> iovecs;
+    for (TracePacket& packet : packets) {
+      struct iovec preamble;
+      std::tie(preamble.iov_base, preamble.iov_len) =
+          packet.GetProtoPreamble();
+      iovecs.push_back(preamble);
+      for (const Slice& slice : packet.slices())
+        iovecs.push_back({const_cast<void*>(slice.start), slice.size});
+    }
+    for (size_t i = 0; i < iovecs.size(); i += IOV_MAX) {
+      int iov_batch_size =
+          static_cast<int>(std::min(iovecs.size() - i, size_t{IOV_MAX}));
+      ssize_t wr_size =
+          PERFETTO_EINTR(writev(tmp_file.fd(), &iovecs[i], iov_batch_size));
+      PERFETTO_CHECK(wr_size > 0);
+      bytes += static_cast<uint64_t>(wr_size);
+      file_size += static_cast<uint64_t>(wr_size);
+    }
+    MaybeTruncate(tmp_file.fd(), &file_size);
+  }
+  SetCounters(state, bytes);
+}
+BENCHMARK(BM_TraceFileWriterIovecPerSlice)->Arg(64)->Arg(512)->Arg(4096);
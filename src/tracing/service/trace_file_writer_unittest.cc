@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/tracing/service/trace_file_writer.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/tracing/core/slice.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+// Returns a packet made of slices of the given sizes, filled with |c|.
+TracePacket CreatePacket(const std::vector<size_t>& slice_sizes, char c) {
+  TracePacket packet;
+  for (size_t size : slice_sizes) {
+    Slice slice = Slice::Allocate(size);
+    memset(slice.own_data(), c, size);
+    packet.AddSlice(std::move(slice));
+  }
+  return packet;
+}
+
+// Returns the expected contents of the file for |packets|.
+std::string Serialize(std::vector<TracePacket>* packets) {
+  std::string res;
+  for (TracePacket& packet : *packets) {
+    char* preamble;
+    size_t preamble_size;
+    std::tie(preamble, preamble_size) = packet.GetProtoPreamble();
+    res.append(preamble, preamble_size);
+    res.append(packet.GetRawBytesForTesting());
+  }
+  return res;
+}
+
+std::string WriteAndReadBack(TraceFileWriter* writer,
+                             std::vector<TracePacket>* packets,
+                             uint64_t* bytes_written) {
+  base::TempFile tmp_file = base::TempFile::Create();
+  *bytes_written =
+      writer->WritePackets(tmp_file.fd(), packets->data(), packets->size());
+  std::string contents;
+  EXPECT_TRUE(base::ReadFile(tmp_file.path(), &contents));
+  return contents;
+}
+
+TEST(TraceFileWriterTest, SmallAndLargeSlices) {
+  std::vector<TracePacket> packets;
+  packets.push_back(CreatePacket({10}, 'a'));
+  packets.push_back(CreatePacket({4096, 10}, 'b'));
+  packets.push_back(CreatePacket({TraceFileWriter::kMaxCopiedSliceSize,
+                                  TraceFileWriter::kMaxCopiedSliceSize + 1},
+                                 'c'));
+  packets.push_back(CreatePacket({1, 2, 3}, 'd'));
+
+  TraceFileWriter writer;
+  uint64_t bytes_written;
+  std::string contents = WriteAndReadBack(&writer, &packets, &bytes_written);
+  std::string expected = Serialize(&packets);
+  EXPECT_EQ(bytes_written, expected.size());
+  EXPECT_EQ(contents, expected);
+}
+
+TEST(TraceFileWriterTest, ManyWrites) {
+  // Enough small slices to fill the staging buffer several times and enough
+  // large ones to exceed IOV_MAX.
+  std::vector<TracePacket> packets;
+  for (size_t i = 0; i < 10000; i++) {
+    char c = static_cast<char>('a' + i % 26);
+    if (i % 3 == 0) {
+      packets.push_back(CreatePacket({1024, 8}, c));
+    } else {
+      packets.push_back(CreatePacket({64 + i % 100, 8}, c));
+    }
+  }
+
+  TraceFileWriter writer;
+  uint64_t bytes_written;
+  std::string contents = WriteAndReadBack(&writer, &packets, &bytes_written);
+  std::string expected = Serialize(&packets);
+  EXPECT_EQ(bytes_written, expected.size());
+  EXPECT_EQ(contents, expected);
+
+  // The writer can be reused for another file.
+  std::vector<TracePacket> more_packets;
+  more_packets.push_back(CreatePacket({20}, 'z'));
+  contents = WriteAndReadBack(&writer, &more_packets, &bytes_written);
+  EXPECT_EQ(contents, Serialize(&more_packets));
+}
+
+TEST(TraceFileWriterTest, WriteError) {
+  std::vector<TracePacket> packets;
+  packets.push_back(CreatePacket({10}, 'a'));
+
+  // Writing into a read-only fd fails.
+  base::TempFile tmp_file = base::TempFile::Create();
+  base::ScopedFile fd = base::OpenFile(tmp_file.path(), O_RDONLY);
+  ASSERT_TRUE(fd);
+  TraceFileWriter writer;
+  EXPECT_EQ(writer.WritePackets(*fd, packets.data(), packets.size()), 0u);
+}
+
+}  // namespace
+}  // namespace perfetto
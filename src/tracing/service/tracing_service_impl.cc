@@ -32,7 +32,6 @@
 
 #if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && \
     !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
-#include <sys/uio.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 #endif
@@ -125,31 +124,6 @@ constexpr uint32_t kMaxTracingDurationMillis = 7 * 24 * kMillisPerHour;
 constexpr uint32_t kGuardrailsMaxTracingBufferSizeKb = 128 * 1024;
 constexpr uint32_t kGuardrailsMaxTracingDurationMillis = 24 * kMillisPerHour;
 
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) || PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
-struct iovec {
-  void* iov_base;  // Address
-  size_t iov_len;  // Block size
-};
-
-// Simple implementation of writev. Note that this does not give the atomicity
-// guarantees of a real writev, but we don't depend on these (we aren't writing
-// to the same file from another thread).
-ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
-  ssize_t total_size = 0;
-  for (int i = 0; i < iovcnt; ++i) {
-    ssize_t current_size = base::WriteAll(fd, iov[i].iov_base, iov[i].iov_len);
-    if (current_size != static_cast<ssize_t>(iov[i].iov_len))
-      return -1;
-    total_size += current_size;
-  }
-  return total_size;
-}
-
-#define IOV_MAX 1024  // Linux compatible limit.
-
-#endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) ||
-        // PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
-
 // Partially encodes a CommitDataRequest in an int32 for the purposes of
 // metatracing. Note that it encodes only the bottom 10 bits of the producer id
 // (which is technically 16 bits wide).
@@ -305,6 +279,22 @@ void AppendOwnedSlicesToPacket(std::unique_ptr<uint8_t[]> data,
   }
 }
 
+// Replaces the slices of `*packet`, which can point into the memory of the
+// trace buffers, with owned copies. This allows the packet to be used after
+// the buffers are written again, e.g. from another thread.
+void CopyPacketSlices(perfetto::TracePacket* packet) {
+  perfetto::TracePacket copy;
+  for (const Slice& slice : packet->slices()) {
+    Slice owned_slice = Slice::Allocate(slice.size);
+    memcpy(owned_slice.own_data(), slice.start, slice.size);
+    copy.AddSlice(std::move(owned_slice));
+  }
+  std::optional<uint32_t> buffer_idx = packet->buffer_index_for_stats();
+  if (buffer_idx.has_value())
+    copy.set_buffer_index_for_stats(*buffer_idx);
+  *packet = std::move(copy);
+}
+
 using TraceFilter = protos::gen::TraceConfig::TraceFilter;
 std::optional<protozero::StringFilter::Policy> ConvertPolicy(
     TraceFilter::StringFilterPolicy policy) {
@@ -919,26 +909,37 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
                                 cfg.output_path().c_str());
       }
     }
-    tracing_session->write_into_file = std::move(fd);
+    tracing_session->write_into_file = std::make_shared<OutputFile>();
+    tracing_session->write_into_file->fd = std::move(fd);
+    tracing_session->write_into_file->max_size_bytes =
+        cfg.max_file_size_bytes();
     uint32_t write_period_ms = cfg.file_write_period_ms();
     if (write_period_ms == 0)
       write_period_ms = kDefaultWriteIntoFilePeriodMs;
     if (write_period_ms < min_write_period_ms_)
       write_period_ms = min_write_period_ms_;
     tracing_session->write_period_ms = write_period_ms;
-    tracing_session->max_file_size_bytes = cfg.max_file_size_bytes();
-    tracing_session->bytes_written_into_file = 0;
   }
 
   if (cfg.compression_type() == TraceConfig::COMPRESSION_TYPE_DEFLATE) {
     if (init_opts_.compressor_fn) {
-      tracing_session->compress_deflate = true;
+      tracing_session->compressor_fn = init_opts_.compressor_fn;
     } else {
       PERFETTO_LOG(
           "COMPRESSION_TYPE_DEFLATE is not supported in the current build "
           "configuration. Skipping compression");
     }
+  } else if (cfg.compression_type() == TraceConfig::COMPRESSION_TYPE_ZSTD) {
+    if (init_opts_.zstd_compressor_fn) {
+      tracing_session->compressor_fn = init_opts_.zstd_compressor_fn;
+    } else {
+      PERFETTO_LOG(
+          "COMPRESSION_TYPE_ZSTD is not supported in the current build "
+          "configuration. Skipping compression");
+    }
   }
+  tracing_session->packet_processing_task_runner =
+      PickPacketProcessingTaskRunner(tracing_session);
 
   // Initialize the log buffers.
   bool did_allocate_all_buffers = true;
@@ -1772,6 +1773,17 @@ void TracingServiceImpl::DisableTracingNotifyConsumerAndFlushFile(
     ReadBuffersIntoFile(tracing_session->id);
   }
 
+  // The last packets are still being written into the file: the consumer is
+  // notified once it's closed.
+  if (tracing_session->write_into_file &&
+      tracing_session->pending_packet_processing) {
+    return;
+  }
+  NotifyTracingDisabled(tracing_session);
+}
+
+void TracingServiceImpl::NotifyTracingDisabled(
+    TracingSession* tracing_session) {
   MaybeLogUploadEvent(tracing_session->config, tracing_session->trace_uuid,
                       PerfettoStatsdAtom::kTracedNotifyTracingDisabled);
 
@@ -2193,9 +2205,39 @@ bool TracingServiceImpl::ReadBuffersIntoConsumer(
   // catches up).
   static constexpr size_t kApproxBytesPerTask = 32768;
   bool has_more;
+
+  // The read in flight keeps going until the buffers are drained, this read
+  // is folded into it.
+  if (tracing_session->pending_packet_processing)
+    return true;
+
+  if (ShouldProcessPacketsAsync(tracing_session)) {
+    std::vector<TracePacket> packets =
+        ReadPackets(tracing_session, kApproxBytesPerTask, &has_more);
+    auto weak_consumer = consumer->weak_ptr_factory_.GetWeakPtr();
+    ProcessPacketsAsync(
+        tracing_session, std::move(packets), has_more,
+        /*write_into_file=*/false,
+        [this, weak_consumer, tsid](TracingSession*, PacketProcessingJob* job) {
+          if (!weak_consumer)
+            return;
+          SendTraceDataToConsumer(tsid, weak_consumer.get(),
+                                  std::move(job->packets), job->has_more);
+        });
+    return true;
+  }
+
   std::vector<TracePacket> packets =
       ReadBuffers(tracing_session, kApproxBytesPerTask, &has_more);
+  SendTraceDataToConsumer(tsid, consumer, std::move(packets), has_more);
+  return true;
+}
 
+void TracingServiceImpl::SendTraceDataToConsumer(
+    TracingSessionID tsid,
+    ConsumerEndpointImpl* consumer,
+    std::vector<TracePacket> packets,
+    bool has_more) {
   if (has_more) {
     auto weak_consumer = consumer->weak_ptr_factory_.GetWeakPtr();
     auto weak_this = weak_ptr_factory_.GetWeakPtr();
@@ -2208,7 +2250,6 @@ bool TracingServiceImpl::ReadBuffersIntoConsumer(
 
   // Keep this as tail call, just in case the consumer re-enters.
   consumer->consumer_->OnTraceData(std::move(packets), has_more);
-  return true;
 }
 
 bool TracingServiceImpl::ReadBuffersIntoFile(TracingSessionID tsid) {
@@ -2238,21 +2279,85 @@ bool TracingServiceImpl::ReadBuffersIntoFile(TracingSessionID tsid) {
   // to support the disable_immediately=true code paths.
   bool has_more = true;
   bool stop_writing_into_file = false;
-  do {
+
+  // A read in flight keeps going until the buffers are drained, unless this is
+  // the last write: in this case the rest of the buffers is written after it.
+  if (PacketProcessingJob* job =
+          tracing_session->pending_packet_processing.get()) {
+    if (tracing_session->write_period_ms != 0 || job->last_write_into_file)
+      return true;
+    ReadRemainingBuffersIntoFileAsync(tracing_session);
+    return true;
+  }
+
+  if (tracing_session->write_period_ms != 0 &&
+      ShouldProcessPacketsAsync(tracing_session)) {
+    ReadBuffersIntoFileAsync(tracing_session);
+    return true;
+  }
+
+  while (has_more && !stop_writing_into_file) {
     std::vector<TracePacket> packets =
         ReadBuffers(tracing_session, kWriteIntoFileChunkSize, &has_more);
 
-    stop_writing_into_file = WriteIntoFile(tracing_session, std::move(packets));
-  } while (has_more && !stop_writing_into_file);
+    stop_writing_into_file = WriteIntoFile(
+        tracing_session->write_into_file.get(), std::move(packets));
+  }
+
+  OnBuffersReadIntoFile(tracing_session, stop_writing_into_file);
+  return true;
+}
+
+void TracingServiceImpl::ReadBuffersIntoFileAsync(
+    TracingSession* tracing_session) {
+  bool has_more;
+  std::vector<TracePacket> packets =
+      ReadPackets(tracing_session, kWriteIntoFileChunkSize, &has_more);
+  ProcessPacketsAsync(
+      tracing_session, std::move(packets), has_more,
+      /*write_into_file=*/true,
+      [this](TracingSession* session, PacketProcessingJob* job) {
+        // The last write into the file, if queued, takes over from here.
+        if (!session->write_into_file || session->pending_packet_processing)
+          return;
+        if (job->has_more && !job->stop_writing_into_file) {
+          ReadBuffersIntoFileAsync(session);
+          return;
+        }
+        OnBuffersReadIntoFile(session, job->stop_writing_into_file);
+      });
+}
+
+void TracingServiceImpl::ReadRemainingBuffersIntoFileAsync(
+    TracingSession* tracing_session) {
+  // Everything is read now: the buffers can be freed before the job runs.
+  bool has_more;
+  std::vector<TracePacket> packets = ReadPackets(
+      tracing_session, std::numeric_limits<size_t>::max(), &has_more);
+  PERFETTO_DCHECK(!has_more);
+  ProcessPacketsAsync(
+      tracing_session, std::move(packets), /*has_more=*/false,
+      /*write_into_file=*/true,
+      [this](TracingSession* session, PacketProcessingJob* job) {
+        if (!session->write_into_file)
+          return;
+        OnBuffersReadIntoFile(session, job->stop_writing_into_file);
+        NotifyTracingDisabled(session);
+      });
+  tracing_session->pending_packet_processing->last_write_into_file = true;
+}
 
+void TracingServiceImpl::OnBuffersReadIntoFile(TracingSession* tracing_session,
+                                               bool stop_writing_into_file) {
+  TracingSessionID tsid = tracing_session->id;
   if (stop_writing_into_file || tracing_session->write_period_ms == 0) {
     // Ensure all data was written to the file before we close it.
-    base::FlushFile(tracing_session->write_into_file.get());
+    base::FlushFile(tracing_session->write_into_file->fd.get());
     tracing_session->write_into_file.reset();
     tracing_session->write_period_ms = 0;
     if (tracing_session->state == TracingSession::STARTED)
       DisableTracing(tsid);
-    return true;
+    return;
   }
 
   auto weak_this = weak_ptr_factory_.GetWeakPtr();
@@ -2262,7 +2367,6 @@ bool TracingServiceImpl::ReadBuffersIntoFile(TracingSessionID tsid) {
           weak_this->ReadBuffersIntoFile(tsid);
       },
       tracing_session->delay_to_next_write_period_ms());
-  return true;
 }
 
 bool TracingServiceImpl::IsWaitingForTrigger(TracingSession* tracing_session) {
@@ -2304,6 +2408,27 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
     TracingSession* tracing_session,
     size_t threshold,
     bool* has_more) {
+  std::vector<TracePacket> packets =
+      ReadPackets(tracing_session, threshold, has_more);
+
+  MaybeFilterPackets(tracing_session, &packets);
+
+  MaybeCompressPackets(tracing_session, &packets);
+
+  if (!*has_more) {
+    // We've observed some extremely high memory usage by scudo after
+    // MaybeFilterPackets in the past. The original bug (b/195145848) is fixed
+    // now, but this code asks scudo to release memory just in case.
+    base::MaybeReleaseAllocatorMemToOS();
+  }
+
+  return packets;
+}
+
+std::vector<TracePacket> TracingServiceImpl::ReadPackets(
+    TracingSession* tracing_session,
+    size_t threshold,
+    bool* has_more) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DCHECK(tracing_session);
   *has_more = false;
@@ -2459,32 +2584,146 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
     tracing_session->should_emit_stats = false;
   }
 
-  MaybeFilterPackets(tracing_session, &packets);
-
-  MaybeCompressPackets(tracing_session, &packets);
+  return packets;
+}
 
-  if (!*has_more) {
-    // We've observed some extremely high memory usage by scudo after
-    // MaybeFilterPackets in the past. The original bug (b/195145848) is fixed
-    // now, but this code asks scudo to release memory just in case.
-    base::MaybeReleaseAllocatorMemToOS();
+base::TaskRunner* TracingServiceImpl::PickPacketProcessingTaskRunner(
+    const TracingSession* tracing_session) {
+  if (!tracing_session->trace_filter && !tracing_session->compressor_fn)
+    return nullptr;
+  if (!init_opts_.create_packet_processing_task_runner)
+    return nullptr;
+  auto& task_runners = packet_processing_task_runners_;
+  std::vector<size_t> num_sessions(task_runners.size());
+  for (const auto& id_and_session : tracing_sessions_) {
+    auto it = std::find(task_runners.begin(), task_runners.end(),
+                        id_and_session.second.packet_processing_task_runner);
+    if (it != task_runners.end())
+      num_sessions[static_cast<size_t>(it - task_runners.begin())]++;
+  }
+  auto min_it = std::min_element(num_sessions.begin(), num_sessions.end());
+  if ((min_it == num_sessions.end() || *min_it > 0) &&
+      task_runners.size() < init_opts_.max_packet_processing_task_runners) {
+    base::TaskRunner* task_runner =
+        init_opts_.create_packet_processing_task_runner();
+    if (task_runner) {
+      task_runners.push_back(task_runner);
+      return task_runner;
+    }
   }
+  if (min_it == num_sessions.end())
+    return nullptr;
+  return task_runners[static_cast<size_t>(min_it - num_sessions.begin())];
+}
 
-  return packets;
+bool TracingServiceImpl::ShouldProcessPacketsAsync(
+    const TracingSession* tracing_session) const {
+  // The packets have to be copied out of the buffers before they can be
+  // handed over to another thread. That pays off only if they're going to be
+  // copied anyway, by the filter or by the compressor.
+  return tracing_session->packet_processing_task_runner &&
+         (tracing_session->trace_filter || tracing_session->compressor_fn);
+}
+
+void TracingServiceImpl::ProcessPacketsAsync(
+    TracingSession* tracing_session,
+    std::vector<TracePacket> packets,
+    bool has_more,
+    bool write_into_file,
+    PacketsProcessedCallback on_processed) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  // The packets point into the trace buffers, which producers keep writing
+  // into while the packets are processed. Copying them is much cheaper than
+  // filtering or compressing them.
+  for (TracePacket& packet : packets)
+    CopyPacketSlices(&packet);
+
+  auto job = std::make_shared<PacketProcessingJob>();
+  job->packets = std::move(packets);
+  job->has_more = has_more;
+  job->trace_filter = tracing_session->trace_filter;
+  job->compressor_fn = tracing_session->compressor_fn;
+  if (write_into_file)
+    job->output_file = tracing_session->write_into_file;
+  tracing_session->pending_packet_processing = job;
+
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  TracingSessionID tsid = tracing_session->id;
+  base::TaskRunner* task_runner = task_runner_;
+  tracing_session->packet_processing_task_runner->PostTask(
+      [job, weak_this, tsid, task_runner,
+       on_processed = std::move(on_processed)]() mutable {
+        if (job->trace_filter) {
+          FilterPackets(job->trace_filter.get(), &job->packets,
+                        &job->filter_stats);
+        }
+        if (job->compressor_fn)
+          job->compressor_fn(&job->packets);
+        if (job->output_file) {
+          job->stop_writing_into_file =
+              WriteIntoFile(job->output_file.get(), std::move(job->packets));
+          job->packets.clear();
+        }
+
+        task_runner->PostTask([job, weak_this, tsid,
+                               on_processed = std::move(on_processed)] {
+          if (!weak_this)
+            return;
+          TracingSession* session = weak_this->GetTracingSession(tsid);
+          if (!session)
+            return;
+          weak_this->FinishPacketProcessing(session, job.get());
+          on_processed(session, job.get());
+          if (!job->has_more)
+            base::MaybeReleaseAllocatorMemToOS();
+        });
+      });
+}
+
+void TracingServiceImpl::FinishPacketProcessing(TracingSession* tracing_session,
+                                                PacketProcessingJob* job) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  if (tracing_session->pending_packet_processing.get() == job)
+    tracing_session->pending_packet_processing.reset();
+
+  AccountFilterStats(tracing_session, job->filter_stats);
+}
+
+void TracingServiceImpl::AccountFilterStats(TracingSession* tracing_session,
+                                            const TraceFilterStats& stats) {
+  tracing_session->filter_input_packets += stats.input_packets;
+  tracing_session->filter_input_bytes += stats.input_bytes;
+  tracing_session->filter_output_bytes += stats.output_bytes;
+  tracing_session->filter_errors += stats.errors;
+  tracing_session->filter_time_taken_ns += stats.time_taken_ns;
+  auto& vec = tracing_session->filter_bytes_discarded_per_buffer;
+  if (stats.bytes_discarded_per_buffer.size() > vec.size())
+    vec.resize(stats.bytes_discarded_per_buffer.size());
+  for (size_t i = 0; i < stats.bytes_discarded_per_buffer.size(); ++i)
+    vec[i] += stats.bytes_discarded_per_buffer[i];
 }
 
 void TracingServiceImpl::MaybeFilterPackets(TracingSession* tracing_session,
                                             std::vector<TracePacket>* packets) {
-  // If the tracing session specified a filter, run all packets through the
-  // filter and replace them with the filter results.
+  if (!tracing_session->trace_filter) {
+    return;
+  }
+  TraceFilterStats stats;
+  FilterPackets(tracing_session->trace_filter.get(), packets, &stats);
+  AccountFilterStats(tracing_session, stats);
+}
+
+// static
+void TracingServiceImpl::FilterPackets(protozero::MessageFilter* filter,
+                                       std::vector<TracePacket>* packets,
+                                       TraceFilterStats* stats) {
+  // Run all packets through the filter and replace them with the filter
+  // results.
   // The process below mantains the cardinality of input packets. Even if an
   // entire packet is filtered out, we emit a zero-sized TracePacket proto. That
   // makes debugging and reasoning about the trace stats easier.
   // This place swaps the contents of each |packets| entry in place.
-  if (!tracing_session->trace_filter) {
-    return;
-  }
-  protozero::MessageFilter& trace_filter = *tracing_session->trace_filter;
+  protozero::MessageFilter& trace_filter = *filter;
   // The filter root should be reset from protos.Trace to protos.TracePacket
   // by the earlier call to SetFilterRoot() in EnableTracing().
   PERFETTO_DCHECK(trace_filter.config().root_msg_index() != 0);
@@ -2495,8 +2734,8 @@ void TracingServiceImpl::MaybeFilterPackets(TracingSession* tracing_session,
     const size_t input_packet_size = packet.size();
     filter_input.clear();
     filter_input.resize(packet_slices.size());
-    ++tracing_session->filter_input_packets;
-    tracing_session->filter_input_bytes += input_packet_size;
+    ++stats->input_packets;
+    stats->input_bytes += input_packet_size;
     for (size_t i = 0; i < packet_slices.size(); ++i)
       filter_input[i] = {packet_slices[i].start, packet_slices[i].size};
     auto filtered_packet = trace_filter.FilterMessageFragments(
@@ -2506,19 +2745,19 @@ void TracingServiceImpl::MaybeFilterPackets(TracingSession* tracing_session,
     std::optional<uint32_t> maybe_buffer_idx = packet.buffer_index_for_stats();
     packet = TracePacket();
     if (filtered_packet.error) {
-      ++tracing_session->filter_errors;
+      ++stats->errors;
       PERFETTO_DLOG("Trace packet filtering failed @ packet %" PRIu64,
-                    tracing_session->filter_input_packets);
+                    stats->input_packets);
       continue;
     }
-    tracing_session->filter_output_bytes += filtered_packet.size;
+    stats->output_bytes += filtered_packet.size;
     if (maybe_buffer_idx.has_value()) {
       // Keep the per-buffer stats updated. Also propagate the
       // buffer_index_for_stats in the output packet to allow accounting by
       // other parts of the ReadBuffer pipeline.
       uint32_t buffer_idx = maybe_buffer_idx.value();
       packet.set_buffer_index_for_stats(buffer_idx);
-      auto& vec = tracing_session->filter_bytes_discarded_per_buffer;
+      auto& vec = stats->bytes_discarded_per_buffer;
       if (static_cast<size_t>(buffer_idx) >= vec.size())
         vec.resize(buffer_idx + 1);
       PERFETTO_DCHECK(input_packet_size >= filtered_packet.size);
@@ -2530,85 +2769,54 @@ void TracingServiceImpl::MaybeFilterPackets(TracingSession* tracing_session,
                               &packet);
   }
   auto end = base::GetWallTimeNs();
-  tracing_session->filter_time_taken_ns +=
-      static_cast<uint64_t>((end - start).count());
+  stats->time_taken_ns += static_cast<uint64_t>((end - start).count());
 }
 
 void TracingServiceImpl::MaybeCompressPackets(
     TracingSession* tracing_session,
     std::vector<TracePacket>* packets) {
-  if (!tracing_session->compress_deflate) {
+  if (!tracing_session->compressor_fn) {
     return;
   }
 
-  init_opts_.compressor_fn(packets);
+  tracing_session->compressor_fn(packets);
 }
 
-bool TracingServiceImpl::WriteIntoFile(TracingSession* tracing_session,
+// static
+bool TracingServiceImpl::WriteIntoFile(OutputFile* file,
                                        std::vector<TracePacket> packets) {
-  if (!tracing_session->write_into_file) {
+  if (!file) {
     return false;
   }
-  const uint64_t max_size = tracing_session->max_file_size_bytes
-                                ? tracing_session->max_file_size_bytes
+  if (file->stopped)
+    return true;
+  const uint64_t max_size = file->max_size_bytes
+                                ? file->max_size_bytes
                                 : std::numeric_limits<size_t>::max();
 
-  size_t total_slices = 0;
-  for (const TracePacket& packet : packets) {
-    total_slices += packet.slices().size();
-  }
   // When writing into a file, the file should look like a root trace.proto
-  // message. Each packet should be prepended with a proto preamble stating
-  // its field id (within trace.proto) and size. Hence the addition below.
-  const size_t max_iovecs = total_slices + packets.size();
-
-  size_t num_iovecs = 0;
+  // message. Each packet is prepended with a proto preamble stating its field
+  // id (within trace.proto) and size.
   bool stop_writing_into_file = false;
-  std::unique_ptr<struct iovec[]> iovecs(new struct iovec[max_iovecs]);
-  size_t num_iovecs_at_last_packet = 0;
+  size_t num_packets = 0;
   uint64_t bytes_about_to_be_written = 0;
   for (TracePacket& packet : packets) {
-    std::tie(iovecs[num_iovecs].iov_base, iovecs[num_iovecs].iov_len) =
-        packet.GetProtoPreamble();
-    bytes_about_to_be_written += iovecs[num_iovecs].iov_len;
-    num_iovecs++;
-    for (const Slice& slice : packet.slices()) {
-      // writev() doesn't change the passed pointer. However, struct iovec
-      // take a non-const ptr because it's the same struct used by readv().
-      // Hence the const_cast here.
-      char* start = static_cast<char*>(const_cast<void*>(slice.start));
-      bytes_about_to_be_written += slice.size;
-      iovecs[num_iovecs++] = {start, slice.size};
-    }
-
-    if (tracing_session->bytes_written_into_file + bytes_about_to_be_written >=
+    size_t packet_size = std::get<1>(packet.GetProtoPreamble()) + packet.size();
+    if (file->bytes_written + bytes_about_to_be_written + packet_size >=
         max_size) {
       stop_writing_into_file = true;
-      num_iovecs = num_iovecs_at_last_packet;
       break;
     }
-
-    num_iovecs_at_last_packet = num_iovecs;
+    bytes_about_to_be_written += packet_size;
+    num_packets++;
   }
-  PERFETTO_DCHECK(num_iovecs <= max_iovecs);
-  int fd = *tracing_session->write_into_file;
+  uint64_t total_wr_size =
+      file->writer.WritePackets(*file->fd, packets.data(), num_packets);
+  if (total_wr_size != bytes_about_to_be_written)
+    stop_writing_into_file = true;
 
-  uint64_t total_wr_size = 0;
-
-  // writev() can take at most IOV_MAX entries per call. Batch them.
-  constexpr size_t kIOVMax = IOV_MAX;
-  for (size_t i = 0; i < num_iovecs; i += kIOVMax) {
-    int iov_batch_size = static_cast<int>(std::min(num_iovecs - i, kIOVMax));
-    ssize_t wr_size = PERFETTO_EINTR(writev(fd, &iovecs[i], iov_batch_size));
-    if (wr_size <= 0) {
-      PERFETTO_PLOG("writev() failed");
-      stop_writing_into_file = true;
-      break;
-    }
-    total_wr_size += static_cast<size_t>(wr_size);
-  }
-
-  tracing_session->bytes_written_into_file += total_wr_size;
+  file->bytes_written += total_wr_size;
+  file->stopped = stop_writing_into_file;
 
   PERFETTO_DLOG("Draining into file, written: %" PRIu64 " KB, stop: %d",
                 (total_wr_size + 1023) / 1024, stop_writing_into_file);
@@ -2625,6 +2833,13 @@ void TracingServiceImpl::FreeBuffers(TracingSessionID tsid) {
   }
   DisableTracing(tsid, /*disable_immediately=*/true);
 
+  // The last write into the file outlives the session, the consumer can't be
+  // notified when it's done.
+  if (tracing_session->write_into_file &&
+      tracing_session->pending_packet_processing) {
+    NotifyTracingDisabled(tracing_session);
+  }
+
   PERFETTO_DCHECK(tracing_session->AllDataSourceInstancesStopped());
   tracing_session->data_source_instances.clear();
 
@@ -4026,12 +4241,14 @@ base::Status TracingServiceImpl::FinishCloneSession(
   cloned_session->flushes_requested = src->flushes_requested;
   cloned_session->flushes_succeeded = src->flushes_succeeded;
   cloned_session->flushes_failed = src->flushes_failed;
-  cloned_session->compress_deflate = src->compress_deflate;
+  cloned_session->compressor_fn = src->compressor_fn;
   if (src->trace_filter && !skip_trace_filter) {
     // Copy the trace filter, unless it's a clone-for-bugreport (b/317065412).
     cloned_session->trace_filter.reset(
         new protozero::MessageFilter(src->trace_filter->config()));
   }
+  cloned_session->packet_processing_task_runner =
+      PickPacketProcessingTaskRunner(cloned_session);
 
   SnapshotLifecyleEvent(
       cloned_session,
@@ -48,6 +48,7 @@
 #include "perfetto/tracing/core/trace_config.h"
 #include "src/android_stats/perfetto_atoms.h"
 #include "src/tracing/core/id_allocator.h"
+#include "src/tracing/service/trace_file_writer.h"
 
 namespace protozero {
 class MessageFilter;
@@ -490,6 +491,44 @@ class TracingServiceImpl : public TracingService {
     bool skip_trace_filter = false;
   };
 
+  struct TraceFilterStats {
+    uint64_t input_packets = 0;
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    uint64_t errors = 0;
+    uint64_t time_taken_ns = 0;
+    std::vector<uint64_t> bytes_discarded_per_buffer;
+  };
+
+  // The file a write_into_file session streams its packets into.
+  struct OutputFile {
+    base::ScopedFile fd;
+    uint64_t max_size_bytes = 0;
+    uint64_t bytes_written = 0;
+    TraceFileWriter writer;
+
+    // Set once the file is full or a write failed. Later writes are dropped.
+    bool stopped = false;
+  };
+
+  // The packets of a read from the buffers of a session, filtered and
+  // compressed (and written into |output_file|, if set) on the packet
+  // processing task runner of the session. Owned by that task runner until
+  // the job is handed back to the service thread.
+  struct PacketProcessingJob {
+    std::vector<TracePacket> packets;
+    bool has_more = false;
+    std::shared_ptr<protozero::MessageFilter> trace_filter;
+    InitOpts::CompressorFn compressor_fn = nullptr;
+    TraceFilterStats filter_stats;
+    std::shared_ptr<OutputFile> output_file;
+    bool stop_writing_into_file = false;
+
+    // Set on the last write into the file, queued after the job in flight
+    // when tracing is disabled.
+    bool last_write_into_file = false;
+  };
+
   // Holds the state of a tracing session. A tracing session is uniquely bound
   // a specific Consumer. Each Consumer can own one or more sessions.
   struct TracingSession {
@@ -643,8 +682,8 @@ class TracingServiceImpl : public TracingService {
     // Whether we emitted clock offsets for relay clients yet.
     bool did_emit_remote_clock_sync_ = false;
 
-    // Whether we should compress TracePackets after reading them.
-    bool compress_deflate = false;
+    // If set, compresses TracePackets after reading them.
+    TracingService::InitOpts::CompressorFn compressor_fn = nullptr;
 
     // The number of received triggers we've emitted into the trace output.
     size_t num_triggers_emitted_into_trace = 0;
@@ -706,11 +745,10 @@ class TracingServiceImpl : public TracingService {
     // This is set when the Consumer calls sets |write_into_file| == true in the
     // TraceConfig. In this case this represents the file we should stream the
     // trace packets into, rather than returning it to the consumer via
-    // OnTraceData().
-    base::ScopedFile write_into_file;
+    // OnTraceData(). Shared with the PacketProcessingJob in flight, if any,
+    // which writes into it: it must not be accessed while a job is in flight.
+    std::shared_ptr<OutputFile> write_into_file;
     uint32_t write_period_ms = 0;
-    uint64_t max_file_size_bytes = 0;
-    uint64_t bytes_written_into_file = 0;
 
     // Periodic task for snapshotting service events (e.g. clocks, sync markers
     // etc)
@@ -722,7 +760,8 @@ class TracingServiceImpl : public TracingService {
     base::PeriodicTask timed_stop_task;
 
     // When non-NULL the packets should be post-processed using the filter.
-    std::unique_ptr<protozero::MessageFilter> trace_filter;
+    // Shared with the PacketProcessingJob in flight, if any.
+    std::shared_ptr<protozero::MessageFilter> trace_filter;
     uint64_t filter_input_packets = 0;
     uint64_t filter_input_bytes = 0;
     uint64_t filter_output_bytes = 0;
@@ -730,6 +769,17 @@ class TracingServiceImpl : public TracingService {
     uint64_t filter_time_taken_ns = 0;
     std::vector<uint64_t> filter_bytes_discarded_per_buffer;
 
+    // One of |packet_processing_task_runners_| if the session filters or
+    // compresses its packets, nullptr otherwise.
+    base::TaskRunner* packet_processing_task_runner = nullptr;
+
+    // Set while the packets of the last read from the buffers are being
+    // processed on |packet_processing_task_runner|. Reads of a session are
+    // serialized, or queued on the same task runner for the last write into
+    // the file, which keeps the packets in order and the filter and the file
+    // used by one thread at a time.
+    std::shared_ptr<PacketProcessingJob> pending_packet_processing;
+
     // A randomly generated trace identifier. Note that this does NOT always
     // match the requested TraceConfig.trace_uuid_msb/lsb. Spcifically, it does
     // until a gap-less snapshot is requested. Each snapshot re-generates the
@@ -800,6 +850,7 @@ class TracingServiceImpl : public TracingService {
   void OnFlushTimeout(TracingSessionID, FlushRequestID);
   void OnDisableTracingTimeout(TracingSessionID);
   void DisableTracingNotifyConsumerAndFlushFile(TracingSession*);
+  void NotifyTracingDisabled(TracingSession*);
   void PeriodicFlushTask(TracingSessionID, bool post_next_only);
   void CompleteFlush(TracingSessionID tsid,
                      ConsumerEndpoint::FlushCallback callback,
@@ -844,22 +895,87 @@ class TracingServiceImpl : public TracingService {
                                        size_t threshold,
                                        bool* has_more);
 
+  // Same as ReadBuffers() but doesn't filter nor compress the packets.
+  std::vector<TracePacket> ReadPackets(TracingSession* tracing_session,
+                                       size_t threshold,
+                                       bool* has_more);
+
+  // Returns the packet processing task runner with the fewest tracing
+  // sessions assigned, creating a new one if all of them are used and there
+  // are fewer than the maximum. Returns nullptr if `*tracing_session` neither
+  // filters nor compresses its packets, or if there are no packet processing
+  // task runners.
+  base::TaskRunner* PickPacketProcessingTaskRunner(
+      const TracingSession* tracing_session);
+
+  // Returns true if the packets read from `*tracing_session` should be
+  // filtered and compressed (and written into its file) on its packet
+  // processing task runner. Packets that need neither are written straight
+  // from the buffers on the service thread, without copying them.
+  bool ShouldProcessPacketsAsync(const TracingSession* tracing_session) const;
+
+  // Filters and compresses `packets` on the packet processing task runner of
+  // `*tracing_session`, writing them into its file too if `write_into_file`.
+  // Then calls `on_processed` on the service thread unless the session is
+  // gone. Jobs posted while another one is in flight run after it.
+  using PacketsProcessedCallback =
+      std::function<void(TracingSession*, PacketProcessingJob*)>;
+  void ProcessPacketsAsync(TracingSession* tracing_session,
+                           std::vector<TracePacket> packets,
+                           bool has_more,
+                           bool write_into_file,
+                           PacketsProcessedCallback on_processed);
+
+  // Accounts the filter stats of `*job`.
+  void FinishPacketProcessing(TracingSession* tracing_session,
+                              PacketProcessingJob* job);
+
+  // Adds `stats` to the filter stats of `*tracing_session`.
+  static void AccountFilterStats(TracingSession* tracing_session,
+                                 const TraceFilterStats& stats);
+
   // If `*tracing_session` has a filter, applies it to `*packets`. Doesn't
   // change the number of `*packets`, only their content.
   void MaybeFilterPackets(TracingSession* tracing_session,
                           std::vector<TracePacket>* packets);
 
+  // Applies `*filter` to `*packets`, updating `*stats`. Can be called from any
+  // thread.
+  static void FilterPackets(protozero::MessageFilter* filter,
+                            std::vector<TracePacket>* packets,
+                            TraceFilterStats* stats);
+
   // If `*tracing_session` has compression enabled, compress `*packets`.
   void MaybeCompressPackets(TracingSession* tracing_session,
                             std::vector<TracePacket>* packets);
 
-  // If `*tracing_session` is configured to write into a file, writes `packets`
-  // into the file.
+  // Writes `packets` into `*file`. Can be called from any thread.
   //
   // Returns true if the file should be closed (because it's full or there has
   // been an error), false otherwise.
-  bool WriteIntoFile(TracingSession* tracing_session,
-                     std::vector<TracePacket> packets);
+  static bool WriteIntoFile(OutputFile* file, std::vector<TracePacket> packets);
+
+  // Reads one chunk of the buffers of `*tracing_session`, processes it and
+  // writes it into the file on the packet processing task runner, until the
+  // buffers are drained.
+  void ReadBuffersIntoFileAsync(TracingSession* tracing_session);
+
+  // Reads all the buffers of `*tracing_session` and writes them into the file
+  // after the job in flight, then closes the file and notifies the consumer
+  // that tracing is disabled.
+  void ReadRemainingBuffersIntoFileAsync(TracingSession* tracing_session);
+
+  // Closes the file of `*tracing_session` if `stop_writing_into_file` is true
+  // or if this was the last write, schedules the next periodic write
+  // otherwise.
+  void OnBuffersReadIntoFile(TracingSession* tracing_session,
+                             bool stop_writing_into_file);
+
+  // Sends `packets` to `*consumer`, posting the next read if `has_more`.
+  void SendTraceDataToConsumer(TracingSessionID tsid,
+                               ConsumerEndpointImpl* consumer,
+                               std::vector<TracePacket> packets,
+                               bool has_more);
   void OnStartTriggersTimeout(TracingSessionID tsid);
   void MaybeLogUploadEvent(const TraceConfig&,
                            const base::Uuid&,
@@ -875,6 +991,8 @@ class TracingServiceImpl : public TracingService {
 
   base::TaskRunner* const task_runner_;
   const InitOpts init_opts_;
+  // Created on demand by |init_opts_.create_packet_processing_task_runner|.
+  std::vector<base::TaskRunner*> packet_processing_task_runners_;
   std::unique_ptr<SharedMemory::Factory> shm_factory_;
   ProducerID last_producer_id_ = 0;
   DataSourceInstanceID last_data_source_instance_id_ = 0;
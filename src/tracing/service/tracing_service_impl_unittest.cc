@@ -22,6 +22,7 @@
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/sys_types.h"
 #include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/client_identity.h"
 #include "perfetto/ext/tracing/core/consumer.h"
@@ -60,6 +61,11 @@
 #include "src/tracing/service/zlib_compressor.h"
 #endif
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+#include <zstd.h>
+#include "src/tracing/service/zstd_compressor.h"
+#endif
+
 using ::testing::_;
 using ::testing::AssertionFailure;
 using ::testing::AssertionResult;
@@ -163,6 +169,42 @@ std::vector<protos::gen::TracePacket> DecompressTrace(
 }
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+std::vector<protos::gen::TracePacket> ZstdDecompressTrace(
+    const std::vector<protos::gen::TracePacket> compressed) {
+  std::vector<protos::gen::TracePacket> decompressed;
+
+  for (const protos::gen::TracePacket& c : compressed) {
+    if (c.compressed_packets().empty()) {
+      decompressed.push_back(c);
+      continue;
+    }
+
+    const std::string& data = c.compressed_packets();
+    std::string s;
+    std::vector<char> out(ZSTD_DStreamOutSize());
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    ZSTD_inBuffer in{data.data(), data.size(), 0};
+    size_t ret;
+    do {
+      ZSTD_outBuffer out_buf{out.data(), out.size(), 0};
+      ret = ZSTD_decompressStream(dctx, &out_buf, &in);
+      EXPECT_FALSE(ZSTD_isError(ret));
+      if (ZSTD_isError(ret))
+        break;
+      s.append(out.data(), out_buf.pos);
+    } while (ret != 0);
+    ZSTD_freeDCtx(dctx);
+
+    protos::gen::Trace t;
+    EXPECT_TRUE(t.ParseFromString(s));
+    decompressed.insert(decompressed.end(), t.packet().begin(),
+                        t.packet().end());
+  }
+  return decompressed;
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+
 }  // namespace
 
 class TracingServiceImplTest : public testing::Test {
@@ -2025,6 +2067,226 @@ TEST_F(TracingServiceImplTest, CompressionWriteIntoFile) {
                   Property(&protos::gen::TestEvent::str, Eq("payload-2")))));
 }
 
+TEST_F(TracingServiceImplTest, CompressionOnPacketProcessingTaskRunner) {
+  base::ThreadTaskRunner packet_processing_task_runner =
+      base::ThreadTaskRunner::CreateAndStart("pkt");
+  TracingService::InitOpts init_opts;
+  init_opts.compressor_fn = ZlibCompressFn;
+  init_opts.create_packet_processing_task_runner =
+      [&packet_processing_task_runner]() -> base::TaskRunner* {
+    return &packet_processing_task_runner;
+  };
+  InitializeSvcWithOpts(init_opts);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_DEFLATE);
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  // Enough packets for the read to take several tasks.
+  static constexpr size_t kNumPackets = 1000;
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (size_t i = 0; i < kNumPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload-" + std::to_string(i));
+  }
+
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::vector<protos::gen::TracePacket> compressed_packets =
+      consumer->ReadBuffers();
+  EXPECT_THAT(compressed_packets, Not(IsEmpty()));
+  EXPECT_THAT(compressed_packets,
+              Each(Property(&protos::gen::TracePacket::compressed_packets,
+                            Not(IsEmpty()))));
+
+  // The packets must come out in the order they were written.
+  std::vector<std::string> payloads;
+  for (const auto& packet : DecompressTrace(compressed_packets)) {
+    if (packet.has_for_testing())
+      payloads.push_back(packet.for_testing().str());
+  }
+  ASSERT_EQ(payloads.size(), kNumPackets);
+  for (size_t i = 0; i < kNumPackets; i++)
+    EXPECT_EQ(payloads[i], "payload-" + std::to_string(i));
+}
+
+TEST_F(TracingServiceImplTest,
+       CompressionWriteIntoFileOnPacketProcessingTaskRunner) {
+  base::ThreadTaskRunner packet_processing_task_runner =
+      base::ThreadTaskRunner::CreateAndStart("pkt");
+  TracingService::InitOpts init_opts;
+  init_opts.compressor_fn = ZlibCompressFn;
+  init_opts.create_packet_processing_task_runner =
+      [&packet_processing_task_runner]() -> base::TaskRunner* {
+    return &packet_processing_task_runner;
+  };
+  InitializeSvcWithOpts(init_opts);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(1);
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_DEFLATE);
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  static constexpr size_t kNumPackets = 1000;
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (size_t i = 0; i < kNumPackets; i++) {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload-" + std::to_string(i));
+  }
+
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+  EXPECT_THAT(trace.packet(), Not(IsEmpty()));
+  EXPECT_THAT(trace.packet(),
+              Each(Property(&protos::gen::TracePacket::compressed_packets,
+                            Not(IsEmpty()))));
+
+  std::vector<std::string> payloads;
+  for (const auto& packet : DecompressTrace(trace.packet())) {
+    if (packet.has_for_testing())
+      payloads.push_back(packet.for_testing().str());
+  }
+  ASSERT_EQ(payloads.size(), kNumPackets);
+  for (size_t i = 0; i < kNumPackets; i++)
+    EXPECT_EQ(payloads[i], "payload-" + std::to_string(i));
+}
+
+// Disables a session while a write into its file is in flight on the packet
+// processing task runner. The rest of the buffers must be written after it,
+// without blocking the service thread, and the consumer must be notified only
+// once the file is complete.
+TEST_F(TracingServiceImplTest,
+       CompressionWriteIntoFileLastWriteQueuedAfterJobInFlight) {
+  base::TestTaskRunner packet_processing_task_runner;
+  TracingService::InitOpts init_opts;
+  init_opts.compressor_fn = ZlibCompressFn;
+  init_opts.create_packet_processing_task_runner =
+      [&packet_processing_task_runner]() -> base::TaskRunner* {
+    return &packet_processing_task_runner;
+  };
+  InitializeSvcWithOpts(init_opts);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(1);
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_DEFLATE);
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  static constexpr size_t kNumPackets = 100;
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  for (size_t i = 0; i < kNumPackets; i++) {
+    writer->NewTracePacket()->set_for_testing()->set_str(
+        "payload-" + std::to_string(i));
+  }
+  writer->Flush();
+
+  // Wait for a periodic read into the file to post its job, which is not run
+  // until |packet_processing_task_runner| is.
+  for (int attempt = 0; !tracing_session()->pending_packet_processing;
+       attempt++) {
+    auto checkpoint_name = "wait_job_" + std::to_string(attempt);
+    auto timer_expired = task_runner.CreateCheckpoint(checkpoint_name);
+    task_runner.PostDelayedTask([timer_expired] { timer_expired(); }, 1);
+    task_runner.RunUntilCheckpoint(checkpoint_name);
+  }
+
+  for (size_t i = kNumPackets; i < 2 * kNumPackets; i++) {
+    writer->NewTracePacket()->set_for_testing()->set_str(
+        "payload-" + std::to_string(i));
+  }
+  writer->Flush();
+  writer.reset();
+
+  // OnTracingDisabled() is not expected yet: the mock consumer is strict.
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  task_runner.RunUntilIdle();
+  ASSERT_TRUE(tracing_session()->pending_packet_processing);
+  EXPECT_TRUE(
+      tracing_session()->pending_packet_processing->last_write_into_file);
+
+  packet_processing_task_runner.RunUntilIdle();
+  consumer->WaitForTracingDisabled();
+
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+  std::vector<std::string> payloads;
+  for (const auto& packet : DecompressTrace(trace.packet())) {
+    if (packet.has_for_testing())
+      payloads.push_back(packet.for_testing().str());
+  }
+  ASSERT_EQ(payloads.size(), 2 * kNumPackets);
+  for (size_t i = 0; i < 2 * kNumPackets; i++)
+    EXPECT_EQ(payloads[i], "payload-" + std::to_string(i));
+}
+
 TEST_F(TracingServiceImplTest, CloneSessionWithCompression) {
   TracingService::InitOpts init_opts;
   init_opts.compressor_fn = ZlibCompressFn;
@@ -2096,6 +2358,218 @@ TEST_F(TracingServiceImplTest, CloneSessionWithCompression) {
 
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+TEST_F(TracingServiceImplTest, CompressionZstdReadIpc) {
+  TracingService::InitOpts init_opts;
+  init_opts.compressor_fn = nullptr;
+  init_opts.zstd_compressor_fn = ZstdCompressFn;
+  InitializeSvcWithOpts(init_opts);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_ZSTD);
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload-1");
+  }
+  {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload-2");
+  }
+
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::vector<protos::gen::TracePacket> compressed_packets =
+      consumer->ReadBuffers();
+  EXPECT_THAT(compressed_packets, Not(IsEmpty()));
+  EXPECT_THAT(compressed_packets,
+              Each(Property(&protos::gen::TracePacket::compressed_packets,
+                            Not(IsEmpty()))));
+  std::vector<protos::gen::TracePacket> decompressed_packets =
+      ZstdDecompressTrace(compressed_packets);
+  EXPECT_THAT(decompressed_packets,
+              Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str, Eq("payload-1")))));
+  EXPECT_THAT(decompressed_packets,
+              Contains(Property(
+                  &protos::gen::TracePacket::for_testing,
+                  Property(&protos::gen::TestEvent::str, Eq("payload-2")))));
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+// Creates two compressed write_into_file sessions and checks that they are
+// assigned to different packet processing task runners, created on demand, and
+// that each file still gets the packets of its session in order.
+TEST_F(TracingServiceImplTest,
+       CompressionWriteIntoFileShardedOnPacketProcessingTaskRunners) {
+  base::ThreadTaskRunner packet_processing_task_runner_1 =
+      base::ThreadTaskRunner::CreateAndStart("pkt.1");
+  base::ThreadTaskRunner packet_processing_task_runner_2 =
+      base::ThreadTaskRunner::CreateAndStart("pkt.2");
+  size_t num_created_task_runners = 0;
+  TracingService::InitOpts init_opts;
+  init_opts.compressor_fn = ZlibCompressFn;
+  init_opts.max_packet_processing_task_runners = 2;
+  init_opts.create_packet_processing_task_runner =
+      [&]() -> base::TaskRunner* {
+    return ++num_created_task_runners == 1 ? &packet_processing_task_runner_1
+                                           : &packet_processing_task_runner_2;
+  };
+  InitializeSvcWithOpts(init_opts);
+
+  std::unique_ptr<MockConsumer> consumer_1 = CreateMockConsumer();
+  consumer_1->Connect(svc.get());
+  std::unique_ptr<MockConsumer> consumer_2 = CreateMockConsumer();
+  consumer_2->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("ds_1");
+  producer->RegisterDataSource("ds_2");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("ds_1");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(1);
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_DEFLATE);
+  base::TempFile tmp_file_1 = base::TempFile::Create();
+  consumer_1->EnableTracing(trace_config,
+                            base::ScopedFile(dup(tmp_file_1.fd())));
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("ds_1");
+  producer->WaitForDataSourceStart("ds_1");
+  auto tracing_session_1_id = GetTracingSessionID();
+
+  ds_config->set_name("ds_2");
+  base::TempFile tmp_file_2 = base::TempFile::Create();
+  consumer_2->EnableTracing(trace_config,
+                            base::ScopedFile(dup(tmp_file_2.fd())));
+  producer->WaitForDataSourceSetup("ds_2");
+  producer->WaitForDataSourceStart("ds_2");
+  auto tracing_session_2_id = GetTracingSessionID();
+
+  base::TaskRunner* session_1_task_runner =
+      GetTracingSession(tracing_session_1_id)->packet_processing_task_runner;
+  base::TaskRunner* session_2_task_runner =
+      GetTracingSession(tracing_session_2_id)->packet_processing_task_runner;
+  EXPECT_NE(session_1_task_runner, nullptr);
+  EXPECT_NE(session_2_task_runner, nullptr);
+  EXPECT_NE(session_1_task_runner, session_2_task_runner);
+  EXPECT_EQ(num_created_task_runners, 2u);
+
+  static constexpr size_t kNumPackets = 1000;
+  std::unique_ptr<TraceWriter> writer_1 = producer->CreateTraceWriter("ds_1");
+  std::unique_ptr<TraceWriter> writer_2 = producer->CreateTraceWriter("ds_2");
+  for (size_t i = 0; i < kNumPackets; i++) {
+    writer_1->NewTracePacket()->set_for_testing()->set_str(
+        "payload-1-" + std::to_string(i));
+    writer_2->NewTracePacket()->set_for_testing()->set_str(
+        "payload-2-" + std::to_string(i));
+  }
+  writer_1->Flush();
+  writer_1.reset();
+  writer_2->Flush();
+  writer_2.reset();
+
+  consumer_1->DisableTracing();
+  producer->WaitForDataSourceStop("ds_1");
+  consumer_1->WaitForTracingDisabled();
+
+  consumer_2->DisableTracing();
+  producer->WaitForDataSourceStop("ds_2");
+  consumer_2->WaitForTracingDisabled();
+
+  for (int session = 1; session <= 2; session++) {
+    const base::TempFile& tmp_file = session == 1 ? tmp_file_1 : tmp_file_2;
+    std::string trace_raw;
+    ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+    protos::gen::Trace trace;
+    ASSERT_TRUE(trace.ParseFromString(trace_raw));
+    std::vector<std::string> payloads;
+    for (const auto& packet : DecompressTrace(trace.packet())) {
+      if (packet.has_for_testing())
+        payloads.push_back(packet.for_testing().str());
+    }
+    ASSERT_EQ(payloads.size(), kNumPackets);
+    for (size_t i = 0; i < kNumPackets; i++) {
+      EXPECT_EQ(payloads[i], "payload-" + std::to_string(session) + "-" +
+                                 std::to_string(i));
+    }
+  }
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
+// Sessions which neither filter nor compress their packets don't use packet
+// processing task runners, so none must be created for them.
+TEST_F(TracingServiceImplTest, PacketProcessingTaskRunnersCreatedOnDemand) {
+  size_t num_created_task_runners = 0;
+  TracingService::InitOpts init_opts;
+  init_opts.max_packet_processing_task_runners = 4;
+  init_opts.create_packet_processing_task_runner = [&]() -> base::TaskRunner* {
+    num_created_task_runners++;
+    return nullptr;
+  };
+  InitializeSvcWithOpts(init_opts);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(1);
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  EXPECT_EQ(GetTracingSession(GetTracingSessionID())
+                ->packet_processing_task_runner,
+            nullptr);
+  EXPECT_EQ(num_created_task_runners, 0u);
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+  EXPECT_EQ(num_created_task_runners, 0u);
+}
+
 // Note: file_write_period_ms is set to a large enough to have exactly one flush
 // of the tracing buffers (and therefore at most one synchronization section),
 // unless the test runs unrealistically slowly, or the implementation of the
@@ -50,6 +50,22 @@ class PerfettoFunction(TestSuite):
         7
       """))
 
+  def test_function_memoization_multiple_args(self):
+    return DiffTestBlueprint(
+        trace=TextProto(""),
+        query="""
+        -- Compute 2 * 2^n inefficiently: without memoization of the results
+        -- within the statement this would time out.
+        CREATE PERFETTO FUNCTION f(x INT, s STRING) RETURNS INT AS
+        SELECT IIF($x = 0, length($s), f($x - 1, $s) + f($x - 1, $s));
+
+        SELECT f(50, 'ab') as result;
+      """,
+        out=Csv("""
+        "result"
+        2251799813685248
+      """))
+
   def test_legacy_create_function(self):
     return DiffTestBlueprint(
         trace=TextProto(""),
@@ -327,3 +327,43 @@ class PerfettoTable(TestSuite):
         "id","numeric","string","nullable"
         0,3111,460,0
         """))
+
+  def test_create_perfetto_index(self):
+    return DiffTestBlueprint(
+        trace=TextProto(r''),
+        query="""
+        CREATE PERFETTO TABLE foo AS
+        WITH data(a, b, c) AS (
+          VALUES (1, 10, 'x'), (2, 20, 'y'), (1, 30, 'z'), (2, 10, 'w'),
+                 (1, 20, 'v'), (1, 10, 'u')
+        )
+        SELECT * FROM data;
+
+        CREATE PERFETTO INDEX foo_idx ON foo(a, b);
+
+        SELECT c FROM foo WHERE a = 1 AND b >= 20 ORDER BY c;
+        """,
+        out=Csv("""
+        "c"
+        "v"
+        "z"
+        """))
+
+  def test_drop_perfetto_index(self):
+    return DiffTestBlueprint(
+        trace=TextProto(r''),
+        query="""
+        CREATE PERFETTO TABLE foo AS
+        WITH data(a, b) AS (VALUES (1, 10), (2, 20), (1, 30))
+        SELECT * FROM data;
+
+        CREATE PERFETTO INDEX foo_idx ON foo(a);
+        DROP PERFETTO INDEX foo_idx ON foo;
+
+        SELECT b FROM foo WHERE a = 1;
+        """,
+        out=Csv("""
+        "b"
+        10
+        30
+        """))